@@ -0,0 +1,262 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Compares the ASCII85 decoders of igt_ascii85 against the original
+ * intel_error_decode implementation on the buffers of captured error states.
+ * Only the ASCII85 step is timed, not inflating the buffers.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "igt_ascii85.h"
+#include "igt_x86.h"
+
+struct buffer {
+	const char *in;
+	uint32_t *ref;
+	size_t count;
+};
+
+static struct buffer *buffers;
+static unsigned int num_buffers;
+static size_t total_chars;
+
+static double
+elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+/* The decoder intel_error_decode used to have, growing its output as it goes */
+static int ascii85_decode_orig(const char *in, uint32_t **out)
+{
+	int len = 0, size = 1024;
+
+	*out = realloc(*out, sizeof(uint32_t)*size);
+	if (*out == NULL)
+		return 0;
+
+	while (*in >= '!' && *in <= 'z') {
+		uint32_t v = 0;
+
+		if (len == size) {
+			size *= 2;
+			*out = realloc(*out, sizeof(uint32_t)*size);
+			if (*out == NULL)
+				return 0;
+		}
+
+		if (*in == 'z') {
+			in++;
+		} else {
+			v += in[0] - 33; v *= 85;
+			v += in[1] - 33; v *= 85;
+			v += in[2] - 33; v *= 85;
+			v += in[3] - 33; v *= 85;
+			v += in[4] - 33;
+			in += 5;
+		}
+		(*out)[len++] = v;
+	}
+
+	return len;
+}
+
+static int load(const char *filename)
+{
+	FILE *file;
+	char *line = NULL;
+	size_t line_size = 0;
+
+	file = fopen(filename, "r");
+	if (!file)
+		return -errno;
+
+	while (getline(&line, &line_size, file) > 0) {
+		struct buffer *b;
+
+		if (line[0] != ':' && line[0] != '~')
+			continue;
+
+		buffers = realloc(buffers, (num_buffers + 1) * sizeof(*buffers));
+		if (!buffers)
+			return -ENOMEM;
+
+		b = &buffers[num_buffers++];
+		b->in = line + 1;
+		b->ref = NULL;
+		b->count = ascii85_decode_orig(b->in, &b->ref);
+		total_chars += strlen(b->in);
+
+		line = NULL;
+		line_size = 0;
+	}
+
+	free(line);
+	fclose(file);
+	return 0;
+}
+
+static double run_orig(unsigned int reps)
+{
+	struct timespec start, end;
+	uint32_t *out = NULL;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned int r = 0; r < reps; r++) {
+		for (unsigned int i = 0; i < num_buffers; i++) {
+			ascii85_decode_orig(buffers[i].in, &out);
+			free(out);
+			out = NULL;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return elapsed(&start, &end);
+}
+
+static double run_igt(unsigned int reps, bool *valid)
+{
+	struct timespec start, end;
+
+	*valid = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned int r = 0; r < reps; r++) {
+		for (unsigned int i = 0; i < num_buffers; i++) {
+			const struct buffer *b = &buffers[i];
+			size_t len, size, count;
+			uint32_t *out;
+
+			len = igt_ascii85_scan(b->in, &size);
+			out = malloc(sizeof(uint32_t) * (size ?: 1));
+			count = igt_ascii85_decode(b->in, len, out);
+
+			if (r == 0 &&
+			    (count != b->count ||
+			     memcmp(out, b->ref, count * sizeof(*out))))
+				*valid = false;
+			free(out);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return elapsed(&start, &end);
+}
+
+static void report(const char *name, double t, unsigned int reps)
+{
+	printf("%-8s %8.3fs  %8.1f MiB/s\n",
+	       name, t, reps * total_chars / t / (1 << 20));
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+"Usage: %s [-r REPS] ERROR_STATE...\n"
+"\n"
+"Times the ASCII85 decoding of the buffers of saved i915 error states with\n"
+"the original intel_error_decode decoder and with each igt_ascii85\n"
+"implementation supported by the cpu, checking they decode the same.\n"
+"\n"
+"  -r REPS  decode every buffer REPS times (default 10)\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	const struct {
+		const char *name;
+		unsigned features;
+	} impls[] = {
+		{ "scalar", 0 },
+		{ "sse4.1", SSSE3 | SSE4_1 },
+		{ "avx2", SSSE3 | SSE4_1 | AVX2 },
+	};
+	unsigned int reps = 10;
+	int ret = 0, opt;
+
+	while ((opt = getopt(argc, argv, "r:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			reps = atoi(optarg);
+			if (!reps)
+				reps = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	for (; optind < argc; optind++) {
+		int err = load(argv[optind]);
+
+		if (err) {
+			fprintf(stderr, "%s: %s\n", argv[optind], strerror(-err));
+			return 1;
+		}
+	}
+
+	if (!total_chars) {
+		fprintf(stderr, "No ASCII85 buffers found\n");
+		return 1;
+	}
+
+	printf("%u buffers, %.1f MiB of ASCII85\n",
+	       num_buffers, total_chars / (double)(1 << 20));
+
+	report("orig", run_orig(reps), reps);
+	for (unsigned int i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+		bool valid;
+		double t;
+
+		if (igt_ascii85_select(impls[i].features) != impls[i].features)
+			continue;
+
+		t = run_igt(reps, &valid);
+		report(impls[i].name, t, reps);
+		if (!valid) {
+			fprintf(stderr, "%s: decoded differently!\n", impls[i].name);
+			ret = 1;
+		}
+	}
+
+	return ret;
+}
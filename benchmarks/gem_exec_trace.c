@@ -38,58 +38,87 @@
 #include <sys/time.h>
 #include <time.h>
 #include <assert.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include "drm.h"
 #include "ioctl_wrappers.h"
 #include "drmtest.h"
 #include "intel_io.h"
 #include "igt_stats.h"
+#include "gem_exec_tracer.h"
 
-enum {
-	ADD_BO = 0,
-	DEL_BO,
-	ADD_CTX,
-	DEL_CTX,
-	EXEC,
-	WAIT,
+#define LOCAL_I915_EXEC_FENCE_IN	(1 << 16)
+#define LOCAL_I915_EXEC_FENCE_OUT	(1 << 17)
+
+/* Output fence of the last EXEC of a recorded thread, until its FENCE_OUT. */
+struct pending_fence {
+	struct pending_fence *next;
+	uint32_t tid;
+	int fence;
+};
+
+/* A batch submitted by the timed replay, until its output fence signals. */
+struct inflight {
+	int fence;
+	uint32_t context;
+	uint64_t submit;
+	uint64_t late;
 };
 
-struct trace_add_bo {
-	uint32_t handle;
-	uint64_t size;
-} __attribute__((packed));
+struct ctx_stats {
+	igt_stats_t latency;
+	igt_stats_t late;
+};
 
-struct trace_del_bo {
-	uint32_t handle;
-} __attribute__((packed));
+struct record {
+	uint8_t *ptr;
+	uint32_t seq;
+	uint32_t mutations; /* preceding records which modify the tables */
+};
 
-struct trace_add_ctx {
-	uint32_t handle;
-} __attribute__((packed));
+struct client {
+	struct replay *r;
+	pthread_t thread;
+	uint32_t tid;
 
-struct trace_del_ctx {
-	uint32_t handle;
-} __attribute__((packed));
+	struct record *records;
+	unsigned int nr_records, max_records;
+	uint32_t next_seq;
 
-struct trace_exec {
-	uint32_t object_count;
-	uint64_t flags;
-	uint32_t context;
-}__attribute__((packed));
-
-struct trace_exec_object {
-	uint32_t handle;
-	uint32_t relocation_count;
-	uint64_t alignment;
-	uint64_t offset;
-	uint64_t flags;
-	uint64_t rsvd1;
-	uint64_t rsvd2;
-}__attribute__((packed));
-
-struct trace_wait {
-	uint32_t handle;
-} __attribute__((packed));
+	struct drm_i915_gem_exec_object2 *exec_objects;
+	int max_objects;
+	struct pending_fence *pending;
+};
+
+struct replay {
+	int fd;
+	uint32_t version;
+	long nop, range;
+
+	uint32_t *bo, *ctx;
+	int num_bo, num_ctx;
+	int *fences, num_fences;
+
+	/* Timed replay */
+	bool timed;
+	uint64_t t0, start;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t mutations_done;
+	struct client *clients;
+	unsigned int num_clients;
+
+	pthread_mutex_t inflight_lock;
+	struct inflight *inflight;
+	unsigned int nr_inflight, max_inflight;
+	bool fence_stats;
+	bool done;
+
+	struct ctx_stats **stats;
+	unsigned int num_stats;
+};
 
 static uint32_t hars_petruska_f54_1_random(void)
 {
@@ -105,6 +134,26 @@ static double elapsed(const struct timespec *start, const struct timespec *end)
 	return 1e3*(end->tv_sec - start->tv_sec) + 1e-6*(end->tv_nsec - start->tv_nsec);
 }
 
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000000ull,
+		.tv_nsec = t % 1000000000ull,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
 static uint32_t __gem_context_create(int fd)
 {
 	struct drm_i915_gem_context_create arg = {};
@@ -112,86 +161,328 @@ static uint32_t __gem_context_create(int fd)
 	return arg.ctx_id;
 }
 
-static double replay(const char *filename, long nop, long range)
+static uint8_t next_cmd(uint8_t **ptr, uint32_t version,
+		       struct trace_header2 *hdr)
 {
-	struct timespec t_start, t_end;
-	struct drm_i915_gem_execbuffer2 eb = {};
-	const struct trace_version {
-		uint32_t magic;
-		uint32_t version;
-	} *tv;
-	const uint32_t bbe = 0xa << 23;
-	struct drm_i915_gem_exec_object2 *exec_objects = NULL;
-	uint32_t *bo, *ctx;
-	int num_bo, num_ctx;
-	int max_objects = 0;
-	struct stat st;
-	uint8_t *ptr, *end;
-	int fd;
+	uint8_t cmd = *(*ptr)++;
 
-	fd = open(filename, O_RDONLY);
-	if (fd < 0)
-		return -1;
+	if (version >= 2) {
+		memcpy(hdr, *ptr, sizeof(*hdr));
+		*ptr += sizeof(*hdr);
+	}
 
-	if (fstat(fd, &st) < 0) {
-		close(fd);
-		return -1;
+	return cmd;
+}
+
+/* Returns the next record, or NULL if the command is unknown. */
+static uint8_t *skip_cmd(uint8_t cmd, uint32_t version, uint8_t *ptr)
+{
+	switch (cmd) {
+	case ADD_BO:
+		return ptr + sizeof(struct trace_add_bo);
+	case DEL_BO:
+		return ptr + sizeof(struct trace_del_bo);
+	case ADD_CTX:
+		return ptr + sizeof(struct trace_add_ctx);
+	case DEL_CTX:
+		return ptr + sizeof(struct trace_del_ctx);
+	case WAIT:
+		return ptr + sizeof(struct trace_wait);
+	case FENCE_OUT:
+		return ptr + sizeof(struct trace_fence_out);
+	case EXEC:
+		{
+			struct trace_exec *t = (void *)ptr;
+			uint32_t count = t->object_count;
+
+			ptr += version >= 2 ? sizeof(struct trace_exec2) : sizeof(*t);
+			while (count--) {
+				struct trace_exec_object *to = (void *)ptr;
+
+				ptr = (uint8_t *)(to + 1) +
+				      to->relocation_count *
+				      sizeof(struct drm_i915_gem_relocation_entry);
+			}
+
+			return ptr;
+		}
+	default:
+		return NULL;
 	}
+}
 
-	ptr = mmap(0, st.st_size, PROT_WRITE, MAP_PRIVATE, fd, 0);
-	close(fd);
+/*
+ * Records which modify the handle or fence tables are replayed in isolation,
+ * after every preceding record and before any following one.
+ */
+static bool is_mutation(uint8_t cmd)
+{
+	return cmd != EXEC && cmd != WAIT;
+}
 
-	if (ptr == MAP_FAILED)
-		return -1;
+static struct pending_fence *
+get_pending_fence(struct pending_fence **list, uint32_t tid)
+{
+	struct pending_fence *p;
 
-	madvise(ptr, st.st_size, MADV_SEQUENTIAL);
-	end = ptr + st.st_size;
+	for (p = *list; p; p = p->next) {
+		if (p->tid == tid)
+			return p;
+	}
 
-	tv = (struct trace_version *)ptr;
-	if (tv->magic != 0xdeadbeef) {
-		fprintf(stderr, "%s: invalid magic\n", filename);
-		return -1;
+	p = malloc(sizeof(*p));
+	assert(p);
+	p->tid = tid;
+	p->fence = -1;
+	p->next = *list;
+	*list = p;
+
+	return p;
+}
+
+static void add_inflight(struct replay *r, int fence, uint32_t context,
+			 uint64_t submit, uint64_t late)
+{
+	struct inflight *f;
+
+	pthread_mutex_lock(&r->inflight_lock);
+	if (r->nr_inflight == r->max_inflight) {
+		r->max_inflight = r->max_inflight ? 2 * r->max_inflight : 64;
+		r->inflight = realloc(r->inflight,
+				      r->max_inflight * sizeof(*r->inflight));
+		assert(r->inflight);
 	}
-	if (tv->version != 1) {
-		fprintf(stderr, "%s: unhandled version %d\n",
-			filename, tv->version);
-		return -1;
+	f = &r->inflight[r->nr_inflight++];
+	f->fence = fence;
+	f->context = context;
+	f->submit = submit;
+	f->late = late;
+	pthread_mutex_unlock(&r->inflight_lock);
+}
+
+static struct ctx_stats *get_ctx_stats(struct replay *r, uint32_t context)
+{
+	if (context >= r->num_stats) {
+		unsigned int num_stats = ALIGN(context + 1, 64);
+
+		r->stats = realloc(r->stats, num_stats * sizeof(*r->stats));
+		assert(r->stats);
+		memset(r->stats + r->num_stats, 0,
+		       (num_stats - r->num_stats) * sizeof(*r->stats));
+		r->num_stats = num_stats;
 	}
-	ptr = (void *)(tv + 1);
 
-	ctx = calloc(1024, sizeof(*ctx));
-	num_ctx = 1024;
+	if (!r->stats[context]) {
+		r->stats[context] = malloc(sizeof(struct ctx_stats));
+		assert(r->stats[context]);
+		igt_stats_init(&r->stats[context]->latency);
+		igt_stats_init(&r->stats[context]->late);
+	}
 
-	bo = calloc(4096, sizeof(*bo));
-	num_bo = 4096;
+	return r->stats[context];
+}
 
-	fd = drm_open_driver(DRIVER_INTEL);
-	if (nop > 0) {
-		bo[0] = gem_create(fd, nop + range);
-		gem_write(fd, bo[0], nop + range - sizeof(bbe),
-			  &bbe, sizeof(bbe));
-		range *= 2;
-		range -= 64;
+/*
+ * Waits upon the output fences of the submitted batches and accounts the
+ * time from submission to completion to their context.
+ */
+static void *reaper(void *arg)
+{
+	struct replay *r = arg;
+	struct pollfd *pfd = NULL;
+	unsigned int max_pfd = 0;
+
+	for (;;) {
+		unsigned int i, n;
+		uint64_t now;
+		bool done;
+
+		pthread_mutex_lock(&r->inflight_lock);
+		n = r->nr_inflight;
+		done = r->done;
+		if (n > max_pfd) {
+			max_pfd = r->max_inflight;
+			pfd = realloc(pfd, max_pfd * sizeof(*pfd));
+			assert(pfd);
+		}
+		for (i = 0; i < n; i++) {
+			pfd[i].fd = r->inflight[i].fence;
+			pfd[i].events = POLLIN;
+		}
+		pthread_mutex_unlock(&r->inflight_lock);
+
+		if (!n) {
+			if (done)
+				break;
+			usleep(100);
+			continue;
+		}
+
+		if (poll(pfd, n, 1) <= 0)
+			continue;
+
+		now = now_ns();
+
+		/* New batches are only ever added after the first n. */
+		pthread_mutex_lock(&r->inflight_lock);
+		for (i = n; i--; ) {
+			struct inflight *f = &r->inflight[i];
+			struct ctx_stats *s;
+
+			if (!pfd[i].revents)
+				continue;
+
+			s = get_ctx_stats(r, f->context);
+			igt_stats_push(&s->latency, now - f->submit);
+			igt_stats_push(&s->late, f->late);
+
+			close(f->fence);
+			*f = r->inflight[--r->nr_inflight];
+		}
+		pthread_mutex_unlock(&r->inflight_lock);
+	}
+
+	free(pfd);
+	return NULL;
+}
+
+static uint8_t *replay_exec(struct replay *r, struct client *c,
+			    const struct trace_header2 *hdr, uint8_t *ptr)
+{
+	struct drm_i915_gem_execbuffer2 eb = {};
+	struct trace_exec *t = (void *)ptr;
+	bool fence_out, stats_fence = false;
+	int fence_in = -1;
+	uint64_t submit = 0;
+
+	if (r->version >= 2) {
+		fence_in = ((struct trace_exec2 *)ptr)->fence_in;
+		ptr += sizeof(struct trace_exec2);
 	} else {
-		bo[0] = gem_create(fd, 4096);
-		gem_write(fd, bo[0], 0, &bbe, sizeof(bbe));
+		ptr = (void *)(t + 1);
 	}
 
-	clock_gettime(CLOCK_MONOTONIC, &t_start);
-	do switch (*ptr++) {
+	eb.buffer_count = t->object_count;
+	eb.flags = t->flags;
+	eb.rsvd1 = r->ctx[t->context];
+
+	/* Fences which were not captured are dropped. */
+	if (eb.flags & LOCAL_I915_EXEC_FENCE_IN) {
+		if (fence_in >= 0 && fence_in < r->num_fences &&
+		    r->fences[fence_in])
+			eb.rsvd2 = r->fences[fence_in] - 1;
+		else
+			eb.flags &= ~LOCAL_I915_EXEC_FENCE_IN;
+	}
+
+	fence_out = eb.flags & LOCAL_I915_EXEC_FENCE_OUT;
+	if (r->fence_stats) {
+		eb.flags |= LOCAL_I915_EXEC_FENCE_OUT;
+		stats_fence = true;
+	}
+
+	if (eb.buffer_count >= c->max_objects) {
+		free(c->exec_objects);
+
+		c->max_objects = ALIGN(eb.buffer_count + 1, 4096);
+
+		c->exec_objects = malloc(c->max_objects*sizeof(*c->exec_objects));
+	}
+	eb.buffers_ptr = (uintptr_t)c->exec_objects;
+
+	for (uint32_t i = 0; i < eb.buffer_count; i++) {
+		struct trace_exec_object *to = (void *)ptr;
+		ptr = (void *)(to + 1);
+
+		c->exec_objects[i].handle = r->bo[to->handle];
+		c->exec_objects[i].alignment = to->alignment;
+		c->exec_objects[i].offset = to->offset;
+		c->exec_objects[i].flags = to->flags;
+		c->exec_objects[i].rsvd1 = to->rsvd1;
+		c->exec_objects[i].rsvd2 = to->rsvd2;
+
+		c->exec_objects[i].relocation_count = to->relocation_count;
+		c->exec_objects[i].relocs_ptr = (uintptr_t)ptr;
+
+		if (!(eb.flags & I915_EXEC_HANDLE_LUT)) {
+			struct drm_i915_gem_relocation_entry *relocs =
+				(struct drm_i915_gem_relocation_entry *)ptr;
+			for (uint32_t j = 0; j < to->relocation_count; j++)
+				relocs[j].target_handle = r->bo[relocs[j].target_handle];
+		}
+
+		ptr += sizeof(struct drm_i915_gem_relocation_entry) * to->relocation_count;
+	}
+
+	((struct drm_i915_gem_exec_object2 *)
+	 memset(&c->exec_objects[eb.buffer_count++], 0,
+		sizeof(*c->exec_objects)))->handle = r->bo[0];
+
+	if (r->nop > 0) {
+		eb.batch_start_offset = hars_petruska_f54_1_random();
+		eb.batch_start_offset =
+			((uint64_t)eb.batch_start_offset * r->range) >> 32;
+		eb.batch_start_offset = ALIGN(eb.batch_start_offset, 64);
+	}
+
+	if (r->timed)
+		submit = now_ns();
+
+	if (stats_fence && __gem_execbuf_wr(r->fd, &eb)) {
+		/* No fence support, fall back to just replaying. */
+		r->fence_stats = false;
+		stats_fence = false;
+		eb.flags &= ~LOCAL_I915_EXEC_FENCE_OUT;
+		fence_out = false;
+	}
+
+	if (!stats_fence) {
+		if (fence_out)
+			gem_execbuf_wr(r->fd, &eb);
+		else
+			gem_execbuf(r->fd, &eb);
+	}
+
+	if (fence_out) {
+		struct pending_fence *p = get_pending_fence(&c->pending, hdr->tid);
+
+		if (p->fence >= 0)
+			close(p->fence);
+		p->fence = eb.rsvd2 >> 32;
+	}
+
+	if (stats_fence) {
+		uint64_t due = r->start + hdr->ts - r->t0;
+		int fence = eb.rsvd2 >> 32;
+
+		if (fence_out)
+			fence = dup(fence);
+
+		add_inflight(r, fence, t->context, submit,
+			     submit > due ? submit - due : 0);
+	}
+
+	return ptr;
+}
+
+/* Replays one record and returns the next one, or NULL if unknown. */
+static uint8_t *replay_cmd(struct replay *r, struct client *c, uint8_t cmd,
+			   const struct trace_header2 *hdr, uint8_t *ptr)
+{
+	switch (cmd) {
 	case ADD_BO:
 		{
 			struct trace_add_bo *t = (void *)ptr;
 			ptr = (void *)(t + 1);
 
-			if (t->handle >= num_bo) {
-				int new_bo = ALIGN(t->handle, 4096);
-				bo = realloc(bo, sizeof(*bo)*new_bo);
-				memset(bo + num_bo, 0, sizeof(*bo)*(new_bo - num_bo));
-				num_bo = new_bo;
+			if (t->handle >= r->num_bo) {
+				int new_bo = ALIGN(t->handle + 1, 4096);
+				r->bo = realloc(r->bo, sizeof(*r->bo)*new_bo);
+				memset(r->bo + r->num_bo, 0, sizeof(*r->bo)*(new_bo - r->num_bo));
+				r->num_bo = new_bo;
 			}
 
-			bo[t->handle] = gem_create(fd, t->size);
+			r->bo[t->handle] = gem_create(r->fd, t->size);
 			break;
 		}
 	case DEL_BO:
@@ -199,9 +490,9 @@ static double replay(const char *filename, long nop, long range)
 			struct trace_del_bo *t = (void *)ptr;
 			ptr = (void *)(t + 1);
 
-			assert(t->handle && t->handle < num_bo && bo[t->handle]);
-			gem_close(fd, bo[t->handle]);
-			bo[t->handle] = 0;
+			assert(t->handle && t->handle < r->num_bo && r->bo[t->handle]);
+			gem_close(r->fd, r->bo[t->handle]);
+			r->bo[t->handle] = 0;
 			break;
 		}
 	case ADD_CTX:
@@ -209,14 +500,14 @@ static double replay(const char *filename, long nop, long range)
 			struct trace_add_ctx *t = (void *)ptr;
 			ptr = (void *)(t + 1);
 
-			if (t->handle >= num_ctx) {
-				int new_ctx = ALIGN(t->handle, 1024);
-				ctx = realloc(ctx, sizeof(*ctx)*new_ctx);
-				memset(ctx + num_ctx, 0, sizeof(*ctx)*(new_ctx - num_ctx));
-				num_ctx = new_ctx;
+			if (t->handle >= r->num_ctx) {
+				int new_ctx = ALIGN(t->handle + 1, 1024);
+				r->ctx = realloc(r->ctx, sizeof(*r->ctx)*new_ctx);
+				memset(r->ctx + r->num_ctx, 0, sizeof(*r->ctx)*(new_ctx - r->num_ctx));
+				r->num_ctx = new_ctx;
 			}
 
-			ctx[t->handle] = __gem_context_create(fd);
+			r->ctx[t->handle] = __gem_context_create(r->fd);
 			break;
 		}
 	case DEL_CTX:
@@ -224,64 +515,37 @@ static double replay(const char *filename, long nop, long range)
 			struct trace_del_ctx *t = (void *)ptr;
 			ptr = (void *)(t + 1);
 
-			assert(t->handle < num_ctx && ctx[t->handle]);
-			gem_context_destroy(fd, ctx[t->handle]);
-			ctx[t->handle] = 0;
+			assert(t->handle < r->num_ctx && r->ctx[t->handle]);
+			gem_context_destroy(r->fd, r->ctx[t->handle]);
+			r->ctx[t->handle] = 0;
 			break;
 		}
 	case EXEC:
+		ptr = replay_exec(r, c, hdr, ptr);
+		break;
+
+	case FENCE_OUT:
 		{
-			struct trace_exec *t = (void *)ptr;
+			struct trace_fence_out *t = (void *)ptr;
+			struct pending_fence *p =
+				get_pending_fence(&c->pending, hdr->tid);
 			ptr = (void *)(t + 1);
 
-			eb.buffer_count = t->object_count;
-			eb.flags = t->flags;
-			eb.rsvd1 = ctx[t->context];
+			if (p->fence < 0 || t->fd < 0)
+				break;
 
-			if (eb.buffer_count >= max_objects) {
-				free(exec_objects);
-
-				max_objects = ALIGN(eb.buffer_count + 1, 4096);
-
-				exec_objects = malloc(max_objects*sizeof(*exec_objects));
-				eb.buffers_ptr = (uintptr_t)exec_objects;
+			if (t->fd >= r->num_fences) {
+				int new_fences = ALIGN(t->fd + 1, 1024);
+				r->fences = realloc(r->fences, sizeof(*r->fences)*new_fences);
+				memset(r->fences + r->num_fences, 0, sizeof(*r->fences)*(new_fences - r->num_fences));
+				r->num_fences = new_fences;
 			}
 
-			for (uint32_t i = 0; i < eb.buffer_count; i++) {
-				struct trace_exec_object *to = (void *)ptr;
-				ptr = (void *)(to + 1);
-
-				exec_objects[i].handle = bo[to->handle];
-				exec_objects[i].alignment = to->alignment;
-				exec_objects[i].offset = to->offset;
-				exec_objects[i].flags = to->flags;
-				exec_objects[i].rsvd1 = to->rsvd1;
-				exec_objects[i].rsvd2 = to->rsvd2;
-
-				exec_objects[i].relocation_count = to->relocation_count;
-				exec_objects[i].relocs_ptr = (uintptr_t)ptr;
-
-				if (!(eb.flags & I915_EXEC_HANDLE_LUT)) {
-					struct drm_i915_gem_relocation_entry *relocs =
-						(struct drm_i915_gem_relocation_entry *)ptr;
-					for (uint32_t j = 0; j < to->relocation_count; j++)
-						relocs[j].target_handle = bo[relocs[j].target_handle];
-				}
-
-				ptr += sizeof(struct drm_i915_gem_relocation_entry) * to->relocation_count;
-			}
-
-			((struct drm_i915_gem_exec_object2 *)
-			 memset(&exec_objects[eb.buffer_count++], 0,
-				sizeof(*exec_objects)))->handle = bo[0];
-
-			if (nop > 0) {
-				eb.batch_start_offset = hars_petruska_f54_1_random();
-				eb.batch_start_offset =
-					((uint64_t)eb.batch_start_offset * range) >> 32;
-				eb.batch_start_offset = ALIGN(eb.batch_start_offset, 64);
-			}
-			gem_execbuf(fd, &eb);
+			/* The recorded fd has been closed and reused. */
+			if (r->fences[t->fd])
+				close(r->fences[t->fd] - 1);
+			r->fences[t->fd] = p->fence + 1;
+			p->fence = -1;
 			break;
 		}
 
@@ -290,17 +554,259 @@ static double replay(const char *filename, long nop, long range)
 			struct trace_wait *t = (void *)ptr;
 			ptr = (void *)(t + 1);
 
-			assert(t->handle && t->handle < num_bo && bo[t->handle]);
-			gem_wait(fd, bo[t->handle], NULL);
+			assert(t->handle && t->handle < r->num_bo && r->bo[t->handle]);
+			gem_wait(r->fd, r->bo[t->handle], NULL);
 			break;
 		}
 
 	default:
-		fprintf(stderr, "Unknown cmd: %x\n", *ptr);
+		return NULL;
+	}
+
+	return ptr;
+}
+
+static bool all_done_before(struct replay *r, uint32_t seq)
+{
+	for (unsigned int i = 0; i < r->num_clients; i++) {
+		if (r->clients[i].next_seq < seq)
+			return false;
+	}
+
+	return true;
+}
+
+static void *client_thread(void *arg)
+{
+	struct client *c = arg;
+	struct replay *r = c->r;
+
+	for (unsigned int i = 0; i < c->nr_records; i++) {
+		struct record *rec = &c->records[i];
+		struct trace_header2 hdr;
+		uint8_t *ptr = rec->ptr;
+		uint8_t cmd = next_cmd(&ptr, r->version, &hdr);
+		bool mutation = is_mutation(cmd);
+
+		sleep_until(r->start + hdr.ts - r->t0);
+
+		pthread_mutex_lock(&r->lock);
+		while (mutation ? !all_done_before(r, rec->seq) :
+		       r->mutations_done < rec->mutations)
+			pthread_cond_wait(&r->cond, &r->lock);
+		pthread_mutex_unlock(&r->lock);
+
+		replay_cmd(r, c, cmd, &hdr, ptr);
+
+		pthread_mutex_lock(&r->lock);
+		c->next_seq = i + 1 < c->nr_records ? c->records[i + 1].seq : UINT32_MAX;
+		if (mutation)
+			r->mutations_done++;
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->lock);
+	}
+
+	return NULL;
+}
+
+static struct client *get_client(struct replay *r, uint32_t tid)
+{
+	struct client *c;
+
+	for (unsigned int i = 0; i < r->num_clients; i++) {
+		if (r->clients[i].tid == tid)
+			return &r->clients[i];
+	}
+
+	r->clients = realloc(r->clients, ++r->num_clients * sizeof(*c));
+	assert(r->clients);
+
+	c = memset(&r->clients[r->num_clients - 1], 0, sizeof(*c));
+	c->r = r;
+	c->tid = tid;
+
+	return c;
+}
+
+/*
+ * Splits the trace by recording thread and replays each thread on its own,
+ * submitting every record at the same offset from the start as it was
+ * recorded at. Records changing the object tables are still replayed in trace
+ * order with respect to all others.
+ */
+static int replay_timed(struct replay *r, const char *filename,
+			uint8_t *ptr, uint8_t *end)
+{
+	uint32_t seq = 0, mutations = 0;
+	pthread_t reaper_thread;
+	unsigned int i;
+
+	r->timed = true;
+	r->fence_stats = true;
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	pthread_mutex_init(&r->inflight_lock, NULL);
+
+	while (ptr < end) {
+		struct trace_header2 hdr;
+		uint8_t *next = ptr;
+		uint8_t cmd = next_cmd(&next, r->version, &hdr);
+		struct client *c;
+		struct record *rec;
+
+		next = skip_cmd(cmd, r->version, next);
+		if (!next) {
+			fprintf(stderr, "%s: unknown cmd: %x\n", filename, cmd);
+			return -1;
+		}
+
+		if (!seq)
+			r->t0 = hdr.ts;
+
+		c = get_client(r, hdr.tid);
+		if (c->nr_records == c->max_records) {
+			c->max_records = c->max_records ? 2 * c->max_records : 1024;
+			c->records = realloc(c->records,
+					     c->max_records * sizeof(*c->records));
+			assert(c->records);
+		}
+
+		rec = &c->records[c->nr_records++];
+		rec->ptr = ptr;
+		rec->seq = seq++;
+		rec->mutations = mutations;
+		mutations += is_mutation(cmd);
+
+		ptr = next;
+	}
+
+	for (i = 0; i < r->num_clients; i++)
+		r->clients[i].next_seq = r->clients[i].records[0].seq;
+
+	pthread_create(&reaper_thread, NULL, reaper, r);
+
+	r->start = now_ns() + 1000000;
+	for (i = 0; i < r->num_clients; i++)
+		pthread_create(&r->clients[i].thread, NULL,
+			       client_thread, &r->clients[i]);
+	for (i = 0; i < r->num_clients; i++)
+		pthread_join(r->clients[i].thread, NULL);
+
+	pthread_mutex_lock(&r->inflight_lock);
+	r->done = true;
+	pthread_mutex_unlock(&r->inflight_lock);
+	pthread_join(reaper_thread, NULL);
+
+	return 0;
+}
+
+static void print_stats(struct replay *r, const char *filename)
+{
+	if (!r->num_stats)
+		fprintf(stderr, "%s: no fence support, latency not measured\n",
+			filename);
+
+	for (unsigned int i = 0; i < r->num_stats; i++) {
+		struct ctx_stats *s = r->stats[i];
+
+		if (!s)
+			continue;
+
+		printf("%s: ctx %u: %u batches, latency median %.1fus, mean %.1fus, max %.1fus, late by %.1fus on average\n",
+		       filename, i, s->latency.n_values,
+		       1e-3 * igt_stats_get_median(&s->latency),
+		       1e-3 * igt_stats_get_mean(&s->latency),
+		       1e-3 * igt_stats_get_max(&s->latency),
+		       1e-3 * igt_stats_get_mean(&s->late));
+	}
+}
+
+static double replay(const char *filename, long nop, long range, bool timed)
+{
+	struct timespec t_start, t_end;
+	const struct trace_version *tv;
+	struct replay r = {};
+	struct client c = {};
+	const uint32_t bbe = 0xa << 23;
+	struct stat st;
+	uint8_t *ptr, *end;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	ptr = mmap(0, st.st_size, PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (ptr == MAP_FAILED)
+		return -1;
+
+	madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+	end = ptr + st.st_size;
+
+	tv = (struct trace_version *)ptr;
+	if (tv->magic != TRACE_MAGIC) {
+		fprintf(stderr, "%s: invalid magic\n", filename);
+		return -1;
+	}
+	if (tv->version != 1 && tv->version != 2) {
+		fprintf(stderr, "%s: unhandled version %d\n",
+			filename, tv->version);
+		return -1;
+	}
+	if (timed && tv->version < 2) {
+		fprintf(stderr, "%s: no timestamps in version %d traces\n",
+			filename, tv->version);
 		return -1;
+	}
+	ptr = (void *)(tv + 1);
+
+	r.version = tv->version;
+	r.nop = nop;
+	r.range = range;
+
+	r.ctx = calloc(1024, sizeof(*r.ctx));
+	r.num_ctx = 1024;
+
+	r.bo = calloc(4096, sizeof(*r.bo));
+	r.num_bo = 4096;
+
+	r.fd = fd = drm_open_driver(DRIVER_INTEL);
+	if (nop > 0) {
+		r.bo[0] = gem_create(fd, nop + range);
+		gem_write(fd, r.bo[0], nop + range - sizeof(bbe),
+			  &bbe, sizeof(bbe));
+		r.range = 2 * range - 64;
+	} else {
+		r.bo[0] = gem_create(fd, 4096);
+		gem_write(fd, r.bo[0], 0, &bbe, sizeof(bbe));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	if (timed) {
+		if (replay_timed(&r, filename, ptr, end))
+			return -1;
+	} else do {
+		struct trace_header2 hdr = {};
+		uint8_t cmd = next_cmd(&ptr, r.version, &hdr);
+
+		ptr = replay_cmd(&r, &c, cmd, &hdr, ptr);
+		if (!ptr) {
+			fprintf(stderr, "Unknown cmd: %x\n", cmd);
+			return -1;
+		}
 	} while (ptr < end);
 	clock_gettime(CLOCK_MONOTONIC, &t_end);
 
+	if (timed)
+		print_stats(&r, filename);
+
 	return elapsed(&t_start, &t_end);
 }
 
@@ -369,12 +875,13 @@ int main(int argc, char **argv)
 	double *results;
 	long nop = 0;
 	long range = 0;
+	bool timed = false;
 	int i, c;
 
 	results = mmap(NULL, ALIGN(argc*sizeof(double), 4096),
 		       PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
 
-	while ((c = getopt(argc, argv, "d:n:r:")) != -1) {
+	while ((c = getopt(argc, argv, "d:n:r:t")) != -1) {
 		switch (c) {
 		case 'd':
 			delay = atoi(optarg);
@@ -389,6 +896,9 @@ int main(int argc, char **argv)
 			if (range > 0)
 				range = ALIGN(range, 4096);
 			break;
+		case 't':
+			timed = true;
+			break;
 		default:
 			break;
 		}
@@ -406,7 +916,7 @@ int main(int argc, char **argv)
 	}
 
 	igt_fork(child, argc-optind)
-		results[child] = replay(argv[child + optind], nop, range);
+		results[child] = replay(argv[child + optind], nop, range, timed);
 	igt_waitchildren();
 
 	for (i = 0; i < argc - optind; i++) {
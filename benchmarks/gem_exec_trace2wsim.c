@@ -0,0 +1,748 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Converts a gem_exec_tracer capture into a gem_wsim workload descriptor.
+ *
+ * Every EXEC becomes a batch step on the engine selected by its ring flags,
+ * in a context numbered in order of first use. Data dependencies are inferred
+ * from the objects shared between execs: a batch depends on the last batch
+ * which wrote to any of its objects, or with -s on the last batch which used
+ * them at all. WAITs, which include set-domain calls, become sync steps on the
+ * last batch using the object. Version 2 traces also record sync fences, and
+ * an input fence becomes a fence dependency on the batch which exported it.
+ *
+ * The trace has no batch durations, so they come from a calibration table
+ * (-c) or per ring estimates (-d).
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "drm.h"
+#include "drmtest.h"
+#include "gem_exec_tracer.h"
+
+#define LOCAL_I915_EXEC_BSD_SHIFT	(13)
+#define LOCAL_I915_EXEC_BSD_MASK	(3 << LOCAL_I915_EXEC_BSD_SHIFT)
+#define LOCAL_I915_EXEC_BSD_RING1	(1 << LOCAL_I915_EXEC_BSD_SHIFT)
+#define LOCAL_I915_EXEC_BSD_RING2	(2 << LOCAL_I915_EXEC_BSD_SHIFT)
+#define LOCAL_I915_EXEC_FENCE_IN	(1 << 16)
+#define LOCAL_I915_EXEC_BATCH_FIRST	(1 << 18)
+
+enum engine {
+	RCS,
+	BCS,
+	VCS,
+	VCS1,
+	VCS2,
+	VECS,
+	NUM_ENGINES
+};
+
+static const char *engine_str[NUM_ENGINES] = {
+	[RCS] = "RCS",
+	[BCS] = "BCS",
+	[VCS] = "VCS",
+	[VCS1] = "VCS1",
+	[VCS2] = "VCS2",
+	[VECS] = "VECS",
+};
+
+#define ANY_CTX (~0u)
+
+/* Durations as wsim strings, "<us>[-<us>]", looked up by trace context. */
+struct duration {
+	struct duration *next;
+	unsigned int ctx;
+	char str[32];
+};
+
+static struct duration *durations[NUM_ENGINES];
+
+struct bo {
+	int writer; /* last step writing to the object */
+	int user; /* last step using the object */
+	int synced; /* last step waited upon */
+};
+
+/* Last EXEC of a recorded thread, until its FENCE_OUT record. */
+struct thread {
+	struct thread *next;
+	uint32_t tid;
+	int step;
+};
+
+struct convert {
+	FILE *out;
+	bool shared;
+	uint32_t version;
+	struct trace_header2 hdr;
+
+	struct thread *threads;
+
+	int *fences; /* step exporting each recorded fence fd, or -1 */
+	unsigned int num_fences;
+
+	struct bo *bo;
+	unsigned int num_bo;
+
+	unsigned int *ctx;
+	unsigned int num_ctx;
+	unsigned int nr_ctx;
+
+	int *deps;
+	unsigned int max_deps;
+
+	int step;
+	unsigned long nr_exec;
+	unsigned long nr_sync;
+	unsigned long nr_deps;
+	unsigned long nr_fences;
+};
+
+static int parse_engine(const char *str)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_ENGINES; i++) {
+		if (!strcasecmp(str, engine_str[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+static bool valid_duration(const char *str)
+{
+	char *end;
+	long min, max;
+
+	min = strtol(str, &end, 10);
+	if (end == str || min <= 0)
+		return false;
+
+	if (*end == '-') {
+		str = end + 1;
+		max = strtol(str, &end, 10);
+		if (end == str || max < min)
+			return false;
+	}
+
+	return *end == '\0';
+}
+
+static int add_duration(int engine, unsigned int ctx, const char *str)
+{
+	struct duration *d;
+
+	if (!valid_duration(str) || strlen(str) >= sizeof(d->str))
+		return -1;
+
+	if (engine < 0) {
+		for (engine = 0; engine < NUM_ENGINES; engine++) {
+			if (add_duration(engine, ctx, str))
+				return -1;
+		}
+
+		return 0;
+	}
+
+	for (d = durations[engine]; d; d = d->next) {
+		if (d->ctx == ctx)
+			break;
+	}
+
+	if (!d) {
+		d = calloc(1, sizeof(*d));
+		if (!d)
+			return -1;
+
+		d->ctx = ctx;
+		d->next = durations[engine];
+		durations[engine] = d;
+	}
+
+	strcpy(d->str, str);
+
+	return 0;
+}
+
+/* -d [<ring>=]<us>[-<us>] */
+static int parse_estimate(char *arg)
+{
+	char *eq = strchr(arg, '=');
+	int engine = -1;
+
+	if (eq) {
+		*eq = '\0';
+		engine = parse_engine(arg);
+		if (engine < 0)
+			return -1;
+		arg = eq + 1;
+	}
+
+	return add_duration(engine, ANY_CTX, arg);
+}
+
+/*
+ * Calibration table with one "<ctx>|*.<ring>.<us>[-<us>]" entry per line, where
+ * ctx is the context handle as recorded in the trace. Lines starting with #
+ * are ignored.
+ */
+static int load_calibration(const char *filename)
+{
+	char *line = NULL;
+	size_t len = 0;
+	unsigned int n = 0;
+	int ret = 0;
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (!f)
+		return -errno;
+
+	while (getline(&line, &len, f) > 0) {
+		char *ctx, *ring, *dur, *ctxp = NULL;
+		unsigned int handle;
+		int engine;
+
+		n++;
+
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '#' || line[0] == '\0')
+			continue;
+
+		ctx = strtok_r(line, ".", &ctxp);
+		ring = strtok_r(NULL, ".", &ctxp);
+		dur = strtok_r(NULL, ".", &ctxp);
+		if (!ctx || !ring || !dur || strtok_r(NULL, ".", &ctxp)) {
+			fprintf(stderr, "%s:%u: invalid entry\n", filename, n);
+			ret = -EINVAL;
+			break;
+		}
+
+		if (!strcmp(ctx, "*"))
+			handle = ANY_CTX;
+		else
+			handle = strtoul(ctx, NULL, 0);
+
+		engine = parse_engine(ring);
+		if (engine < 0 || add_duration(engine, handle, dur)) {
+			fprintf(stderr, "%s:%u: invalid entry\n", filename, n);
+			ret = -EINVAL;
+			break;
+		}
+	}
+
+	free(line);
+	fclose(f);
+
+	return ret;
+}
+
+static const char *get_duration(enum engine engine, unsigned int ctx)
+{
+	struct duration *d, *any = NULL;
+
+	for (d = durations[engine]; d; d = d->next) {
+		if (d->ctx == ctx)
+			return d->str;
+		if (d->ctx == ANY_CTX)
+			any = d;
+	}
+
+	return any ? any->str : "1000";
+}
+
+static enum engine get_engine(uint64_t flags)
+{
+	switch (flags & I915_EXEC_RING_MASK) {
+	case I915_EXEC_DEFAULT:
+	case I915_EXEC_RENDER:
+	default:
+		return RCS;
+	case I915_EXEC_BLT:
+		return BCS;
+	case I915_EXEC_VEBOX:
+		return VECS;
+	case I915_EXEC_BSD:
+		switch (flags & LOCAL_I915_EXEC_BSD_MASK) {
+		case LOCAL_I915_EXEC_BSD_RING1:
+			return VCS1;
+		case LOCAL_I915_EXEC_BSD_RING2:
+			return VCS2;
+		default:
+			return VCS;
+		}
+	}
+}
+
+static struct bo *get_bo(struct convert *c, uint32_t handle)
+{
+	if (handle >= c->num_bo) {
+		unsigned int num_bo = ALIGN(handle + 1, 4096);
+		unsigned int i;
+
+		c->bo = realloc(c->bo, num_bo * sizeof(*c->bo));
+		if (!c->bo)
+			abort();
+
+		for (i = c->num_bo; i < num_bo; i++)
+			c->bo[i] = (struct bo){ -1, -1, -1 };
+		c->num_bo = num_bo;
+	}
+
+	return &c->bo[handle];
+}
+
+static unsigned int get_ctx(struct convert *c, uint32_t handle)
+{
+	if (handle >= c->num_ctx) {
+		unsigned int num_ctx = ALIGN(handle + 1, 1024);
+
+		c->ctx = realloc(c->ctx, num_ctx * sizeof(*c->ctx));
+		if (!c->ctx)
+			abort();
+
+		memset(c->ctx + c->num_ctx, 0,
+		       (num_ctx - c->num_ctx) * sizeof(*c->ctx));
+		c->num_ctx = num_ctx;
+	}
+
+	/* wsim contexts are numbered from 1 in order of first use */
+	if (!c->ctx[handle])
+		c->ctx[handle] = ++c->nr_ctx;
+
+	return c->ctx[handle];
+}
+
+static struct thread *get_thread(struct convert *c, uint32_t tid)
+{
+	struct thread *t;
+
+	for (t = c->threads; t; t = t->next) {
+		if (t->tid == tid)
+			return t;
+	}
+
+	t = malloc(sizeof(*t));
+	if (!t)
+		abort();
+
+	t->tid = tid;
+	t->step = -1;
+	t->next = c->threads;
+	c->threads = t;
+
+	return t;
+}
+
+static int *get_fence(struct convert *c, int fd)
+{
+	if (fd >= c->num_fences) {
+		unsigned int num_fences = ALIGN(fd + 1, 1024);
+		unsigned int i;
+
+		c->fences = realloc(c->fences, num_fences * sizeof(*c->fences));
+		if (!c->fences)
+			abort();
+
+		for (i = c->num_fences; i < num_fences; i++)
+			c->fences[i] = -1;
+		c->num_fences = num_fences;
+	}
+
+	return &c->fences[fd];
+}
+
+static void add_dep(struct convert *c, unsigned int *nr, int step)
+{
+	unsigned int i;
+
+	if (step < 0)
+		return;
+
+	for (i = 0; i < *nr; i++) {
+		if (c->deps[i] == step)
+			return;
+	}
+
+	if (*nr == c->max_deps) {
+		c->max_deps = c->max_deps ? 2 * c->max_deps : 16;
+		c->deps = realloc(c->deps, c->max_deps * sizeof(*c->deps));
+		if (!c->deps)
+			abort();
+	}
+
+	c->deps[(*nr)++] = step;
+}
+
+static uint8_t *convert_exec(struct convert *c, uint8_t *ptr)
+{
+	const struct trace_exec *t = (void *)ptr;
+	const struct trace_exec_object *objects;
+	const struct trace_exec_object *batch;
+	const struct trace_exec_object *to;
+	enum engine engine = get_engine(t->flags);
+	unsigned int ctx = get_ctx(c, t->context);
+	unsigned int i, j, nr = 0;
+	int fence = -1;
+
+	if (c->version >= 2) {
+		const struct trace_exec2 *t2 = (void *)ptr;
+
+		if (t->flags & LOCAL_I915_EXEC_FENCE_IN && t2->fence_in >= 0)
+			fence = *get_fence(c, t2->fence_in);
+		objects = (void *)(t2 + 1);
+	} else {
+		objects = (void *)(t + 1);
+	}
+
+	if (!t->object_count)
+		return (uint8_t *)objects;
+
+	/* Objects are interleaved with their relocations. */
+	batch = NULL;
+	ptr = (uint8_t *)objects;
+	for (i = 0; i < t->object_count; i++) {
+		to = (void *)ptr;
+		ptr = (uint8_t *)(to + 1) +
+		      to->relocation_count *
+		      sizeof(struct trace_exec_relocation);
+
+		if (i == 0 && t->flags & LOCAL_I915_EXEC_BATCH_FIRST)
+			batch = to;
+		else if (i == t->object_count - 1 &&
+			 !(t->flags & LOCAL_I915_EXEC_BATCH_FIRST))
+			batch = to;
+
+		if (to != batch) {
+			struct bo *bo = get_bo(c, to->handle);
+
+			add_dep(c, &nr, c->shared ? bo->user : bo->writer);
+		}
+	}
+
+	fprintf(c->out, "%u.%s.%s.", ctx, engine_str[engine],
+		get_duration(engine, t->context));
+	if (nr || fence >= 0) {
+		for (i = 0; i < nr; i++)
+			fprintf(c->out, "%s%d", i ? "/" : "",
+				c->deps[i] - c->step);
+		if (fence >= 0)
+			fprintf(c->out, "%sf%d", nr ? "/" : "",
+				fence - c->step);
+	} else {
+		fprintf(c->out, "0");
+	}
+	fprintf(c->out, ".0\n");
+
+	/* Now that the dependencies are known update the object tracking. */
+	to = objects;
+	for (i = 0; i < t->object_count; i++) {
+		const struct trace_exec_relocation *reloc =
+			(const void *)(to + 1);
+		struct bo *bo = get_bo(c, to->handle);
+
+		bo->user = c->step;
+		if (to->flags & EXEC_OBJECT_WRITE)
+			bo->writer = c->step;
+
+		for (j = 0; j < to->relocation_count; j++) {
+			uint32_t handle = reloc[j].target_handle;
+
+			if (!reloc[j].write_domain)
+				continue;
+
+			if (t->flags & I915_EXEC_HANDLE_LUT) {
+				const struct trace_exec_object *target;
+				unsigned int k;
+
+				if (handle >= t->object_count)
+					continue;
+
+				target = objects;
+				for (k = 0; k < handle; k++)
+					target = (void *)((uint8_t *)(target + 1) +
+							  target->relocation_count *
+							  sizeof(*reloc));
+				handle = target->handle;
+			}
+
+			get_bo(c, handle)->writer = c->step;
+		}
+
+		to = (void *)(reloc + to->relocation_count);
+	}
+
+	get_thread(c, c->hdr.tid)->step = c->step;
+
+	c->nr_deps += nr;
+	c->nr_fences += fence >= 0;
+	c->nr_exec++;
+	c->step++;
+
+	return ptr;
+}
+
+static void convert_wait(struct convert *c, uint32_t handle)
+{
+	struct bo *bo = get_bo(c, handle);
+
+	if (bo->user < 0 || bo->synced == bo->user)
+		return;
+
+	fprintf(c->out, "s.%d\n", bo->user - c->step);
+	bo->synced = bo->user;
+
+	c->nr_sync++;
+	c->step++;
+}
+
+static uint8_t next_cmd(struct convert *c, uint8_t **ptr)
+{
+	uint8_t cmd = *(*ptr)++;
+
+	if (c->version >= 2) {
+		memcpy(&c->hdr, *ptr, sizeof(c->hdr));
+		*ptr += sizeof(c->hdr);
+	}
+
+	return cmd;
+}
+
+static void convert_fence_out(struct convert *c, int fd)
+{
+	struct thread *t = get_thread(c, c->hdr.tid);
+
+	if (fd >= 0)
+		*get_fence(c, fd) = t->step;
+	t->step = -1;
+}
+
+static int convert(const char *filename, struct convert *c)
+{
+	const struct trace_version *tv;
+	struct stat st;
+	uint8_t *ptr, *end;
+	void *map;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -errno;
+	}
+
+	map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return -errno;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	ptr = map;
+	end = ptr + st.st_size;
+
+	tv = (const struct trace_version *)ptr;
+	if (st.st_size < sizeof(*tv) || tv->magic != TRACE_MAGIC) {
+		fprintf(stderr, "%s: invalid magic\n", filename);
+		munmap(map, st.st_size);
+		return -EINVAL;
+	}
+	if (tv->version != 1 && tv->version != 2) {
+		fprintf(stderr, "%s: unhandled version %d\n",
+			filename, tv->version);
+		munmap(map, st.st_size);
+		return -EINVAL;
+	}
+	c->version = tv->version;
+	ptr = (void *)(tv + 1);
+
+	while (ptr < end) switch (next_cmd(c, &ptr)) {
+	case ADD_BO:
+		{
+			const struct trace_add_bo *t = (void *)ptr;
+
+			/* Handles get recycled, forget the previous object. */
+			*get_bo(c, t->handle) = (struct bo){ -1, -1, -1 };
+			ptr = (void *)(t + 1);
+			break;
+		}
+	case DEL_BO:
+		{
+			const struct trace_del_bo *t = (void *)ptr;
+
+			*get_bo(c, t->handle) = (struct bo){ -1, -1, -1 };
+			ptr = (void *)(t + 1);
+			break;
+		}
+	case ADD_CTX:
+	case DEL_CTX:
+		ptr += sizeof(struct trace_add_ctx);
+		break;
+	case EXEC:
+		ptr = convert_exec(c, ptr);
+		break;
+	case WAIT:
+		{
+			const struct trace_wait *t = (void *)ptr;
+
+			convert_wait(c, t->handle);
+			ptr = (void *)(t + 1);
+			break;
+		}
+	case FENCE_OUT:
+		{
+			const struct trace_fence_out *t = (void *)ptr;
+
+			convert_fence_out(c, t->fd);
+			ptr = (void *)(t + 1);
+			break;
+		}
+	default:
+		fprintf(stderr, "%s: unknown cmd: %x\n", filename, ptr[-1]);
+		munmap(map, st.st_size);
+		return -EINVAL;
+	}
+
+	munmap(map, st.st_size);
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+"Usage: %s [OPTIONS] TRACE\n"
+"\n"
+"Converts a gem_exec_tracer capture into a gem_wsim workload descriptor.\n"
+"TRACE is one of the /tmp/trace-<pid>.<fd>.<seq> files written by the tracer.\n"
+"\n"
+"Options:\n"
+"  -o <file>             Write the workload to a file instead of stdout.\n"
+"  -d [<ring>=]<us>[-<us>]\n"
+"                        Batch duration estimate, for one ring or all rings.\n"
+"                        Can be given multiple times. Defaults to 1000us.\n"
+"  -c <file>             Calibration table of batch durations with one\n"
+"                        <ctx>.<ring>.<us>[-<us>] entry per line, where ctx is\n"
+"                        the context handle from the trace or * for any\n"
+"                        context. Entries for a context take precedence\n"
+"                        over those for any context, otherwise the last\n"
+"                        entry or estimate given wins.\n"
+"  -s                    Depend on the last batch sharing an object, not just\n"
+"                        on the last one writing to it.\n"
+"  -q                    Do not print the conversion summary.\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct convert c = { .out = stdout };
+	const char *output = NULL;
+	bool quiet = false;
+	int ret, opt;
+
+	while ((opt = getopt(argc, argv, "ho:d:c:sq")) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'd':
+			if (parse_estimate(optarg)) {
+				fprintf(stderr, "Invalid duration estimate!\n");
+				return 1;
+			}
+			break;
+		case 'c':
+			ret = load_calibration(optarg);
+			if (ret) {
+				fprintf(stderr,
+					"Failed to load calibration table %s: %s\n",
+					optarg, strerror(-ret));
+				return 1;
+			}
+			break;
+		case 's':
+			c.shared = true;
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (output) {
+		c.out = fopen(output, "w");
+		if (!c.out) {
+			fprintf(stderr, "Failed to open %s: %s\n",
+				output, strerror(errno));
+			return 1;
+		}
+	}
+
+	ret = convert(argv[optind], &c);
+	if (ret) {
+		if (ret != -EINVAL)
+			fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+
+	if (fclose(c.out)) {
+		fprintf(stderr, "Failed to write the workload: %s\n",
+			strerror(errno));
+		return 1;
+	}
+
+	if (!quiet)
+		fprintf(stderr,
+			"%lu batches in %u contexts, %lu data dependencies, %lu fence dependencies, %lu syncs.\n",
+			c.nr_exec, c.nr_ctx, c.nr_deps, c.nr_fences,
+			c.nr_sync);
+
+	return 0;
+}
@@ -0,0 +1,605 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Characterises a gem_exec_tracer capture without replaying it.
+ *
+ * The trace is read in a single pass and the pages already parsed are
+ * dropped as we go, so memory use only depends on the number of object and
+ * context handles, never on the length of the trace.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "drm.h"
+#include "drmtest.h"
+#include "gem_exec_tracer.h"
+#include "hist.h"
+
+#define LOCAL_I915_EXEC_BSD_SHIFT	(13)
+#define LOCAL_I915_EXEC_BSD_MASK	(3 << LOCAL_I915_EXEC_BSD_SHIFT)
+#define LOCAL_I915_EXEC_BSD_RING1	(1 << LOCAL_I915_EXEC_BSD_SHIFT)
+#define LOCAL_I915_EXEC_BSD_RING2	(2 << LOCAL_I915_EXEC_BSD_SHIFT)
+#define LOCAL_I915_EXEC_NO_RELOC	(1 << 11)
+
+#define NR_SAMPLES	(20)
+#define NR_TOP_CTX	(10)
+#define DROP_CHUNK	(64 << 20)
+
+enum engine {
+	RCS,
+	BCS,
+	VCS,
+	VCS1,
+	VCS2,
+	VECS,
+	NUM_ENGINES
+};
+
+static const char *engine_str[NUM_ENGINES] = {
+	[RCS] = "RCS",
+	[BCS] = "BCS",
+	[VCS] = "VCS",
+	[VCS1] = "VCS1",
+	[VCS2] = "VCS2",
+	[VECS] = "VECS",
+};
+
+struct bo {
+	uint64_t size;
+	uint64_t last_exec; /* exec number of the last use, 0 if never used */
+	bool live;
+};
+
+struct sample {
+	uint64_t nr_exec;
+	uint64_t ts;
+	uint64_t live_objects;
+	uint64_t live_bytes;
+};
+
+struct analysis {
+	uint32_t version;
+
+	struct bo *bo;
+	unsigned int num_bo;
+
+	uint64_t *ctx_exec;
+	unsigned int num_ctx;
+
+	uint64_t first_ts, last_ts;
+
+	uint64_t nr_exec;
+	uint64_t nr_no_reloc;
+	uint64_t nr_lut;
+	uint64_t nr_relocs;
+	uint64_t nr_wait;
+	uint64_t nr_fence_in;
+	uint64_t nr_fence_out;
+	uint64_t nr_unknown_bo;
+	uint64_t nr_first_use;
+	uint64_t nr_created, nr_closed;
+	uint64_t engine_exec[NUM_ENGINES];
+
+	uint64_t live_objects, live_bytes;
+	uint64_t peak_objects, peak_bytes;
+
+	struct hist bo_size;
+	struct hist objects;
+	struct hist relocs;
+	struct hist exec_bytes;
+	struct hist reuse;
+	struct hist wait_interval;
+	uint64_t last_wait_ts;
+
+	struct sample sample[NR_SAMPLES];
+	unsigned int nr_samples;
+};
+
+static enum engine get_engine(uint64_t flags)
+{
+	switch (flags & I915_EXEC_RING_MASK) {
+	case I915_EXEC_DEFAULT:
+	case I915_EXEC_RENDER:
+	default:
+		return RCS;
+	case I915_EXEC_BLT:
+		return BCS;
+	case I915_EXEC_VEBOX:
+		return VECS;
+	case I915_EXEC_BSD:
+		switch (flags & LOCAL_I915_EXEC_BSD_MASK) {
+		case LOCAL_I915_EXEC_BSD_RING1:
+			return VCS1;
+		case LOCAL_I915_EXEC_BSD_RING2:
+			return VCS2;
+		default:
+			return VCS;
+		}
+	}
+}
+
+static struct bo *get_bo(struct analysis *a, uint32_t handle)
+{
+	if (handle >= a->num_bo) {
+		unsigned int num_bo = ALIGN(handle + 1, 4096);
+
+		a->bo = realloc(a->bo, num_bo * sizeof(*a->bo));
+		if (!a->bo)
+			abort();
+
+		memset(a->bo + a->num_bo, 0,
+		       (num_bo - a->num_bo) * sizeof(*a->bo));
+		a->num_bo = num_bo;
+	}
+
+	return &a->bo[handle];
+}
+
+static uint64_t *get_ctx(struct analysis *a, uint32_t handle)
+{
+	if (handle >= a->num_ctx) {
+		unsigned int num_ctx = ALIGN(handle + 1, 1024);
+
+		a->ctx_exec = realloc(a->ctx_exec,
+				      num_ctx * sizeof(*a->ctx_exec));
+		if (!a->ctx_exec)
+			abort();
+
+		memset(a->ctx_exec + a->num_ctx, 0,
+		       (num_ctx - a->num_ctx) * sizeof(*a->ctx_exec));
+		a->num_ctx = num_ctx;
+	}
+
+	return &a->ctx_exec[handle];
+}
+
+static void add_bo(struct analysis *a, uint32_t handle, uint64_t size)
+{
+	struct bo *bo = get_bo(a, handle);
+
+	/* Handles are recycled, but a close may have gone untraced. */
+	if (bo->live) {
+		a->live_objects--;
+		a->live_bytes -= bo->size;
+	}
+
+	bo->size = size;
+	bo->last_exec = 0;
+	bo->live = true;
+
+	a->live_objects++;
+	a->live_bytes += size;
+	if (a->live_objects > a->peak_objects)
+		a->peak_objects = a->live_objects;
+	if (a->live_bytes > a->peak_bytes)
+		a->peak_bytes = a->live_bytes;
+
+	hist_add(&a->bo_size, size);
+	a->nr_created++;
+}
+
+static void del_bo(struct analysis *a, uint32_t handle)
+{
+	struct bo *bo = get_bo(a, handle);
+
+	if (bo->live) {
+		a->live_objects--;
+		a->live_bytes -= bo->size;
+	}
+
+	bo->live = false;
+	a->nr_closed++;
+}
+
+static uint8_t *analyse_exec(struct analysis *a, uint8_t *ptr)
+{
+	const struct trace_exec *t = (void *)ptr;
+	uint64_t bytes = 0, relocs = 0;
+	uint32_t i;
+
+	if (a->version >= 2) {
+		const struct trace_exec2 *t2 = (void *)ptr;
+
+		if (t2->fence_in >= 0)
+			a->nr_fence_in++;
+		ptr = (void *)(t2 + 1);
+	} else {
+		ptr = (void *)(t + 1);
+	}
+
+	a->nr_exec++;
+	a->engine_exec[get_engine(t->flags)]++;
+	(*get_ctx(a, t->context))++;
+	if (t->flags & LOCAL_I915_EXEC_NO_RELOC)
+		a->nr_no_reloc++;
+	if (t->flags & I915_EXEC_HANDLE_LUT)
+		a->nr_lut++;
+
+	for (i = 0; i < t->object_count; i++) {
+		const struct trace_exec_object *to = (void *)ptr;
+		struct bo *bo = get_bo(a, to->handle);
+
+		if (!bo->live) {
+			/* Created before tracing started, or imported. */
+			a->nr_unknown_bo++;
+		} else {
+			bytes += bo->size;
+			if (bo->last_exec)
+				hist_add(&a->reuse, a->nr_exec - bo->last_exec);
+			else
+				a->nr_first_use++;
+		}
+		bo->last_exec = a->nr_exec;
+
+		relocs += to->relocation_count;
+		ptr = (uint8_t *)(to + 1) +
+		      to->relocation_count *
+		      sizeof(struct trace_exec_relocation);
+	}
+
+	hist_add(&a->objects, t->object_count);
+	hist_add(&a->relocs, relocs);
+	hist_add(&a->exec_bytes, bytes);
+	a->nr_relocs += relocs;
+
+	return ptr;
+}
+
+static void analyse_wait(struct analysis *a, uint64_t ts)
+{
+	if (a->version >= 2 && a->nr_wait)
+		hist_add(&a->wait_interval, ts - a->last_wait_ts);
+
+	a->last_wait_ts = ts;
+	a->nr_wait++;
+}
+
+static void take_sample(struct analysis *a)
+{
+	struct sample *s = &a->sample[a->nr_samples++];
+
+	s->nr_exec = a->nr_exec;
+	s->ts = a->last_ts - a->first_ts;
+	s->live_objects = a->live_objects;
+	s->live_bytes = a->live_bytes;
+}
+
+static int analyse(const char *filename, struct analysis *a)
+{
+	const struct trace_version *tv;
+	struct trace_header2 hdr = {};
+	uint8_t *map, *ptr, *end, *dropped;
+	struct stat st;
+	uint64_t next_sample;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -errno;
+	}
+
+	map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return -errno;
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	ptr = map;
+	end = ptr + st.st_size;
+	dropped = map;
+
+	tv = (const struct trace_version *)ptr;
+	if (st.st_size < sizeof(*tv) || tv->magic != TRACE_MAGIC) {
+		fprintf(stderr, "%s: invalid magic\n", filename);
+		munmap(map, st.st_size);
+		return -EINVAL;
+	}
+	if (tv->version != 1 && tv->version != 2) {
+		fprintf(stderr, "%s: unhandled version %d\n",
+			filename, tv->version);
+		munmap(map, st.st_size);
+		return -EINVAL;
+	}
+	a->version = tv->version;
+	ptr = (void *)(tv + 1);
+
+	next_sample = st.st_size / NR_SAMPLES;
+	while (ptr < end) {
+		uint8_t cmd = *ptr++;
+
+		if (a->version >= 2) {
+			memcpy(&hdr, ptr, sizeof(hdr));
+			ptr += sizeof(hdr);
+
+			if (!a->first_ts)
+				a->first_ts = hdr.ts;
+			a->last_ts = hdr.ts;
+		}
+
+		switch (cmd) {
+		case ADD_BO:
+			{
+				const struct trace_add_bo *t = (void *)ptr;
+
+				add_bo(a, t->handle, t->size);
+				ptr = (void *)(t + 1);
+				break;
+			}
+		case DEL_BO:
+			{
+				const struct trace_del_bo *t = (void *)ptr;
+
+				del_bo(a, t->handle);
+				ptr = (void *)(t + 1);
+				break;
+			}
+		case ADD_CTX:
+			ptr += sizeof(struct trace_add_ctx);
+			break;
+		case DEL_CTX:
+			ptr += sizeof(struct trace_del_ctx);
+			break;
+		case EXEC:
+			ptr = analyse_exec(a, ptr);
+			break;
+		case WAIT:
+			analyse_wait(a, hdr.ts);
+			ptr += sizeof(struct trace_wait);
+			break;
+		case FENCE_OUT:
+			a->nr_fence_out++;
+			ptr += sizeof(struct trace_fence_out);
+			break;
+		default:
+			fprintf(stderr, "%s: unknown cmd %x at offset %lu\n",
+				filename, cmd, (unsigned long)(ptr - 1 - map));
+			munmap(map, st.st_size);
+			return -EINVAL;
+		}
+
+		if (ptr - map >= next_sample && a->nr_samples < NR_SAMPLES - 1) {
+			take_sample(a);
+			next_sample += st.st_size / NR_SAMPLES;
+		}
+
+		/* Keep only the pages being parsed resident. */
+		if (ptr - dropped >= 2 * DROP_CHUNK) {
+			madvise(dropped, DROP_CHUNK, MADV_DONTNEED);
+			dropped += DROP_CHUNK;
+		}
+	}
+
+	take_sample(a);
+	munmap(map, st.st_size);
+
+	return 0;
+}
+
+static const char *bytes_str(uint64_t bytes, char *buf)
+{
+	static const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+	double v = bytes;
+	unsigned int i = 0;
+
+	while (v >= 1024 && i < ARRAY_SIZE(units) - 1) {
+		v /= 1024;
+		i++;
+	}
+
+	sprintf(buf, i ? "%.1f%s" : "%.0f%s", v, units[i]);
+
+	return buf;
+}
+
+static void print_hist(const char *name, const struct hist *h, bool bytes)
+{
+	char buf[5][32];
+
+	if (!h->count) {
+		printf("  %-22s -\n", name);
+		return;
+	}
+
+	if (bytes)
+		printf("  %-22s mean %s, median %s, p90 %s, p99 %s, max %s\n",
+		       name,
+		       bytes_str(h->sum / h->count, buf[0]),
+		       bytes_str(hist_percentile(h, 50), buf[1]),
+		       bytes_str(hist_percentile(h, 90), buf[2]),
+		       bytes_str(hist_percentile(h, 99), buf[3]),
+		       bytes_str(h->max, buf[4]));
+	else
+		printf("  %-22s mean %.1f, median %lu, p90 %lu, p99 %lu, max %lu\n",
+		       name, (double)h->sum / h->count,
+		       (unsigned long)hist_percentile(h, 50),
+		       (unsigned long)hist_percentile(h, 90),
+		       (unsigned long)hist_percentile(h, 99),
+		       (unsigned long)h->max);
+}
+
+static void print_ctx(const struct analysis *a)
+{
+	unsigned int top[NR_TOP_CTX];
+	unsigned int i, j, nr = 0, nr_ctx = 0;
+
+	/* Busiest contexts first. */
+	for (i = 0; i < a->num_ctx; i++) {
+		if (!a->ctx_exec[i])
+			continue;
+
+		nr_ctx++;
+		if (nr < NR_TOP_CTX)
+			nr++;
+		else if (a->ctx_exec[top[nr - 1]] >= a->ctx_exec[i])
+			continue;
+
+		for (j = nr - 1; j > 0 && a->ctx_exec[top[j - 1]] < a->ctx_exec[i]; j--)
+			top[j] = top[j - 1];
+		top[j] = i;
+	}
+
+	printf("Contexts: %u used\n", nr_ctx);
+	for (i = 0; i < nr; i++)
+		printf("  %-10u %12lu execs (%.1f%%)\n", top[i],
+		       (unsigned long)a->ctx_exec[top[i]],
+		       100.0 * a->ctx_exec[top[i]] / a->nr_exec);
+	if (nr < nr_ctx)
+		printf("  (%u more)\n", nr_ctx - nr);
+}
+
+static void report(const struct analysis *a)
+{
+	double duration = 1e-9 * (a->last_ts - a->first_ts);
+	char buf[2][32];
+	unsigned int i;
+
+	printf("Execs: %lu", (unsigned long)a->nr_exec);
+	if (a->version >= 2 && duration > 0)
+		printf(" over %.3fs, %.1f/s", duration, a->nr_exec / duration);
+	printf("\n");
+	print_hist("objects per exec:", &a->objects, false);
+	print_hist("relocations per exec:", &a->relocs, false);
+	print_hist("bytes per exec:", &a->exec_bytes, true);
+	printf("  %lu relocations, %lu execs with NO_RELOC, %lu with HANDLE_LUT\n",
+	       (unsigned long)a->nr_relocs, (unsigned long)a->nr_no_reloc,
+	       (unsigned long)a->nr_lut);
+	if (a->version >= 2)
+		printf("  %lu input fences, %lu output fences\n",
+		       (unsigned long)a->nr_fence_in,
+		       (unsigned long)a->nr_fence_out);
+
+	printf("Rings:\n");
+	for (i = 0; i < NUM_ENGINES; i++) {
+		if (!a->engine_exec[i])
+			continue;
+
+		printf("  %-10s %12lu execs (%.1f%%)\n", engine_str[i],
+		       (unsigned long)a->engine_exec[i],
+		       100.0 * a->engine_exec[i] / a->nr_exec);
+	}
+
+	print_ctx(a);
+
+	printf("Objects: %lu created, %lu closed, peak %lu live using %s\n",
+	       (unsigned long)a->nr_created, (unsigned long)a->nr_closed,
+	       (unsigned long)a->peak_objects,
+	       bytes_str(a->peak_bytes, buf[0]));
+	print_hist("size:", &a->bo_size, true);
+	print_hist("reuse distance (execs):", &a->reuse, false);
+	printf("  %lu first uses, %lu uses of untraced objects\n",
+	       (unsigned long)a->nr_first_use,
+	       (unsigned long)a->nr_unknown_bo);
+
+	printf("Waits: %lu, %.2f per exec", (unsigned long)a->nr_wait,
+	       a->nr_exec ? (double)a->nr_wait / a->nr_exec : 0);
+	if (a->version >= 2 && duration > 0)
+		printf(", %.1f/s", a->nr_wait / duration);
+	printf("\n");
+	if (a->version >= 2) {
+		const struct hist *h = &a->wait_interval;
+
+		if (h->count)
+			printf("  interval median %.1fus, p10 %.1fus, max %.1fus\n",
+			       1e-3 * hist_percentile(h, 50),
+			       1e-3 * hist_percentile(h, 10),
+			       1e-3 * h->max);
+	}
+
+	printf("Working set:\n");
+	for (i = 0; i < a->nr_samples; i++) {
+		const struct sample *s = &a->sample[i];
+
+		printf("  exec %12lu", (unsigned long)s->nr_exec);
+		if (a->version >= 2)
+			printf("  %10.3fs", 1e-9 * s->ts);
+		printf("  %10lu objects  %s\n",
+		       (unsigned long)s->live_objects,
+		       bytes_str(s->live_bytes, buf[1]));
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+"Usage: %s TRACE\n"
+"\n"
+"Reports statistics of a gem_exec_tracer capture: object sizes, working set\n"
+"over time, object reuse distance, objects and relocations per exec, ring and\n"
+"context mix and wait frequency. Memory use does not depend on the length of\n"
+"the trace. TRACE is one of the /tmp/trace-<pid>.<fd>.<seq> files written by\n"
+"gem_exec_tracer.\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct analysis *a;
+	int ret, opt;
+
+	while ((opt = getopt(argc, argv, "h")) != -1) {
+		switch (opt) {
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	a = calloc(1, sizeof(*a));
+	if (!a)
+		return 1;
+
+	ret = analyse(argv[optind], a);
+	if (ret) {
+		if (ret != -EINVAL)
+			fprintf(stderr, "%s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+
+	report(a);
+
+	return 0;
+}
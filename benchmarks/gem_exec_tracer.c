@@ -39,89 +39,87 @@
 #include <dlfcn.h>
 #include <i915_drm.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include "intel_aub.h"
 #include "intel_chipset.h"
+#include "gem_exec_tracer.h"
 
 static int (*libc_close)(int fd);
 static int (*libc_ioctl)(int fd, unsigned long request, void *argp);
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Every thread appends its records to its own ring buffer so submission is
+ * never serialised on the trace files. A writer thread periodically merges
+ * the records of all threads in time order and writes them out to the trace
+ * file of each fd.
+ *
+ * Before timestamping a record a thread publishes the time it started to build
+ * it in ring->pending, and the writer only writes out records older than any
+ * pending one. So even records built concurrently reach the file in order.
+ */
 
 struct trace {
 	int fd;
 	FILE *file;
+	uint64_t closed;
 	struct trace *next;
-} *traces;
+};
+
+#define NOT_I915 ((struct trace *)-1)
+
+/* Indexed by fd, NULL if not looked at yet and NOT_I915 if not traced */
+static struct trace **traces;
+static unsigned int max_traces;
+static struct trace *open_traces, *closing_traces;
+
+#define RING_SIZE (1 << 20)
 
-#define DRM_MAJOR 226
+struct ring {
+	struct ring *next;
+	uint32_t tid;
+	bool dead;
 
-enum {
-	ADD_BO = 0,
-	DEL_BO,
-	ADD_CTX,
-	DEL_CTX,
-	EXEC,
-	WAIT,
+	uint64_t pending;
+	uint64_t head;
+	uint64_t tail;
+	uint8_t data[RING_SIZE];
 };
 
-static struct trace_verion {
-	uint32_t magic;
-	uint32_t version;
-} version = {
-	.magic = 0xdeadbeef,
-	.version = 1
+/* Followed in the ring by the record as written to the trace file. */
+struct ring_entry {
+	struct trace *trace;
+	uint64_t ts;
+	uint32_t len;
 };
 
-struct trace_add_bo {
-	uint8_t cmd;
-	uint32_t handle;
-	uint64_t size;
-} __attribute__((packed));
-struct trace_del_bo {
-	uint8_t cmd;
-	uint32_t handle;
-}__attribute__((packed));
-
-struct trace_add_ctx {
-	uint8_t cmd;
-	uint32_t handle;
-} __attribute__((packed));
-struct trace_del_ctx {
-	uint8_t cmd;
-	uint32_t handle;
-}__attribute__((packed));
-
-struct trace_exec {
-	uint8_t cmd;
-	uint32_t object_count;
-	uint64_t flags;
-	uint32_t context;
-}__attribute__((packed));
-
-struct trace_exec_object {
-	uint32_t handle;
-	uint32_t relocation_count;
-	uint64_t alignment;
-	uint64_t offset;
-	uint64_t flags;
-	uint64_t rsvd1;
-	uint64_t rsvd2;
-}__attribute__((packed));
-
-struct trace_exec_relocation {
-	uint32_t target_handle;
-	uint32_t delta;
-	uint64_t offset;
-	uint64_t presumed_offset;
-	uint32_t read_domains;
-	uint32_t write_domain;
-}__attribute__((packed));
-
-struct trace_wait {
-	uint8_t cmd;
-	uint32_t handle;
-} __attribute__((packed));
+struct record {
+	struct ring *ring;
+	uint64_t pos;
+	FILE *file; /* set if too large for the ring, see record_direct() */
+};
+
+static struct ring *rings;
+static pthread_key_t ring_key;
+static __thread struct ring *thread_ring;
+static __thread unsigned int thread_generation;
+static unsigned int generation;
+
+static pthread_t writer;
+static bool writer_running, writer_stop;
+
+/* Names each trace file, as a reused fd may still have its trace closing. */
+static unsigned int trace_seq;
+
+static const struct trace_version version = {
+	.magic = TRACE_MAGIC,
+	.version = 2
+};
 
 static void __attribute__ ((format(__printf__, 2, 3)))
 fail_if(int cond, const char *format, ...)
@@ -141,6 +139,302 @@ fail_if(int cond, const char *format, ...)
 #define LOCAL_I915_EXEC_FENCE_IN              (1<<16)
 #define LOCAL_I915_EXEC_FENCE_OUT             (1<<17)
 
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void
+ring_copy_in(struct ring *r, uint64_t pos, const void *src, size_t len)
+{
+	size_t offset = pos % RING_SIZE;
+	size_t n = len < RING_SIZE - offset ? len : RING_SIZE - offset;
+
+	memcpy(r->data + offset, src, n);
+	memcpy(r->data, (const uint8_t *)src + n, len - n);
+}
+
+static void
+ring_copy_out(struct ring *r, uint64_t pos, void *dst, size_t len)
+{
+	size_t offset = pos % RING_SIZE;
+	size_t n = len < RING_SIZE - offset ? len : RING_SIZE - offset;
+
+	memcpy(dst, r->data + offset, n);
+	memcpy((uint8_t *)dst + n, r->data, len - n);
+}
+
+static void ring_release(void *data)
+{
+	struct ring *r = data;
+
+	__atomic_store_n(&r->dead, true, __ATOMIC_RELEASE);
+}
+
+static struct ring *get_ring(void)
+{
+	struct ring *r = thread_ring;
+
+	if (r && thread_generation == generation)
+		return r;
+
+	r = calloc(1, sizeof(*r));
+	fail_if(r == NULL, "failed to allocate trace buffer\n");
+	r->tid = syscall(SYS_gettid);
+	r->pending = ~0ull;
+
+	pthread_mutex_lock(&mutex);
+	r->next = rings;
+	rings = r;
+	pthread_mutex_unlock(&mutex);
+
+	pthread_setspecific(ring_key, r);
+	thread_ring = r;
+	thread_generation = generation;
+
+	return r;
+}
+
+static void __write_records(uint64_t until, bool all);
+
+/*
+ * A record which would not fit in the ring, such as an execbuf with a huge
+ * number of relocations, is written straight to the trace file instead. Once
+ * no other thread is still building an older record, everything older is
+ * written out and the mutex is then held until record_commit().
+ */
+static void
+record_direct(struct record *rec, struct trace *trace, uint8_t cmd,
+	      struct trace_header2 *hdr)
+{
+	struct ring *r = rec->ring;
+
+	__atomic_store_n(&r->pending, hdr->ts, __ATOMIC_SEQ_CST);
+
+	for (;;) {
+		struct ring *other;
+
+		pthread_mutex_lock(&mutex);
+		for (other = rings; other; other = other->next) {
+			if (other != r &&
+			    __atomic_load_n(&other->pending,
+					    __ATOMIC_SEQ_CST) < hdr->ts)
+				break;
+		}
+		if (!other)
+			break;
+
+		pthread_cond_signal(&wakeup);
+		pthread_mutex_unlock(&mutex);
+		usleep(100);
+	}
+
+	__write_records(hdr->ts - 1, false);
+
+	rec->file = trace->file;
+	fwrite_unlocked(&cmd, 1, sizeof(cmd), rec->file);
+	fwrite_unlocked(hdr, 1, sizeof(*hdr), rec->file);
+}
+
+static void
+record_begin(struct record *rec, struct trace *trace, uint8_t cmd,
+	     uint32_t len)
+{
+	struct ring *r = get_ring();
+	struct ring_entry e;
+	struct trace_header2 hdr;
+	uint64_t size;
+
+	len += sizeof(cmd) + sizeof(hdr);
+	size = sizeof(e) + len;
+
+	__atomic_store_n(&r->pending, now(), __ATOMIC_SEQ_CST);
+
+	rec->ring = r;
+	rec->file = NULL;
+
+	if (size > RING_SIZE) {
+		hdr.tid = r->tid;
+		hdr.ts = now();
+		record_direct(rec, trace, cmd, &hdr);
+		return;
+	}
+
+	while (RING_SIZE - (r->head - __atomic_load_n(&r->tail,
+						     __ATOMIC_ACQUIRE)) < size) {
+		pthread_cond_signal(&wakeup);
+		usleep(100);
+	}
+
+	e.trace = trace;
+	e.ts = now();
+	e.len = len;
+
+	hdr.tid = r->tid;
+	hdr.ts = e.ts;
+
+	rec->pos = r->head;
+
+	ring_copy_in(r, rec->pos, &e, sizeof(e));
+	rec->pos += sizeof(e);
+	ring_copy_in(r, rec->pos, &cmd, sizeof(cmd));
+	rec->pos += sizeof(cmd);
+	ring_copy_in(r, rec->pos, &hdr, sizeof(hdr));
+	rec->pos += sizeof(hdr);
+}
+
+static void record_data(struct record *rec, const void *data, size_t len)
+{
+	if (rec->file) {
+		fwrite_unlocked(data, 1, len, rec->file);
+		return;
+	}
+
+	ring_copy_in(rec->ring, rec->pos, data, len);
+	rec->pos += len;
+}
+
+static void record_commit(struct record *rec)
+{
+	struct ring *r = rec->ring;
+
+	if (rec->file) {
+		pthread_mutex_unlock(&mutex);
+		__atomic_store_n(&r->pending, ~0ull, __ATOMIC_RELEASE);
+		return;
+	}
+
+	__atomic_store_n(&r->head, rec->pos, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->pending, ~0ull, __ATOMIC_RELEASE);
+
+	if (r->head - __atomic_load_n(&r->tail, __ATOMIC_RELAXED) >
+	    RING_SIZE / 2)
+		pthread_cond_signal(&wakeup);
+}
+
+static void
+write_entry(struct ring *r, const struct ring_entry *e)
+{
+	size_t offset = (r->tail + sizeof(*e)) % RING_SIZE;
+	size_t n = e->len < RING_SIZE - offset ? e->len : RING_SIZE - offset;
+
+	fwrite_unlocked(r->data + offset, 1, n, e->trace->file);
+	fwrite_unlocked(r->data, 1, e->len - n, e->trace->file);
+}
+
+/*
+ * Writes out, in time order, all records older than @until which no longer
+ * can be preceded by a record still being built. With @all everything which
+ * was recorded is written out.
+ */
+static void __write_records(uint64_t until, bool all)
+{
+	struct trace *t, **pt;
+	struct ring *list, *r, **pr;
+
+	list = rings;
+
+	for (r = list; !all && r; r = r->next) {
+		uint64_t pending = __atomic_load_n(&r->pending,
+						   __ATOMIC_SEQ_CST);
+
+		if (pending <= until)
+			until = pending - 1;
+	}
+
+	for (;;) {
+		struct ring_entry e, first;
+		struct ring *next = NULL;
+
+		for (r = list; r; r = r->next) {
+			if (r->tail == __atomic_load_n(&r->head,
+						       __ATOMIC_ACQUIRE))
+				continue;
+
+			ring_copy_out(r, r->tail, &e, sizeof(e));
+			if (e.ts > until)
+				continue;
+
+			if (!next || e.ts < first.ts) {
+				next = r;
+				first = e;
+			}
+		}
+
+		if (!next)
+			break;
+
+		write_entry(next, &first);
+		__atomic_store_n(&next->tail,
+				 next->tail + sizeof(first) + first.len,
+				 __ATOMIC_RELEASE);
+	}
+
+
+	for (t = open_traces; t; t = t->next)
+		fflush(t->file);
+
+	for (pt = &closing_traces; (t = *pt); ) {
+		if (all || t->closed <= until) {
+			*pt = t->next;
+			fclose(t->file);
+			free(t);
+		} else {
+			pt = &t->next;
+		}
+	}
+
+	for (pr = &rings; (r = *pr); ) {
+		if (__atomic_load_n(&r->dead, __ATOMIC_ACQUIRE) &&
+		    r->tail == r->head) {
+			*pr = r->next;
+			free(r);
+		} else {
+			pr = &r->next;
+		}
+	}
+}
+
+static void write_records(uint64_t until, bool all)
+{
+	/*
+	 * Held throughout so that the stdio buffers are never caught half
+	 * written by fork, see fork_prepare(). Recording never takes the mutex,
+	 * except for the rare record too large for the ring.
+	 */
+	pthread_mutex_lock(&mutex);
+	__write_records(until, all);
+	pthread_mutex_unlock(&mutex);
+}
+
+static void *writer_thread(void *arg)
+{
+	pthread_mutex_lock(&mutex);
+	while (!writer_stop) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 10 * 1000 * 1000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_nsec -= 1000000000;
+			ts.tv_sec++;
+		}
+		pthread_cond_timedwait(&wakeup, &mutex, &ts);
+		pthread_mutex_unlock(&mutex);
+
+		write_records(now(), false);
+
+		pthread_mutex_lock(&mutex);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return NULL;
+}
+
 static void
 trace_exec(struct trace *trace,
 	   const struct drm_i915_gem_execbuffer2 *execbuffer2)
@@ -148,20 +442,23 @@ trace_exec(struct trace *trace,
 #define to_ptr(T, x) ((T *)(uintptr_t)(x))
 	const struct drm_i915_gem_exec_object2 *exec_objects =
 		to_ptr(typeof(*exec_objects), execbuffer2->buffers_ptr);
-
-	fail_if(execbuffer2->flags & (LOCAL_I915_EXEC_FENCE_IN | LOCAL_I915_EXEC_FENCE_OUT),
-		"fences not supported yet\n");
-
-	flockfile(trace->file);
-	{
-		struct trace_exec t = {
-			EXEC,
-			execbuffer2->buffer_count,
-			execbuffer2->flags,
-			execbuffer2->rsvd1,
-		};
-		fwrite(&t, sizeof(t), 1, trace->file);
-	}
+	struct trace_exec2 t = {
+		execbuffer2->buffer_count,
+		execbuffer2->flags,
+		execbuffer2->rsvd1,
+		execbuffer2->flags & LOCAL_I915_EXEC_FENCE_IN ?
+		(int32_t)execbuffer2->rsvd2 : -1,
+	};
+	struct record rec;
+	uint32_t len = sizeof(t);
+
+	for (uint32_t i = 0; i < execbuffer2->buffer_count; i++)
+		len += sizeof(struct trace_exec_object) +
+		       exec_objects[i].relocation_count *
+		       sizeof(struct trace_exec_relocation);
+
+	record_begin(&rec, trace, EXEC, len);
+	record_data(&rec, &t, sizeof(t));
 
 	for (uint32_t i = 0; i < execbuffer2->buffer_count; i++) {
 		const struct drm_i915_gem_exec_object2 *obj = &exec_objects[i];
@@ -177,50 +474,66 @@ trace_exec(struct trace *trace,
 				obj->rsvd1,
 				obj->rsvd2
 			};
-			fwrite(&t, sizeof(t), 1, trace->file);
+			record_data(&rec, &t, sizeof(t));
 		}
-		fwrite(relocs, sizeof(*relocs), obj->relocation_count,
-		       trace->file);
+		record_data(&rec, relocs,
+			    obj->relocation_count * sizeof(*relocs));
 	}
 
-	fflush(trace->file);
-	funlockfile(trace->file);
+	record_commit(&rec);
 #undef to_ptr
 }
 
+static void
+trace_record(struct trace *trace, uint8_t cmd, const void *data, uint32_t len)
+{
+	struct record rec;
+
+	record_begin(&rec, trace, cmd, len);
+	record_data(&rec, data, len);
+	record_commit(&rec);
+}
+
+static void
+trace_fence_out(struct trace *trace, int fd)
+{
+	struct trace_fence_out t = { fd };
+	trace_record(trace, FENCE_OUT, &t, sizeof(t));
+}
+
 static void
 trace_wait(struct trace *trace, uint32_t handle)
 {
-	struct trace_wait t = { WAIT, handle };
-	fwrite(&t, sizeof(t), 1, trace->file);
+	struct trace_wait t = { handle };
+	trace_record(trace, WAIT, &t, sizeof(t));
 }
 
 static void
 trace_add(struct trace *trace, uint32_t handle, uint64_t size)
 {
-	struct trace_add_bo t = { ADD_BO, handle, size };
-	fwrite(&t, sizeof(t), 1, trace->file);
+	struct trace_add_bo t = { handle, size };
+	trace_record(trace, ADD_BO, &t, sizeof(t));
 }
 
 static void
 trace_del(struct trace *trace, uint32_t handle)
 {
-	struct trace_del_bo t = { DEL_BO, handle };
-	fwrite(&t, sizeof(t), 1, trace->file);
+	struct trace_del_bo t = { handle };
+	trace_record(trace, DEL_BO, &t, sizeof(t));
 }
 
 static void
 trace_add_context(struct trace *trace, uint32_t handle)
 {
-	struct trace_add_ctx t = { ADD_CTX, handle };
-	fwrite(&t, sizeof(t), 1, trace->file);
+	struct trace_add_ctx t = { handle };
+	trace_record(trace, ADD_CTX, &t, sizeof(t));
 }
 
 static void
 trace_del_context(struct trace *trace, uint32_t handle)
 {
-	struct trace_del_ctx t = { DEL_CTX, handle };
-	fwrite(&t, sizeof(t), 1, trace->file);
+	struct trace_del_ctx t = { handle };
+	trace_record(trace, DEL_CTX, &t, sizeof(t));
 }
 
 int
@@ -228,16 +541,23 @@ close(int fd)
 {
 	struct trace *t, **p;
 
-	pthread_mutex_lock(&mutex);
-	for (p = &traces; (t = *p); p = &t->next) {
-		if (t->fd == fd) {
+	if (fd >= 0 && fd < max_traces &&
+	    __atomic_load_n(&traces[fd], __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&mutex);
+		t = traces[fd];
+		traces[fd] = NULL;
+		if (t && t != NOT_I915) {
+			for (p = &open_traces; *p != t; p = &(*p)->next)
+				;
 			*p = t->next;
-			fclose(t->file);
-			free(t);
-			break;
+
+			/* Closed by the writer once all records are out. */
+			t->closed = now();
+			t->next = closing_traces;
+			closing_traces = t;
 		}
+		pthread_mutex_unlock(&mutex);
 	}
-	pthread_mutex_unlock(&mutex);
 
 	return libc_close(fd);
 }
@@ -274,10 +594,65 @@ static int is_i915(int fd)
 #define LOCAL_IOCTL_I915_GEM_EXECBUFFER2_WR \
     DRM_IOWR(DRM_COMMAND_BASE + DRM_I915_GEM_EXECBUFFER2, struct drm_i915_gem_execbuffer2)
 
+static struct trace *get_trace(int fd)
+{
+	struct trace *t;
+	char filename[80];
+
+	if (fd < 0 || fd >= max_traces)
+		return NULL;
+
+	t = __atomic_load_n(&traces[fd], __ATOMIC_ACQUIRE);
+	if (t)
+		return t != NOT_I915 ? t : NULL;
+
+	pthread_mutex_lock(&mutex);
+	t = traces[fd];
+	if (t)
+		goto out;
+
+	if (!is_i915(fd)) {
+		t = NOT_I915;
+		goto publish;
+	}
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		goto out;
+
+	sprintf(filename, "/tmp/trace-%d.%d.%u", getpid(), fd, trace_seq++);
+	t->file = fopen(filename, "w+");
+	t->fd = fd;
+
+	if (!t->file || !fwrite(&version, sizeof(version), 1, t->file)) {
+		if (t->file)
+			fclose(t->file);
+		free(t);
+		t = NULL;
+		goto out;
+	}
+
+	t->next = open_traces;
+	open_traces = t;
+
+	if (!writer_running) {
+		fail_if(pthread_create(&writer, NULL, writer_thread, NULL),
+			"failed to start the trace writer\n");
+		writer_running = true;
+	}
+
+publish:
+	__atomic_store_n(&traces[fd], t, __ATOMIC_RELEASE);
+out:
+	pthread_mutex_unlock(&mutex);
+
+	return t != NOT_I915 ? t : NULL;
+}
+
 int
 ioctl(int fd, unsigned long request, ...)
 {
-	struct trace *t, **p;
+	struct trace *t;
 	va_list args;
 	void *argp;
 	int ret;
@@ -289,46 +664,9 @@ ioctl(int fd, unsigned long request, ...)
 	if (_IOC_TYPE(request) != DRM_IOCTL_BASE)
 		goto untraced;
 
-	pthread_mutex_lock(&mutex);
-	for (p = &traces; (t = *p); p = &t->next) {
-		if (fd == t->fd) {
-			if (traces != t) {
-				*p = t->next;
-				t->next = traces;
-				traces = t;
-			}
-			break;
-		}
-	}
-	if (!t) {
-		char filename[80];
-
-		if (!is_i915(fd)) {
-			pthread_mutex_unlock(&mutex);
-			goto untraced;
-		}
-
-		t = malloc(sizeof(*t));
-		if (!t) {
-			pthread_mutex_unlock(&mutex);
-			return -ENOMEM;
-		}
-
-		sprintf(filename, "/tmp/trace-%d.%d", getpid(), fd);
-		t->file = fopen(filename, "w+");
-		t->fd = fd;
-
-		if (!fwrite(&version, sizeof(version), 1, t->file)) {
-			pthread_mutex_unlock(&mutex);
-			fclose(t->file);
-			free(t);
-			return -ENOMEM;
-		}
-
-		t->next = traces;
-		traces = t;
-	}
-	pthread_mutex_unlock(&mutex);
+	t = get_trace(fd);
+	if (!t)
+		goto untraced;
 
 	switch (request) {
 	case DRM_IOCTL_I915_GEM_EXECBUFFER2:
@@ -366,6 +704,13 @@ ioctl(int fd, unsigned long request, ...)
 		return ret;
 
 	switch (request) {
+	case LOCAL_IOCTL_I915_GEM_EXECBUFFER2_WR: {
+		struct drm_i915_gem_execbuffer2 *eb = argp;
+		if (eb->flags & LOCAL_I915_EXEC_FENCE_OUT)
+			trace_fence_out(t, eb->rsvd2 >> 32);
+		break;
+	}
+
 	case DRM_IOCTL_I915_GEM_CREATE: {
 		struct drm_i915_gem_create *create = argp;
 		trace_add(t, create->handle, create->size);
@@ -411,11 +756,86 @@ untraced:
 	return libc_ioctl(fd, request, argp);
 }
 
+static void fork_prepare(void)
+{
+	struct trace *t;
+
+	/* Or the child would write out the parent's buffered records again. */
+	pthread_mutex_lock(&mutex);
+	for (t = open_traces; t; t = t->next)
+		fflush(t->file);
+	for (t = closing_traces; t; t = t->next)
+		fflush(t->file);
+}
+
+static void fork_parent(void)
+{
+	pthread_mutex_unlock(&mutex);
+}
+
+/*
+ * The writer thread does not survive fork, so the child starts over with its
+ * own traces, leaving the ones of the parent alone.
+ */
+static void fork_child(void)
+{
+	pthread_mutex_init(&mutex, NULL);
+	pthread_cond_init(&wakeup, NULL);
+
+	memset(traces, 0, max_traces * sizeof(*traces));
+	open_traces = NULL;
+	closing_traces = NULL;
+	rings = NULL;
+	generation++;
+	trace_seq = 0;
+
+	writer_running = false;
+	writer_stop = false;
+}
+
 static void __attribute__ ((constructor))
 init(void)
 {
+	struct rlimit rlim;
+
 	libc_close = dlsym(RTLD_NEXT, "close");
 	libc_ioctl = dlsym(RTLD_NEXT, "ioctl");
 	fail_if(libc_close == NULL || libc_ioctl == NULL,
 		"failed to get libc ioctl or close\n");
+
+	max_traces = 1024;
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_max > max_traces)
+		max_traces = rlim.rlim_max < 1 << 20 ? rlim.rlim_max : 1 << 20;
+	traces = calloc(max_traces, sizeof(*traces));
+	fail_if(traces == NULL, "failed to allocate the trace table\n");
+
+	fail_if(pthread_key_create(&ring_key, ring_release),
+		"failed to create the trace buffer key\n");
+	pthread_atfork(fork_prepare, fork_parent, fork_child);
+}
+
+static void __attribute__ ((destructor))
+fini(void)
+{
+	struct trace *t;
+
+	pthread_mutex_lock(&mutex);
+	writer_stop = true;
+	pthread_cond_signal(&wakeup);
+	pthread_mutex_unlock(&mutex);
+
+	if (writer_running) {
+		pthread_join(writer, NULL);
+		writer_running = false;
+	}
+
+	write_records(~0ull, true);
+
+	pthread_mutex_lock(&mutex);
+	while ((t = open_traces)) {
+		open_traces = t->next;
+		fclose(t->file);
+		free(t);
+	}
+	pthread_mutex_unlock(&mutex);
 }
@@ -0,0 +1,127 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef GEM_EXEC_TRACER_H
+#define GEM_EXEC_TRACER_H
+
+#include <stdint.h>
+
+/*
+ * gem_exec_tracer trace format
+ *
+ * A trace starts with struct trace_version and is followed by a stream of
+ * commands, each made of a command byte and its payload. EXEC payloads are
+ * followed by object_count trace_exec_object, each followed by its
+ * relocation_count trace_exec_relocation.
+ *
+ * Version 2 adds struct trace_header2 after the command byte, with the thread
+ * which issued the ioctl and the CLOCK_MONOTONIC time it was issued at.
+ * Commands from all threads are in time order. EXEC payloads gain the input
+ * fence fd, and FENCE_OUT records the output fence fd of the preceding EXEC
+ * from the same thread.
+ *
+ * The tracer writes the trace of each i915 fd to /tmp/trace-<pid>.<fd>.<seq>,
+ * where seq counts the traces of the process so that a reused fd number never
+ * overwrites a trace which is still being written.
+ */
+
+#define TRACE_MAGIC 0xdeadbeef
+
+enum {
+	ADD_BO = 0,
+	DEL_BO,
+	ADD_CTX,
+	DEL_CTX,
+	EXEC,
+	WAIT,
+	FENCE_OUT, /* v2 */
+};
+
+struct trace_version {
+	uint32_t magic;
+	uint32_t version;
+} __attribute__((packed));
+
+struct trace_header2 {
+	uint32_t tid;
+	uint64_t ts; /* ns */
+} __attribute__((packed));
+
+struct trace_add_bo {
+	uint32_t handle;
+	uint64_t size;
+} __attribute__((packed));
+
+struct trace_del_bo {
+	uint32_t handle;
+} __attribute__((packed));
+
+struct trace_add_ctx {
+	uint32_t handle;
+} __attribute__((packed));
+
+struct trace_del_ctx {
+	uint32_t handle;
+} __attribute__((packed));
+
+struct trace_exec {
+	uint32_t object_count;
+	uint64_t flags;
+	uint32_t context;
+} __attribute__((packed));
+
+struct trace_exec2 {
+	uint32_t object_count;
+	uint64_t flags;
+	uint32_t context;
+	int32_t fence_in; /* -1 if none */
+} __attribute__((packed));
+
+struct trace_exec_object {
+	uint32_t handle;
+	uint32_t relocation_count;
+	uint64_t alignment;
+	uint64_t offset;
+	uint64_t flags;
+	uint64_t rsvd1;
+	uint64_t rsvd2;
+} __attribute__((packed));
+
+struct trace_exec_relocation {
+	uint32_t target_handle;
+	uint32_t delta;
+	uint64_t offset;
+	uint64_t presumed_offset;
+	uint32_t read_domains;
+	uint32_t write_domain;
+} __attribute__((packed));
+
+struct trace_wait {
+	uint32_t handle;
+} __attribute__((packed));
+
+struct trace_fence_out {
+	int32_t fd;
+} __attribute__((packed));
+
+#endif /* GEM_EXEC_TRACER_H */
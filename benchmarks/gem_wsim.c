@@ -40,6 +40,10 @@
 #include <assert.h>
 #include <limits.h>
 #include <pthread.h>
+#include <getopt.h>
+#include <dlfcn.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 
 #include "intel_chipset.h"
@@ -53,6 +57,8 @@
 #include "sw_sync.h"
 
 #include "ewma.h"
+#include "hist.h"
+#include "gem_wsim_balancer.h"
 
 #define LOCAL_I915_EXEC_FENCE_IN              (1<<16)
 #define LOCAL_I915_EXEC_FENCE_OUT             (1<<17)
@@ -121,9 +127,14 @@ struct w_step
 
 	struct drm_i915_gem_execbuffer2 eb;
 	struct drm_i915_gem_exec_object2 *obj;
-	struct drm_i915_gem_relocation_entry reloc[4];
+	struct drm_i915_gem_relocation_entry reloc[9];
 	unsigned long bb_sz;
 	uint32_t bb_handle;
+	struct bb_pool *bb_pool;
+	unsigned long chain_start;
+	uint32_t *chain_address;
+	unsigned int chain_reloc;
+	uint32_t *tl_address[2];
 	uint32_t *mapped_batch;
 	uint32_t *seqno_value;
 	uint32_t *seqno_address;
@@ -132,11 +143,83 @@ struct w_step
 	uint32_t *rt1_address;
 	uint32_t *latch_value;
 	uint32_t *latch_address;
+	uint32_t *lat_value;
+	uint32_t *lat_address[2];
+	unsigned int lat_reloc;
+	bool lat_pending;
+	enum intel_engine_id lat_engine;
 	unsigned int mapped_len;
+
+	/* Fence of the last submission when multiplexing clients */
+	int mux_fence;
+
+	/* Simulation state */
+	struct sim_rq *sim_rq;
+	struct sim_rq **sim_readers;
+	unsigned int nr_sim_readers;
+	uint32_t sim_fence_point;
+};
+
+enum w_state {
+	S_INIT,
+	S_REPEAT,
+	S_STEP,
+	S_DEPSYNC,
+	S_BALANCE,
+	S_SUBMIT,
+	S_QD_THROTTLE,
+	S_REPEAT_END,
+	S_DRAIN,
+	S_DONE
+};
+
+enum w_wait {
+	W_DONE,
+	W_SLEEP,
+	W_SYNC
+};
+
+/*
+ * Execution state of a workload, so it can be advanced step by step until
+ * it needs to wait on either time or a batch.
+ */
+struct w_exec {
+	enum w_state state;
+	int count;
+	int i;
+	unsigned int dep;
+	int throttle;
+	int qd_throttle;
+	bool last_sync;
+	unsigned int cur_seqno;
+	enum intel_engine_id engine;
+	uint64_t start;
+	uint64_t repeat_start;
+
+	uint64_t wake;
+	struct w_step *sync;
 };
 
 DECLARE_EWMA(uint64_t, rt, 4, 2)
 
+/*
+ * One timeline record per submitted batch, preallocated per client. The batch
+ * stores its start and end RCS_TIMESTAMP into the matching slot of the client
+ * timeline object, which gets converted to CPU time when writing the trace.
+ */
+#define TL_RECORDS (1 << 14)
+
+struct tl_record {
+	uint64_t submit;
+	uint64_t start;
+	uint64_t end;
+	uint32_t seqno;
+	uint32_t ticks;
+	uint16_t step;
+	uint16_t context;
+	uint8_t engine;
+};
+
 struct workload
 {
 	unsigned int id;
@@ -146,6 +229,8 @@ struct workload
 	int prio;
 
 	pthread_t thread;
+	int mux_wait;
+	uint64_t cpu_ns;
 	bool run;
 	bool background;
 	const struct workload_balancer *balancer;
@@ -155,7 +240,7 @@ struct workload
 
 	uint32_t prng;
 
-	struct timespec repeat_start;
+	struct w_exec exec;
 
 	unsigned int nr_ctxs;
 	struct {
@@ -165,6 +250,8 @@ struct workload
 
 	int sync_timeline;
 	uint32_t sync_seqno;
+	uint32_t sim_timeline;
+	struct sim_rq **sim_ctx_last;
 
 	uint32_t seqno[NUM_ENGINES];
 	struct drm_i915_gem_exec_object2 status_object[2];
@@ -175,6 +262,21 @@ struct workload
 	unsigned long qd_sum[NUM_ENGINES];
 	unsigned long nr_bb[NUM_ENGINES];
 
+	/* Latency histograms, indexed by step and by engine */
+	struct drm_i915_gem_exec_object2 lat_object;
+	uint32_t *lat_page;
+	struct hist *step_lat;
+	struct hist *engine_lat;
+	unsigned long *nr_periods;
+	unsigned long *missed_periods;
+
+	/* Timeline of submitted batches, see --timeline */
+	struct drm_i915_gem_exec_object2 tl_object;
+	uint32_t *tl_page;
+	struct tl_record *tl;
+	unsigned int nr_tl;
+	unsigned long tl_dropped;
+
 	struct igt_list requests[NUM_ENGINES];
 	unsigned int nrequest[NUM_ENGINES];
 
@@ -182,6 +284,9 @@ struct workload
 	const struct workload_balancer *global_balancer;
 	pthread_mutex_t mutex;
 
+	/* Private to balancer modules. */
+	void *balancer_data;
+
 	union {
 		struct rtavg {
 			struct ewma_rt avg[NUM_ENGINES];
@@ -197,6 +302,7 @@ static unsigned int context_vcs_rr;
 
 static int verbose = 1;
 static int fd;
+static double timestamp_ns;
 
 #define SWAPVCS		(1<<0)
 #define SEQNO		(1<<1)
@@ -208,6 +314,11 @@ static int fd;
 #define HEARTBEAT	(1<<7)
 #define GLOBAL_BALANCE	(1<<8)
 #define DEPSYNC		(1<<9)
+#define SIMULATE	(1<<10)
+#define MULTIPLEX	(1<<11)
+#define LATENCY		(1<<12)
+#define BBPOOL		(1<<13)
+#define TIMELINE	(1<<14)
 
 #define SEQNO_IDX(engine) ((engine) * 16)
 #define SEQNO_OFFSET(engine) (SEQNO_IDX(engine) * sizeof(uint32_t))
@@ -587,7 +698,7 @@ add_step:
 }
 
 static struct workload *
-clone_workload(struct workload *_wrk)
+clone_workload(struct workload *_wrk, unsigned int flags)
 {
 	struct workload *wrk;
 	int i;
@@ -604,7 +715,7 @@ clone_workload(struct workload *_wrk)
 	memcpy(wrk->steps, _wrk->steps, sizeof(struct w_step) * wrk->nr_steps);
 
 	/* Check if we need a sw sync timeline. */
-	for (i = 0; i < wrk->nr_steps; i++) {
+	for (i = 0; !(flags & SIMULATE) && i < wrk->nr_steps; i++) {
 		if (wrk->steps[i].type == SW_FENCE) {
 			wrk->sync_timeline = sw_sync_timeline_create();
 			igt_assert(wrk->sync_timeline >= 0);
@@ -640,6 +751,64 @@ static unsigned long get_bb_sz(unsigned int duration)
 		     nop_calibration_us, sizeof(uint32_t));
 }
 
+/*
+ * Nop batches shared between all steps of all clients.
+ *
+ * Batches are keyed by engine and by the maximum step duration rounded up to
+ * one of eight buckets per power of two. Steps pick their duration by starting
+ * execution at an offset into the batch so a bigger batch is a fine substitute.
+ * Pooled batches are never written to after creation.
+ */
+struct bb_pool {
+	struct bb_pool *next;
+	enum intel_engine_id engine;
+	unsigned int duration;
+	unsigned long sz;
+	uint32_t handle;
+};
+
+static struct bb_pool *bb_pool;
+
+static unsigned int bb_pool_duration(unsigned int duration)
+{
+	unsigned int shift;
+
+	if (duration <= 8)
+		return duration;
+
+	shift = fls(duration) - 4;
+
+	return ALIGN(duration, 1 << shift);
+}
+
+static struct bb_pool *
+get_bb_pool(enum intel_engine_id engine, unsigned int duration)
+{
+	const uint32_t bbe = 0xa << 23;
+	struct bb_pool *pool;
+
+	duration = bb_pool_duration(duration);
+
+	for (pool = bb_pool; pool; pool = pool->next) {
+		if (pool->engine == engine && pool->duration == duration)
+			return pool;
+	}
+
+	pool = calloc(1, sizeof(*pool));
+	igt_assert(pool);
+
+	pool->engine = engine;
+	pool->duration = duration;
+	pool->sz = get_bb_sz(duration);
+	pool->handle = gem_create(fd, pool->sz);
+	gem_write(fd, pool->handle, pool->sz - sizeof(bbe), &bbe, sizeof(bbe));
+
+	pool->next = bb_pool;
+	bb_pool = pool;
+
+	return pool;
+}
+
 static void
 terminate_bb(struct w_step *w, unsigned int flags)
 {
@@ -651,10 +820,16 @@ terminate_bb(struct w_step *w, unsigned int flags)
 	igt_assert(((flags & RT) && (flags & SEQNO)) || !(flags & RT));
 
 	batch_start -= sizeof(uint32_t); /* bbend */
+	if (w->bb_pool)
+		batch_start -= 4 * sizeof(uint32_t);
+	if (flags & TIMELINE)
+		batch_start -= 8 * sizeof(uint32_t);
 	if (flags & SEQNO)
 		batch_start -= 4 * sizeof(uint32_t);
 	if (flags & RT)
 		batch_start -= 12 * sizeof(uint32_t);
+	if (flags & LATENCY)
+		batch_start -= 8 * sizeof(uint32_t);
 
 	mmap_start = rounddown(batch_start, PAGE_SIZE);
 	mmap_len = w->bb_sz - mmap_start;
@@ -665,6 +840,36 @@ terminate_bb(struct w_step *w, unsigned int flags)
 	ptr = gem_mmap__wc(fd, w->bb_handle, mmap_start, mmap_len, PROT_WRITE);
 	cs = (uint32_t *)((char *)ptr + batch_start - mmap_start);
 
+	if (w->bb_pool) {
+		/* Relocations go after the seqno, RT and latency ones. */
+		w->chain_start = batch_start;
+		w->chain_reloc = (flags & RT) ? 4 : (flags & SEQNO) ? 1 : 0;
+		if (flags & LATENCY)
+			w->chain_reloc += 2;
+
+		if (flags & TIMELINE) {
+			w->reloc[w->chain_reloc + 1].offset =
+				batch_start + 2 * sizeof(uint32_t);
+			batch_start += 4 * sizeof(uint32_t);
+
+			*cs++ = 0x24 << 23 | 2; /* MI_STORE_REG_MEM */
+			*cs++ = RCS_TIMESTAMP;
+			w->tl_address[0] = cs;
+			*cs++ = 0;
+			*cs++ = 0;
+		}
+
+		w->reloc[w->chain_reloc].offset = batch_start + sizeof(uint32_t);
+		batch_start += 4 * sizeof(uint32_t);
+
+		/* Second level so the pooled batch returns here. */
+		*cs++ = MI_BATCH_BUFFER_START | 1 << 22 | 1 << 8 | 1;
+		w->chain_address = cs;
+		*cs++ = 0;
+		*cs++ = 0;
+		*cs++ = 0; /* MI_NOOP */
+	}
+
 	if (flags & SEQNO) {
 		w->reloc[0].offset = batch_start + sizeof(uint32_t);
 		batch_start += 4 * sizeof(uint32_t);
@@ -708,6 +913,43 @@ terminate_bb(struct w_step *w, unsigned int flags)
 		*cs++ = 0;
 	}
 
+	if (flags & LATENCY) {
+		unsigned int r = (flags & RT) ? 4 : (flags & SEQNO) ? 1 : 0;
+
+		w->lat_reloc = r;
+
+		w->reloc[r].offset = batch_start + sizeof(uint32_t);
+		batch_start += 4 * sizeof(uint32_t);
+
+		*cs++ = MI_STORE_DWORD_IMM;
+		w->lat_address[0] = cs;
+		*cs++ = 0;
+		*cs++ = 0;
+		w->lat_value = cs;
+		*cs++ = 0;
+
+		w->reloc[r + 1].offset = batch_start + 2 * sizeof(uint32_t);
+		batch_start += 4 * sizeof(uint32_t);
+
+		*cs++ = 0x24 << 23 | 2; /* MI_STORE_REG_MEM */
+		*cs++ = RCS_TIMESTAMP;
+		w->lat_address[1] = cs;
+		*cs++ = 0;
+		*cs++ = 0;
+	}
+
+	if (flags & TIMELINE) {
+		w->reloc[w->chain_reloc + 2].offset =
+			batch_start + 2 * sizeof(uint32_t);
+		batch_start += 4 * sizeof(uint32_t);
+
+		*cs++ = 0x24 << 23 | 2; /* MI_STORE_REG_MEM */
+		*cs++ = RCS_TIMESTAMP;
+		w->tl_address[1] = cs;
+		*cs++ = 0;
+		*cs++ = 0;
+	}
+
 	*cs = bbe;
 
 	w->mapped_batch = ptr;
@@ -744,7 +986,7 @@ eb_update_flags(struct w_step *w, enum intel_engine_id engine,
 	w->eb.flags |= I915_EXEC_NO_RELOC;
 
 	igt_assert(w->emit_fence <= 0);
-	if (w->emit_fence)
+	if (w->emit_fence || (flags & MULTIPLEX))
 		w->eb.flags |= LOCAL_I915_EXEC_FENCE_OUT;
 }
 
@@ -762,7 +1004,8 @@ alloc_step_batch(struct workload *wrk, struct w_step *w, unsigned int flags)
 {
 	enum intel_engine_id engine = w->engine;
 	unsigned int j = 0;
-	unsigned int nr_obj = 3 + w->data_deps.nr;
+	unsigned int nr_obj = 6 + w->data_deps.nr;
+	unsigned int lat_idx = 0, tl_idx = 0, pool_idx = 0;
 	unsigned int i;
 
 	w->obj = calloc(nr_obj, sizeof(*w->obj));
@@ -778,6 +1021,12 @@ alloc_step_batch(struct workload *wrk, struct w_step *w, unsigned int flags)
 		igt_assert(j < nr_obj);
 	}
 
+	if (flags & LATENCY) {
+		lat_idx = j;
+		w->obj[j++] = wrk->lat_object;
+		igt_assert(j < nr_obj);
+	}
+
 	for (i = 0; i < w->data_deps.nr; i++) {
 		igt_assert(w->data_deps.list[i] <= 0);
 		if (w->data_deps.list[i]) {
@@ -792,9 +1041,36 @@ alloc_step_batch(struct workload *wrk, struct w_step *w, unsigned int flags)
 		}
 	}
 
-	w->bb_sz = get_bb_sz(w->duration.max);
-	w->bb_handle = w->obj[j].handle = gem_create(fd, w->bb_sz);
-	terminate_bb(w, flags);
+	if (flags & (BBPOOL | TIMELINE))
+		w->bb_pool = get_bb_pool(w->engine, w->duration.max);
+
+	if (w->bb_pool && !(flags & (SEQNO | LATENCY | TIMELINE))) {
+		/* Nothing to patch so execute the pooled batch directly. */
+		w->bb_sz = w->bb_pool->sz;
+		w->bb_handle = w->obj[j].handle = w->bb_pool->handle;
+	} else {
+		/*
+		 * The per-client tail is kept in a small private batch which
+		 * calls into the pooled one.
+		 */
+		if (flags & TIMELINE) {
+			tl_idx = j;
+			w->obj[j++] = wrk->tl_object;
+			igt_assert(j < nr_obj);
+		}
+
+		if (w->bb_pool) {
+			pool_idx = j;
+			w->obj[j++].handle = w->bb_pool->handle;
+			igt_assert(j < nr_obj);
+			w->bb_sz = 4096;
+		} else {
+			w->bb_sz = get_bb_sz(w->duration.max);
+		}
+
+		w->bb_handle = w->obj[j].handle = gem_create(fd, w->bb_sz);
+		terminate_bb(w, flags);
+	}
 
 	if (flags & SEQNO) {
 		w->obj[j].relocs_ptr = to_user_pointer(&w->reloc);
@@ -806,6 +1082,32 @@ alloc_step_batch(struct workload *wrk, struct w_step *w, unsigned int flags)
 			w->reloc[i].target_handle = 1;
 	}
 
+	if (flags & LATENCY) {
+		struct drm_i915_gem_relocation_entry *r = &w->reloc[w->lat_reloc];
+
+		r[0].target_handle = lat_idx;
+		r[0].delta = w->idx * 2 * sizeof(uint32_t);
+		r[1].target_handle = lat_idx;
+		r[1].delta = r[0].delta + sizeof(uint32_t);
+
+		w->obj[j].relocs_ptr = to_user_pointer(&w->reloc);
+		w->obj[j].relocation_count = w->lat_reloc + 2;
+	}
+
+	if (w->chain_address) {
+		w->reloc[w->chain_reloc].target_handle = pool_idx;
+
+		w->obj[j].relocs_ptr = to_user_pointer(&w->reloc);
+		w->obj[j].relocation_count = w->chain_reloc + 1;
+	}
+
+	if (flags & TIMELINE) {
+		w->reloc[w->chain_reloc + 1].target_handle = tl_idx;
+		w->reloc[w->chain_reloc + 2].target_handle = tl_idx;
+
+		w->obj[j].relocation_count = w->chain_reloc + 3;
+	}
+
 	w->eb.buffers_ptr = to_user_pointer(w->obj);
 	w->eb.buffer_count = j + 1;
 	w->eb.rsvd1 = wrk->ctx_list[w->context].id;
@@ -845,7 +1147,13 @@ prepare_workload(unsigned int id, struct workload *wrk, unsigned int flags)
 		igt_assert(ret == 0);
 	}
 
-	if (flags & SEQNO) {
+	if ((flags & SEQNO) && (flags & SIMULATE)) {
+		/* Simulated engines write straight into a plain status page. */
+		if (!(flags & GLOBAL_BALANCE) || id == 0) {
+			wrk->status_page = calloc(1, 4096);
+			igt_assert(wrk->status_page);
+		}
+	} else if (flags & SEQNO) {
 		if (!(flags & GLOBAL_BALANCE) || id == 0) {
 			uint32_t handle;
 
@@ -862,6 +1170,45 @@ prepare_workload(unsigned int id, struct workload *wrk, unsigned int flags)
 		}
 	}
 
+	if (flags & LATENCY) {
+		wrk->step_lat = calloc(wrk->nr_steps, sizeof(*wrk->step_lat));
+		wrk->engine_lat = calloc(NUM_ENGINES, sizeof(*wrk->engine_lat));
+		wrk->nr_periods = calloc(wrk->nr_steps,
+					 sizeof(*wrk->nr_periods));
+		wrk->missed_periods = calloc(wrk->nr_steps,
+					     sizeof(*wrk->missed_periods));
+		igt_assert(wrk->step_lat && wrk->engine_lat &&
+			   wrk->nr_periods && wrk->missed_periods);
+	}
+
+	if ((flags & LATENCY) && !(flags & SIMULATE)) {
+		unsigned long sz = ALIGN(wrk->nr_steps * 2 * sizeof(uint32_t),
+					 4096);
+		uint32_t handle;
+
+		handle = gem_create(fd, sz);
+		gem_set_caching(fd, handle, I915_CACHING_CACHED);
+		wrk->lat_object.handle = handle;
+		wrk->lat_page = gem_mmap__cpu(fd, handle, 0, sz, PROT_READ);
+	}
+
+	if (flags & TIMELINE) {
+		wrk->tl = calloc(TL_RECORDS, sizeof(*wrk->tl));
+		igt_assert(wrk->tl);
+	}
+
+	if ((flags & TIMELINE) && !(flags & SIMULATE)) {
+		/* One extra slot for batches past the end of the timeline. */
+		unsigned long sz = ALIGN((TL_RECORDS + 1) * 2 *
+					 sizeof(uint32_t), 4096);
+		uint32_t handle;
+
+		handle = gem_create(fd, sz);
+		gem_set_caching(fd, handle, I915_CACHING_CACHED);
+		wrk->tl_object.handle = handle;
+		wrk->tl_page = gem_mmap__cpu(fd, handle, 0, sz, PROT_READ);
+	}
+
 	for (i = 0, w = wrk->steps; i < wrk->nr_steps; i++, w++) {
 		if ((int)w->context > max_ctx) {
 			int delta = w->context + 1 - wrk->nr_ctxs;
@@ -879,7 +1226,11 @@ prepare_workload(unsigned int id, struct workload *wrk, unsigned int flags)
 		if (!wrk->ctx_list[w->context].id) {
 			struct drm_i915_gem_context_create arg = {};
 
-			drmIoctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_CREATE, &arg);
+			if (flags & SIMULATE)
+				arg.ctx_id = w->context + 1;
+			else
+				drmIoctl(fd, DRM_IOCTL_I915_GEM_CONTEXT_CREATE,
+					 &arg);
 			igt_assert(arg.ctx_id);
 
 			wrk->ctx_list[w->context].id = arg.ctx_id;
@@ -892,7 +1243,7 @@ prepare_workload(unsigned int id, struct workload *wrk, unsigned int flags)
 				ctx_vcs ^= 1;
 			}
 
-			if (wrk->prio) {
+			if (wrk->prio && !(flags & SIMULATE)) {
 				struct local_i915_gem_context_param param = {
 					.context = arg.ctx_id,
 					.param = 0x6,
@@ -903,6 +1254,13 @@ prepare_workload(unsigned int id, struct workload *wrk, unsigned int flags)
 		}
 	}
 
+	if (flags & SIMULATE) {
+		wrk->sim_ctx_last = calloc(wrk->nr_ctxs * NUM_ENGINES,
+					   sizeof(*wrk->sim_ctx_last));
+		igt_assert(wrk->sim_ctx_last);
+		return;
+	}
+
 	for (i = 0, w = wrk->steps; i < wrk->nr_steps; i++, w++) {
 		unsigned int _flags = flags;
 		enum intel_engine_id engine = w->engine;
@@ -923,11 +1281,6 @@ static double elapsed(const struct timespec *start, const struct timespec *end)
 	       (end->tv_nsec - start->tv_nsec) / 1e9;
 }
 
-static int elapsed_us(const struct timespec *start, const struct timespec *end)
-{
-	return elapsed(start, end) * 1e6;
-}
-
 static enum intel_engine_id get_vcs_engine(unsigned int n)
 {
 	const enum intel_engine_id vcs_engines[2] = { VCS1, VCS2 };
@@ -1351,6 +1704,178 @@ global_balance(const struct workload_balancer *balancer,
 	return engine;
 }
 
+/* Adapts a balancer module to the built-in interface, see gem_wsim_balancer.h */
+static const struct wsim_balancer *module_balancer;
+
+static struct workload *to_workload(struct wsim_client *client)
+{
+	return (struct workload *)client;
+}
+
+static uint32_t
+module_current_seqno(struct wsim_client *client, unsigned int engine)
+{
+	igt_assert(engine < NUM_ENGINES);
+
+	return current_seqno(to_workload(client), engine);
+}
+
+static uint32_t
+module_current_gpu_seqno(struct wsim_client *client, unsigned int engine)
+{
+	igt_assert(engine < NUM_ENGINES);
+
+	return current_gpu_seqno(to_workload(client), engine);
+}
+
+static unsigned int
+module_get_qd_depth(struct wsim_client *client, unsigned int engine)
+{
+	struct workload *wrk = to_workload(client);
+	unsigned int qd;
+
+	igt_assert(engine < NUM_ENGINES);
+
+	qd = get_qd_depth(NULL, wrk, engine);
+	wrk->qd_sum[engine] += qd;
+
+	return qd;
+}
+
+static void
+module_get_rt_depth(struct wsim_client *client, unsigned int engine,
+		    struct wsim_rt_depth *rt)
+{
+	struct rt_depth depth;
+
+	igt_assert(engine < NUM_ENGINES);
+
+	get_rt_depth(to_workload(client), engine, &depth);
+
+	rt->seqno = depth.seqno;
+	rt->submitted = depth.submitted;
+	rt->completed = depth.completed;
+}
+
+static uint64_t
+module_ewma_read(struct wsim_client *client, unsigned int engine)
+{
+	igt_assert(engine < NUM_ENGINES);
+
+	return ewma_rt_read(&to_workload(client)->rt.avg[engine]);
+}
+
+static void
+module_ewma_add(struct wsim_client *client, unsigned int engine,
+		uint64_t value)
+{
+	igt_assert(engine < NUM_ENGINES);
+
+	ewma_rt_add(&to_workload(client)->rt.avg[engine], value);
+}
+
+static uint32_t module_random(struct wsim_client *client)
+{
+	return hars_petruska_f54_1_random(&to_workload(client)->prng);
+}
+
+static unsigned int
+module_static_vcs(struct wsim_client *client, unsigned int context)
+{
+	struct workload *wrk = to_workload(client);
+
+	igt_assert(context < wrk->nr_ctxs);
+
+	return wrk->ctx_list[context].static_vcs;
+}
+
+static void **module_data(struct wsim_client *client)
+{
+	return &to_workload(client)->balancer_data;
+}
+
+static const struct wsim_balancer_ops module_ops = {
+	.current_seqno = module_current_seqno,
+	.current_gpu_seqno = module_current_gpu_seqno,
+	.get_qd_depth = module_get_qd_depth,
+	.get_rt_depth = module_get_rt_depth,
+	.ewma_read = module_ewma_read,
+	.ewma_add = module_ewma_add,
+	.random = module_random,
+	.static_vcs = module_static_vcs,
+	.data = module_data,
+};
+
+static enum intel_engine_id
+module_balance(const struct workload_balancer *balancer,
+	       struct workload *wrk, struct w_step *w)
+{
+	struct wsim_step step = {
+		.client = wrk->id,
+		.idx = w->idx,
+		.context = w->context,
+		.duration_min = w->duration.min,
+		.duration_max = w->duration.max,
+	};
+	unsigned int engine;
+
+	igt_assert(w->engine == VCS);
+
+	engine = module_balancer->balance(&module_ops,
+					  (struct wsim_client *)wrk, &step);
+	igt_assert(engine == VCS1 || engine == VCS2);
+
+	return engine;
+}
+
+static struct workload_balancer loaded_balancer = {
+	.id = ~1,
+	.balance = module_balance,
+};
+
+static const struct workload_balancer *load_balancer(const char *path)
+{
+	const struct wsim_balancer *(*init)(unsigned int abi_version);
+	const struct wsim_balancer *balancer;
+	void *dl;
+
+	dl = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!dl) {
+		if (verbose)
+			fprintf(stderr, "Failed to load balancer: %s!\n",
+				dlerror());
+		return NULL;
+	}
+
+	init = dlsym(dl, "wsim_balancer_init");
+	balancer = init ? init(WSIM_BALANCER_ABI_VERSION) : NULL;
+	if (!balancer ||
+	    balancer->abi_version != WSIM_BALANCER_ABI_VERSION ||
+	    !balancer->balance) {
+		if (verbose)
+			fprintf(stderr,
+				"Balancer module %s is not compatible with ABI version %u!\n",
+				path, WSIM_BALANCER_ABI_VERSION);
+		dlclose(dl);
+		return NULL;
+	}
+
+	module_balancer = balancer;
+
+	loaded_balancer.name = balancer->name ?: path;
+	loaded_balancer.desc = balancer->desc;
+	if (balancer->flags & WSIM_BALANCER_RT)
+		loaded_balancer.flags = SEQNO | RT;
+	else if (balancer->flags & WSIM_BALANCER_SEQNO)
+		loaded_balancer.flags = SEQNO;
+	if (loaded_balancer.flags & SEQNO) {
+		loaded_balancer.min_gen = 8;
+		loaded_balancer.get_qd = get_qd_depth;
+	}
+
+	return &loaded_balancer;
+}
+
 static const struct workload_balancer global_balancer = {
 		.id = ~0,
 		.name = "global",
@@ -1400,48 +1925,551 @@ update_bb_rt(struct w_step *w, enum intel_engine_id engine, uint32_t seqno)
 	}
 }
 
-static void w_sync_to(struct workload *wrk, struct w_step *w, int target)
+static void
+update_bb_chain(struct w_step *w, unsigned long offset)
 {
-	if (target < 0)
-		target = wrk->nr_steps + target;
+	struct drm_i915_gem_relocation_entry *r = &w->reloc[w->chain_reloc];
 
-	igt_assert(target < wrk->nr_steps);
+	gem_set_domain(fd, w->bb_handle,
+		       I915_GEM_DOMAIN_WC, I915_GEM_DOMAIN_WC);
 
-	while (wrk->steps[target].type != BATCH) {
-		if (--target < 0)
-			target = wrk->nr_steps + target;
+	r->delta = offset;
+	*w->chain_address = r->presumed_offset + r->delta;
+
+	/* If not using NO_RELOC, force the relocations */
+	if (!(w->eb.flags & I915_EXEC_NO_RELOC))
+		r->presumed_offset = -1;
+}
+
+static struct tl_record *
+tl_record(struct workload *wrk, struct w_step *w, enum intel_engine_id engine,
+	  uint32_t seqno, uint64_t submit)
+{
+	struct tl_record *rec;
+
+	if (wrk->nr_tl == TL_RECORDS) {
+		wrk->tl_dropped++;
+		return NULL;
 	}
 
-	igt_assert(target < wrk->nr_steps);
-	igt_assert(wrk->steps[target].type == BATCH);
+	rec = &wrk->tl[wrk->nr_tl++];
+	rec->submit = submit;
+	rec->seqno = seqno;
+	rec->step = w->idx;
+	rec->context = w->context;
+	rec->engine = engine;
 
-	gem_sync(fd, wrk->steps[target].obj[0].handle);
+	return rec;
 }
 
-static uint32_t *get_status_cs(struct workload *wrk)
+static void
+update_bb_timeline(struct workload *wrk, struct w_step *w,
+		   enum intel_engine_id engine, uint32_t seqno)
 {
-	return wrk->status_cs;
+	struct drm_i915_gem_relocation_entry *r = &w->reloc[w->chain_reloc + 1];
+	struct tl_record *rec;
+	struct timespec ts;
+	unsigned int slot;
+
+	gem_set_domain(fd, w->bb_handle,
+		       I915_GEM_DOMAIN_WC, I915_GEM_DOMAIN_WC);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	rec = tl_record(wrk, w, engine, seqno,
+			ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec);
+	slot = rec ? rec - wrk->tl : TL_RECORDS;
+	if (rec)
+		rec->ticks = *REG(RCS_TIMESTAMP);
+
+	r[0].delta = slot * 2 * sizeof(uint32_t);
+	r[1].delta = r[0].delta + sizeof(uint32_t);
+
+	*w->tl_address[0] = r[0].presumed_offset + r[0].delta;
+	*w->tl_address[1] = r[1].presumed_offset + r[1].delta;
+
+	/* If not using NO_RELOC, force the relocations */
+	if (!(w->eb.flags & I915_EXEC_NO_RELOC)) {
+		r[0].presumed_offset = -1;
+		r[1].presumed_offset = -1;
+	}
 }
 
-#define INIT_CLOCKS 0x1
-#define INIT_ALL (INIT_CLOCKS)
-static void init_status_page(struct workload *wrk, unsigned int flags)
+static void
+record_latency(struct workload *wrk, struct w_step *w,
+	       enum intel_engine_id engine, uint64_t ns)
 {
-	struct drm_i915_gem_relocation_entry reloc[4] = {};
-	struct drm_i915_gem_exec_object2 *status_object =
-						get_status_objects(wrk);
-	struct drm_i915_gem_execbuffer2 eb = {
-		.buffer_count = ARRAY_SIZE(wrk->status_object),
-		.buffers_ptr = to_user_pointer(status_object)
-	};
-	uint32_t *base = get_status_cs(wrk);
+	hist_add(&wrk->step_lat[w->idx], ns);
+	hist_add(&wrk->engine_lat[engine], ns);
+}
 
-	/* Want to make sure that the balancer has a reasonable view of
-	 * the background busyness of each engine. To do that we occasionally
-	 * send a dummy batch down the pipeline.
-	 */
+static void collect_latency(struct workload *wrk, struct w_step *w)
+{
+	const uint32_t *slot = &wrk->lat_page[w->idx * 2];
+	uint32_t ticks = READ_ONCE(slot[1]) - READ_ONCE(slot[0]);
 
-	if (!base)
+	if (!w->lat_pending)
+		return;
+
+	record_latency(wrk, w, w->lat_engine, ticks * timestamp_ns);
+	w->lat_pending = false;
+}
+
+static void
+update_bb_latency(struct workload *wrk, struct w_step *w,
+		  enum intel_engine_id engine)
+{
+	struct drm_i915_gem_relocation_entry *r = &w->reloc[w->lat_reloc];
+
+	/* Waits for the previous execution of this batch to complete. */
+	gem_set_domain(fd, w->bb_handle,
+		       I915_GEM_DOMAIN_WC, I915_GEM_DOMAIN_WC);
+
+	collect_latency(wrk, w);
+
+	*w->lat_value = *REG(RCS_TIMESTAMP);
+	*w->lat_address[0] = r[0].presumed_offset + r[0].delta;
+	*w->lat_address[1] = r[1].presumed_offset + r[1].delta;
+
+	/* If not using NO_RELOC, force the relocations */
+	if (!(w->eb.flags & I915_EXEC_NO_RELOC)) {
+		r[0].presumed_offset = -1;
+		r[1].presumed_offset = -1;
+	}
+
+	w->lat_pending = true;
+	w->lat_engine = engine;
+}
+
+#define INIT_CLOCKS 0x1
+#define INIT_ALL (INIT_CLOCKS)
+
+/* Sleeping workloads, as a min-heap ordered by wake up time. */
+struct w_timers {
+	struct workload **heap;
+	unsigned int count;
+};
+
+static void timers_add(struct w_timers *timers, struct workload *wrk)
+{
+	unsigned int i = timers->count++;
+
+	while (i) {
+		unsigned int parent = (i - 1) / 2;
+
+		if (timers->heap[parent]->exec.wake <= wrk->exec.wake)
+			break;
+
+		timers->heap[i] = timers->heap[parent];
+		i = parent;
+	}
+
+	timers->heap[i] = wrk;
+}
+
+static struct workload *timers_pop(struct w_timers *timers)
+{
+	struct workload *first = timers->heap[0];
+	struct workload *last = timers->heap[--timers->count];
+	unsigned int i = 0;
+
+	for (;;) {
+		unsigned int child = 2 * i + 1;
+
+		if (child >= timers->count)
+			break;
+		if (child + 1 < timers->count &&
+		    timers->heap[child + 1]->exec.wake <
+		    timers->heap[child]->exec.wake)
+			child++;
+		if (last->exec.wake <= timers->heap[child]->exec.wake)
+			break;
+
+		timers->heap[i] = timers->heap[child];
+		i = child;
+	}
+
+	timers->heap[i] = last;
+
+	return first;
+}
+
+static uint64_t timers_next(struct w_timers *timers)
+{
+	return timers->count ? timers->heap[0]->exec.wake : UINT64_MAX;
+}
+
+/*
+ * Simulation backend.
+ *
+ * Instead of being submitted to the GPU every batch becomes a request in a
+ * virtual time model of the engines. A request waits for its data and fence
+ * dependencies, the implicit object ordering and the previous request from the
+ * same context on the same engine. Once runnable it queues on its engine in
+ * priority order and executes for a duration picked from the workload
+ * descriptor. Completion writes the seqno and timestamps into the status page
+ * just like the real batch would, so the balancers run unchanged.
+ */
+#define SIM_TIMESTAMP_NS (80) /* 12.5MHz RCS_TIMESTAMP */
+#define SIM_HEARTBEAT_NS (1000)
+
+struct sim_rq {
+	struct workload *wrk;
+	struct w_step *w;
+	enum intel_engine_id engine;
+	enum intel_engine_id hw;
+	int prio;
+	uint32_t seqno;
+	uint32_t submit_ts;
+	bool clocks;
+	bool latch;
+
+	uint64_t submit;
+	uint64_t duration;
+	uint64_t end;
+
+	unsigned int nr_deps;
+	struct sim_rq **deps;
+	bool sw_fence;
+	uint32_t sw_fence_point;
+
+	unsigned int ref;
+	bool done;
+	struct workload *waiter;
+	struct igt_list link;
+};
+
+struct sim_engine {
+	struct igt_list queue;
+	struct sim_rq *active;
+
+	uint64_t busy;
+	unsigned long count;
+	uint64_t latency;
+	uint64_t max_latency;
+};
+
+static struct sim_engine sim_engines[NUM_ENGINES];
+static IGT_LIST(sim_blocked);
+static uint64_t sim_time;
+
+static struct workload **sim_runnable;
+static unsigned int sim_nr_runnable;
+static struct w_timers sim_timers;
+
+static struct sim_rq *sim_rq_get(struct sim_rq *rq)
+{
+	rq->ref++;
+
+	return rq;
+}
+
+static void sim_rq_put(struct sim_rq *rq)
+{
+	if (!rq)
+		return;
+
+	igt_assert(rq->ref);
+	if (--rq->ref)
+		return;
+
+	igt_assert(!rq->nr_deps);
+	free(rq);
+}
+
+static void sim_rq_add_dep(struct sim_rq *rq, struct sim_rq *dep)
+{
+	if (!dep || dep->done)
+		return;
+
+	rq->deps = realloc(rq->deps, (rq->nr_deps + 1) * sizeof(*rq->deps));
+	igt_assert(rq->deps);
+	rq->deps[rq->nr_deps++] = sim_rq_get(dep);
+}
+
+static enum intel_engine_id
+sim_hw_engine(struct workload *wrk, enum intel_engine_id engine)
+{
+	if (engine == VCS2 && (wrk->flags & VCS2REMAP))
+		return BCS;
+
+	/*
+	 * Unbalanced VCS batches go where the kernel puts them, which is an
+	 * engine picked once per file, and all clients share a single fd.
+	 */
+	if (engine == VCS)
+		return VCS1;
+
+	return engine;
+}
+
+static uint32_t *sim_status_page(struct workload *wrk)
+{
+	if (wrk->flags & GLOBAL_BALANCE)
+		return wrk->global_wrk->status_page;
+	else
+		return wrk->status_page;
+}
+
+/* The returned reference belongs to the engine until the request completes. */
+static struct sim_rq *
+sim_new_rq(struct workload *wrk, enum intel_engine_id engine, uint32_t seqno,
+	   uint64_t duration)
+{
+	struct sim_rq *rq;
+
+	rq = calloc(1, sizeof(*rq));
+	igt_assert(rq);
+
+	rq->ref = 1;
+	rq->wrk = wrk;
+	rq->engine = engine;
+	rq->hw = sim_hw_engine(wrk, engine);
+	rq->prio = wrk->prio;
+	rq->seqno = seqno;
+	rq->submit = sim_time;
+	rq->submit_ts = sim_time / SIM_TIMESTAMP_NS;
+	rq->duration = duration;
+	igt_list_add_tail(&rq->link, &sim_blocked);
+
+	return rq;
+}
+
+static void
+sim_eb(struct workload *wrk, struct w_step *w, enum intel_engine_id engine)
+{
+	uint32_t seqno = new_seqno(wrk, engine);
+	struct sim_rq *rq, **last;
+	unsigned int i;
+
+	rq = sim_new_rq(wrk, engine, seqno, get_duration(w) * 1000ULL);
+	rq->w = w;
+	rq->clocks = wrk->flags & RT;
+	rq->latch = wrk->flags & RT;
+
+	/* Requests from one context execute in order on each engine. */
+	last = &wrk->sim_ctx_last[w->context * NUM_ENGINES + rq->hw];
+	sim_rq_add_dep(rq, *last);
+	sim_rq_put(*last);
+	*last = sim_rq_get(rq);
+
+	/* Read after write on the objects of our data dependencies... */
+	for (i = 0; i < w->data_deps.nr; i++) {
+		struct w_step *dep;
+
+		if (!w->data_deps.list[i])
+			continue;
+
+		dep = &wrk->steps[w->idx + w->data_deps.list[i]];
+		igt_assert(dep->type == BATCH);
+		sim_rq_add_dep(rq, dep->sim_rq);
+
+		dep->sim_readers = realloc(dep->sim_readers,
+					   (dep->nr_sim_readers + 1) *
+					   sizeof(*dep->sim_readers));
+		igt_assert(dep->sim_readers);
+		dep->sim_readers[dep->nr_sim_readers++] = sim_rq_get(rq);
+	}
+
+	/* ...and write after read or write on the one we write to. */
+	sim_rq_add_dep(rq, w->sim_rq);
+	for (i = 0; i < w->nr_sim_readers; i++) {
+		sim_rq_add_dep(rq, w->sim_readers[i]);
+		sim_rq_put(w->sim_readers[i]);
+	}
+	w->nr_sim_readers = 0;
+	sim_rq_put(w->sim_rq);
+	w->sim_rq = sim_rq_get(rq);
+
+	for (i = 0; i < w->fence_deps.nr; i++) {
+		struct w_step *tgt = &wrk->steps[w->idx + w->fence_deps.list[i]];
+
+		igt_assert(tgt->emit_fence > 0);
+
+		if (tgt->type == SW_FENCE) {
+			rq->sw_fence = true;
+			rq->sw_fence_point = tgt->sim_fence_point;
+		} else {
+			sim_rq_add_dep(rq, tgt->sim_rq);
+		}
+	}
+
+	if (w->emit_fence)
+		w->emit_fence = 1;
+}
+
+static void sim_init_status_page(struct workload *wrk, unsigned int flags)
+{
+	enum intel_engine_id engine;
+
+	if (!(wrk->flags & SEQNO))
+		return;
+
+	for (engine = 0; engine < NUM_ENGINES; engine++) {
+		struct sim_rq *rq;
+
+		rq = sim_new_rq(wrk, engine, new_seqno(wrk, engine),
+				SIM_HEARTBEAT_NS);
+		rq->clocks = flags & INIT_CLOCKS;
+		rq->latch = true;
+	}
+}
+
+static bool sim_rq_ready(struct sim_rq *rq)
+{
+	unsigned int i;
+
+	if (rq->sw_fence &&
+	    (int32_t)(rq->wrk->sim_timeline - rq->sw_fence_point) < 0)
+		return false;
+
+	for (i = 0; i < rq->nr_deps; i++) {
+		if (!rq->deps[i]->done)
+			return false;
+	}
+
+	return true;
+}
+
+static void sim_promote(void)
+{
+	struct sim_rq *rq, *tmp;
+
+	igt_list_for_each_safe(rq, tmp, &sim_blocked, link) {
+		struct sim_engine *engine = &sim_engines[rq->hw];
+		struct sim_rq *pos;
+		unsigned int i;
+
+		if (!sim_rq_ready(rq))
+			continue;
+
+		for (i = 0; i < rq->nr_deps; i++)
+			sim_rq_put(rq->deps[i]);
+		free(rq->deps);
+		rq->deps = NULL;
+		rq->nr_deps = 0;
+
+		/* Priority order, FIFO within the same priority level. */
+		igt_list_del(&rq->link);
+		igt_list_for_each(pos, &engine->queue, link) {
+			if (pos->prio < rq->prio)
+				break;
+		}
+		igt_list_add_tail(&rq->link, &pos->link);
+	}
+}
+
+static void sim_dispatch(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_ENGINES; i++) {
+		struct sim_engine *engine = &sim_engines[i];
+		struct sim_rq *rq;
+
+		if (engine->active || igt_list_empty(&engine->queue))
+			continue;
+
+		rq = igt_list_first_entry(&engine->queue, rq, link);
+		igt_list_del(&rq->link);
+
+		rq->end = sim_time + rq->duration;
+		engine->active = rq;
+	}
+}
+
+static void sim_complete(struct sim_engine *engine)
+{
+	struct sim_rq *rq = engine->active;
+	uint32_t *status = sim_status_page(rq->wrk);
+	const unsigned int idx = SEQNO_IDX(rq->engine);
+
+	if (status) {
+		status[idx] = rq->seqno;
+		if (rq->clocks) {
+			status[idx + 1] = rq->submit_ts;
+			status[idx + 2] = rq->end / SIM_TIMESTAMP_NS;
+		}
+		if (rq->latch)
+			status[idx + 3] = rq->seqno;
+	}
+
+	if (rq->w) {
+		uint64_t latency = rq->end - rq->submit;
+
+		if (rq->wrk->flags & LATENCY)
+			record_latency(rq->wrk, rq->w, rq->engine, latency);
+
+		if (rq->wrk->flags & TIMELINE) {
+			struct tl_record *rec;
+
+			rec = tl_record(rq->wrk, rq->w, rq->engine, rq->seqno,
+					rq->submit);
+			if (rec) {
+				rec->start = rq->end - rq->duration;
+				rec->end = rq->end;
+			}
+		}
+
+		engine->busy += rq->duration;
+		engine->count++;
+		engine->latency += latency;
+		if (latency > engine->max_latency)
+			engine->max_latency = latency;
+	}
+
+	if (rq->waiter)
+		sim_runnable[sim_nr_runnable++] = rq->waiter;
+
+	rq->done = true;
+	engine->active = NULL;
+	sim_rq_put(rq);
+}
+
+static struct w_step *throttle_target(struct workload *wrk, int target)
+{
+	if (target < 0)
+		target = wrk->nr_steps + target;
+
+	igt_assert(target < wrk->nr_steps);
+
+	while (wrk->steps[target].type != BATCH) {
+		if (--target < 0)
+			target = wrk->nr_steps + target;
+	}
+
+	igt_assert(target < wrk->nr_steps);
+	igt_assert(wrk->steps[target].type == BATCH);
+
+	return &wrk->steps[target];
+}
+
+static uint32_t *get_status_cs(struct workload *wrk)
+{
+	return wrk->status_cs;
+}
+
+static void init_status_page(struct workload *wrk, unsigned int flags)
+{
+	struct drm_i915_gem_relocation_entry reloc[4] = {};
+	struct drm_i915_gem_exec_object2 *status_object =
+						get_status_objects(wrk);
+	struct drm_i915_gem_execbuffer2 eb = {
+		.buffer_count = ARRAY_SIZE(wrk->status_object),
+		.buffers_ptr = to_user_pointer(status_object)
+	};
+	uint32_t *base = get_status_cs(wrk);
+
+	if (wrk->flags & SIMULATE) {
+		sim_init_status_page(wrk, flags);
+		return;
+	}
+
+	/* Want to make sure that the balancer has a reasonable view of
+	 * the background busyness of each engine. To do that we occasionally
+	 * send a dummy batch down the pipeline.
+	 */
+
+	if (!base)
 		return;
 
 	gem_set_domain(fd, status_object[1].handle,
@@ -1526,6 +2554,7 @@ do_eb(struct workload *wrk, struct w_step *w, enum intel_engine_id engine,
       unsigned int flags)
 {
 	uint32_t seqno = new_seqno(wrk, engine);
+	unsigned long bb_sz, offset;
 	unsigned int i;
 
 	eb_update_flags(w, engine, flags);
@@ -1534,10 +2563,21 @@ do_eb(struct workload *wrk, struct w_step *w, enum intel_engine_id engine,
 		update_bb_seqno(w, engine, seqno);
 	if (flags & RT)
 		update_bb_rt(w, engine, seqno);
-
-	w->eb.batch_start_offset =
-		ALIGN(w->bb_sz - get_bb_sz(get_duration(w)),
-			2 * sizeof(uint32_t));
+	if (flags & LATENCY)
+		update_bb_latency(wrk, w, engine);
+	if (flags & TIMELINE)
+		update_bb_timeline(wrk, w, engine, seqno);
+
+	bb_sz = w->bb_pool ? w->bb_pool->sz : w->bb_sz;
+	offset = ALIGN(bb_sz - get_bb_sz(get_duration(w)),
+		       2 * sizeof(uint32_t));
+
+	if (w->chain_address) {
+		update_bb_chain(w, offset);
+		w->eb.batch_start_offset = w->chain_start;
+	} else {
+		w->eb.batch_start_offset = offset;
+	}
 
 	for (i = 0; i < w->fence_deps.nr; i++) {
 		int tgt = w->idx + w->fence_deps.list[i];
@@ -1547,226 +2587,681 @@ do_eb(struct workload *wrk, struct w_step *w, enum intel_engine_id engine,
 		igt_assert(tgt >= 0 && tgt < w->idx);
 		igt_assert(wrk->steps[tgt].emit_fence > 0);
 
-		w->eb.flags |= LOCAL_I915_EXEC_FENCE_IN;
-		w->eb.rsvd2 = wrk->steps[tgt].emit_fence;
+		w->eb.flags |= LOCAL_I915_EXEC_FENCE_IN;
+		w->eb.rsvd2 = wrk->steps[tgt].emit_fence;
+	}
+
+	if (w->eb.flags & LOCAL_I915_EXEC_FENCE_OUT)
+		gem_execbuf_wr(fd, &w->eb);
+	else
+		gem_execbuf(fd, &w->eb);
+
+	if (w->eb.flags & LOCAL_I915_EXEC_FENCE_OUT) {
+		int fence = w->eb.rsvd2 >> 32;
+
+		igt_assert(fence > 0);
+
+		if (flags & MULTIPLEX) {
+			if (w->mux_fence > 0)
+				close(w->mux_fence);
+			w->mux_fence = fence;
+
+			if (w->emit_fence) {
+				w->emit_fence = dup(fence);
+				igt_assert(w->emit_fence > 0);
+			}
+		} else {
+			w->emit_fence = fence;
+		}
+	}
+}
+
+static uint64_t w_now(struct workload *wrk)
+{
+	struct timespec ts;
+
+	if (wrk->flags & SIMULATE)
+		return sim_time;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void sw_fence_inc(struct workload *wrk, int inc)
+{
+	if (wrk->flags & SIMULATE)
+		wrk->sim_timeline += inc;
+	else
+		sw_sync_timeline_inc(wrk->sync_timeline, inc);
+}
+
+static void print_workload_stats(struct workload *wrk, uint64_t ns)
+{
+	double t = ns / 1e9;
+
+	if (!wrk->print_stats)
+		return;
+
+	printf("%c%u: %.3fs elapsed (%d cycles, %.3f workloads/s).",
+	       wrk->background ? ' ' : '*', wrk->id,
+	       t, wrk->exec.count, wrk->exec.count / t);
+	if (wrk->balancer)
+		printf(" %lu (%lu + %lu) total VCS batches.",
+		       wrk->nr_bb[VCS], wrk->nr_bb[VCS1], wrk->nr_bb[VCS2]);
+	if (wrk->balancer && wrk->balancer->get_qd)
+		printf(" Average queue depths %.3f, %.3f.",
+		       (double)wrk->qd_sum[VCS1] / wrk->nr_bb[VCS],
+		       (double)wrk->qd_sum[VCS2] / wrk->nr_bb[VCS]);
+	putchar('\n');
+}
+
+/*
+ * Runs the workload until it either finishes, needs to sleep until
+ * wrk->exec.wake, or needs to wait for the last batch submitted from
+ * wrk->exec.sync to complete. The caller performs the wait and calls back
+ * in to continue.
+ */
+static enum w_wait advance_workload(struct workload *wrk)
+{
+	struct w_exec *x = &wrk->exec;
+	struct w_step *w;
+	int i;
+
+	for (;;) {
+		switch (x->state) {
+		case S_INIT:
+			x->start = w_now(wrk);
+			x->throttle = -1;
+			x->qd_throttle = -1;
+
+			hars_petruska_f54_1_random_seed((wrk->flags & SYNCEDCLIENTS) ?
+							0 : wrk->id);
+
+			init_status_page(wrk, INIT_ALL);
+			x->state = S_REPEAT;
+			break;
+
+		case S_REPEAT:
+			if (!wrk->run ||
+			    (!wrk->background && x->count >= wrk->repeat)) {
+				x->dep = 0;
+				x->state = S_DRAIN;
+				break;
+			}
+
+			x->cur_seqno = wrk->sync_seqno;
+			x->repeat_start = w_now(wrk);
+			x->i = 0;
+			x->state = S_STEP;
+			break;
+
+		case S_STEP:
+			if (!wrk->run || x->i >= wrk->nr_steps) {
+				x->state = S_REPEAT_END;
+				break;
+			}
+
+			w = &wrk->steps[x->i];
+
+			if (w->type == BATCH) {
+				x->engine = w->engine;
+				x->state = S_BALANCE;
+				if ((wrk->flags & DEPSYNC) && x->engine == VCS) {
+					x->last_sync = false;
+					x->dep = 0;
+					x->state = S_DEPSYNC;
+				}
+				break;
+			}
+
+			x->i++;
+
+			if (w->type == DELAY) {
+				x->wake = w_now(wrk) + w->delay * 1000ULL;
+				return W_SLEEP;
+			} else if (w->type == PERIOD) {
+				uint64_t now = w_now(wrk);
+				int do_sleep;
+
+				do_sleep = w->period -
+					   (int)((now - x->repeat_start) / 1000);
+
+				if (wrk->nr_periods) {
+					wrk->nr_periods[w->idx]++;
+					if (do_sleep < 0)
+						wrk->missed_periods[w->idx]++;
+				}
+
+				if (do_sleep < 0) {
+					if (verbose > 1)
+						printf("%u: Dropped period @ %u/%u (%dus late)!\n",
+						       wrk->id, x->count, w->idx,
+						       do_sleep);
+					break;
+				}
+
+				x->wake = now + do_sleep * 1000ULL;
+				return W_SLEEP;
+			} else if (w->type == SYNC) {
+				int s_idx = w->idx + w->target;
+
+				igt_assert(s_idx >= 0 && s_idx < w->idx);
+				igt_assert(wrk->steps[s_idx].type == BATCH);
+				x->sync = &wrk->steps[s_idx];
+				return W_SYNC;
+			} else if (w->type == THROTTLE) {
+				x->throttle = w->throttle;
+			} else if (w->type == QD_THROTTLE) {
+				x->qd_throttle = w->throttle;
+			} else if (w->type == SW_FENCE) {
+				igt_assert(w->emit_fence < 0);
+				if (wrk->flags & SIMULATE) {
+					w->sim_fence_point = x->cur_seqno + w->idx;
+					w->emit_fence = 1;
+				} else {
+					w->emit_fence =
+						sw_sync_timeline_create_fence(wrk->sync_timeline,
+									      x->cur_seqno + w->idx);
+					igt_assert(w->emit_fence > 0);
+				}
+			} else if (w->type == SW_FENCE_SIGNAL) {
+				int tgt = w->idx + w->target;
+
+				igt_assert(tgt >= 0 && tgt < w->idx);
+				igt_assert(wrk->steps[tgt].type == SW_FENCE);
+				x->cur_seqno += wrk->steps[tgt].idx;
+				sw_fence_inc(wrk, x->cur_seqno - wrk->sync_seqno);
+			}
+			break;
+
+		case S_DEPSYNC:
+			w = &wrk->steps[x->i];
+
+			while (x->dep < w->data_deps.nr &&
+			       !w->data_deps.list[x->dep])
+				x->dep++;
+
+			if (x->dep < w->data_deps.nr) {
+				int dep_idx = w->idx + w->data_deps.list[x->dep++];
+
+				igt_assert(dep_idx >= 0 && dep_idx < w->idx);
+				igt_assert(wrk->steps[dep_idx].type == BATCH);
+
+				x->last_sync = true;
+				x->sync = &wrk->steps[dep_idx];
+				return W_SYNC;
+			}
+
+			x->state = S_BALANCE;
+			break;
+
+		case S_BALANCE:
+			w = &wrk->steps[x->i];
+
+			if (x->last_sync && (wrk->flags & HEARTBEAT))
+				init_status_page(wrk, 0);
+
+			x->last_sync = false;
+
+			wrk->nr_bb[x->engine]++;
+			if (x->engine == VCS && wrk->balancer) {
+				x->engine = wrk->balancer->balance(wrk->balancer,
+								   wrk, w);
+				wrk->nr_bb[x->engine]++;
+			}
+
+			x->state = S_SUBMIT;
+			if (x->throttle > 0) {
+				x->sync = throttle_target(wrk, x->i - x->throttle);
+				return W_SYNC;
+			}
+			break;
+
+		case S_SUBMIT:
+			w = &wrk->steps[x->i];
+
+			if (wrk->flags & SIMULATE)
+				sim_eb(wrk, w, x->engine);
+			else
+				do_eb(wrk, w, x->engine, wrk->flags);
+
+			if (w->request != -1) {
+				igt_list_del(&w->rq_link);
+				wrk->nrequest[w->request]--;
+			}
+			w->request = x->engine;
+			igt_list_add_tail(&w->rq_link, &wrk->requests[x->engine]);
+			wrk->nrequest[x->engine]++;
+
+			if (!wrk->run) {
+				x->state = S_REPEAT_END;
+				break;
+			}
+
+			x->state = S_QD_THROTTLE;
+			if (w->sync) {
+				x->last_sync = true;
+				x->sync = w;
+				return W_SYNC;
+			}
+			break;
+
+		case S_QD_THROTTLE:
+			if (x->qd_throttle > 0 &&
+			    wrk->nrequest[x->engine] > x->qd_throttle) {
+				w = igt_list_first_entry(&wrk->requests[x->engine],
+							 w, rq_link);
+
+				w->request = -1;
+				igt_list_del(&w->rq_link);
+				wrk->nrequest[x->engine]--;
+
+				x->last_sync = true;
+				x->sync = w;
+				return W_SYNC;
+			}
+
+			x->i++;
+			x->state = S_STEP;
+			break;
+
+		case S_REPEAT_END:
+			if (wrk->sync_timeline || (wrk->flags & SIMULATE)) {
+				sw_fence_inc(wrk, wrk->nr_steps -
+					     (x->cur_seqno - wrk->sync_seqno));
+				wrk->sync_seqno += wrk->nr_steps;
+			}
+
+			/* Cleanup all fences instantiated in this iteration. */
+			for (i = 0, w = wrk->steps;
+			     wrk->run && (i < wrk->nr_steps);
+			     i++, w++) {
+				if (w->emit_fence > 0) {
+					if (!(wrk->flags & SIMULATE))
+						close(w->emit_fence);
+					w->emit_fence = -1;
+				}
+			}
+
+			x->count++;
+			x->state = S_REPEAT;
+			break;
+
+		case S_DRAIN:
+			while (x->dep < NUM_ENGINES && !wrk->nrequest[x->dep])
+				x->dep++;
+
+			if (x->dep < NUM_ENGINES) {
+				struct igt_list *requests = &wrk->requests[x->dep++];
+
+				x->sync = igt_list_last_entry(requests, w, rq_link);
+				return W_SYNC;
+			}
+
+			if ((wrk->flags & LATENCY) && !(wrk->flags & SIMULATE)) {
+				for (i = 0, w = wrk->steps; i < wrk->nr_steps;
+				     i++, w++) {
+					if (!w->lat_pending)
+						continue;
+
+					gem_sync(fd, w->bb_handle);
+					collect_latency(wrk, w);
+				}
+			}
+
+			print_workload_stats(wrk, w_now(wrk) - x->start);
+			x->state = S_DONE;
+			/* Fall through */
+		case S_DONE:
+			return W_DONE;
+		}
+	}
+}
+
+static uint64_t thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void *run_workload(void *data)
+{
+	struct workload *wrk = (struct workload *)data;
+	enum w_wait wait;
+
+	while ((wait = advance_workload(wrk)) != W_DONE) {
+		if (wait == W_SLEEP) {
+			uint64_t now = w_now(wrk);
+
+			if (wrk->exec.wake > now)
+				usleep((wrk->exec.wake - now) / 1000);
+		} else {
+			gem_sync(fd, wrk->exec.sync->obj[0].handle);
+		}
+	}
+
+	wrk->cpu_ns = thread_cpu_ns();
+
+	return NULL;
+}
+
+/*
+ * Multiplexed clients: each worker thread owns a subset of the clients and
+ * advances their state machines from an epoll loop. Batch completion is
+ * tracked with the output fences of every submission and sleeps with a
+ * single timerfd armed for the earliest wake up.
+ */
+struct mux_worker {
+	pthread_t thread;
+	struct workload **clients;
+	unsigned int nr_clients;
+
+	struct workload **all;
+	unsigned int nr_all;
+	struct workload *master;
+
+	uint64_t cpu_ns;
+};
+
+/* Returns true once the workload has finished. */
+static bool
+mux_advance(struct workload *wrk, int epfd, struct w_timers *timers)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = wrk };
+	uint64_t cpu = thread_cpu_ns();
+	bool done = false;
+
+	for (;;) {
+		enum w_wait wait = advance_workload(wrk);
+		int fence;
+
+		if (wait == W_DONE) {
+			done = true;
+			break;
+		}
+
+		if (wait == W_SLEEP) {
+			if (wrk->exec.wake <= w_now(wrk))
+				continue;
+
+			timers_add(timers, wrk);
+			break;
+		}
+
+		fence = wrk->exec.sync->mux_fence;
+		if (fence <= 0 || sync_fence_wait(fence, 0) != -ETIME)
+			continue;
+
+		wrk->mux_wait = fence;
+		igt_assert_eq(epoll_ctl(epfd, EPOLL_CTL_ADD, fence, &ev), 0);
+		break;
 	}
 
-	if (w->eb.flags & LOCAL_I915_EXEC_FENCE_OUT)
-		gem_execbuf_wr(fd, &w->eb);
-	else
-		gem_execbuf(fd, &w->eb);
+	wrk->cpu_ns += thread_cpu_ns() - cpu;
 
-	if (w->eb.flags & LOCAL_I915_EXEC_FENCE_OUT) {
-		w->emit_fence = w->eb.rsvd2 >> 32;
-		igt_assert(w->emit_fence > 0);
-	}
+	return done;
 }
 
-static bool sync_deps(struct workload *wrk, struct w_step *w)
+static void *mux_workloads(void *data)
 {
-	bool synced = false;
+	struct mux_worker *mw = data;
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	struct w_timers timers = { };
+	struct workload **runnable;
+	unsigned int nr_runnable = 0;
+	unsigned int nr_done = 0;
+	int epfd, tfd;
 	unsigned int i;
 
-	for (i = 0; i < w->data_deps.nr; i++) {
-		int dep_idx;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	igt_assert(epfd >= 0);
 
-		igt_assert(w->data_deps.list[i] <= 0);
+	tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	igt_assert(tfd >= 0);
+	igt_assert_eq(epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev), 0);
 
-		if (!w->data_deps.list[i])
+	runnable = calloc(mw->nr_clients, sizeof(*runnable));
+	timers.heap = calloc(mw->nr_clients, sizeof(*timers.heap));
+	igt_assert(runnable && timers.heap);
+
+	for (i = mw->nr_clients; i > 0; i--)
+		runnable[nr_runnable++] = mw->clients[i - 1];
+
+	for (;;) {
+		struct epoll_event events[16];
+		uint64_t now;
+		int n;
+
+		while (nr_runnable) {
+			struct workload *wrk = runnable[--nr_runnable];
+
+			if (!mux_advance(wrk, epfd, &timers))
+				continue;
+
+			nr_done++;
+			if (wrk == mw->master) {
+				for (i = 0; i < mw->nr_all; i++)
+					mw->all[i]->run = false;
+			}
+		}
+
+		if (nr_done == mw->nr_clients)
+			break;
+
+		if (timers.count) {
+			struct itimerspec its = {
+				.it_value.tv_sec = timers_next(&timers) /
+						   NSEC_PER_SEC,
+				.it_value.tv_nsec = timers_next(&timers) %
+						    NSEC_PER_SEC,
+			};
+
+			timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+		}
+
+		n = epoll_wait(epfd, events, ARRAY_SIZE(events), -1);
+		if (n < 0 && errno == EINTR)
 			continue;
+		igt_assert(n >= 0);
+
+		for (i = 0; i < n; i++) {
+			struct workload *wrk = events[i].data.ptr;
 
-		dep_idx = w->idx + w->data_deps.list[i];
+			if (!wrk) {
+				uint64_t expirations;
 
-		igt_assert(dep_idx >= 0 && dep_idx < w->idx);
-		igt_assert(wrk->steps[dep_idx].type == BATCH);
+				igt_ignore_warn(read(tfd, &expirations,
+						     sizeof(expirations)));
+				continue;
+			}
 
-		gem_sync(fd, wrk->steps[dep_idx].obj[0].handle);
+			epoll_ctl(epfd, EPOLL_CTL_DEL, wrk->mux_wait, NULL);
+			wrk->mux_wait = -1;
+			runnable[nr_runnable++] = wrk;
+		}
 
-		synced = true;
+		now = w_now(mw->clients[0]);
+		while (timers_next(&timers) <= now)
+			runnable[nr_runnable++] = timers_pop(&timers);
 	}
 
-	return synced;
+	mw->cpu_ns = thread_cpu_ns();
+
+	free(timers.heap);
+	free(runnable);
+	close(tfd);
+	close(epfd);
+
+	return NULL;
 }
 
-static void *run_workload(void *data)
+static uint64_t
+mux_run(struct workload **w, unsigned int clients, unsigned int workers,
+	int master_workload)
 {
-	struct workload *wrk = (struct workload *)data;
-	struct timespec t_start, t_end;
-	struct w_step *w;
-	bool last_sync = false;
-	int throttle = -1;
-	int qd_throttle = -1;
-	int count;
-	int i;
-
-	clock_gettime(CLOCK_MONOTONIC, &t_start);
+	struct mux_worker *mw;
+	uint64_t cpu_ns = 0;
+	unsigned int i;
 
-	hars_petruska_f54_1_random_seed((wrk->flags & SYNCEDCLIENTS) ?
-					0 : wrk->id);
+	if (workers > clients)
+		workers = clients;
 
-	init_status_page(wrk, INIT_ALL);
-	for (count = 0; wrk->run && (wrk->background || count < wrk->repeat);
-	     count++) {
-		unsigned int cur_seqno = wrk->sync_seqno;
+	mw = calloc(workers, sizeof(*mw));
+	igt_assert(mw);
 
-		clock_gettime(CLOCK_MONOTONIC, &wrk->repeat_start);
+	for (i = 0; i < workers; i++) {
+		mw[i].clients = calloc(clients / workers + 1,
+				       sizeof(*mw[i].clients));
+		igt_assert(mw[i].clients);
+		mw[i].all = w;
+		mw[i].nr_all = clients;
+		if (master_workload >= 0)
+			mw[i].master = w[master_workload];
+	}
 
-		for (i = 0, w = wrk->steps; wrk->run && (i < wrk->nr_steps);
-		     i++, w++) {
-			enum intel_engine_id engine = w->engine;
-			int do_sleep = 0;
+	for (i = 0; i < clients; i++) {
+		struct mux_worker *worker = &mw[i % workers];
 
-			if (w->type == DELAY) {
-				do_sleep = w->delay;
-			} else if (w->type == PERIOD) {
-				struct timespec now;
+		worker->clients[worker->nr_clients++] = w[i];
+	}
 
-				clock_gettime(CLOCK_MONOTONIC, &now);
-				do_sleep = w->period -
-					   elapsed_us(&wrk->repeat_start, &now);
-				if (do_sleep < 0) {
-					if (verbose > 1)
-						printf("%u: Dropped period @ %u/%u (%dus late)!\n",
-						       wrk->id, count, i, do_sleep);
-					continue;
-				}
-			} else if (w->type == SYNC) {
-				unsigned int s_idx = i + w->target;
+	for (i = 0; i < workers; i++) {
+		int ret = pthread_create(&mw[i].thread, NULL,
+					 mux_workloads, &mw[i]);
+		igt_assert_eq(ret, 0);
+	}
 
-				igt_assert(s_idx >= 0 && s_idx < i);
-				igt_assert(wrk->steps[s_idx].type == BATCH);
-				gem_sync(fd, wrk->steps[s_idx].obj[0].handle);
-				continue;
-			} else if (w->type == THROTTLE) {
-				throttle = w->throttle;
-				continue;
-			} else if (w->type == QD_THROTTLE) {
-				qd_throttle = w->throttle;
-				continue;
-			} else if (w->type == SW_FENCE) {
-				igt_assert(w->emit_fence < 0);
-				w->emit_fence =
-					sw_sync_timeline_create_fence(wrk->sync_timeline,
-								      cur_seqno + w->idx);
-				igt_assert(w->emit_fence > 0);
-				continue;
-			} else if (w->type == SW_FENCE_SIGNAL) {
-				int tgt = w->idx + w->target;
-				int inc;
+	for (i = 0; i < workers; i++) {
+		int ret = pthread_join(mw[i].thread, NULL);
 
-				igt_assert(tgt >= 0 && tgt < i);
-				igt_assert(wrk->steps[tgt].type == SW_FENCE);
-				cur_seqno += wrk->steps[tgt].idx;
-				inc = cur_seqno - wrk->sync_seqno;
-				sw_sync_timeline_inc(wrk->sync_timeline, inc);
-				continue;
-			}
+		igt_assert_eq(ret, 0);
+		cpu_ns += mw[i].cpu_ns;
+		free(mw[i].clients);
+	}
 
-			if (do_sleep || w->type == PERIOD) {
-				usleep(do_sleep);
-				continue;
-			}
+	free(mw);
 
-			igt_assert(w->type == BATCH);
+	return cpu_ns;
+}
 
-			if ((wrk->flags & DEPSYNC) && engine == VCS)
-				last_sync = sync_deps(wrk, w);
+/* Returns true once the workload has finished. */
+static bool sim_advance(struct workload *wrk)
+{
+	for (;;) {
+		struct sim_rq *rq;
+
+		switch (advance_workload(wrk)) {
+		case W_DONE:
+			return true;
+		case W_SLEEP:
+			if (wrk->exec.wake <= sim_time)
+				break;
+			timers_add(&sim_timers, wrk);
+			return false;
+		case W_SYNC:
+			rq = wrk->exec.sync->sim_rq;
+			if (!rq || rq->done)
+				break;
+			rq->waiter = wrk;
+			return false;
+		}
+	}
+}
 
-			if (last_sync && (wrk->flags & HEARTBEAT))
-				init_status_page(wrk, 0);
+static void sim_print_stats(double t)
+{
+	unsigned int i;
 
-			last_sync = false;
+	for (i = 0; i < NUM_ENGINES; i++) {
+		struct sim_engine *engine = &sim_engines[i];
 
-			wrk->nr_bb[engine]++;
-			if (engine == VCS && wrk->balancer) {
-				engine = wrk->balancer->balance(wrk->balancer,
-								wrk, w);
-				wrk->nr_bb[engine]++;
-			}
+		if (!engine->count)
+			continue;
 
-			if (throttle > 0)
-				w_sync_to(wrk, w, i - throttle);
+		printf("%s: %lu batches, %.1f%% busy, %.3fms average latency, %.3fms max latency.\n",
+		       ring_str_map[i], engine->count,
+		       t > 0 ? 100.0 * engine->busy / 1e9 / t : 0.0,
+		       engine->latency / 1e6 / engine->count,
+		       engine->max_latency / 1e6);
+	}
+}
 
-			do_eb(wrk, w, engine, wrk->flags);
+/*
+ * Drives all clients through the workloads in virtual time. Returns the
+ * simulated elapsed time in nanoseconds.
+ */
+static uint64_t
+sim_run(struct workload **w, unsigned int clients, int master_workload)
+{
+	unsigned int nr_done = 0;
+	int i;
 
-			if (w->request != -1) {
-				igt_list_del(&w->rq_link);
-				wrk->nrequest[w->request]--;
-			}
-			w->request = engine;
-			igt_list_add_tail(&w->rq_link, &wrk->requests[engine]);
-			wrk->nrequest[engine]++;
+	for (i = 0; i < NUM_ENGINES; i++)
+		igt_list_init(&sim_engines[i].queue);
 
-			if (!wrk->run)
-				break;
+	sim_runnable = calloc(clients, sizeof(*sim_runnable));
+	sim_timers.heap = calloc(clients, sizeof(*sim_timers.heap));
+	igt_assert(sim_runnable && sim_timers.heap);
 
-			if (w->sync) {
-				gem_sync(fd, w->obj[0].handle);
-				last_sync = true;
-			}
+	for (i = clients - 1; i >= 0; i--)
+		sim_runnable[sim_nr_runnable++] = w[i];
 
-			if (qd_throttle > 0) {
-				while (wrk->nrequest[engine] > qd_throttle) {
-					struct w_step *s;
+	for (;;) {
+		uint64_t next = UINT64_MAX;
 
-					s = igt_list_first_entry(&wrk->requests[engine],
-								 s, rq_link);
+		while (sim_nr_runnable) {
+			struct workload *wrk = sim_runnable[--sim_nr_runnable];
 
-					gem_sync(fd, s->obj[0].handle);
-					last_sync = true;
+			if (!sim_advance(wrk))
+				continue;
 
-					s->request = -1;
-					igt_list_del(&s->rq_link);
-					wrk->nrequest[engine]--;
-				}
+			nr_done++;
+			if (master_workload >= 0 && wrk == w[master_workload]) {
+				for (i = 0; i < clients; i++)
+					w[i]->run = false;
 			}
 		}
 
-		if (wrk->sync_timeline) {
-			int inc;
+		if (nr_done == clients)
+			break;
+
+		sim_promote();
+		sim_dispatch();
 
-			inc = wrk->nr_steps - (cur_seqno - wrk->sync_seqno);
-			sw_sync_timeline_inc(wrk->sync_timeline, inc);
-			wrk->sync_seqno += wrk->nr_steps;
-		}
+		for (i = 0; i < NUM_ENGINES; i++) {
+			struct sim_rq *rq = sim_engines[i].active;
 
-		/* Cleanup all fences instantiated in this iteration. */
-		for (i = 0, w = wrk->steps; wrk->run && (i < wrk->nr_steps);
-		     i++, w++) {
-			if (w->emit_fence > 0) {
-				close(w->emit_fence);
-				w->emit_fence = -1;
-			}
+			if (rq && rq->end < next)
+				next = rq->end;
 		}
-	}
 
-	for (i = 0; i < NUM_ENGINES; i++) {
-		if (!wrk->nrequest[i])
-			continue;
+		if (timers_next(&sim_timers) < next)
+			next = timers_next(&sim_timers);
 
-		w = igt_list_last_entry(&wrk->requests[i], w, rq_link);
-		gem_sync(fd, w->obj[0].handle);
-	}
+		igt_assert_f(next != UINT64_MAX,
+			     "Simulated workloads deadlocked!\n");
 
-	clock_gettime(CLOCK_MONOTONIC, &t_end);
+		sim_time = next;
 
-	if (wrk->print_stats) {
-		double t = elapsed(&t_start, &t_end);
+		for (i = 0; i < NUM_ENGINES; i++) {
+			struct sim_rq *rq = sim_engines[i].active;
 
-		printf("%c%u: %.3fs elapsed (%d cycles, %.3f workloads/s).",
-		       wrk->background ? ' ' : '*', wrk->id,
-		       t, count, count / t);
-		if (wrk->balancer)
-			printf(" %lu (%lu + %lu) total VCS batches.",
-			       wrk->nr_bb[VCS], wrk->nr_bb[VCS1], wrk->nr_bb[VCS2]);
-		if (wrk->balancer && wrk->balancer->get_qd)
-			printf(" Average queue depths %.3f, %.3f.",
-			       (double)wrk->qd_sum[VCS1] / wrk->nr_bb[VCS],
-			       (double)wrk->qd_sum[VCS2] / wrk->nr_bb[VCS]);
-		putchar('\n');
+			if (rq && rq->end == sim_time)
+				sim_complete(&sim_engines[i]);
+		}
+
+		while (timers_next(&sim_timers) <= sim_time)
+			sim_runnable[sim_nr_runnable++] = timers_pop(&sim_timers);
 	}
 
-	return NULL;
+	free(sim_runnable);
+	free(sim_timers.heap);
+
+	return sim_time;
 }
 
 static void fini_workload(struct workload *wrk)
@@ -1844,6 +3339,9 @@ static void print_help(void)
 "  -a <desc|path>  Append a workload to all other workloads.\n"
 "  -r <n>          How many times to emit the workload.\n"
 "  -c <n>          Fork N clients emitting the workload simultaneously.\n"
+"  -m <n>          Drive all clients from N worker threads, advancing each\n"
+"                  client from an event loop instead of running it in a\n"
+"                  dedicated thread.\n"
 "  -x              Swap VCS1 and VCS2 engines in every other client.\n"
 "  -b <n>          Load balancing to use.\n"
 "                  Available load balancers are:"
@@ -1858,7 +3356,8 @@ static void print_help(void)
 	}
 	puts(
 "                  Balancers can be specified either as names or as their id\n"
-"                  number as listed above.\n"
+"                  number as listed above, or as a path to a balancer module\n"
+"                  (see gem_wsim_balancer.h), like ./balancer.so.\n"
 "  -2              Remap VCS2 to BCS.\n"
 "  -R              Round-robin initial VCS assignment per client.\n"
 "  -H              Send heartbeat on synchronisation points with seqno based\n"
@@ -1867,7 +3366,25 @@ static void print_help(void)
 "                  clients.\n"
 "  -G              Global load balancing - a single load balancer will be shared\n"
 "                  between all clients and there will be a single seqno domain.\n"
-"  -d              Sync between data dependencies in userspace."
+"  -d              Sync between data dependencies in userspace.\n"
+"  -P, --bb-pool   Share nop batches of similar duration between all steps and\n"
+"                  clients. Seqno based balancers and latency tracking need\n"
+"                  Gen8+ with this option.\n"
+"  -s, --simulate  Do not touch the GPU but run the workloads against a virtual\n"
+"                  time model of the engines, using the batch durations from the\n"
+"                  workload descriptors. No nop calibration is needed.\n"
+"  -o, --results <file>\n"
+"                  Record submit to completion latency of every batch using\n"
+"                  GPU timestamps, and write p50/p90/p99/max percentiles per\n"
+"                  step and per engine, plus missed periods, to the file as\n"
+"                  JSON, or CSV if the file name ends with .csv. Every batch\n"
+"                  waits for its previous execution before being resubmitted.\n"
+"  -T, --timeline <file>\n"
+"                  Record submission, start and end time of every batch, as\n"
+"                  written by the batch itself, and write them to the file in\n"
+"                  the Chrome trace event format (chrome://tracing). Up to\n"
+"                  16384 batches are recorded per client. Implies -P and\n"
+"                  needs Gen8+."
 	);
 }
 
@@ -1938,7 +3455,7 @@ static const struct workload_balancer *find_balancer_by_id(unsigned int id)
 	return NULL;
 }
 
-static void init_clocks(void)
+static void init_clocks(unsigned int flags)
 {
 	struct timespec t_start, t_end;
 	uint32_t rcs_start, rcs_end;
@@ -1946,7 +3463,7 @@ static void init_clocks(void)
 
 	intel_register_access_init(intel_get_pci_device(), false, fd);
 
-	if (verbose <= 1)
+	if (verbose <= 1 && !(flags & (LATENCY | TIMELINE)))
 		return;
 
 	clock_gettime(CLOCK_MONOTONIC, &t_start);
@@ -1963,20 +3480,273 @@ static void init_clocks(void)
 
 	clock_gettime(CLOCK_MONOTONIC, &t_start);
 	rcs_start = *REG(RCS_TIMESTAMP);
-	usleep(100);
+	usleep(flags & (LATENCY | TIMELINE) ? 10000 : 100);
 	rcs_end = *REG(RCS_TIMESTAMP);
 	clock_gettime(CLOCK_MONOTONIC, &t_end);
 
 	t = elapsed(&t_start, &t_end) - overhead;
-	printf("%d cycles in %.1fus, i.e. 1024 cycles takes %1.fus\n",
-	       rcs_end - rcs_start, 1e6*t, 1024e6 * t / (rcs_end - rcs_start));
+	timestamp_ns = 1e9 * t / (rcs_end - rcs_start);
+
+	if (verbose > 1)
+		printf("%d cycles in %.1fus, i.e. 1024 cycles takes %1.fus\n",
+		       rcs_end - rcs_start, 1e6*t,
+		       1024e6 * t / (rcs_end - rcs_start));
+}
+
+static const char *step_type_str(enum w_type type)
+{
+	static const char *str[] = {
+		[BATCH] = "batch",
+		[SYNC] = "sync",
+		[DELAY] = "delay",
+		[PERIOD] = "period",
+		[THROTTLE] = "throttle",
+		[QD_THROTTLE] = "qd_throttle",
+		[SW_FENCE] = "sw_fence",
+		[SW_FENCE_SIGNAL] = "sw_fence_signal",
+	};
+
+	return str[type];
+}
+
+static void
+write_hist(FILE *f, bool csv, const struct hist *h)
+{
+	static const double pct[] = { 50, 90, 99 };
+	unsigned int i;
+
+	if (csv) {
+		fprintf(f, "%" PRIu64, h->count);
+		for (i = 0; i < ARRAY_SIZE(pct); i++)
+			fprintf(f, ",%.3f", hist_percentile(h, pct[i]) / 1e3);
+		fprintf(f, ",%.3f,%.3f", h->max / 1e3,
+			h->count ? h->sum / 1e3 / h->count : 0.0);
+	} else {
+		fprintf(f, "\"count\": %" PRIu64, h->count);
+		for (i = 0; i < ARRAY_SIZE(pct); i++)
+			fprintf(f, ", \"p%.0f_us\": %.3f",
+				pct[i], hist_percentile(h, pct[i]) / 1e3);
+		fprintf(f, ", \"max_us\": %.3f, \"avg_us\": %.3f", h->max / 1e3,
+			h->count ? h->sum / 1e3 / h->count : 0.0);
+	}
+}
+
+/*
+ * Merges the latency histograms and period misses of all clients, per source
+ * workload and per engine, and writes them out as JSON or CSV.
+ */
+static int
+write_results(const char *filename, struct workload **w, unsigned int clients,
+	      struct workload **wrk, unsigned int nr_w_args, double t)
+{
+	const char *ext = strrchr(filename, '.');
+	bool csv = ext && !strcasecmp(ext, ".csv");
+	struct hist *engine_lat;
+	unsigned int i, j, k;
+	FILE *f;
+
+	f = fopen(filename, "w");
+	if (!f)
+		return -errno;
+
+	engine_lat = calloc(NUM_ENGINES, sizeof(*engine_lat));
+	igt_assert(engine_lat);
+
+	if (csv)
+		fprintf(f, "scope,workload,step,type,engine,count,p50_us,p90_us,p99_us,max_us,avg_us,periods,missed_periods\n");
+	else
+		fprintf(f, "{\n  \"elapsed\": %.6f,\n  \"clients\": %u,\n  \"workloads\": [",
+			t, clients);
+
+	for (i = 0; i < nr_w_args; i++) {
+		struct workload *src = wrk[i];
+		struct hist *step_lat;
+
+		step_lat = calloc(src->nr_steps, sizeof(*step_lat));
+		igt_assert(step_lat);
+
+		if (!csv)
+			fprintf(f, "%s\n    { \"id\": %u, \"steps\": [",
+				i ? "," : "", i);
+
+		for (j = 0; j < src->nr_steps; j++) {
+			struct w_step *step = &src->steps[j];
+			unsigned long periods = 0, missed = 0;
+
+			for (k = 0; k < clients; k++) {
+				if ((nr_w_args > 1 ? k : 0) != i)
+					continue;
+
+				hist_merge(&step_lat[j], &w[k]->step_lat[j]);
+				periods += w[k]->nr_periods[j];
+				missed += w[k]->missed_periods[j];
+			}
+
+			if (csv) {
+				fprintf(f, "step,%u,%u,%s,%s,", i, j,
+					step_type_str(step->type),
+					step->type == BATCH ?
+					ring_str_map[step->engine] : "");
+				write_hist(f, true, &step_lat[j]);
+				fprintf(f, ",%lu,%lu\n", periods, missed);
+			} else {
+				fprintf(f, "%s\n      { \"step\": %u, \"type\": \"%s\"",
+					j ? "," : "", j,
+					step_type_str(step->type));
+				if (step->type == BATCH) {
+					fprintf(f, ", \"engine\": \"%s\", ",
+						ring_str_map[step->engine]);
+					write_hist(f, false, &step_lat[j]);
+				} else if (step->type == PERIOD) {
+					fprintf(f, ", \"periods\": %lu, \"missed\": %lu",
+						periods, missed);
+				}
+				fprintf(f, " }");
+			}
+		}
+
+		if (!csv)
+			fprintf(f, "\n    ] }");
+
+		free(step_lat);
+	}
+
+	for (i = 0; i < clients; i++) {
+		for (j = 0; j < NUM_ENGINES; j++)
+			hist_merge(&engine_lat[j], &w[i]->engine_lat[j]);
+	}
+
+	if (!csv)
+		fprintf(f, "\n  ],\n  \"engines\": [");
+
+	for (i = 0, k = 0; i < NUM_ENGINES; i++) {
+		if (!engine_lat[i].count)
+			continue;
+
+		if (csv) {
+			fprintf(f, "engine,,,,%s,", ring_str_map[i]);
+			write_hist(f, true, &engine_lat[i]);
+			fprintf(f, ",,\n");
+		} else {
+			fprintf(f, "%s\n    { \"engine\": \"%s\", ",
+				k++ ? "," : "", ring_str_map[i]);
+			write_hist(f, false, &engine_lat[i]);
+			fprintf(f, " }");
+		}
+	}
+
+	if (!csv)
+		fprintf(f, "\n  ]\n}\n");
+
+	free(engine_lat);
+
+	return fclose(f) ? -errno : 0;
+}
+
+/*
+ * Converts the GPU timestamps of every recorded batch to CPU time, relative
+ * to their submission, and writes all clients out in the Chrome trace event
+ * format. Engines show up as processes with one track per client, and each
+ * batch is linked to its submission on the CPU track with a flow event.
+ */
+static int
+write_timeline(const char *filename, struct workload **w, unsigned int clients)
+{
+	uint64_t t0 = ~0ULL;
+	unsigned long dropped = 0;
+	unsigned int i, j, n = 0;
+	FILE *f;
+
+	for (i = 0; i < clients; i++) {
+		struct workload *wrk = w[i];
+
+		if (!(wrk->flags & SIMULATE) && wrk->nr_tl)
+			gem_sync(fd, wrk->tl_object.handle);
+
+		for (j = 0; j < wrk->nr_tl; j++) {
+			struct tl_record *rec = &wrk->tl[j];
+
+			if (!(wrk->flags & SIMULATE)) {
+				const uint32_t *slot = &wrk->tl_page[j * 2];
+
+				rec->start = rec->submit +
+					     (uint32_t)(slot[0] - rec->ticks) *
+					     timestamp_ns;
+				rec->end = rec->submit +
+					   (uint32_t)(slot[1] - rec->ticks) *
+					   timestamp_ns;
+			}
+
+			if (rec->submit < t0)
+				t0 = rec->submit;
+		}
+
+		dropped += wrk->tl_dropped;
+	}
+
+	if (dropped && verbose)
+		fprintf(stderr,
+			"Timeline full, %lu batches were not recorded!\n",
+			dropped);
+
+	f = fopen(filename, "w");
+	if (!f)
+		return -errno;
+
+	fprintf(f, "{\n  \"displayTimeUnit\": \"ns\",\n  \"traceEvents\": [");
+
+	for (i = 0; i <= NUM_ENGINES; i++)
+		fprintf(f, "%s\n    { \"name\": \"process_name\", \"ph\": \"M\", \"pid\": %u, \"args\": { \"name\": \"%s\" } }",
+			i ? "," : "", i,
+			i < NUM_ENGINES ? ring_str_map[i] : "submit");
+
+	for (i = 0; i < clients; i++) {
+		struct workload *wrk = w[i];
+
+		for (j = 0; j < wrk->nr_tl; j++) {
+			struct tl_record *rec = &wrk->tl[j];
+			double submit = (rec->submit - t0) / 1e3;
+			double start = (rec->start - t0) / 1e3;
+			double end = (rec->end - t0) / 1e3;
+
+			fprintf(f, ",\n    { \"name\": \"%u.%u\", \"cat\": \"submit\", \"ph\": \"i\", \"s\": \"t\", \"pid\": %u, \"tid\": %u, \"ts\": %.3f }",
+				wrk->id, rec->step, NUM_ENGINES, wrk->id,
+				submit);
+			fprintf(f, ",\n    { \"name\": \"%u.%u\", \"cat\": \"batch\", \"ph\": \"s\", \"id\": %u, \"pid\": %u, \"tid\": %u, \"ts\": %.3f }",
+				wrk->id, rec->step, n, NUM_ENGINES, wrk->id,
+				submit);
+			fprintf(f, ",\n    { \"name\": \"%u.%u\", \"cat\": \"batch\", \"ph\": \"X\", \"pid\": %u, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"args\": { \"client\": %u, \"context\": %u, \"step\": %u, \"request\": %u, \"seqno\": %u, \"queued_us\": %.3f } }",
+				wrk->id, rec->step, rec->engine, wrk->id,
+				start, end - start, wrk->id, rec->context,
+				rec->step, j, rec->seqno, start - submit);
+			fprintf(f, ",\n    { \"name\": \"%u.%u\", \"cat\": \"batch\", \"ph\": \"f\", \"bp\": \"e\", \"id\": %u, \"pid\": %u, \"tid\": %u, \"ts\": %.3f }",
+				wrk->id, rec->step, n, rec->engine, wrk->id,
+				start);
+			n++;
+		}
+	}
+
+	fprintf(f, "\n  ]\n}\n");
+
+	return fclose(f) ? -errno : 0;
 }
 
 int main(int argc, char **argv)
 {
+	static const struct option long_options[] = {
+		{ "simulate", no_argument, NULL, 's' },
+		{ "results", required_argument, NULL, 'o' },
+		{ "bb-pool", no_argument, NULL, 'P' },
+		{ "timeline", required_argument, NULL, 'T' },
+		{ NULL, 0, NULL, 0 }
+	};
 	unsigned int repeat = 1;
 	unsigned int clients = 1;
+	unsigned int workers = 0;
 	unsigned int flags = 0;
+	char *results = NULL;
+	char *timeline = NULL;
+	uint64_t cpu_ns = 0;
 	struct timespec t_start, t_end;
 	struct workload **w, **wrk = NULL;
 	struct workload *app_w = NULL;
@@ -1991,18 +3761,8 @@ int main(int argc, char **argv)
 	double t;
 	int i, c;
 
-	/*
-	 * Open the device via the low-level API so we can do the GPU quiesce
-	 * manually as close as possible in time to the start of the workload.
-	 * This minimizes the gap in engine utilization tracking when observed
-	 * via external tools like trace.pl.
-	 */
-	fd = __drm_open_driver(DRIVER_INTEL);
-	igt_require(fd);
-
-	init_clocks();
-
-	while ((c = getopt(argc, argv, "hqv2RSHxGdc:n:r:w:W:a:t:b:p:")) != -1) {
+	while ((c = getopt_long(argc, argv, "hqv2RSHxGdsPc:n:r:w:W:a:t:b:p:m:o:T:",
+				long_options, NULL)) != -1) {
 		switch (c) {
 		case 'W':
 			if (master_workload >= 0) {
@@ -2031,6 +3791,11 @@ int main(int argc, char **argv)
 		case 'c':
 			clients = strtol(optarg, NULL, 0);
 			break;
+		case 'm':
+			workers = strtol(optarg, NULL, 0);
+			if (workers)
+				flags |= MULTIPLEX;
+			break;
 		case 't':
 			tolerance_pct = strtol(optarg, NULL, 0);
 			break;
@@ -2067,6 +3832,20 @@ int main(int argc, char **argv)
 		case 'd':
 			flags |= DEPSYNC;
 			break;
+		case 's':
+			flags |= SIMULATE;
+			break;
+		case 'P':
+			flags |= BBPOOL;
+			break;
+		case 'T':
+			timeline = optarg;
+			flags |= TIMELINE;
+			break;
+		case 'o':
+			results = optarg;
+			flags |= LATENCY;
+			break;
 		case 'b':
 			i = find_balancer_by_name(optarg);
 			if (i < 0) {
@@ -2075,13 +3854,13 @@ int main(int argc, char **argv)
 					i = -1;
 			}
 
-			if (i >= 0) {
+			if (i >= 0)
 				balancer = find_balancer_by_id(i);
-				if (balancer) {
-					igt_assert(intel_gen(intel_get_drm_devid(fd)) >= balancer->min_gen);
-					flags |= BALANCE | balancer->flags;
-				}
-			}
+			else if (strchr(optarg, '/'))
+				balancer = load_balancer(optarg);
+
+			if (balancer)
+				flags |= BALANCE | balancer->flags;
 
 			if (!balancer) {
 				if (verbose)
@@ -2105,7 +3884,47 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	if (!nop_calibration) {
+	if ((flags & MULTIPLEX) && (flags & SIMULATE)) {
+		if (verbose)
+			fprintf(stderr,
+				"Multiplexing clients is not supported in simulation!\n");
+		return 1;
+	}
+
+	if (!(flags & SIMULATE)) {
+		/*
+		 * Open the device via the low-level API so we can do the GPU
+		 * quiesce manually as close as possible in time to the start
+		 * of the workload. This minimizes the gap in engine utilization
+		 * tracking when observed via external tools like trace.pl.
+		 */
+		fd = __drm_open_driver(DRIVER_INTEL);
+		igt_require(fd);
+
+		init_clocks(flags);
+
+		if (balancer)
+			igt_assert(intel_gen(intel_get_drm_devid(fd)) >=
+				   balancer->min_gen);
+
+		if ((flags & BBPOOL) && (flags & (SEQNO | LATENCY)) &&
+		    intel_gen(intel_get_drm_devid(fd)) < 8) {
+			if (verbose)
+				fprintf(stderr,
+					"Pooled batches need Gen8+ with seqno based balancers or latency tracking!\n");
+			return 1;
+		}
+
+		if ((flags & TIMELINE) &&
+		    intel_gen(intel_get_drm_devid(fd)) < 8) {
+			if (verbose)
+				fprintf(stderr,
+					"Timeline recording needs Gen8+!\n");
+			return 1;
+		}
+	}
+
+	if (!nop_calibration && !(flags & SIMULATE)) {
 		if (verbose > 1)
 			printf("Calibrating nop delay with %u%% tolerance...\n",
 				tolerance_pct);
@@ -2185,9 +4004,15 @@ int main(int argc, char **argv)
 		clients = nr_w_args;
 
 	if (verbose > 1) {
-		printf("Using %lu nop calibration for %uus delay.\n",
-		       nop_calibration, nop_calibration_us);
+		if (flags & SIMULATE)
+			printf("Simulating engines in virtual time.\n");
+		else
+			printf("Using %lu nop calibration for %uus delay.\n",
+			       nop_calibration, nop_calibration_us);
 		printf("%u client%s.\n", clients, clients > 1 ? "s" : "");
+		if (flags & MULTIPLEX)
+			printf("Multiplexing clients over %u worker thread%s.\n",
+			       workers, workers > 1 ? "s" : "");
 		if (flags & SWAPVCS)
 			printf("Swapping VCS rings between clients.\n");
 		if (flags & GLOBAL_BALANCE)
@@ -2206,7 +4031,7 @@ int main(int argc, char **argv)
 	for (i = 0; i < clients; i++) {
 		unsigned int flags_ = flags;
 
-		w[i] = clone_workload(wrk[nr_w_args > 1 ? i : 0]);
+		w[i] = clone_workload(wrk[nr_w_args > 1 ? i : 0], flags);
 
 		if (flags & SWAPVCS && i & 1)
 			flags_ &= ~SWAPVCS;
@@ -2228,10 +4053,32 @@ int main(int argc, char **argv)
 		prepare_workload(i, w[i], flags_);
 	}
 
+	if (flags & SIMULATE) {
+		clock_gettime(CLOCK_MONOTONIC, &t_start);
+		t = sim_run(w, clients, master_workload) / 1e9;
+		clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+		if (verbose) {
+			printf("%.3fs simulated (%.3f workloads/s)\n",
+			       t, clients * repeat / t);
+			sim_print_stats(t);
+		}
+		if (verbose > 1)
+			printf("Simulation took %.3fs.\n",
+			       elapsed(&t_start, &t_end));
+
+		goto out;
+	}
+
 	gem_quiescent_gpu(fd);
 
 	clock_gettime(CLOCK_MONOTONIC, &t_start);
 
+	if (flags & MULTIPLEX) {
+		cpu_ns = mux_run(w, clients, workers, master_workload);
+		goto done;
+	}
+
 	for (i = 0; i < clients; i++) {
 		int ret;
 
@@ -2255,12 +4102,44 @@ int main(int argc, char **argv)
 		}
 	}
 
+	for (i = 0; i < clients; i++)
+		cpu_ns += w[i]->cpu_ns;
+
+done:
 	clock_gettime(CLOCK_MONOTONIC, &t_end);
 
 	t = elapsed(&t_start, &t_end);
-	if (verbose)
+	if (verbose) {
+		unsigned long cycles = 0;
+
+		for (i = 0; i < clients; i++)
+			cycles += w[i]->exec.count;
+
 		printf("%.3fs elapsed (%.3f workloads/s)\n",
 		       t, clients * repeat / t);
+		printf("%.3fms submission CPU time per client (%.1fus per workload).\n",
+		       cpu_ns / 1e6 / clients,
+		       cycles ? cpu_ns / 1e3 / cycles : 0.0);
+	}
+
+out:
+	if (results) {
+		if (write_results(results, w, clients, wrk, nr_w_args, t)) {
+			if (verbose)
+				fprintf(stderr, "Failed to write results to %s!\n",
+					results);
+			return 1;
+		}
+	}
+
+	if (timeline) {
+		if (write_timeline(timeline, w, clients)) {
+			if (verbose)
+				fprintf(stderr, "Failed to write timeline to %s!\n",
+					timeline);
+			return 1;
+		}
+	}
 
 	for (i = 0; i < clients; i++)
 		fini_workload(w[i]);
@@ -0,0 +1,147 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#ifndef GEM_WSIM_BALANCER_H
+#define GEM_WSIM_BALANCER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Load balancer module interface
+ *
+ * gem_wsim can load a balancer from a shared object with "-b path.so". The
+ * object has to export wsim_balancer_init(), which is passed the ABI version
+ * gem_wsim was built with and returns the balancer description, or NULL if
+ * the versions are incompatible.
+ *
+ * The balance() hook is called for every VCS batch and returns the engine to
+ * submit it to, WSIM_VCS1 or WSIM_VCS2. Everything it may want to know about
+ * the client is available through the ops table, so modules only depend on
+ * this header and never on gem_wsim internals. With -G a single client state
+ * is shared by all clients and calls are serialised.
+ *
+ * A minimal shortest queue balancer:
+ *
+ *	static unsigned int
+ *	sq_balance(const struct wsim_balancer_ops *ops,
+ *		   struct wsim_client *client, const struct wsim_step *step)
+ *	{
+ *		return ops->get_qd_depth(client, WSIM_VCS1) <=
+ *		       ops->get_qd_depth(client, WSIM_VCS2) ?
+ *		       WSIM_VCS1 : WSIM_VCS2;
+ *	}
+ *
+ *	static const struct wsim_balancer sq = {
+ *		.abi_version = WSIM_BALANCER_ABI_VERSION,
+ *		.name = "sq",
+ *		.desc = "Shortest queue.",
+ *		.flags = WSIM_BALANCER_SEQNO,
+ *		.balance = sq_balance,
+ *	};
+ *
+ *	const struct wsim_balancer *wsim_balancer_init(unsigned int abi_version)
+ *	{
+ *		return abi_version == WSIM_BALANCER_ABI_VERSION ? &sq : NULL;
+ *	}
+ */
+
+#define WSIM_BALANCER_ABI_VERSION (1)
+
+/* Same numbering as the engines in workload descriptors. */
+enum wsim_engine {
+	WSIM_RCS,
+	WSIM_BCS,
+	WSIM_VCS,
+	WSIM_VCS1,
+	WSIM_VCS2,
+	WSIM_VECS,
+	WSIM_NUM_ENGINES
+};
+
+/* Submit and complete seqnos of each batch, needed by get_qd_depth(). */
+#define WSIM_BALANCER_SEQNO	(1 << 0)
+/* Batch timestamps, needed by get_rt_depth(). Implies WSIM_BALANCER_SEQNO. */
+#define WSIM_BALANCER_RT	(1 << 1)
+
+/* Opaque per client (or global with -G) balancing state. */
+struct wsim_client;
+
+struct wsim_step {
+	unsigned int client;
+	unsigned int idx;
+	unsigned int context;
+	unsigned int duration_min; /* us */
+	unsigned int duration_max; /* us */
+};
+
+/* Last completed batch on an engine, with RCS_TIMESTAMP ticks. */
+struct wsim_rt_depth {
+	uint32_t seqno;
+	uint32_t submitted;
+	uint32_t completed;
+};
+
+struct wsim_balancer_ops {
+	/* Last seqno submitted to the engine. */
+	uint32_t (*current_seqno)(struct wsim_client *client,
+				  unsigned int engine);
+	/* Last seqno completed by the engine. */
+	uint32_t (*current_gpu_seqno)(struct wsim_client *client,
+				      unsigned int engine);
+	/* Batches in flight on the engine, accounted in the statistics. */
+	unsigned int (*get_qd_depth)(struct wsim_client *client,
+				     unsigned int engine);
+	void (*get_rt_depth)(struct wsim_client *client, unsigned int engine,
+			     struct wsim_rt_depth *rt);
+
+	/* Per engine EWMA, as used by the built-in qdavg and rtavg. */
+	uint64_t (*ewma_read)(struct wsim_client *client, unsigned int engine);
+	void (*ewma_add)(struct wsim_client *client, unsigned int engine,
+			 uint64_t value);
+
+	/* Per client PRNG, reproducible with the same seed. */
+	uint32_t (*random)(struct wsim_client *client);
+	/* VCS assigned to the context at creation, 0 or 1. */
+	unsigned int (*static_vcs)(struct wsim_client *client,
+				   unsigned int context);
+
+	/* Pointer to free for use by the module, initially NULL. */
+	void **(*data)(struct wsim_client *client);
+};
+
+struct wsim_balancer {
+	unsigned int abi_version;
+	const char *name;
+	const char *desc;
+	unsigned int flags;
+
+	unsigned int (*balance)(const struct wsim_balancer_ops *ops,
+				struct wsim_client *client,
+				const struct wsim_step *step);
+};
+
+const struct wsim_balancer *wsim_balancer_init(unsigned int abi_version);
+
+#endif /* GEM_WSIM_BALANCER_H */
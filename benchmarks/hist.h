@@ -0,0 +1,107 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <ilog2.h>
+
+/*
+ * Log-linear histogram
+ *
+ * Values below HIST_SUB are counted exactly, above that every power of two
+ * is split into HIST_SUB linear sub-buckets, which bounds the relative error
+ * of any reported percentile to 1/HIST_SUB while keeping the histogram a
+ * small fixed size. Values up to 2^HIST_MAX_BITS are tracked, larger ones
+ * land in the last bucket.
+ */
+
+#define HIST_SUB_BITS	(4)
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS	(40)
+#define HIST_BUCKETS	((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint32_t bucket[HIST_BUCKETS];
+};
+
+static inline unsigned int hist_index(uint64_t v)
+{
+	unsigned int shift, idx;
+
+	if (v < HIST_SUB)
+		return v;
+
+	shift = fls64(v) - 1 - HIST_SUB_BITS;
+	idx = (shift + 1) * HIST_SUB + ((v >> shift) & (HIST_SUB - 1));
+
+	return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+}
+
+/* Lowest value counted in the bucket. */
+static inline uint64_t hist_value(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < HIST_SUB)
+		return idx;
+
+	shift = idx / HIST_SUB - 1;
+
+	return (uint64_t)(HIST_SUB + idx % HIST_SUB) << shift;
+}
+
+static inline void hist_add(struct hist *h, uint64_t v)
+{
+	h->bucket[hist_index(v)]++;
+	h->count++;
+	h->sum += v;
+	if (v > h->max)
+		h->max = v;
+}
+
+static inline void hist_merge(struct hist *dst, const struct hist *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->bucket[i] += src->bucket[i];
+
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/*
+ * Returns the middle of the bucket holding the requested percentile, clamped
+ * to the maximum recorded value.
+ */
+static inline uint64_t hist_percentile(const struct hist *h, double pct)
+{
+	uint64_t target = h->count * pct / 100.0;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		uint64_t v;
+
+		seen += h->bucket[i];
+		if (seen <= target)
+			continue;
+
+		v = (hist_value(i) + hist_value(i + 1)) / 2;
+
+		return v < h->max ? v : h->max;
+	}
+
+	return h->max;
+}
+
+#endif /* HIST_H */
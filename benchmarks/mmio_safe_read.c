@@ -0,0 +1,202 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Compares safe mode intel_register_read() against checking each access with
+ * intel_get_register_range(), as it used to, reading every readable register
+ * of an MMIO snapshot taken with "intel_reg snapshot".
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pciaccess.h>
+
+#include "intel_io.h"
+#include "intel_chipset.h"
+
+static uint32_t *offsets;
+static unsigned int num_offsets;
+
+static double
+elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+/* Check the bitmaps agree with the range lists, and collect readable offsets */
+static bool check_map(struct intel_register_map map)
+{
+	uint32_t *readable = intel_get_register_bitmap(map, INTEL_RANGE_READ);
+	uint32_t *writable = intel_get_register_bitmap(map, INTEL_RANGE_WRITE);
+	bool valid = true;
+	uint32_t offset;
+
+	offsets = malloc(map.top / 4 * sizeof(*offsets));
+	if (!readable || !writable || !offsets)
+		return false;
+
+	for (offset = 0; offset < map.top; offset += 4) {
+		uint32_t bit = 1u << (offset / 4 % 32);
+		bool r = readable[offset / 4 / 32] & bit;
+		bool w = writable[offset / 4 / 32] & bit;
+
+		if (r != !!intel_get_register_range(map, offset,
+						    INTEL_RANGE_READ) ||
+		    w != !!intel_get_register_range(map, offset,
+						    INTEL_RANGE_WRITE))
+			valid = false;
+
+		if (r)
+			offsets[num_offsets++] = offset;
+	}
+
+	free(readable);
+	free(writable);
+
+	return valid;
+}
+
+static double run_ranges(struct intel_register_map map, unsigned int reps,
+			 uint32_t *sum)
+{
+	struct timespec start, end;
+
+	*sum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned int r = 0; r < reps; r++) {
+		for (unsigned int i = 0; i < num_offsets; i++) {
+			if (intel_get_register_range(map, offsets[i],
+						     INTEL_RANGE_READ))
+				*sum += INREG(offsets[i]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return elapsed(&start, &end);
+}
+
+static double run_read(unsigned int reps, uint32_t *sum)
+{
+	struct timespec start, end;
+
+	*sum = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned int r = 0; r < reps; r++) {
+		for (unsigned int i = 0; i < num_offsets; i++)
+			*sum += intel_register_read(offsets[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return elapsed(&start, &end);
+}
+
+static void report(const char *name, double t, unsigned int reps)
+{
+	printf("%-8s %8.3fs  %8.1f Mreads/s\n",
+	       name, t, reps * (double)num_offsets / t / 1e6);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+"Usage: %s [-r REPS] -d DEVID MMIO_FILE\n"
+"\n"
+"Times reading every register allowed by the safe register access tables from\n"
+"an MMIO snapshot, with safe mode intel_register_read() and with a lookup in\n"
+"the range list per access, checking both allow the same registers.\n"
+"\n"
+"  -d DEVID  PCI device id the snapshot was taken on, e.g. 0x0412\n"
+"  -r REPS   read every register REPS times (default 100)\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct pci_device pci_dev = {};
+	struct intel_register_map map;
+	unsigned int reps = 100;
+	uint32_t sum_ranges, sum_read;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:r:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			pci_dev.device_id = strtoul(optarg, NULL, 16);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			if (!reps)
+				reps = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1 || !pci_dev.device_id) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (intel_gen(pci_dev.device_id) < 4) {
+		fprintf(stderr, "No safe register access tables before gen4\n");
+		return 1;
+	}
+
+	/* There's no device to keep awake */
+	setenv("IGT_NO_FORCEWAKE", "1", 1);
+
+	intel_mmio_use_dump_file(argv[optind]);
+	intel_register_access_init(&pci_dev, 1, -1);
+
+	map = intel_get_register_map(pci_dev.device_id);
+	if (!check_map(map)) {
+		fprintf(stderr, "Register bitmaps differ from the ranges!\n");
+		return 1;
+	}
+
+	printf("%u readable registers\n", num_offsets);
+
+	report("ranges", run_ranges(map, reps, &sum_ranges), reps);
+	report("read", run_read(reps, &sum_read), reps);
+
+	intel_register_access_fini();
+
+	if (sum_ranges != sum_read) {
+		fprintf(stderr, "Read different values!\n");
+		return 1;
+	}
+
+	return 0;
+}
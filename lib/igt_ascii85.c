@@ -0,0 +1,405 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "igt_ascii85.h"
+#include "igt_x86.h"
+
+/**
+ * SECTION:igt_ascii85
+ * @short_description: ASCII85 decoding of i915 error state buffers
+ * @title: ASCII85
+ * @include: igt_ascii85.h
+ *
+ * The kernel prints the buffers it captures in the GPU error state as one
+ * line of ASCII85 per buffer. Each dword is encoded as five characters from
+ * '!' to 'u', most significant digit first, or as a single 'z' when it is
+ * zero. There are no partial groups.
+ *
+ * Decoding is split in two so that callers can allocate the output exactly:
+ * igt_ascii85_scan() measures the encoded line and igt_ascii85_decode()
+ * converts it.
+ */
+
+typedef size_t (*decode_fn)(const char *in, size_t len, uint32_t *out);
+
+#define A85_BIAS (33u * (85u*85u*85u*85u + 85u*85u*85u + 85u*85u + 85u + 1u))
+
+static inline uint32_t decode_group(const unsigned char *in)
+{
+	uint32_t v;
+
+	v = in[0];
+	v = v * 85 + in[1];
+	v = v * 85 + in[2];
+	v = v * 85 + in[3];
+	v = v * 85 + in[4];
+
+	return v - A85_BIAS;
+}
+
+static size_t decode_scalar(const char *in, size_t len, uint32_t *out)
+{
+	const unsigned char *s = (const unsigned char *)in;
+	uint32_t *o = out;
+
+	while (len) {
+		if (*s == 'z') {
+			*o++ = 0;
+			s++, len--;
+		} else if (len >= 5) {
+			*o++ = decode_group(s);
+			s += 5, len -= 5;
+		} else {
+			break;
+		}
+	}
+
+	return o - out;
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+static inline __m128i valid_sse2(__m128i v)
+{
+	const __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('!'));
+
+	return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8('z' - '!')), d);
+}
+
+static inline size_t sum_bytes_sse2(__m128i v)
+{
+	v = _mm_sad_epu8(v, _mm_setzero_si128());
+
+	return _mm_cvtsi128_si32(v) + _mm_extract_epi16(v, 4);
+}
+
+/*
+ * SSE2 is part of x86-64, so the scan is always vectorised. The unrolled loop
+ * reads 64 bytes before checking any of them, so the string is first walked
+ * to a 64 byte boundary: an aligned block then lies within one page, as does
+ * the terminator, and reading past the terminator cannot fault. The 'z' are
+ * counted per byte lane, and summed before a lane can overflow.
+ */
+static size_t scan(const char *in, size_t *zeroes)
+{
+	const unsigned char *s = (const unsigned char *)in;
+	const __m128i z = _mm_set1_epi8('z');
+	__m128i count = _mm_setzero_si128();
+	unsigned int blocks = 0;
+	size_t len = 0;
+
+	*zeroes = 0;
+
+	while ((uintptr_t)s & 63) {
+		if ((unsigned char)(*s - '!') > 'z' - '!')
+			return len;
+		*zeroes += *s++ == 'z';
+		len++;
+	}
+
+	for (;;) {
+		const __m128i *v = (const __m128i *)s;
+		__m128i v0 = _mm_load_si128(v + 0);
+		__m128i v1 = _mm_load_si128(v + 1);
+		__m128i v2 = _mm_load_si128(v + 2);
+		__m128i v3 = _mm_load_si128(v + 3);
+		__m128i valid;
+
+		valid = _mm_and_si128(_mm_and_si128(valid_sse2(v0), valid_sse2(v1)),
+				      _mm_and_si128(valid_sse2(v2), valid_sse2(v3)));
+		if (_mm_movemask_epi8(valid) != 0xffff)
+			break;
+
+		count = _mm_sub_epi8(count, _mm_cmpeq_epi8(v0, z));
+		count = _mm_sub_epi8(count, _mm_cmpeq_epi8(v1, z));
+		count = _mm_sub_epi8(count, _mm_cmpeq_epi8(v2, z));
+		count = _mm_sub_epi8(count, _mm_cmpeq_epi8(v3, z));
+		if (++blocks == 255 / 4) {
+			*zeroes += sum_bytes_sse2(count);
+			count = _mm_setzero_si128();
+			blocks = 0;
+		}
+
+		s += 64, len += 64;
+	}
+	*zeroes += sum_bytes_sse2(count);
+
+	for (;;) {
+		__m128i v = _mm_load_si128((const __m128i *)s);
+		unsigned valid = _mm_movemask_epi8(valid_sse2(v));
+		unsigned zmask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, z));
+
+		if (valid != 0xffff) {
+			unsigned n = __builtin_ctz(~valid);
+
+			*zeroes += __builtin_popcount(zmask & ((1u << n) - 1));
+			return len + n;
+		}
+
+		*zeroes += __builtin_popcount(zmask);
+		s += 16, len += 16;
+	}
+}
+
+/*
+ * Four groups occupy 20 bytes, which are loaded as bytes [0, 16) and [4, 20).
+ * One pair of shuffles gathers the first four digits of each group into its
+ * dword, from the first load where possible, and another pair its last digit.
+ * The digits are then combined by pmaddubsw and pmaddwd as
+ *
+ *	(d0 * 85 + d1) * 85^2 + (d2 * 85 + d3)
+ *
+ * which fits in 32 bits, leaving one multiplication by 85 to add the last
+ * digit. Like the scalar code, the result wraps for groups above 0xffffffff.
+ */
+#define BYTE_LO(p) ((p) < 16 ? (p) : -1)
+#define BYTE_HI(p) ((p) < 16 ? -1 : (p) - 4)
+
+#define HEAD_MASK(B) \
+	B(0), B(1), B(2), B(3), B(5), B(6), B(7), B(8), \
+	B(10), B(11), B(12), B(13), B(15), B(16), B(17), B(18)
+
+#define TAIL_MASK(B) \
+	B(4), -1, -1, -1, B(9), -1, -1, -1, \
+	B(14), -1, -1, -1, B(19), -1, -1, -1
+
+static const int8_t head_lo[16] __attribute__((aligned(16))) = { HEAD_MASK(BYTE_LO) };
+static const int8_t head_hi[16] __attribute__((aligned(16))) = { HEAD_MASK(BYTE_HI) };
+static const int8_t tail_lo[16] __attribute__((aligned(16))) = { TAIL_MASK(BYTE_LO) };
+static const int8_t tail_hi[16] __attribute__((aligned(16))) = { TAIL_MASK(BYTE_HI) };
+
+__attribute__((target("sse4.1")))
+static inline __m128i gather_sse4(__m128i lo, __m128i hi,
+				  const int8_t *mask_lo, const int8_t *mask_hi)
+{
+	return _mm_or_si128(_mm_shuffle_epi8(lo, _mm_load_si128((const __m128i *)mask_lo)),
+			    _mm_shuffle_epi8(hi, _mm_load_si128((const __m128i *)mask_hi)));
+}
+
+__attribute__((target("sse4.1")))
+static size_t decode_sse4(const char *in, size_t len, uint32_t *out)
+{
+	const unsigned char *s = (const unsigned char *)in;
+	const __m128i bang = _mm_set1_epi8('!');
+	const __m128i z = _mm_set1_epi8('z');
+	const __m128i w8 = _mm_set1_epi16(85 | 1 << 8);
+	const __m128i w16 = _mm_set1_epi32(85 * 85 | 1 << 16);
+	const __m128i r85 = _mm_set1_epi32(85);
+	uint32_t *o = out;
+
+	while (len >= 20) {
+		__m128i lo = _mm_loadu_si128((const __m128i *)s);
+		__m128i hi = _mm_loadu_si128((const __m128i *)(s + 4));
+		unsigned zmask = _mm_movemask_epi8(_mm_cmpeq_epi8(lo, z));
+		__m128i v;
+
+		if (zmask == 0xffff) { /* runs of zero dwords are common */
+			memset(o, 0, 16 * sizeof(*o));
+			o += 16, s += 16, len -= 16;
+			continue;
+		}
+
+		if (zmask | _mm_movemask_epi8(_mm_cmpeq_epi8(hi, z))) {
+			size_t n = *s == 'z' ? 1 : 5;
+
+			*o++ = n == 1 ? 0 : decode_group(s);
+			s += n, len -= n;
+			continue;
+		}
+
+		lo = _mm_sub_epi8(lo, bang);
+		hi = _mm_sub_epi8(hi, bang);
+
+		v = gather_sse4(lo, hi, head_lo, head_hi);
+		v = _mm_madd_epi16(_mm_maddubs_epi16(v, w8), w16);
+		v = _mm_add_epi32(_mm_mullo_epi32(v, r85),
+				  gather_sse4(lo, hi, tail_lo, tail_hi));
+		_mm_storeu_si128((__m128i *)o, v);
+
+		o += 4, s += 20, len -= 20;
+	}
+
+	return (o - out) + decode_scalar((const char *)s, len, o);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load2_avx2(const unsigned char *lo, const unsigned char *hi)
+{
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)lo)),
+				       _mm_loadu_si128((const __m128i *)hi), 1);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i gather_avx2(__m256i lo, __m256i hi,
+				  const int8_t *mask_lo, const int8_t *mask_hi)
+{
+	return _mm256_or_si256(_mm256_shuffle_epi8(lo, _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)mask_lo))),
+			       _mm256_shuffle_epi8(hi, _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)mask_hi))));
+}
+
+/* As decode_sse4(), with the upper 128b lane decoding the next 20 bytes */
+__attribute__((target("avx2")))
+static size_t decode_avx2(const char *in, size_t len, uint32_t *out)
+{
+	const unsigned char *s = (const unsigned char *)in;
+	const __m256i bang = _mm256_set1_epi8('!');
+	const __m256i z = _mm256_set1_epi8('z');
+	const __m256i w8 = _mm256_set1_epi16(85 | 1 << 8);
+	const __m256i w16 = _mm256_set1_epi32(85 * 85 | 1 << 16);
+	const __m256i r85 = _mm256_set1_epi32(85);
+	uint32_t *o = out;
+
+	while (len >= 40) {
+		__m256i lo = load2_avx2(s, s + 20);
+		__m256i hi = load2_avx2(s + 4, s + 24);
+		__m256i v;
+
+		if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)s), z)) == 0xffffffff) {
+			memset(o, 0, 32 * sizeof(*o));
+			o += 32, s += 32, len -= 32;
+			continue;
+		}
+
+		if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(lo, z),
+							 _mm256_cmpeq_epi8(hi, z)))) {
+			size_t n = *s == 'z' ? 1 : 5;
+
+			*o++ = n == 1 ? 0 : decode_group(s);
+			s += n, len -= n;
+			continue;
+		}
+
+		lo = _mm256_sub_epi8(lo, bang);
+		hi = _mm256_sub_epi8(hi, bang);
+
+		v = gather_avx2(lo, hi, head_lo, head_hi);
+		v = _mm256_madd_epi16(_mm256_maddubs_epi16(v, w8), w16);
+		v = _mm256_add_epi32(_mm256_mullo_epi32(v, r85),
+				     gather_avx2(lo, hi, tail_lo, tail_hi));
+		_mm256_storeu_si256((__m256i *)o, v);
+
+		o += 8, s += 40, len -= 40;
+	}
+
+	return (o - out) + decode_sse4((const char *)s, len, o);
+}
+
+#else
+static size_t scan(const char *in, size_t *zeroes)
+{
+	const unsigned char *s = (const unsigned char *)in;
+	size_t len = 0;
+
+	*zeroes = 0;
+	while ((unsigned char)(s[len] - '!') <= 'z' - '!')
+		*zeroes += s[len++] == 'z';
+
+	return len;
+}
+#endif
+
+static decode_fn select_decode(unsigned features)
+{
+#if defined(__x86_64__)
+	if (features & AVX2)
+		return decode_avx2;
+	if ((features & (SSSE3 | SSE4_1)) == (SSSE3 | SSE4_1))
+		return decode_sse4;
+#endif
+	return decode_scalar;
+}
+
+static decode_fn decode_impl;
+
+/**
+ * igt_ascii85_select:
+ * @features: mask of igt_x86_features() to allow
+ *
+ * Selects the implementation used by igt_ascii85_decode(), which otherwise
+ * picks the fastest one supported by the cpu on first use. This is mostly
+ * useful to compare the implementations.
+ *
+ * Returns: the features used by the selected implementation.
+ */
+unsigned igt_ascii85_select(unsigned features)
+{
+	decode_fn fn = select_decode(features & igt_x86_features());
+
+	__atomic_store_n(&decode_impl, fn, __ATOMIC_RELAXED);
+
+#if defined(__x86_64__)
+	if (fn == decode_avx2)
+		return AVX2 | SSE4_1 | SSSE3;
+	if (fn == decode_sse4)
+		return SSE4_1 | SSSE3;
+#endif
+	return 0;
+}
+
+/**
+ * igt_ascii85_scan:
+ * @in: ASCII85 encoded string
+ * @dwords: returns the number of dwords it decodes to
+ *
+ * Measures the ASCII85 string at the start of @in, which ends with the first
+ * character outside of '!' to 'z', such as the newline of an error state
+ * line. @dwords is exact for well formed input and an upper bound otherwise,
+ * so that it can be used to allocate the output of igt_ascii85_decode().
+ *
+ * Returns: the number of encoded characters.
+ */
+size_t igt_ascii85_scan(const char *in, size_t *dwords)
+{
+	size_t len, zeroes;
+
+	len = scan(in, &zeroes);
+	*dwords = zeroes + (len - zeroes) / 5;
+
+	return len;
+}
+
+/**
+ * igt_ascii85_decode:
+ * @in: ASCII85 encoded string
+ * @len: the number of encoded characters, from igt_ascii85_scan()
+ * @out: the output buffer, large enough for the dwords of igt_ascii85_scan()
+ *
+ * Decodes the @len characters of @in into @out, using the vector instructions
+ * supported by the cpu. A trailing partial group is ignored.
+ *
+ * Returns: the number of dwords written.
+ */
+size_t igt_ascii85_decode(const char *in, size_t len, uint32_t *out)
+{
+	decode_fn fn = __atomic_load_n(&decode_impl, __ATOMIC_RELAXED);
+
+	if (!fn) {
+		fn = select_decode(igt_x86_features());
+		__atomic_store_n(&decode_impl, fn, __ATOMIC_RELAXED);
+	}
+
+	return fn(in, len, out);
+}
@@ -77,7 +77,11 @@ static struct _mmio_data {
 	int inited;
 	bool safe;
 	uint32_t i915_devid;
+	int gen;
 	struct intel_register_map map;
+	/* in safe mode, a bit per allowed dword below map.top */
+	uint32_t *readable;
+	uint32_t *writable;
 	int key;
 } mmio_data;
 
@@ -181,8 +185,15 @@ intel_register_access_init(struct pci_device *pci_dev, int safe, int fd)
 	mmio_data.safe = (safe != 0 &&
 			intel_gen(pci_dev->device_id) >= 4) ? true : false;
 	mmio_data.i915_devid = pci_dev->device_id;
-	if (mmio_data.safe)
+	mmio_data.gen = intel_gen(mmio_data.i915_devid);
+	if (mmio_data.safe) {
 		mmio_data.map = intel_get_register_map(mmio_data.i915_devid);
+		mmio_data.readable = intel_get_register_bitmap(mmio_data.map,
+							       INTEL_RANGE_READ);
+		mmio_data.writable = intel_get_register_bitmap(mmio_data.map,
+							       INTEL_RANGE_WRITE);
+		igt_assert(mmio_data.readable && mmio_data.writable);
+	}
 
 	/* Find where the forcewake lock is. Forcewake doesn't exist
 	 * gen < 6, but the debugfs should do the right things for us.
@@ -225,7 +236,23 @@ intel_register_access_fini(void)
 {
 	if (mmio_data.key && intel_register_access_needs_wake())
 		release_forcewake_lock(mmio_data.key);
-	mmio_data.inited--;
+	if (--mmio_data.inited == 0) {
+		free(mmio_data.readable);
+		free(mmio_data.writable);
+		mmio_data.readable = NULL;
+		mmio_data.writable = NULL;
+	}
+}
+
+/* Same as intel_get_register_range() != NULL, from the bitmaps */
+static inline bool
+register_allowed(const uint32_t *bitmap, uint32_t reg)
+{
+	if (reg & mmio_data.map.alignment_mask || reg >= mmio_data.map.top)
+		return false;
+
+	reg /= 4;
+	return bitmap[reg / 32] & (1u << (reg % 32));
 }
 
 /**
@@ -244,22 +271,17 @@ intel_register_access_fini(void)
 uint32_t
 intel_register_read(uint32_t reg)
 {
-	struct intel_register_range *range;
 	uint32_t ret;
 
 	igt_assert(mmio_data.inited);
 
-	if (intel_gen(mmio_data.i915_devid) >= 6)
+	if (mmio_data.gen >= 6)
 		igt_assert(mmio_data.key != -1);
 
 	if (!mmio_data.safe)
 		goto read_out;
 
-	range = intel_get_register_range(mmio_data.map,
-					 reg,
-					 INTEL_RANGE_READ);
-
-	if(!range) {
+	if (!register_allowed(mmio_data.readable, reg)) {
 		igt_warn("Register read blocked for safety ""(*0x%08x)\n", reg);
 		ret = 0xffffffff;
 		goto out;
@@ -285,21 +307,15 @@ out:
 void
 intel_register_write(uint32_t reg, uint32_t val)
 {
-	struct intel_register_range *range;
-
 	igt_assert(mmio_data.inited);
 
-	if (intel_gen(mmio_data.i915_devid) >= 6)
+	if (mmio_data.gen >= 6)
 		igt_assert(mmio_data.key != -1);
 
 	if (!mmio_data.safe)
 		goto write_out;
 
-	range = intel_get_register_range(mmio_data.map,
-					 reg,
-					 INTEL_RANGE_WRITE);
-
-	igt_warn_on_f(!range,
+	igt_warn_on_f(!register_allowed(mmio_data.writable, reg),
 		      "Register write blocked for safety ""(*0x%08x = 0x%x)\n", reg, val);
 
 write_out:
@@ -178,3 +178,35 @@ intel_get_register_range(struct intel_register_map map, uint32_t offset, uint32_
 
 	return NULL;
 }
+
+/*
+ * Build a bitmap with a bit per dword below map.top, set where
+ * intel_get_register_range() would allow an access in mode.
+ */
+uint32_t *
+intel_get_register_bitmap(struct intel_register_map map, uint32_t mode)
+{
+	struct intel_register_range *range;
+	uint32_t align = map.alignment_mask;
+	uint32_t *bitmap;
+	uint32_t offset;
+
+	igt_assert(align == 0x3);
+
+	bitmap = calloc(map.top / 4 / 32 + 1, sizeof(*bitmap));
+	if (!bitmap)
+		return NULL;
+
+	for (range = map.map; !(range->flags & INTEL_RANGE_END); range++) {
+		if ((mode & range->flags) != mode)
+			continue;
+
+		for (offset = (range->base + align) & ~align;
+		     offset < map.top &&
+		     offset + align <= range->base + range->size;
+		     offset += align + 1)
+			bitmap[offset / 4 / 32] |= 1u << (offset / 4 % 32);
+	}
+
+	return bitmap;
+}
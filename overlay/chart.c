@@ -43,22 +43,26 @@ int chart_init(struct chart *chart, const char *name, int num_samples)
 	chart->range_automatic = 1;
 	chart->stroke_width = 2;
 	chart->smooth = CHART_CURVE;
+	chart->dirty = 1;
 	return 0;
 }
 
 void chart_set_mode(struct chart *chart, enum chart_mode mode)
 {
 	chart->mode = mode;
+	chart->dirty = 1;
 }
 
 void chart_set_smooth(struct chart *chart, enum chart_smooth smooth)
 {
 	chart->smooth = smooth;
+	chart->dirty = 1;
 }
 
 void chart_set_stroke_width(struct chart *chart, float width)
 {
 	chart->stroke_width = width;
+	chart->dirty = 1;
 }
 
 void chart_set_stroke_rgba(struct chart *chart, float red, float green, float blue, float alpha)
@@ -67,6 +71,7 @@ void chart_set_stroke_rgba(struct chart *chart, float red, float green, float bl
 	chart->stroke_rgb[1] = green;
 	chart->stroke_rgb[2] = blue;
 	chart->stroke_rgb[3] = alpha;
+	chart->dirty = 1;
 }
 
 void chart_set_fill_rgba(struct chart *chart, float red, float green, float blue, float alpha)
@@ -75,22 +80,29 @@ void chart_set_fill_rgba(struct chart *chart, float red, float green, float blue
 	chart->fill_rgb[1] = green;
 	chart->fill_rgb[2] = blue;
 	chart->fill_rgb[3] = alpha;
+	chart->dirty = 1;
 }
 
 void chart_set_position(struct chart *chart, int x, int y)
 {
 	chart->x = x;
 	chart->y = y;
+	chart->dirty = 1;
 }
 
 void chart_set_size(struct chart *chart, int w, int h)
 {
 	chart->w = w;
 	chart->h = h;
+	chart->dirty = 1;
 }
 
 void chart_set_range(struct chart *chart, double min, double max)
 {
+	if (chart->range_automatic ||
+	    chart->range[0] != min || chart->range[1] != max)
+		chart->dirty = 1;
+
 	chart->range[0] = min;
 	chart->range[1] = max;
 	chart->range_automatic = 0;
@@ -116,6 +128,18 @@ void chart_add_sample(struct chart *chart, double value)
 	if (chart->num_samples == 0)
 		return;
 
+	/*
+	 * Once every visible sample has the same value, scrolling in
+	 * another of the same leaves the chart unchanged.
+	 */
+	if (chart->current_sample &&
+	    chart->samples[(chart->current_sample - 1) % chart->num_samples] == value)
+		chart->flat++;
+	else
+		chart->flat = 1;
+	if (chart->flat <= chart->num_samples)
+		chart->dirty = 1;
+
 	pos = chart->current_sample++ % chart->num_samples;
 	chart->samples[pos] = value;
 }
@@ -132,8 +156,6 @@ static void chart_update_range(struct chart *chart)
 		else if (chart->samples[n] > chart->range[1])
 			chart->range[1] = chart->samples[n];
 	}
-	if (strcmp(chart->name, "power") == 0)
-	printf ("chart_update_range [%f, %f]\n", chart->range[0], chart->range[1]);
 }
 
 static double value_at(struct chart *chart, int n)
@@ -160,19 +182,10 @@ static double gradient_at(struct chart *chart, int n)
 	return (y1 - y0) / 2.;
 }
 
-void chart_draw(struct chart *chart, cairo_t *cr)
+static void chart_render(struct chart *chart, cairo_t *cr)
 {
 	int i, n, max, x;
 
-	if (chart->current_sample == 0)
-		return;
-
-	if (chart->range_automatic)
-		chart_update_range(chart);
-
-	if (chart->range[1] <= chart->range[0])
-		return;
-
 	cairo_save(cr);
 
 	cairo_translate(cr, chart->x, chart->y + chart->h);
@@ -234,7 +247,55 @@ void chart_draw(struct chart *chart, cairo_t *cr)
 	cairo_restore(cr);
 }
 
+/* Room for the stroke, and for the curve to overshoot the samples */
+#define CACHE_PAD 8
+
+void chart_draw(struct chart *chart, cairo_t *cr)
+{
+	if (chart->current_sample == 0)
+		return;
+
+	if (chart->dirty) {
+		if (chart->range_automatic)
+			chart_update_range(chart);
+
+		if (chart->cache) {
+			cairo_surface_destroy(chart->cache);
+			chart->cache = NULL;
+		}
+
+		if (chart->range[1] > chart->range[0]) {
+			cairo_t *c;
+
+			chart->cache_x = chart->x - CACHE_PAD;
+			chart->cache_y = chart->y - CACHE_PAD;
+			chart->cache =
+				cairo_surface_create_similar(cairo_get_target(cr),
+							     CAIRO_CONTENT_COLOR_ALPHA,
+							     chart->w + 2*CACHE_PAD,
+							     chart->h + 2*CACHE_PAD);
+
+			c = cairo_create(chart->cache);
+			cairo_translate(c, -chart->cache_x, -chart->cache_y);
+			chart_render(chart, c);
+			cairo_destroy(c);
+		}
+
+		chart->dirty = 0;
+	}
+
+	if (chart->cache == NULL)
+		return;
+
+	cairo_save(cr);
+	cairo_set_source_surface(cr, chart->cache, chart->cache_x, chart->cache_y);
+	cairo_paint(cr);
+	cairo_restore(cr);
+}
+
 void chart_fini(struct chart *chart)
 {
+	if (chart->cache)
+		cairo_surface_destroy(chart->cache);
 	free(chart->samples);
 }
@@ -45,6 +45,12 @@ struct chart {
 	double stroke_width;
 	double range[2];
 	double *samples;
+
+	/* rendering of the chart, redrawn only once dirty */
+	cairo_surface_t *cache;
+	int cache_x, cache_y;
+	int dirty;
+	int flat;
 };
 
 int chart_init(struct chart *chart, const char *name, int num_samples);
@@ -0,0 +1,216 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Feed a synthetic stream of i915 tracepoint samples, as recorded from the
+ * perf ring buffers, through the gpu-perf sample handlers. Each client is a
+ * forked child so that its /proc/<pid>/comm lookup is real.
+ */
+
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "gpu-perf.c"
+
+#define RAW_DWORDS 5
+
+struct bench_sample {
+	struct sample_event event;
+	uint32_t raw[RAW_DWORDS]; /* storage for event.raw */
+};
+
+static uint64_t next_id = 1000;
+
+static void fake_tracepoint(struct gpu_perf *gp,
+			    int (*func)(struct gpu_perf *, const void *))
+{
+	int n = gp->nr_cpus * (gp->nr_events + 1);
+
+	gp->sample = realloc(gp->sample, n * sizeof(*gp->sample));
+	if (gp->sample == NULL)
+		exit(ENOMEM);
+
+	for (n = 0; n < gp->nr_cpus; n++) {
+		gp->sample[gp->nr_events * gp->nr_cpus + n].id = next_id++;
+		gp->sample[gp->nr_events * gp->nr_cpus + n].func = func;
+	}
+
+	gp->nr_events++;
+}
+
+static uint64_t event_id(struct gpu_perf *gp, int event, int cpu)
+{
+	return gp->sample[event * gp->nr_cpus + cpu].id;
+}
+
+static void fill(struct bench_sample *s, uint64_t id, pid_t pid, uint64_t time,
+		 uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+	uint32_t *raw = s->event.raw;
+
+	memset(s, 0, sizeof(*s));
+	s->event.header.type = PERF_RECORD_SAMPLE;
+	s->event.header.size = sizeof(*s);
+	s->event.pid = s->event.tid = pid;
+	s->event.time = time;
+	s->event.id = id;
+	s->event.raw_size = sizeof(s->raw) + 8;
+	raw[DEVICE] = a;
+	raw[CTX] = b;
+	raw[ENGINE] = c;
+	raw[CTX_SEQNO] = d;
+}
+
+static double elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-c cpus] [-p clients] [-n samples] [-r reps]\n",
+		name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct gpu_perf gp;
+	struct bench_sample *samples;
+	struct timespec start, end;
+	pid_t *pids;
+	int nr_clients = 64, nr_samples = 1000000, reps = 10;
+	int c, n, r, update = 0;
+	uint32_t seqno = 0;
+
+	memset(&gp, 0, sizeof(gp));
+	gp.nr_cpus = 8;
+
+	while ((c = getopt(argc, argv, "c:p:n:r:")) != -1) {
+		switch (c) {
+		case 'c':
+			gp.nr_cpus = atoi(optarg);
+			break;
+		case 'p':
+			nr_clients = atoi(optarg);
+			break;
+		case 'n':
+			nr_samples = atoi(optarg);
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (gp.nr_cpus < 1 || nr_clients < 1 || nr_samples < 2 || reps < 1)
+		usage(argv[0]);
+
+	/* Same events, in the same order, as gpu_perf_init() */
+	fake_tracepoint(&gp, request_add);
+	fake_tracepoint(&gp, wait_begin);
+	fake_tracepoint(&gp, wait_end);
+	fake_tracepoint(&gp, flip_complete);
+	fake_tracepoint(&gp, ring_sync);
+	fake_tracepoint(&gp, ctx_switch);
+	if (sample_hash_init(&gp))
+		return ENOMEM;
+
+	pids = calloc(nr_clients, sizeof(*pids));
+	samples = calloc(nr_samples, sizeof(*samples));
+	if (pids == NULL || samples == NULL)
+		return ENOMEM;
+
+	for (n = 0; n < nr_clients; n++) {
+		pids[n] = fork();
+		if (pids[n] == 0) {
+			pause();
+			_exit(0);
+		}
+		if (pids[n] < 0)
+			return errno;
+	}
+
+	srandom(0);
+	for (n = 0; n + 1 < nr_samples; n++) {
+		pid_t pid = pids[random() % nr_clients];
+		int cpu = random() % gp.nr_cpus;
+		uint32_t ring = random() % 4;
+
+		switch (random() % 8) {
+		case 0:
+			/* wait_begin and wait_end swap CTX and ENGINE */
+			fill(&samples[n], event_id(&gp, 1, cpu), pid, n,
+			     0, ring, 1, ++seqno);
+			n++;
+			fill(&samples[n], event_id(&gp, 2, cpu), pid, n,
+			     0, 1, ring, seqno);
+			break;
+		case 1:
+			fill(&samples[n], event_id(&gp, 3, cpu), pid, n,
+			     ring, 0, 0, 0);
+			break;
+		case 2:
+			fill(&samples[n], event_id(&gp, 4, cpu), pid, n,
+			     0, 1, ring, 0);
+			break;
+		case 3:
+			fill(&samples[n], event_id(&gp, 5, cpu), pid, n,
+			     0, 1, ring, 0);
+			break;
+		default:
+			fill(&samples[n], event_id(&gp, 0, cpu), pid, n,
+			     0, 1, ring, ++seqno);
+			break;
+		}
+	}
+	nr_samples = n;
+
+	/* prime the comm cache, as a running overlay would have */
+	for (n = 0; n < nr_samples; n++)
+		process_sample(&gp, &samples[n].event.header);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (r = 0; r < reps; r++) {
+		for (n = 0; n < nr_samples; n++)
+			update += process_sample(&gp, &samples[n].event.header);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%d cpus, %d clients: %.1f ns/sample, %.2fM samples/s (%d updates)\n",
+	       gp.nr_cpus, nr_clients,
+	       1e9 * elapsed(&start, &end) / ((double)nr_samples * reps),
+	       (double)nr_samples * reps / elapsed(&start, &end) / 1e6,
+	       update);
+
+	for (n = 0; n < nr_clients; n++) {
+		kill(pids[n], SIGKILL);
+		waitpid(pids[n], NULL, 0);
+	}
+
+	return 0;
+}
@@ -187,15 +187,21 @@ static int get_comm(pid_t pid, char *comm, int len)
 	return len;
 }
 
+static struct gpu_perf_comm **comm_bucket(struct gpu_perf *gp, pid_t pid)
+{
+	return &gp->comm_hash[pid & (COMM_HASH_SIZE - 1)];
+}
+
 static struct gpu_perf_comm *
 lookup_comm(struct gpu_perf *gp, pid_t pid)
 {
-	struct gpu_perf_comm *comm;
+	struct gpu_perf_comm *comm, **bucket;
 
 	if (pid == 0)
 		return NULL;
 
-	for (comm = gp->comm; comm != NULL; comm = comm->next) {
+	bucket = comm_bucket(gp, pid);
+	for (comm = *bucket; comm != NULL; comm = comm->hash) {
 		if (comm->pid == pid)
 			break;
 	}
@@ -212,11 +218,71 @@ lookup_comm(struct gpu_perf *gp, pid_t pid)
 		comm->pid = pid;
 		comm->next = gp->comm;
 		gp->comm = comm;
+		comm->hash = *bucket;
+		*bucket = comm;
 	}
 
 	return comm;
 }
 
+static bool comm_changed(struct gpu_perf_comm *comm)
+{
+	char name[256];
+
+	if (get_comm(comm->pid, name, sizeof(name)) < 0)
+		return true;
+
+	return strcmp(comm->name, name);
+}
+
+static void free_comm(struct gpu_perf *gp, struct gpu_perf_comm *comm)
+{
+	struct gpu_perf_comm **prev;
+	struct gpu_perf_time *wait;
+	int n;
+
+	for (prev = comm_bucket(gp, comm->pid); *prev != comm; prev = &(*prev)->hash)
+		;
+	*prev = comm->hash;
+
+	/* a process may still have other waits outstanding */
+	for (n = 0; n < MAX_RINGS; n++) {
+		struct gpu_perf_time **wprev = &gp->wait[n];
+
+		while ((wait = *wprev) != NULL) {
+			if (wait->comm == comm) {
+				*wprev = wait->next;
+				free(wait);
+			} else
+				wprev = &wait->next;
+		}
+	}
+
+	free(comm);
+}
+
+/*
+ * Forget processes that have not been shown since @idle, or that have exited
+ * and possibly had their pid reused. @fini is called on each first to release
+ * its user_data.
+ */
+void gpu_perf_expire(struct gpu_perf *gp, time_t idle,
+		     void (*fini)(struct gpu_perf_comm *))
+{
+	struct gpu_perf_comm *comm, **prev;
+
+	for (prev = &gp->comm; (comm = *prev) != NULL; ) {
+		if (!comm->active &&
+		    (comm->show < idle || comm_changed(comm))) {
+			*prev = comm->next;
+			if (fini)
+				fini(comm);
+			free_comm(gp, comm);
+		} else
+			prev = &comm->next;
+	}
+}
+
 static int request_add(struct gpu_perf *gp, const void *event)
 {
 	const struct sample_event *sample = event;
@@ -307,6 +373,33 @@ static int wait_end(struct gpu_perf *gp, const void *event)
 	return 0;
 }
 
+/*
+ * Index the sample ids of every tracepoint on every cpu. The kernel hands out
+ * ids sequentially, so with twice as many slots as ids they rarely collide.
+ */
+static int sample_hash_init(struct gpu_perf *gp)
+{
+	int n, size = 1;
+
+	while (size < 2 * gp->nr_events * gp->nr_cpus)
+		size <<= 1;
+
+	gp->sample_hash = calloc(size, sizeof(*gp->sample_hash));
+	if (gp->sample_hash == NULL)
+		return ENOMEM;
+	gp->sample_mask = size - 1;
+
+	for (n = 0; n < gp->nr_events * gp->nr_cpus; n++) {
+		unsigned i = gp->sample[n].id & gp->sample_mask;
+
+		while (gp->sample_hash[i].func)
+			i = (i + 1) & gp->sample_mask;
+		gp->sample_hash[i] = gp->sample[n];
+	}
+
+	return 0;
+}
+
 void gpu_perf_init(struct gpu_perf *gp, unsigned flags)
 {
 	memset(gp, 0, sizeof(*gp));
@@ -325,27 +418,28 @@ void gpu_perf_init(struct gpu_perf *gp, unsigned flags)
 		return;
 	}
 
+	if (sample_hash_init(gp)) {
+		gp->error = "Out of memory";
+		return;
+	}
+
 	if (perf_mmap(gp))
 		return;
 }
 
-static int process_sample(struct gpu_perf *gp, int cpu,
+static int process_sample(struct gpu_perf *gp,
 			  const struct perf_event_header *header)
 {
 	const struct sample_event *sample = (const struct sample_event *)header;
-	int n, update = 0;
-
-	/* hash me! */
-	for (n = 0; n < gp->nr_events; n++) {
-		int m = n * gp->nr_cpus + cpu;
-		if (gp->sample[m].id != sample->id)
-			continue;
+	const struct gpu_perf_sample *hash = gp->sample_hash;
+	unsigned n;
 
-		update = gp->sample[m].func(gp, sample);
-		break;
+	for (n = sample->id & gp->sample_mask; hash[n].func; n = (n + 1) & gp->sample_mask) {
+		if (hash[n].id == sample->id)
+			return hash[n].func(gp, sample);
 	}
 
-	return update;
+	return 0;
 }
 
 int gpu_perf_update(struct gpu_perf *gp)
@@ -405,7 +499,7 @@ int gpu_perf_update(struct gpu_perf *gp)
 			}
 
 			if (header->type == PERF_RECORD_SAMPLE)
-				update += process_sample(gp, n, header);
+				update += process_sample(gp, header);
 			tail += header->size;
 		}
 
@@ -29,6 +29,7 @@
 #include <stdbool.h>
 
 #define MAX_RINGS 16
+#define COMM_HASH_SIZE 256
 
 struct gpu_perf {
 	const char *error;
@@ -40,13 +41,15 @@ struct gpu_perf {
 	struct gpu_perf_sample {
 		uint64_t id;
 		int (*func)(struct gpu_perf *, const void *);
-	} *sample;
+	} *sample, *sample_hash;
+	unsigned sample_mask;
 
 	unsigned flip_complete[MAX_RINGS];
 	unsigned ctx_switch[MAX_RINGS];
 
 	struct gpu_perf_comm {
 		struct gpu_perf_comm *next;
+		struct gpu_perf_comm *hash;
 		char name[256];
 		pid_t pid;
 		bool active;
@@ -57,7 +60,7 @@ struct gpu_perf {
 		uint32_t nr_sema;
 
 		time_t show;
-	} *comm;
+	} *comm, *comm_hash[COMM_HASH_SIZE];
 	struct gpu_perf_time {
 		struct gpu_perf_time *next;
 		struct gpu_perf_comm *comm;
@@ -69,5 +72,7 @@ struct gpu_perf {
 
 void gpu_perf_init(struct gpu_perf *gp, unsigned flags);
 int gpu_perf_update(struct gpu_perf *gp);
+void gpu_perf_expire(struct gpu_perf *gp, time_t idle,
+		     void (*fini)(struct gpu_perf_comm *));
 
 #endif /* GPU_PERF_H */
@@ -0,0 +1,353 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <cairo.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "../overlay.h"
+
+/*
+ * Render into a plain image surface, and write every frame (or as many as
+ * the configured rate allows) either as PNG files or as raw pixels down a
+ * pipe, for machines without a display.
+ */
+
+enum headless_format {
+	HEADLESS_PNG,
+	HEADLESS_RAW,
+};
+
+struct headless_overlay {
+	struct overlay base;
+	enum headless_format format;
+	char *output;
+	int fd;
+
+	/* png output, split around the frame number if there is one */
+	char *prefix, *suffix;
+	int digits;
+	bool zero;
+
+	uint64_t interval; /* ns between written frames, 0 for all */
+	uint64_t next;
+	unsigned frame;
+};
+
+static inline struct headless_overlay *to_headless_overlay(struct overlay *o)
+{
+	return (struct headless_overlay *)o;
+}
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	while (len) {
+		ssize_t ret = write(fd, data, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		data = (const char *)data + ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+/* A single frame, without any stride padding, in native-endian XRGB8888 */
+static void headless_write_raw(struct headless_overlay *priv)
+{
+	cairo_surface_t *surface = priv->base.surface;
+	const unsigned char *data = cairo_image_surface_get_data(surface);
+	int stride = cairo_image_surface_get_stride(surface);
+	int width = cairo_image_surface_get_width(surface);
+	int height = cairo_image_surface_get_height(surface);
+	int y;
+
+	for (y = 0; y < height; y++) {
+		if (write_all(priv->fd, data + y * stride, 4 * width)) {
+			fprintf(stderr, "Failed to write frame: %s\n",
+				strerror(errno));
+			exit(EPIPE);
+		}
+	}
+}
+
+/*
+ * Each frame goes to its own file if the output is numbered, otherwise the
+ * output is replaced so that readers never see a partial frame.
+ */
+static void headless_write_png(struct headless_overlay *priv)
+{
+	char path[1024], tmp[1024 + 8];
+	cairo_status_t status;
+
+	if (priv->suffix) {
+		snprintf(path, sizeof(path), priv->zero ? "%s%0*u%s" : "%s%*u%s",
+			 priv->prefix, priv->digits, priv->frame, priv->suffix);
+		status = cairo_surface_write_to_png(priv->base.surface, path);
+	} else {
+		snprintf(path, sizeof(path), "%s", priv->prefix);
+		snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+		status = cairo_surface_write_to_png(priv->base.surface, tmp);
+		if (status == CAIRO_STATUS_SUCCESS && rename(tmp, path))
+			status = CAIRO_STATUS_WRITE_ERROR;
+	}
+
+	if (status != CAIRO_STATUS_SUCCESS)
+		fprintf(stderr, "Failed to write %s: %s\n",
+			path, cairo_status_to_string(status));
+}
+
+/*
+ * The png output may number the frames with a single %d or %u, optionally
+ * zero padded to a width, and "%%" is a literal '%'. It is split around that
+ * number here, as the user's string is never to be used as a format.
+ */
+static int parse_png_output(struct headless_overlay *priv)
+{
+	size_t len = strlen(priv->output);
+	const char *s;
+	char *dst;
+
+	priv->prefix = malloc(len + 1);
+	if (priv->prefix == NULL)
+		return -1;
+
+	dst = priv->prefix;
+	for (s = priv->output; *s; s++) {
+		if (*s != '%') {
+			*dst++ = *s;
+			continue;
+		}
+
+		if (s[1] == '%') {
+			*dst++ = *++s;
+			continue;
+		}
+
+		if (priv->suffix)
+			goto err;
+
+		if (*++s == '0') {
+			priv->zero = true;
+			s++;
+		}
+		while (isdigit(*s)) {
+			priv->digits = 10 * priv->digits + *s++ - '0';
+			if (priv->digits > 64)
+				goto err;
+		}
+		if (*s != 'd' && *s != 'u')
+			goto err;
+
+		*dst = '\0';
+		priv->suffix = malloc(len + 1);
+		if (priv->suffix == NULL)
+			return -1;
+		dst = priv->suffix;
+	}
+	*dst = '\0';
+
+	return 0;
+
+err:
+	fprintf(stderr, "Invalid headless output '%s': "
+		"only a single %%d or %%u may number the frames\n",
+		priv->output);
+	return -1;
+}
+
+static int prefix_cwd(struct headless_overlay *priv)
+{
+	char cwd[1024], *prefix;
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		return -1;
+
+	prefix = malloc(strlen(cwd) + strlen(priv->prefix) + 2);
+	if (prefix == NULL)
+		return -1;
+
+	sprintf(prefix, "%s/%s", cwd, priv->prefix);
+	free(priv->prefix);
+	priv->prefix = prefix;
+
+	return 0;
+}
+
+static void headless_overlay_show(struct overlay *overlay)
+{
+	struct headless_overlay *priv = to_headless_overlay(overlay);
+	uint64_t t = now();
+
+	if (t < priv->next)
+		return;
+
+	cairo_surface_flush(priv->base.surface);
+	if (priv->format == HEADLESS_RAW)
+		headless_write_raw(priv);
+	else
+		headless_write_png(priv);
+	priv->frame++;
+
+	/* Drop frames rather than trying to catch up */
+	priv->next += priv->interval;
+	if (priv->next < t)
+		priv->next = t + priv->interval;
+}
+
+static void headless_overlay_hide(struct overlay *overlay)
+{
+}
+
+static void headless_overlay_destroy(void *data)
+{
+	struct headless_overlay *priv = data;
+
+	if (priv->fd > STDOUT_FILENO)
+		close(priv->fd);
+	free(priv->suffix);
+	free(priv->prefix);
+	free(priv->output);
+	free(priv);
+}
+
+static void config_get_size(struct config *config, int *width, int *height)
+{
+	const char *str;
+	int w, h;
+
+	str = config_get_value(config, "window", "size");
+	if (str && sscanf(str, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+		*width = w;
+		*height = h;
+	}
+}
+
+static uint64_t config_get_interval(struct config *config)
+{
+	const char *str;
+	double rate;
+
+	str = config_get_value(config, "headless", "rate");
+	if (str == NULL || (rate = atof(str)) <= 0)
+		return 0;
+
+	return 1e9 / rate;
+}
+
+cairo_surface_t *
+headless_overlay_create(struct config *config, int *width, int *height)
+{
+	struct headless_overlay *priv;
+	const char *output, *format;
+
+	output = config_get_value(config, "headless", "output");
+	if (output == NULL)
+		return NULL;
+
+	priv = calloc(1, sizeof(*priv));
+	if (priv == NULL)
+		return NULL;
+
+	priv->output = strdup(output);
+	if (priv->output == NULL)
+		goto err_priv;
+
+	format = config_get_value(config, "headless", "format");
+	if (format == NULL)
+		format = strcmp(output, "-") ? "png" : "raw";
+	if (strcmp(format, "png") == 0) {
+		priv->format = HEADLESS_PNG;
+		priv->fd = -1;
+		if (parse_png_output(priv))
+			goto err_output;
+
+		/* daemon() will move us to /, and the cwd is not a format */
+		if (*priv->prefix != '/' && prefix_cwd(priv))
+			goto err_output;
+	} else if (strcmp(format, "raw") == 0) {
+		priv->format = HEADLESS_RAW;
+		if (strcmp(output, "-") == 0)
+			priv->fd = STDOUT_FILENO;
+		else
+			priv->fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (priv->fd < 0) {
+			fprintf(stderr, "Failed to open %s: %s\n",
+				output, strerror(errno));
+			goto err_output;
+		}
+	} else {
+		fprintf(stderr, "Unknown headless format '%s'\n", format);
+		goto err_output;
+	}
+
+	priv->interval = config_get_interval(config);
+
+	config_get_size(config, width, height);
+	priv->base.surface =
+		cairo_image_surface_create(CAIRO_FORMAT_RGB24, *width, *height);
+	if (cairo_surface_status(priv->base.surface))
+		goto err_fd;
+
+	priv->base.show = headless_overlay_show;
+	priv->base.hide = headless_overlay_hide;
+
+	cairo_surface_set_user_data(priv->base.surface, &overlay_key, priv, headless_overlay_destroy);
+
+	return priv->base.surface;
+
+err_fd:
+	cairo_surface_destroy(priv->base.surface);
+	if (priv->fd > STDOUT_FILENO)
+		close(priv->fd);
+err_output:
+	free(priv->suffix);
+	free(priv->prefix);
+	free(priv->output);
+err_priv:
+	free(priv);
+	return NULL;
+}
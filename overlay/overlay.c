@@ -133,6 +133,7 @@ struct overlay_context {
 	int width, height;
 
 	time_t time;
+	double frame_cost; /* seconds of cpu time, averaged */
 
 	struct overlay_gpu_top gpu_top;
 	struct overlay_gpu_perf gpu_perf;
@@ -282,23 +283,12 @@ static void init_gpu_perf(struct overlay_context *ctx,
 	gp->show_flips = 0;
 }
 
-static char *get_comm(pid_t pid, char *comm, int len)
+static void fini_comm(struct gpu_perf_comm *comm)
 {
-	char filename[1024];
-	int fd;
-
-	*comm = '\0';
-	snprintf(filename, sizeof(filename), "/proc/%d/comm", pid);
-
-	fd = open(filename, 0);
-	if (fd >= 0) {
-		len = read(fd, comm, len);
-		if (len >= 0)
-			comm[len-1] = '\0';
-		close(fd);
+	if (comm->user_data) {
+		chart_fini(comm->user_data);
+		free(comm->user_data);
 	}
-
-	return comm;
 }
 
 static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *gp)
@@ -310,7 +300,7 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 		{ 0.25, 0.25, 1, 1 },
 		{ 1, 1, 1, 1 },
 	};
-	struct gpu_perf_comm *comm, **prev;
+	struct gpu_perf_comm *comm;
 	const char *ring_name[] = {
 		"R",
 		"B",
@@ -426,7 +416,7 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 	cairo_pattern_destroy(linear);
 	cairo_fill(ctx->cr);
 
-	for (prev = &gp->gpu_perf.comm; (comm = *prev) != NULL; ) {
+	for (comm = gp->gpu_perf.comm; comm; comm = comm->next) {
 		int need_comma = 0, len;
 
 		if (comm->user_data == NULL)
@@ -482,18 +472,8 @@ static void show_gpu_perf(struct overlay_context *ctx, struct overlay_gpu_perf *
 
 skip_comm:
 		memset(comm->nr_requests, 0, sizeof(comm->nr_requests));
-		if (!comm->active &&
-		    (comm->show < ctx->time - IDLE_TIME ||
-		     strcmp(comm->name, get_comm(comm->pid, buf, sizeof(buf))))) {
-			*prev = comm->next;
-			if (comm->user_data) {
-				chart_fini(comm->user_data);
-				free(comm->user_data);
-			}
-			free(comm);
-		} else
-			prev = &comm->next;
 	}
+	gpu_perf_expire(&gp->gpu_perf, ctx->time - IDLE_TIME, fini_comm);
 
 	cairo_set_source_rgba(ctx->cr, 1, 1, 1, 1);
 	cairo_move_to(ctx->cr, x, y);
@@ -825,6 +805,11 @@ static int get_sample_period(struct config *config)
 	return 500000;
 }
 
+static double elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + 1e-9*(end->tv_nsec - start->tv_nsec);
+}
+
 static void overlay_snapshot(struct overlay_context *ctx)
 {
 	char buf[1024];
@@ -840,6 +825,7 @@ static void usage(const char *progname)
 	printf("\t--geometry|-G <width>x<height>+<x-offset>+<y-offset>\tExact window placement and size\n");
 	printf("\t--position|-P (top|middle|bottom)-(left|centre|right)\tPlace the window in a particular corner\n");
 	printf("\t--size|-S <width>x<height> | <scale>%%\t\t\tWindow size\n");
+	printf("\t--headless|-H <filename> | -\t\t\t\tRender without a display, to PNG files or raw frames on stdout\n");
 	printf("\t--help|-h\t\t\t\t\t\tThis help message\n");
 }
 
@@ -850,11 +836,13 @@ int main(int argc, char **argv)
 		{"geometry", 1, 0, 'G'},
 		{"position", 1, 0, 'P'},
 		{"size", 1, 0, 'S'},
+		{"headless", 1, 0, 'H'},
 		{"help", 0, 0, 'h'},
 		{NULL, 0, 0, 0,}
 	};
 	struct overlay_context ctx;
 	struct config config;
+	const char *headless;
 	int index, sample_period;
 	int daemonize = 1, renice = 0;
 	int i;
@@ -863,7 +851,7 @@ int main(int argc, char **argv)
 	config_init(&config);
 
 	opterr = 0;
-	while ((i = getopt_long(argc, argv, "c:G:fhn?", long_options, &index)) != -1) {
+	while ((i = getopt_long(argc, argv, "c:G:H:fhn?", long_options, &index)) != -1) {
 		switch (i) {
 		case 'c':
 			config_parse_string(&config, optarg);
@@ -877,6 +865,9 @@ int main(int argc, char **argv)
 		case 'S':
 			config_set_value(&config, "window", "size", optarg);
 			break;
+		case 'H':
+			config_set_value(&config, "headless", "output", optarg);
+			break;
 		case 'f':
 			daemonize = 0;
 			break;
@@ -898,7 +889,18 @@ int main(int argc, char **argv)
 
 	ctx.width = 640;
 	ctx.height = 236;
+	ctx.frame_cost = 0;
 	ctx.surface = NULL;
+	headless = config_get_value(&config, "headless", "output");
+	if (headless) {
+		ctx.surface = headless_overlay_create(&config, &ctx.width, &ctx.height);
+		if (ctx.surface == NULL)
+			return EINVAL;
+
+		/* keep stdout for the frames */
+		if (strcmp(headless, "-") == 0)
+			daemonize = 0;
+	}
 	if (ctx.surface == NULL)
 		ctx.surface = x11_overlay_create(&config, &ctx.width, &ctx.height);
 	if (ctx.surface == NULL)
@@ -927,6 +929,9 @@ int main(int argc, char **argv)
 
 	i = 0;
 	while (1) {
+		struct timespec start, end;
+
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
 		ctx.time = time(NULL);
 
 		ctx.cr = cairo_create(ctx.surface);
@@ -950,6 +955,14 @@ int main(int argc, char **argv)
 				      (ctx.width-extents.width)/2.,
 				      1+extents.height);
 			cairo_show_text(ctx.cr, buf);
+
+			/* what the previous frames cost us to sample, draw and show */
+			sprintf(buf, "%.2fms", ctx.frame_cost * 1e3);
+			cairo_text_extents(ctx.cr, buf, &extents);
+			cairo_move_to(ctx.cr,
+				      ctx.width - PAD - extents.width,
+				      1+extents.height);
+			cairo_show_text(ctx.cr, buf);
 		}
 
 		cairo_destroy(ctx.cr);
@@ -961,6 +974,9 @@ int main(int argc, char **argv)
 			take_snapshot = 0;
 		}
 
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+		ctx.frame_cost += (elapsed(&start, &end) - ctx.frame_cost) / 8;
+
 		usleep(sample_period);
 	}
 
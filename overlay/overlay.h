@@ -100,5 +100,6 @@ static inline cairo_surface_t *x11_window_create(struct config *config, int *wid
 #endif
 
 cairo_surface_t *kms_overlay_create(struct config *config, int *width, int *height);
+cairo_surface_t *headless_overlay_create(struct config *config, int *width, int *height);
 
 #endif /* OVERLAY_H */
@@ -72,6 +72,8 @@ ifneq ("${ANDROID_HAS_CAIRO}", "1")
     skip_tools_list += intel_residency
 endif
 
+intel_error_bucket_LDFLAGS = -lz
+
 ifeq ($(HAVE_LIBDRM_INTEL),true)
     bin_PROGRAMS += $(LIBDRM_INTEL_BIN)
     intel_error_decode_LDFLAGS = -lz
@@ -37,7 +37,11 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <zlib.h>
 #include <i915_drm.h>
 
 #include "intel_aub.h"
@@ -60,6 +64,20 @@ static int gen = 0;
 static int verbose = 0;
 static bool device_override;
 static uint32_t device;
+static bool dedup_stats;
+static uint64_t dedup_written, dedup_saved, dedup_skipped;
+
+/* zlib framed copy of the output, see write_compressed(). */
+static FILE *compressed_file;
+
+/*
+ * Capture window. Outside of it buffers are only tracked and nothing but the
+ * AUB header is written.
+ */
+static bool capturing = true;
+static uint64_t exec_count;
+static uint64_t capture_start = UINT64_MAX, capture_stop = UINT64_MAX;
+static volatile sig_atomic_t capture_toggle;
 
 #define MAX_BO_COUNT 64 * 1024
 
@@ -67,10 +85,27 @@ struct bo {
 	uint32_t size;
 	uint64_t offset;
 	void *map;
+
+	/* What was last written to the AUB, to skip unchanged buffers. */
+	bool dumped;
+	uint64_t dump_offset;
+	uint64_t hash;
 };
 
 static struct bo *bos;
 
+/*
+ * Handle of the buffer last written to each GTT page, so that a buffer is
+ * dumped again once anything else has been written over its pages. Buffers
+ * beyond the first 4GiB of the GTT are always dumped.
+ */
+#define MAX_DEDUP_PAGES (1 << 20)
+
+/* Owner of the pages written over by a ring, never a GEM handle. */
+#define PAGE_OWNER_RING 0
+
+static uint32_t *page_owner;
+
 #define DRM_MAJOR 226
 
 #ifndef DRM_I915_GEM_USERPTR
@@ -139,33 +174,263 @@ align_u64(uint64_t v, uint64_t a)
 	return (v + a - 1) & ~(a - 1);
 }
 
+/*
+ * AUB output is staged in a large ring buffer so the application thread only
+ * pays for a memcpy, while a writer thread drains it to all outputs with
+ * writev(). The application only blocks once the ring is full.
+ */
+#define STAGING_SIZE (64 << 20)
+
+static struct {
+	uint8_t *data;
+	uint64_t head; /* advanced by the application */
+	uint64_t tail; /* advanced by the writer */
+
+	pthread_t writer;
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t space;
+	bool running;
+	bool stop;
+	bool direct; /* no writer, write from the application */
+} staging = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.space = PTHREAD_COND_INITIALIZER,
+};
+
 static void
-dword_out(uint32_t data)
+staging_kick(void)
+{
+	pthread_mutex_lock(&staging.mutex);
+	pthread_cond_signal(&staging.work);
+	pthread_mutex_unlock(&staging.mutex);
+}
+
+static void
+write_all(int fd, struct iovec *iov, int count)
+{
+	while (count) {
+		ssize_t ret = writev(fd, iov, count);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		fail_if(ret <= 0, "intel_aubdump: writing to output failed\n");
+
+		while (count && (size_t) ret >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count) {
+			iov->iov_base = (uint8_t *) iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+}
+
+/*
+ * The compressed output is a sequence of independent chunks, each made of
+ * a little-endian header { "AUBZ", uncompressed size, compressed size }
+ * followed by a zlib stream, so it can be inflated as it is read.
+ */
+#define COMPRESSED_MAGIC 0x5a425541
+#define COMPRESSED_CHUNK (1 << 20)
+
+static void
+write_compressed(const uint8_t *data, size_t len)
+{
+	static uint8_t *buf;
+	static uLong buf_size;
+
+	if (buf == NULL) {
+		buf_size = compressBound(COMPRESSED_CHUNK);
+		buf = malloc(buf_size);
+		fail_if(buf == NULL, "intel_aubdump: out of memory\n");
+	}
+
+	while (len) {
+		uLong chunk = len < COMPRESSED_CHUNK ? len : COMPRESSED_CHUNK;
+		uLongf size = buf_size;
+		uint32_t header[3];
+		struct iovec iov[2] = {
+			{ header, sizeof(header) },
+			{ buf, 0 },
+		};
+
+		fail_if(compress2(buf, &size, data, chunk, Z_BEST_SPEED) != Z_OK,
+			"intel_aubdump: compression failed\n");
+
+		header[0] = COMPRESSED_MAGIC;
+		header[1] = chunk;
+		header[2] = size;
+		iov[1].iov_len = size;
+		write_all(fileno(compressed_file), iov, 2);
+
+		data += chunk;
+		len -= chunk;
+	}
+}
+
+static void
+output_write(const void *data, size_t len)
 {
-	for (int i = 0; i < ARRAY_SIZE (files); i++) {
-		if (files[i] == NULL)
+	for (int i = 0; i < ARRAY_SIZE(files); i++) {
+		struct iovec iov = { (void *) data, len };
+
+		if (files[i] != NULL)
+			write_all(fileno(files[i]), &iov, 1);
+	}
+
+	if (compressed_file != NULL)
+		write_compressed(data, len);
+}
+
+static void *
+staging_writer(void *arg)
+{
+	pthread_mutex_lock(&staging.mutex);
+	for (;;) {
+		uint64_t head, tail = staging.tail;
+		size_t offset, len;
+
+		head = __atomic_load_n(&staging.head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			struct timespec ts;
+
+			if (staging.stop)
+				break;
+
+			/* The application does not lock to append. */
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 10 * 1000 * 1000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_nsec -= 1000000000;
+				ts.tv_sec++;
+			}
+			pthread_cond_timedwait(&staging.work, &staging.mutex, &ts);
 			continue;
+		}
+		pthread_mutex_unlock(&staging.mutex);
 
-		fail_if(fwrite(&data, 1, 4, files[i]) == 0,
-			"Writing to output failed\n");
+		offset = tail % STAGING_SIZE;
+		len = head - tail;
+		if (offset + len > STAGING_SIZE) {
+			output_write(staging.data + offset, STAGING_SIZE - offset);
+			output_write(staging.data, offset + len - STAGING_SIZE);
+		} else {
+			output_write(staging.data + offset, len);
+		}
+
+		pthread_mutex_lock(&staging.mutex);
+		__atomic_store_n(&staging.tail, head, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&staging.space);
 	}
+	pthread_mutex_unlock(&staging.mutex);
+
+	return NULL;
+}
+
+/*
+ * Only the thread calling fork() carries on in the child, and the writer
+ * may have held the staging locks. The parent's writer still owns anything
+ * pending in the ring, so the child starts from an empty ring with a writer
+ * of its own, or writes directly if that cannot be started.
+ */
+static void
+staging_atfork_child(void)
+{
+	if (!staging.running)
+		return;
+
+	pthread_mutex_init(&staging.mutex, NULL);
+	pthread_cond_init(&staging.work, NULL);
+	pthread_cond_init(&staging.space, NULL);
+	staging.tail = staging.head;
+	staging.stop = false;
+
+	if (pthread_create(&staging.writer, NULL, staging_writer, NULL)) {
+		fprintf(stderr, "intel_aubdump: failed to start writer thread "
+			"in child, writing directly\n");
+		staging.running = false;
+		staging.direct = true;
+	}
+}
+
+static void
+staging_init(void)
+{
+	staging.data = mmap(NULL, STAGING_SIZE, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	fail_if(staging.data == MAP_FAILED,
+		"intel_aubdump: failed to allocate staging buffer\n");
+
+	fail_if(pthread_create(&staging.writer, NULL, staging_writer, NULL),
+		"intel_aubdump: failed to start writer thread\n");
+	staging.running = true;
+
+	fail_if(pthread_atfork(NULL, NULL, staging_atfork_child),
+		"intel_aubdump: failed to register fork handler\n");
+}
+
+static void
+staging_fini(void)
+{
+	if (!staging.running)
+		return;
+
+	pthread_mutex_lock(&staging.mutex);
+	staging.stop = true;
+	pthread_cond_signal(&staging.work);
+	pthread_mutex_unlock(&staging.mutex);
+
+	pthread_join(staging.writer, NULL);
+	staging.running = false;
 }
 
 static void
 data_out(const void *data, size_t size)
 {
-	if (size == 0)
+	if (!staging.running) {
+		if (staging.direct)
+			output_write(data, size);
 		return;
+	}
 
-	for (int i = 0; i < ARRAY_SIZE (files); i++) {
-		if (files[i] == NULL)
+	while (size) {
+		uint64_t tail = __atomic_load_n(&staging.tail, __ATOMIC_ACQUIRE);
+		size_t offset = staging.head % STAGING_SIZE;
+		size_t len = STAGING_SIZE - (staging.head - tail);
+
+		if (len == 0) {
+			pthread_mutex_lock(&staging.mutex);
+			pthread_cond_signal(&staging.work);
+			while (staging.head - staging.tail == STAGING_SIZE)
+				pthread_cond_wait(&staging.space, &staging.mutex);
+			pthread_mutex_unlock(&staging.mutex);
 			continue;
+		}
+
+		if (len > STAGING_SIZE - offset)
+			len = STAGING_SIZE - offset;
+		if (len > size)
+			len = size;
+
+		memcpy(staging.data + offset, data, len);
+		__atomic_store_n(&staging.head, staging.head + len,
+				 __ATOMIC_RELEASE);
 
-		fail_if(fwrite(data, 1, size, files[i]) == 0,
-			"Writing to output failed\n");
+		data = (const uint8_t *) data + len;
+		size -= len;
 	}
 }
 
+static void
+dword_out(uint32_t data)
+{
+	data_out(&data, 4);
+}
+
 static uint32_t
 gtt_entry_size(void)
 {
@@ -261,6 +526,69 @@ aub_write_trace_block(uint32_t type, void *virtual, uint32_t size, uint64_t gtt_
 	}
 }
 
+static uint64_t
+hash_data(const void *data, uint32_t size)
+{
+	const uint64_t prime = 0x100000001b3ull;
+	const uint8_t *p = data;
+	uint64_t h[4] = {
+		0xcbf29ce484222325ull, 0x84222325cbf29ce4ull,
+		0x9ce484222325cbf2ull, 0x2325cbf29ce48422ull,
+	};
+	uint32_t i = 0;
+
+	/* Four independent lanes of 64-bit words, then the tail bytewise. */
+	for (; i + 32 <= size; i += 32) {
+		for (int j = 0; j < 4; j++) {
+			uint64_t w;
+
+			memcpy(&w, p + i + 8 * j, 8);
+			h[j] = (h[j] ^ w) * prime;
+			h[j] ^= h[j] >> 29;
+		}
+	}
+	for (; i < size; i++)
+		h[0] = (h[0] ^ p[i]) * prime;
+
+	return (h[0] ^ (h[1] * 3) ^ (h[2] * 5) ^ (h[3] * 7) ^ size) * prime;
+}
+
+/*
+ * Returns whether the buffer contents have to be written out, false if the
+ * same bytes were last written at the same GTT offset and nothing has been
+ * written over them since.
+ */
+static bool
+bo_dump_needed(struct bo *bo, uint32_t handle, const void *data)
+{
+	uint64_t first = bo->offset >> 12;
+	uint64_t last = (bo->offset + bo->size - 1) >> 12;
+	uint64_t hash;
+	bool owned;
+
+	if (data == NULL || bo->size == 0 || last >= MAX_DEDUP_PAGES)
+		return true;
+
+	hash = hash_data(GET_PTR(data), bo->size);
+
+	owned = bo->dumped && bo->dump_offset == bo->offset &&
+		bo->hash == hash;
+	for (uint64_t p = first; owned && p <= last; p++)
+		owned = page_owner[p] == handle;
+
+	if (owned)
+		return false;
+
+	for (uint64_t p = first; p <= last; p++)
+		page_owner[p] = handle;
+
+	bo->dumped = true;
+	bo->dump_offset = bo->offset;
+	bo->hash = hash;
+
+	return true;
+}
+
 static void
 aub_dump_ringbuffer(uint64_t batch_offset, uint64_t offset, int ring_flag)
 {
@@ -297,6 +625,12 @@ aub_dump_ringbuffer(uint64_t batch_offset, uint64_t offset, int ring_flag)
 		dword_out(offset >> 32);
 
 	data_out(ringbuffer, ring_count * 4);
+
+	/* The next exec may place a buffer where this ring now is. */
+	for (uint64_t p = offset >> 12;
+	     p <= (offset + ring_count * 4 - 1) >> 12 && p < MAX_DEDUP_PAGES;
+	     p++)
+		page_owner[p] = PAGE_OWNER_RING;
 }
 
 static void
@@ -396,6 +730,34 @@ gem_get_param(int fd, uint32_t param)
 	return value;
 }
 
+static void
+capture_signal(int sig)
+{
+	capture_toggle = 1;
+}
+
+static void
+update_capture(void)
+{
+	bool was_capturing = capturing;
+
+	if (capture_toggle) {
+		capture_toggle = 0;
+		capturing = !capturing;
+	}
+	if (exec_count == capture_start)
+		capturing = true;
+	if (exec_count == capture_stop)
+		capturing = false;
+
+	if (verbose && capturing != was_capturing)
+		printf("[intel_aubdump: capture %s at execbuffer %llu]\n",
+		       capturing ? "started" : "stopped",
+		       (unsigned long long) exec_count);
+
+	exec_count++;
+}
+
 static void
 dump_execbuffer2(int fd, struct drm_i915_gem_execbuffer2 *execbuffer2)
 {
@@ -422,6 +784,8 @@ dump_execbuffer2(int fd, struct drm_i915_gem_execbuffer2 *execbuffer2)
 			       filename, device, gen);
 	}
 
+	update_capture();
+
 	for (uint32_t i = 0; i < execbuffer2->buffer_count; i++) {
 		obj = &exec_objects[i];
 		bo = get_bo(obj->handle);
@@ -433,11 +797,17 @@ dump_execbuffer2(int fd, struct drm_i915_gem_execbuffer2 *execbuffer2)
 			offset = align_u32(offset + bo->size + 4095, 4096);
 		}
 
+		if (!capturing)
+			continue;
+
 		if (bo->map == NULL && bo->size > 0)
 			bo->map = gem_mmap(fd, obj->handle, 0, bo->size);
 		fail_if(bo->map == MAP_FAILED, "intel_aubdump: bo mmap failed\n");
 	}
 
+	if (!capturing)
+		return;
+
 	batch_bo = get_bo(exec_objects[execbuffer2->buffer_count - 1].handle);
 	for (uint32_t i = 0; i < execbuffer2->buffer_count; i++) {
 		obj = &exec_objects[i];
@@ -448,12 +818,17 @@ dump_execbuffer2(int fd, struct drm_i915_gem_execbuffer2 *execbuffer2)
 		else
 			data = bo->map;
 
-		if (bo == batch_bo) {
+		if (!bo_dump_needed(bo, obj->handle, data)) {
+			dedup_saved += bo->size;
+			dedup_skipped++;
+		} else if (bo == batch_bo) {
 			aub_write_trace_block(AUB_TRACE_TYPE_BATCH,
 					      data, bo->size, bo->offset);
+			dedup_written += bo->size;
 		} else {
 			aub_write_trace_block(AUB_TRACE_TYPE_NOTYPE,
 					      data, bo->size, bo->offset);
+			dedup_written += bo->size;
 		}
 		if (data != bo->map)
 			free(data);
@@ -463,10 +838,7 @@ dump_execbuffer2(int fd, struct drm_i915_gem_execbuffer2 *execbuffer2)
 	aub_dump_ringbuffer(batch_bo->offset + execbuffer2->batch_start_offset,
 			    offset, ring_flag);
 
-	for (int i = 0; i < ARRAY_SIZE(files); i++) {
-		if (files[i] != NULL)
-			fflush(files[i]);
-	}
+	staging_kick();
 }
 
 static void
@@ -478,6 +850,7 @@ add_new_bo(int handle, uint64_t size, void *map)
 
 	bo->size = size;
 	bo->map = map;
+	bo->dumped = false;
 }
 
 static void
@@ -488,6 +861,7 @@ remove_bo(int handle)
 	if (bo->map && !IS_USERPTR(bo->map))
 		munmap(bo->map, bo->size);
 	bo->map = NULL;
+	bo->dumped = false;
 }
 
 int
@@ -549,6 +923,42 @@ maybe_init(void)
 	while (fscanf(config, "%m[^=]=%m[^\n]\n", &key, &value) != EOF) {
 		if (!strcmp(key, "verbose")) {
 			verbose = 1;
+		} else if (!strcmp(key, "dedup-stats")) {
+			dedup_stats = true;
+		} else if (!strcmp(key, "compressed")) {
+			compressed_file = fopen(value, "w");
+			fail_if(compressed_file == NULL,
+				"intel_aubdump: failed to open file '%s'\n",
+				value);
+		} else if (!strcmp(key, "capture-start")) {
+			fail_if(sscanf(value, "%llu",
+				       (unsigned long long *) &capture_start) != 1,
+				"intel_aubdump: failed to parse capture start '%s'\n",
+				value);
+			capturing = false;
+		} else if (!strcmp(key, "capture-stop")) {
+			fail_if(sscanf(value, "%llu",
+				       (unsigned long long *) &capture_stop) != 1,
+				"intel_aubdump: failed to parse capture stop '%s'\n",
+				value);
+		} else if (!strcmp(key, "capture-signal")) {
+			struct sigaction sa = { .sa_handler = capture_signal };
+			int sig;
+
+			if (!strcmp(value, "USR1"))
+				sig = SIGUSR1;
+			else if (!strcmp(value, "USR2"))
+				sig = SIGUSR2;
+			else
+				fail_if(sscanf(value, "%i", &sig) != 1,
+					"intel_aubdump: failed to parse signal '%s'\n",
+					value);
+
+			sa.sa_flags = SA_RESTART;
+			fail_if(sigaction(sig, &sa, NULL),
+				"intel_aubdump: failed to install handler for signal %d\n",
+				sig);
+			capturing = false;
 		} else if (!strcmp(key, "device")) {
 			fail_if(sscanf(value, "%i", &device) != 1,
 				"intel_aubdump: failed to parse device id '%s'",
@@ -574,8 +984,14 @@ maybe_init(void)
 	}
 	fclose(config);
 
+	if (files[0] != NULL || files[1] != NULL || compressed_file != NULL)
+		staging_init();
+
 	bos = calloc(MAX_BO_COUNT, sizeof(bos[0]));
 	fail_if(bos == NULL, "intel_aubdump: out of memory\n");
+
+	page_owner = calloc(MAX_DEDUP_PAGES, sizeof(page_owner[0]));
+	fail_if(page_owner == NULL, "intel_aubdump: out of memory\n");
 }
 
 #define LOCAL_IOCTL_I915_GEM_EXECBUFFER2_WR \
@@ -738,10 +1154,24 @@ ioctl_init_helper(int fd, unsigned long request, ...)
 static void __attribute__ ((destructor))
 fini(void)
 {
+	staging_fini();
+
+	if (dedup_stats)
+		fprintf(stderr, "intel_aubdump: %llu bytes of buffers written, "
+			"%llu bytes (%.1f%%) in %llu unchanged buffers skipped\n",
+			(unsigned long long) dedup_written,
+			(unsigned long long) dedup_saved,
+			dedup_written + dedup_saved ?
+			100.0 * dedup_saved / (dedup_written + dedup_saved) : 0,
+			(unsigned long long) dedup_skipped);
+
 	free(filename);
 	for (int i = 0; i < ARRAY_SIZE(files); i++) {
 		if (files[i] != NULL)
 			fclose(files[i]);
 	}
+	if (compressed_file != NULL)
+		fclose(compressed_file);
+	free(page_owner);
 	free(bos);
 }
@@ -0,0 +1,797 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Sorts a corpus of i915 error states into buckets of hangs with the same
+ * signature: the hung engine, the instruction in IPEHR and at the hang
+ * point, the busy units of INSTDONE and the decoded fault registers.
+ *
+ * The error states are read a line at a time by a pool of threads. Only
+ * the registers and the one buffer around ACTHD of the hung engine are
+ * decoded, and nothing but the signature is kept once a file is done, so
+ * memory use does not depend on the size of the error states.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <getopt.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "intel_chipset.h"
+#include "drmtest.h"
+#include "intel_error_state.h"
+
+#define MAX_ENGINES 16
+#define DEFAULT_EXAMPLES 3
+
+struct engine_regs {
+	char name[32];
+	uint32_t head;
+	uint64_t acthd;
+	uint32_t ipehr;
+	uint32_t instdone;
+	uint32_t fault_reg;
+	bool has_ipehr;
+	bool has_instdone;
+	bool has_fault_reg;
+	bool hung;
+};
+
+/* What is kept of an error state while it is being read */
+struct hang {
+	uint32_t devid;
+	char reason[32];
+
+	struct engine_regs engine[MAX_ENGINES];
+	int num_engines;
+	bool in_engine;
+
+	uint32_t instdone1, error, pgtbl_er, fault_reg;
+	bool has_instdone1, has_error, has_pgtbl_er, has_fault_reg;
+
+	struct engine_regs *hung; /* chosen at the first buffer */
+
+	/* the instruction at the hang, from the batch or else the ring */
+	uint32_t batch_dw, ring_dw;
+	bool has_batch_dw, has_ring_dw;
+};
+
+struct bucket {
+	struct bucket *next;
+	char *signature;
+	uint64_t hash;
+	unsigned int count;
+	int *examples; /* indices into files[], lowest first */
+	unsigned int num_examples;
+};
+
+static struct {
+	char **paths;
+	int count, size;
+} files;
+
+static struct {
+	pthread_mutex_t mutex;
+	struct bucket **table;
+	unsigned int size;
+	unsigned int count;
+} buckets = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static unsigned int max_examples = DEFAULT_EXAMPLES;
+static int next_file;
+
+static const char *mi_names[64] = {
+	[0x00] = "MI_NOOP",
+	[0x02] = "MI_USER_INTERRUPT",
+	[0x03] = "MI_WAIT_FOR_EVENT",
+	[0x04] = "MI_FLUSH",
+	[0x05] = "MI_ARB_CHECK",
+	[0x07] = "MI_REPORT_HEAD",
+	[0x08] = "MI_ARB_ON_OFF",
+	[0x0a] = "MI_BATCH_BUFFER_END",
+	[0x0b] = "MI_SUSPEND_FLUSH",
+	[0x0c] = "MI_PREDICATE",
+	[0x0d] = "MI_TOPOLOGY_FILTER",
+	[0x11] = "MI_OVERLAY_FLIP",
+	[0x12] = "MI_LOAD_SCAN_LINES_INCL",
+	[0x14] = "MI_DISPLAY_FLIP",
+	[0x16] = "MI_SEMAPHORE_MBOX",
+	[0x18] = "MI_SET_CONTEXT",
+	[0x1a] = "MI_MATH",
+	[0x1b] = "MI_SEMAPHORE_SIGNAL",
+	[0x1c] = "MI_SEMAPHORE_WAIT",
+	[0x20] = "MI_STORE_DATA_IMM",
+	[0x21] = "MI_STORE_DATA_INDEX",
+	[0x22] = "MI_LOAD_REGISTER_IMM",
+	[0x23] = "MI_UPDATE_GTT",
+	[0x24] = "MI_STORE_REGISTER_MEM",
+	[0x26] = "MI_FLUSH_DW",
+	[0x27] = "MI_CLFLUSH",
+	[0x28] = "MI_REPORT_PERF_COUNT",
+	[0x29] = "MI_LOAD_REGISTER_MEM",
+	[0x2a] = "MI_LOAD_REGISTER_REG",
+	[0x30] = "MI_BATCH_BUFFER",
+	[0x31] = "MI_BATCH_BUFFER_START",
+	[0x36] = "MI_CONDITIONAL_BATCH_BUFFER_END",
+};
+
+static const struct {
+	uint32_t opcode; /* bits 28:16 of the header */
+	const char *name;
+} gfx_names[] = {
+	{ 0x0101, "STATE_BASE_ADDRESS" },
+	{ 0x0904, "PIPELINE_SELECT" },
+	{ 0x1004, "MEDIA_STATE_FLUSH" },
+	{ 0x1100, "MEDIA_OBJECT" },
+	{ 0x1105, "GPGPU_WALKER" },
+	{ 0x1a00, "PIPE_CONTROL" },
+	{ 0x1b00, "3DPRIMITIVE" },
+};
+
+/*
+ * Name an instruction by its header alone, without the operands, which are
+ * mostly addresses and so differ between otherwise identical hangs.
+ */
+static void
+print_instruction(FILE *out, uint32_t header)
+{
+	unsigned int i;
+
+	switch (header >> 29) {
+	case 0:
+		if (mi_names[header >> 23 & 0x3f])
+			fprintf(out, "%s", mi_names[header >> 23 & 0x3f]);
+		else
+			fprintf(out, "MI 0x%02x", header >> 23 & 0x3f);
+		break;
+	case 2:
+		fprintf(out, "BLT 0x%02x", header >> 22 & 0x7f);
+		break;
+	case 3:
+		for (i = 0; i < ARRAY_SIZE(gfx_names); i++) {
+			if (gfx_names[i].opcode == (header >> 16 & 0x1fff)) {
+				fprintf(out, "%s", gfx_names[i].name);
+				return;
+			}
+		}
+		fprintf(out, "3D(%d, %d, 0x%02x)",
+			header >> 27 & 3, header >> 24 & 7, header >> 16 & 0xff);
+		break;
+	default:
+		fprintf(out, "unknown 0x%08x", header);
+		break;
+	}
+}
+
+static struct engine_regs *
+current_engine(struct hang *h)
+{
+	return h->in_engine ? &h->engine[h->num_engines - 1] : NULL;
+}
+
+static void
+parse_register(struct hang *h, const char *line)
+{
+	struct engine_regs *e;
+	unsigned int reg, hi, lo;
+	const char *str;
+	int matched;
+
+	str = strstr(line, " command stream:");
+	if (str) {
+		h->in_engine = h->num_engines < MAX_ENGINES;
+		if (!h->in_engine)
+			return;
+
+		e = &h->engine[h->num_engines++];
+		memset(e, 0, sizeof(*e));
+		e->acthd = -1;
+		line += strspn(line, " ");
+		snprintf(e->name, sizeof(e->name), "%.*s",
+			 (int)(str - line), line);
+		return;
+	}
+
+	/* The registers of an engine are indented */
+	if (line[0] != ' ')
+		h->in_engine = false;
+	e = current_engine(h);
+
+	str = strstr(line, "ang on ");
+	if (str && !h->reason[0]) {
+		str += strlen("ang on ");
+		snprintf(h->reason, sizeof(h->reason), "%.*s",
+			 (int)strcspn(str, ", \n"), str);
+		return;
+	}
+
+	if (parse_pci_id(line, &h->devid))
+		return;
+
+	if (e) {
+		if (strstr(line, "hangcheck") && strstr(line, "hung")) {
+			e->hung = true;
+			return;
+		}
+
+		if (sscanf(line, "  HEAD: 0x%08x\n", &reg) == 1) {
+			e->head = reg & (0x7ffff << 2);
+			return;
+		}
+
+		matched = sscanf(line, "  ACTHD: 0x%08x %08x\n", &hi, &lo);
+		if (matched > 0) {
+			e->acthd = hi;
+			if (matched == 2)
+				e->acthd = (uint64_t)hi << 32 | lo;
+			return;
+		}
+
+		if (sscanf(line, "  IPEHR: 0x%08x\n", &reg) == 1) {
+			e->ipehr = reg;
+			e->has_ipehr = true;
+			return;
+		}
+
+		if (sscanf(line, "  INSTDONE: 0x%08x\n", &reg) == 1) {
+			e->instdone = reg;
+			e->has_instdone = true;
+			return;
+		}
+
+		if (sscanf(line, "  FAULT_REG: 0x%08x\n", &reg) == 1) {
+			e->fault_reg = reg;
+			e->has_fault_reg = true;
+			return;
+		}
+
+		return;
+	}
+
+	if (sscanf(line, "  INSTDONE1: 0x%08x\n", &reg) == 1) {
+		h->instdone1 = reg;
+		h->has_instdone1 = true;
+	} else if (sscanf(line, "  ERROR: 0x%08x\n", &reg) == 1) {
+		h->error = reg;
+		h->has_error = true;
+	} else if (sscanf(line, "  PGTBL_ER: 0x%08x\n", &reg) == 1) {
+		h->pgtbl_er = reg;
+		h->has_pgtbl_er = true;
+	} else if (sscanf(line, "  FAULT_REG: 0x%08x\n", &reg) == 1) {
+		h->fault_reg = reg;
+		h->has_fault_reg = true;
+	}
+}
+
+/*
+ * The engine the kernel blamed in its "GPU HANG" line, else the first one
+ * hangcheck declared hung, else the first one.
+ */
+static struct engine_regs *
+find_hung_engine(struct hang *h)
+{
+	int i;
+
+	if (!h->num_engines)
+		return NULL;
+
+	for (i = 0; h->reason[0] && i < h->num_engines; i++) {
+		if (!strcmp(h->engine[i].name, h->reason))
+			return &h->engine[i];
+	}
+
+	for (i = 0; i < h->num_engines; i++) {
+		if (h->engine[i].hung)
+			return &h->engine[i];
+	}
+
+	return &h->engine[0];
+}
+
+/* Older kernels name the buffers "render ring" but the registers "render" */
+static bool
+same_engine(const struct engine_regs *e, const char *ring_name)
+{
+	size_t len = strlen(e->name);
+
+	return !strncmp(ring_name, e->name, len) &&
+		(ring_name[len] == '\0' || ring_name[len] == ' ');
+}
+
+/* Look for the hang in the @count dwords at byte @offset of a buffer */
+static void
+find_instruction(struct hang *h, const struct buffer_kind *kind,
+		 uint64_t gtt_offset, uint32_t offset,
+		 const uint32_t *data, int count)
+{
+	uint64_t acthd = h->hung->acthd - gtt_offset;
+	uint32_t head = h->hung->head;
+
+	if (h->hung->acthd >= gtt_offset &&
+	    acthd >= offset && acthd - offset < 4ull * count) {
+		if (kind == buffer_kinds) {
+			h->ring_dw = data[(acthd - offset) / 4];
+			h->has_ring_dw = true;
+		} else {
+			h->batch_dw = data[(acthd - offset) / 4];
+			h->has_batch_dw = true;
+		}
+		return;
+	}
+
+	if (kind == buffer_kinds && !h->has_ring_dw &&
+	    head >= offset && head - offset < 4ull * count) {
+		h->ring_dw = data[(head - offset) / 4];
+		h->has_ring_dw = true;
+	}
+}
+
+static bool
+parse_file(const char *path, struct hang *h)
+{
+	const struct buffer_kind *kind = NULL;
+	uint64_t gtt_offset = 0;
+	uint32_t *data = NULL;
+	size_t line_size = 0;
+	char *line = NULL;
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file)
+		return false;
+
+	memset(h, 0, sizeof(*h));
+	h->devid = PCI_CHIP_I855_GM;
+
+	while (getline(&line, &line_size, file) > 0) {
+		uint32_t offset, value;
+		char *dashes;
+
+		if (line[0] == ':' || line[0] == '~') {
+			int count;
+
+			if (!kind)
+				continue;
+
+			/* Only a batch that starts below ACTHD can hold it */
+			if (kind != buffer_kinds && h->hung->acthd < gtt_offset)
+				continue;
+
+			count = ascii85_decode(line + 1, &data, line[0] == ':');
+			find_instruction(h, kind, gtt_offset, 0, data, count);
+			free(data);
+			data = NULL;
+			continue;
+		}
+
+		dashes = strstr(line, "---");
+		if (dashes) {
+			/* The registers come first, so the hang is known now */
+			if (!h->hung)
+				h->hung = find_hung_engine(h);
+			if (!h->hung)
+				break;
+
+			/* Only the ring and the batch, "<ring> --- <kind>" */
+			gtt_offset = 0;
+			kind = match_buffer(dashes, &gtt_offset);
+			if (kind != &buffer_kinds[0] && kind != &buffer_kinds[1])
+				kind = NULL;
+
+			if (dashes > line)
+				dashes[-1] = '\0';
+			if (kind && !same_engine(h->hung, line))
+				kind = NULL;
+			continue;
+		}
+
+		if (sscanf(line, "%08x : %08x", &offset, &value) == 2) {
+			if (kind)
+				find_instruction(h, kind, gtt_offset, offset,
+						 &value, 1);
+			continue;
+		}
+
+		kind = NULL;
+		if (!h->hung)
+			parse_register(h, line);
+	}
+
+	if (!h->hung)
+		h->hung = find_hung_engine(h);
+
+	free(line);
+	fclose(file);
+	return true;
+}
+
+/* Append the output of a register decoder, less the addresses and counts */
+static void
+append_decoded(FILE *out, const char *name, char *text)
+{
+	char *line, *save;
+
+	for (line = strtok_r(text, "\n", &save); line;
+	     line = strtok_r(NULL, "\n", &save)) {
+		if (strstr(line, "0x") || strstr(line, "pending"))
+			continue;
+
+		fprintf(out, "%s: %s\n", name, line + strspn(line, " "));
+	}
+}
+
+#define DECODE(out, name, fn, ...) do { \
+	char *text__ = NULL; \
+	size_t size__ = 0; \
+	FILE *f__ = open_memstream(&text__, &size__); \
+	if (!f__) \
+		break; \
+	fn(f__, __VA_ARGS__); \
+	fclose(f__); \
+	append_decoded(out, name, text__); \
+	free(text__); \
+} while (0)
+
+static char *
+hang_signature(const struct hang *h)
+{
+	const struct engine_regs *e = h->hung;
+	char *sig = NULL;
+	size_t size = 0;
+	FILE *out;
+
+	out = open_memstream(&sig, &size);
+	if (!out)
+		return NULL;
+
+	if (!e) {
+		fprintf(out, "no hang recorded\n");
+		fclose(out);
+		return sig;
+	}
+
+	fprintf(out, "gen%d %s\n", intel_gen(h->devid), e->name);
+
+	if (e->has_ipehr) {
+		fprintf(out, "IPEHR: ");
+		print_instruction(out, e->ipehr);
+		fprintf(out, "\n");
+	}
+
+	if (h->has_batch_dw || h->has_ring_dw) {
+		fprintf(out, "at %s: ", h->has_batch_dw ? "batch" : "ring");
+		print_instruction(out, h->has_batch_dw ?
+				  h->batch_dw : h->ring_dw);
+		fprintf(out, "\n");
+	}
+
+	if (e->has_instdone)
+		DECODE(out, "INSTDONE", print_instdone,
+		       h->devid, e->instdone, -1);
+	if (h->has_instdone1)
+		DECODE(out, "INSTDONE1", print_instdone,
+		       h->devid, -1, h->instdone1);
+
+	if (e->has_fault_reg && e->fault_reg)
+		DECODE(out, "FAULT_REG", print_fault_reg, h->devid, e->fault_reg);
+	if (h->has_fault_reg && h->fault_reg)
+		DECODE(out, "FAULT_REG", print_fault_reg, h->devid, h->fault_reg);
+	if (h->has_error && h->error)
+		DECODE(out, "ERROR", print_error, h->error, h->devid);
+	if (h->has_pgtbl_er && h->pgtbl_er)
+		DECODE(out, "PGTBL_ER", print_pgtbl_err, h->pgtbl_er, h->devid);
+
+	fclose(out);
+	return sig;
+}
+
+static uint64_t hash_string(const char *str)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	while (*str) {
+		hash ^= (unsigned char)*str++;
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static void bucket_resize(void)
+{
+	unsigned int size = buckets.size ? 2 * buckets.size : 256;
+	struct bucket **table;
+	unsigned int i;
+
+	table = calloc(size, sizeof(*table));
+	if (!table)
+		return;
+
+	for (i = 0; i < buckets.size; i++) {
+		struct bucket *b, *next;
+
+		for (b = buckets.table[i]; b; b = next) {
+			next = b->next;
+			b->next = table[b->hash & (size - 1)];
+			table[b->hash & (size - 1)] = b;
+		}
+	}
+
+	free(buckets.table);
+	buckets.table = table;
+	buckets.size = size;
+}
+
+static void bucket_add(char *signature, int file)
+{
+	uint64_t hash = hash_string(signature);
+	struct bucket *b;
+	unsigned int i;
+
+	pthread_mutex_lock(&buckets.mutex);
+
+	if (buckets.count >= buckets.size)
+		bucket_resize();
+
+	for (b = buckets.table[hash & (buckets.size - 1)]; b; b = b->next) {
+		if (b->hash == hash && !strcmp(b->signature, signature))
+			break;
+	}
+
+	if (!b) {
+		b = calloc(1, sizeof(*b));
+		if (b)
+			b->examples = calloc(max_examples,
+					     sizeof(*b->examples));
+		if (!b || !b->examples) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+
+		b->signature = signature;
+		b->hash = hash;
+		b->next = buckets.table[hash & (buckets.size - 1)];
+		buckets.table[hash & (buckets.size - 1)] = b;
+		buckets.count++;
+	} else {
+		free(signature);
+	}
+
+	b->count++;
+
+	/* Keep the first files in path order, whichever thread read them */
+	for (i = 0; i < b->num_examples; i++) {
+		if (file < b->examples[i])
+			break;
+	}
+	if (i < max_examples) {
+		if (b->num_examples < max_examples)
+			b->num_examples++;
+		memmove(b->examples + i + 1, b->examples + i,
+			(b->num_examples - i - 1) * sizeof(*b->examples));
+		b->examples[i] = file;
+	}
+
+	pthread_mutex_unlock(&buckets.mutex);
+}
+
+static void *worker(void *arg)
+{
+	struct hang *h;
+	int i;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return NULL;
+
+	while ((i = __sync_fetch_and_add(&next_file, 1)) < files.count) {
+		char *signature;
+
+		if (!parse_file(files.paths[i], h)) {
+			fprintf(stderr, "Failed to open %s: %s\n",
+				files.paths[i], strerror(errno));
+			continue;
+		}
+
+		signature = hang_signature(h);
+		if (signature)
+			bucket_add(signature, i);
+	}
+
+	free(h);
+	return NULL;
+}
+
+static int add_file(const char *path, const struct stat *st, int type,
+		    struct FTW *ftw)
+{
+	if (type != FTW_F || !S_ISREG(st->st_mode))
+		return 0;
+
+	if (files.count == files.size) {
+		files.size = files.size ? 2 * files.size : 1024;
+		files.paths = realloc(files.paths,
+				      files.size * sizeof(*files.paths));
+		if (!files.paths) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+
+	files.paths[files.count++] = strdup(path);
+	return 0;
+}
+
+static int cmp_path(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int cmp_bucket(const void *A, const void *B)
+{
+	const struct bucket *a = *(struct bucket * const *)A;
+	const struct bucket *b = *(struct bucket * const *)B;
+
+	if (a->count != b->count)
+		return a->count > b->count ? -1 : 1;
+
+	return a->examples[0] - b->examples[0];
+}
+
+static void report(void)
+{
+	struct bucket **sorted;
+	unsigned int i, j, n = 0;
+	unsigned int total = 0;
+
+	sorted = calloc(buckets.count, sizeof(*sorted));
+	if (!sorted && buckets.count)
+		return;
+
+	for (i = 0; i < buckets.size; i++) {
+		struct bucket *b;
+
+		for (b = buckets.table[i]; b; b = b->next) {
+			sorted[n++] = b;
+			total += b->count;
+		}
+	}
+	qsort(sorted, n, sizeof(*sorted), cmp_bucket);
+
+	printf("%u error states, %u signatures\n", total, n);
+
+	for (i = 0; i < n; i++) {
+		const struct bucket *b = sorted[i];
+		char *line, *save;
+
+		printf("\n[%u] %u (%.1f%%)\n",
+		       i + 1, b->count, 100. * b->count / total);
+
+		for (line = strtok_r(b->signature, "\n", &save); line;
+		     line = strtok_r(NULL, "\n", &save))
+			printf("    %s\n", line);
+
+		for (j = 0; j < b->num_examples; j++)
+			printf("  %s %s\n", j ? "    " : "e.g.",
+			       files.paths[b->examples[j]]);
+	}
+
+	free(sorted);
+}
+
+static void usage(FILE *out, const char *name)
+{
+	fprintf(out,
+		"Usage: %s [options] <file or directory>...\n"
+		"\n"
+		"Buckets the i915 error states found in the given files and directories\n"
+		"by the signature of their hang.\n"
+		"\n"
+		"Options:\n"
+		"  -j, --threads=N   number of files to read in parallel (default: one per cpu)\n"
+		"  -e, --examples=N  number of files listed for each signature (default: %d)\n"
+		"  -h, --help        show this help\n",
+		name, DEFAULT_EXAMPLES);
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "threads", required_argument, 0, 'j' },
+		{ "examples", required_argument, 0, 'e' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0 },
+	};
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *threads;
+	int c, i;
+
+	while ((c = getopt_long(argc, argv, "j:e:h",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'j':
+			num_threads = atoi(optarg);
+			break;
+		case 'e':
+			max_examples = atoi(optarg);
+			break;
+		case 'h':
+			usage(stdout, argv[0]);
+			return 0;
+		default:
+			usage(stderr, argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind == argc) {
+		usage(stderr, argv[0]);
+		return 1;
+	}
+
+	if (num_threads < 1)
+		num_threads = 1;
+	if (max_examples < 1)
+		max_examples = 1;
+
+	for (i = optind; i < argc; i++) {
+		if (nftw(argv[i], add_file, 16, FTW_PHYS)) {
+			fprintf(stderr, "Failed to read %s: %s\n",
+				argv[i], strerror(errno));
+			return 1;
+		}
+	}
+	qsort(files.paths, files.count, sizeof(*files.paths), cmp_path);
+
+	if (num_threads > files.count)
+		num_threads = files.count ? files.count : 1;
+
+	threads = calloc(num_threads, sizeof(*threads));
+	if (!threads)
+		return 1;
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, worker, NULL))
+			break;
+	}
+	if (i == 0)
+		worker(NULL);
+	while (i--)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	report();
+
+	return 0;
+}
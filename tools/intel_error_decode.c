@@ -48,16 +48,18 @@
 #include <inttypes.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <getopt.h>
 #include <err.h>
 #include <assert.h>
+#include <pthread.h>
 #include <intel_bufmgr.h>
-#include <zlib.h>
 
 #include "intel_chipset.h"
 #include "intel_io.h"
-#include "instdone.h"
 #include "intel_reg.h"
 #include "drmtest.h"
+#include "intel_error_state.h"
 
 static uint32_t
 print_head(unsigned int reg)
@@ -91,233 +93,6 @@ print_acthd(unsigned int reg, unsigned int ring_length)
 		printf("    at batch: 0x%08x\n", reg);
 }
 
-static void
-print_instdone(uint32_t devid, unsigned int instdone, unsigned int instdone1)
-{
-	int i;
-	static int once;
-
-	if (!once) {
-		if (!init_instdone_definitions(devid))
-			return;
-		once = 1;
-	}
-
-	for (i = 0; i < num_instdone_bits; i++) {
-		int busy = 0;
-
-		if (instdone_bits[i].reg == INSTDONE_1) {
-			if (!(instdone1 & instdone_bits[i].bit))
-				busy = 1;
-		} else {
-			if (!(instdone & instdone_bits[i].bit))
-				busy = 1;
-		}
-
-		if (busy)
-			printf("    busy: %s\n", instdone_bits[i].name);
-	}
-}
-
-static void
-print_i830_pgtbl_err(unsigned int reg)
-{
-	const char *str;
-
-	switch((reg >> 3) & 0xf) {
-	case 0x1: str = "Overlay TLB"; break;
-	case 0x2: str = "Display A TLB"; break;
-	case 0x3: str = "Host TLB"; break;
-	case 0x4: str = "Render TLB"; break;
-	case 0x5: str = "Display C TLB"; break;
-	case 0x6: str = "Mapping TLB"; break;
-	case 0x7: str = "Command Stream TLB"; break;
-	case 0x8: str = "Vertex Buffer TLB"; break;
-	case 0x9: str = "Display B TLB"; break;
-	case 0xa: str = "Reserved System Memory"; break;
-	case 0xb: str = "Compressor TLB"; break;
-	case 0xc: str = "Binner TLB"; break;
-	default: str = "unknown"; break;
-	}
-
-	if (str)
-		printf("    source = %s\n", str);
-
-	switch(reg & 0x7) {
-	case 0x0: str  = "Invalid GTT"; break;
-	case 0x1: str = "Invalid GTT PTE"; break;
-	case 0x2: str = "Invalid Memory"; break;
-	case 0x3: str = "Invalid TLB miss"; break;
-	case 0x4: str = "Invalid PTE data"; break;
-	case 0x5: str = "Invalid LocalMemory not present"; break;
-	case 0x6: str = "Invalid Tiling"; break;
-	case 0x7: str = "Host to CAM"; break;
-	}
-	printf("    error = %s\n", str);
-}
-
-static void
-print_i915_pgtbl_err(unsigned int reg)
-{
-	if (reg & (1 << 29))
-		printf("    Cursor A: Invalid GTT PTE\n");
-	if (reg & (1 << 28))
-		printf("    Cursor B: Invalid GTT PTE\n");
-	if (reg & (1 << 27))
-		printf("    MT: Invalid tiling\n");
-	if (reg & (1 << 26))
-		printf("    MT: Invalid GTT PTE\n");
-	if (reg & (1 << 25))
-		printf("    LC: Invalid tiling\n");
-	if (reg & (1 << 24))
-		printf("    LC: Invalid GTT PTE\n");
-	if (reg & (1 << 23))
-		printf("    BIN VertexData: Invalid GTT PTE\n");
-	if (reg & (1 << 22))
-		printf("    BIN Instruction: Invalid GTT PTE\n");
-	if (reg & (1 << 21))
-		printf("    CS VertexData: Invalid GTT PTE\n");
-	if (reg & (1 << 20))
-		printf("    CS Instruction: Invalid GTT PTE\n");
-	if (reg & (1 << 19))
-		printf("    CS: Invalid GTT\n");
-	if (reg & (1 << 18))
-		printf("    Overlay: Invalid tiling\n");
-	if (reg & (1 << 16))
-		printf("    Overlay: Invalid GTT PTE\n");
-	if (reg & (1 << 14))
-		printf("    Display C: Invalid tiling\n");
-	if (reg & (1 << 12))
-		printf("    Display C: Invalid GTT PTE\n");
-	if (reg & (1 << 10))
-		printf("    Display B: Invalid tiling\n");
-	if (reg & (1 << 8))
-		printf("    Display B: Invalid GTT PTE\n");
-	if (reg & (1 << 6))
-		printf("    Display A: Invalid tiling\n");
-	if (reg & (1 << 4))
-		printf("    Display A: Invalid GTT PTE\n");
-	if (reg & (1 << 1))
-		printf("    Host Invalid PTE data\n");
-	if (reg & (1 << 0))
-		printf("    Host Invalid GTT PTE\n");
-}
-
-static void
-print_i965_pgtbl_err(unsigned int reg)
-{
-	if (reg & (1 << 26))
-		printf("    Invalid Sampler Cache GTT entry\n");
-	if (reg & (1 << 24))
-		printf("    Invalid Render Cache GTT entry\n");
-	if (reg & (1 << 23))
-		printf("    Invalid Instruction/State Cache GTT entry\n");
-	if (reg & (1 << 22))
-		printf("    There is no ROC, this cannot occur!\n");
-	if (reg & (1 << 21))
-		printf("    Invalid GTT entry during Vertex Fetch\n");
-	if (reg & (1 << 20))
-		printf("    Invalid GTT entry during Command Fetch\n");
-	if (reg & (1 << 19))
-		printf("    Invalid GTT entry during CS\n");
-	if (reg & (1 << 18))
-		printf("    Invalid GTT entry during Cursor Fetch\n");
-	if (reg & (1 << 17))
-		printf("    Invalid GTT entry during Overlay Fetch\n");
-	if (reg & (1 << 8))
-		printf("    Invalid GTT entry during Display B Fetch\n");
-	if (reg & (1 << 4))
-		printf("    Invalid GTT entry during Display A Fetch\n");
-	if (reg & (1 << 1))
-		printf("    Valid PTE references illegal memory\n");
-	if (reg & (1 << 0))
-		printf("    Invalid GTT entry during fetch for host\n");
-}
-
-static void
-print_pgtbl_err(unsigned int reg, unsigned int devid)
-{
-	if (IS_965(devid)) {
-		return print_i965_pgtbl_err(reg);
-	} else if (IS_GEN3(devid)) {
-		return print_i915_pgtbl_err(reg);
-	} else {
-		return print_i830_pgtbl_err(reg);
-	}
-}
-
-static void print_ivb_error(unsigned int reg, unsigned int devid)
-{
-	if (reg & (1 << 0))
-		printf("    TLB page fault error (GTT entry not valid)\n");
-	if (reg & (1 << 1))
-		printf("    Invalid physical address in RSTRM interface (PAVP)\n");
-	if (reg & (1 << 2))
-		printf("    Invalid page directory entry error\n");
-	if (reg & (1 << 3))
-		printf("    Invalid physical address in ROSTRM interface (PAVP)\n");
-	if (reg & (1 << 4))
-		printf("    TLB page VTD translation generated an error\n");
-	if (reg & (1 << 5))
-		printf("    Invalid physical address in WRITE interface (PAVP)\n");
-	if (reg & (1 << 6))
-		printf("    Page directory VTD translation generated error\n");
-	if (reg & (1 << 8))
-		printf("    Cacheline containing a PD was marked as invalid\n");
-	if (IS_HASWELL(devid) && (reg >> 10) & 0x1f)
-		printf("    %d pending page faults\n", (reg >> 10) & 0x1f);
-}
-
-static void print_snb_error(unsigned int reg)
-{
-	if (reg & (1 << 0))
-		printf("    TLB page fault error (GTT entry not valid)\n");
-	if (reg & (1 << 1))
-		printf("    Context page GTT translation generated a fault (GTT entry not valid)\n");
-	if (reg & (1 << 2))
-		printf("    Invalid page directory entry error\n");
-	if (reg & (1 << 3))
-		printf("    HWS page GTT translation generated a page fault (GTT entry not valid)\n");
-	if (reg & (1 << 4))
-		printf("    TLB page VTD translation generated an error\n");
-	if (reg & (1 << 5))
-		printf("    Context page VTD translation generated an error\n");
-	if (reg & (1 << 6))
-		printf("    Page directory VTD translation generated error\n");
-	if (reg & (1 << 7))
-		printf("    HWS page VTD translation generated an error\n");
-	if (reg & (1 << 8))
-		printf("    Cacheline containing a PD was marked as invalid\n");
-}
-
-static void print_bdw_error(unsigned int reg, unsigned int devid)
-{
-	print_ivb_error(reg, devid);
-
-	if (reg & (1 << 10))
-		printf("    Non WB memory type for Advanced Context\n");
-	if (reg & (1 << 11))
-		printf("    PASID not enabled\n");
-	if (reg & (1 << 12))
-		printf("    PASID boundary violation\n");
-	if (reg & (1 << 13))
-		printf("    PASID not valid\n");
-	if (reg & (1 << 14))
-		printf("    PASID was zero for untranslated request\n");
-	if (reg & (1 << 15))
-		printf("    Context was not marked as present when doing DMA\n");
-}
-
-static void
-print_error(unsigned int reg, unsigned int devid)
-{
-	switch (intel_gen(devid)) {
-	case 8: return print_bdw_error(reg, devid);
-	case 7: return print_ivb_error(reg, devid);
-	case 6: return print_snb_error(reg);
-	}
-}
-
 static void
 print_snb_fence(unsigned int devid, uint64_t fence)
 {
@@ -382,57 +157,6 @@ print_fence(unsigned int devid, uint64_t fence)
 	}
 }
 
-static void
-print_fault_reg(unsigned devid, uint32_t reg)
-{
-	const char *gen7_types[] = { "Page",
-				     "Invalid PD",
-				     "Unloaded PD",
-				     "Invalid and Unloaded PD" };
-
-	const char *gen8_types[] = { "PTE",
-				     "PDE",
-				     "PDPE",
-				     "PML4E" };
-
-	const char *engine[] = { "GFX", "MFX0", "MFX1", "VEBX",
-				 "BLT", "Unknown", "Unknown", "Unknown" };
-
-	if (intel_gen(devid) < 7)
-		return;
-
-	if (reg & (1 << 0))
-		printf("    Valid\n");
-	else
-		return;
-
-	if (intel_gen(devid) < 8)
-		printf("    %s Fault (%s)\n", gen7_types[reg >> 1 & 0x3],
-		       reg & (1 << 11) ? "GGTT" : "PPGTT");
-	else
-		printf("    Invalid %s Fault\n", gen8_types[reg >> 1 & 0x3]);
-
-	if (intel_gen(devid) < 8)
-		printf("    Address 0x%08x\n", reg & ~((1 << 12)-1));
-	else
-		printf("    Engine %s\n", engine[reg >> 12 & 0x7]);
-
-	printf("    Source ID %d\n", reg >> 3 & 0xff);
-}
-
-static void
-print_fault_data(unsigned devid, uint32_t data1, uint32_t data0)
-{
-	uint64_t address;
-
-	if (intel_gen(devid) < 8)
-		return;
-
-	address = ((uint64_t)(data0) << 12) | ((uint64_t)data1 & 0xf) << 44;
-	printf("    Address 0x%016" PRIx64 " %s\n", address,
-	       data1 & (1 << 4) ? "GGTT" : "PPGTT");
-}
-
 #define MAX_RINGS 10 /* I really hope this never... */
 
 static void decode(struct drm_intel_decode *ctx,
@@ -467,186 +191,440 @@ static void decode(struct drm_intel_decode *ctx,
 	*count = 0;
 }
 
-static int zlib_inflate(uint32_t **ptr, int len)
+/*
+ * Sections of the error state, in the order they are printed. Text lines are
+ * printed as they are, buffers once they have been decoded. ASCII85 buffers
+ * are decoded and inflated by a pool of worker threads while the main thread
+ * carries on reading the file, and printed in order as they complete.
+ */
+struct section {
+	struct section *next;
+	struct section *next_job;
+
+	char *line;
+
+	char *ascii85;
+	bool encoded;
+	bool inflate;
+	bool done;
+
+	uint32_t *data;
+	int count;
+
+	const char *buffer_name;
+	char *ring_name;
+	uint64_t gtt_offset;
+	int ring; /* index into head[] or -1 */
+	uint64_t acthd; /* of the engine, or -1 when unknown */
+	int do_decode;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t done;
+
+	struct section *jobs, **jobs_tail;
+	bool quit;
+
+	pthread_t *threads;
+	unsigned int num_threads;
+} pool = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.jobs_tail = &pool.jobs,
+};
+
+/* State of the print stage, which follows the file in order. */
+struct print_state {
+	struct drm_intel_decode *decode_ctx;
+	uint32_t devid;
+	uint32_t ring_length;
+	uint32_t head[MAX_RINGS];
+	int num_rings;
+	unsigned int around_head; /* dwords either side of the hang, or 0 */
+};
+
+static void *pool_worker(void *arg)
 {
-	struct z_stream_s zstream;
-	void *out;
+	struct section *s;
+
+	pthread_mutex_lock(&pool.mutex);
+	for (;;) {
+		while (!pool.jobs && !pool.quit)
+			pthread_cond_wait(&pool.work, &pool.mutex);
+		if (!pool.jobs)
+			break;
 
-	memset(&zstream, 0, sizeof(zstream));
+		s = pool.jobs;
+		pool.jobs = s->next_job;
+		if (!pool.jobs)
+			pool.jobs_tail = &pool.jobs;
+		pthread_mutex_unlock(&pool.mutex);
 
-	zstream.next_in = (unsigned char *)*ptr;
-	zstream.avail_in = 4*len;
+		s->count = ascii85_decode(s->ascii85 + 1, &s->data, s->inflate);
+		free(s->ascii85);
+		s->ascii85 = NULL;
 
-	if (inflateInit(&zstream) != Z_OK)
-		return 0;
+		pthread_mutex_lock(&pool.mutex);
+		s->done = true;
+		pthread_cond_broadcast(&pool.done);
+	}
+	pthread_mutex_unlock(&pool.mutex);
 
-	out = malloc(128*4096); /* approximate obj size */
-	zstream.next_out = out;
-	zstream.avail_out = 128*4096;
+	return NULL;
+}
 
-	do {
-		switch (inflate(&zstream, Z_SYNC_FLUSH)) {
-		case Z_STREAM_END:
-			goto end;
-		case Z_OK:
+static void pool_init(void)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int i;
+
+	pool.num_threads = ncpus > 0 ? ncpus : 1;
+	pool.threads = calloc(pool.num_threads, sizeof(*pool.threads));
+	assert(pool.threads);
+
+	for (i = 0; i < pool.num_threads; i++) {
+		if (pthread_create(&pool.threads[i], NULL, pool_worker, NULL))
 			break;
-		default:
-			inflateEnd(&zstream);
-			return 0;
-		}
+	}
+	pool.num_threads = i;
+}
+
+static void pool_fini(void)
+{
+	unsigned int i;
 
-		if (zstream.avail_out)
+	pthread_mutex_lock(&pool.mutex);
+	pool.quit = true;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.mutex);
+
+	for (i = 0; i < pool.num_threads; i++)
+		pthread_join(pool.threads[i], NULL);
+	free(pool.threads);
+}
+
+static void pool_submit(struct section *s)
+{
+	if (!pool.num_threads) {
+		s->count = ascii85_decode(s->ascii85 + 1, &s->data, s->inflate);
+		free(s->ascii85);
+		s->ascii85 = NULL;
+		s->done = true;
+		return;
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	*pool.jobs_tail = s;
+	pool.jobs_tail = &s->next_job;
+	pthread_cond_signal(&pool.work);
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+static void
+print_line(struct print_state *st, const char *line)
+{
+	long long unsigned fence;
+	unsigned int reg, reg2;
+	int matched;
+
+	printf("%s", line);
+
+	if (parse_pci_id(line, &st->devid)) {
+		printf("Detected GEN%i chipset\n",
+				intel_gen(st->devid));
+
+		st->decode_ctx = drm_intel_decode_context_alloc(st->devid);
+	}
+
+	matched = sscanf(line, "  CTL: 0x%08x\n", &reg);
+	if (matched == 1)
+		st->ring_length = print_ctl(reg);
+
+	matched = sscanf(line, "  HEAD: 0x%08x\n", &reg);
+	if (matched == 1) {
+		st->head[st->num_rings++] = print_head(reg);
+	}
+
+	matched = sscanf(line, "  ACTHD: 0x%08x\n", &reg);
+	if (matched == 1) {
+		print_acthd(reg, st->ring_length);
+		drm_intel_decode_set_head_tail(st->decode_ctx, reg, 0xffffffff);
+	}
+
+	matched = sscanf(line, "  PGTBL_ER: 0x%08x\n", &reg);
+	if (matched == 1 && reg)
+		print_pgtbl_err(stdout, reg, st->devid);
+
+	matched = sscanf(line, "  ERROR: 0x%08x\n", &reg);
+	if (matched == 1 && reg)
+		print_error(stdout, reg, st->devid);
+
+	matched = sscanf(line, "  INSTDONE: 0x%08x\n", &reg);
+	if (matched == 1)
+		print_instdone(stdout, st->devid, reg, -1);
+
+	matched = sscanf(line, "  INSTDONE1: 0x%08x\n", &reg);
+	if (matched == 1)
+		print_instdone(stdout, st->devid, -1, reg);
+
+	matched = sscanf(line, "  fence[%i] = %Lx\n", &reg, &fence);
+	if (matched == 2)
+		print_fence(st->devid, fence);
+
+	matched = sscanf(line, "  FAULT_REG: 0x%08x\n", &reg);
+	if (matched == 1 && reg)
+		print_fault_reg(stdout, st->devid, reg);
+
+	matched = sscanf(line, "  FAULT_TLB_DATA: 0x%08x 0x%08x\n", &reg, &reg2);
+	if (matched == 2)
+		print_fault_data(stdout, st->devid, reg, reg2);
+}
+
+/*
+ * Cut a buffer down to the dwords either side of the hang point, in whole
+ * rows of the hex dump. Returns false if the hang is not in this buffer.
+ */
+static bool
+trim_to_hang(struct section *s, uint64_t hang, unsigned int around,
+	     uint32_t *head_offset)
+{
+	uint64_t idx;
+	int first, last;
+
+	if (hang < s->gtt_offset || hang - s->gtt_offset >= 4ull * s->count)
+		return false;
+
+	idx = (hang - s->gtt_offset) / 4;
+	first = idx > around ? (idx - around) & ~3 : 0;
+	last = ALIGN(idx + around + 1, 4);
+	if (last > s->count)
+		last = s->count;
+
+	memmove(s->data, s->data + first, (last - first) * sizeof(uint32_t));
+	s->count = last - first;
+	s->gtt_offset += 4 * first;
+	if (*head_offset != -1)
+		*head_offset -= 4 * first;
+
+	return true;
+}
+
+static void
+print_section(struct print_state *st, struct section *s)
+{
+	uint32_t head_offset = -1;
+	uint64_t hang = s->acthd;
+
+	if (s->line) {
+		print_line(st, s->line);
+		return;
+	}
+
+	if (s->encoded && s->count == 0)
+		fprintf(stderr, "ASCII85 decode failed (%s - %s).\n",
+			s->ring_name, s->buffer_name);
+
+	if (s->ring >= 0 && s->ring < st->num_rings) {
+		head_offset = st->head[s->ring];
+		hang = s->gtt_offset + head_offset;
+	}
+
+	if (st->around_head &&
+	    !trim_to_hang(s, hang, st->around_head, &head_offset))
+		return;
+
+	if (s->acthd != -1)
+		drm_intel_decode_set_head_tail(st->decode_ctx,
+					       s->acthd, 0xffffffff);
+
+	decode(st->decode_ctx,
+	       s->buffer_name, s->ring_name,
+	       s->gtt_offset, head_offset,
+	       s->data, &s->count, s->do_decode);
+}
+
+static struct section *queue_head, **queue_tail = &queue_head;
+static unsigned int queue_pending;
+
+static void queue_add(struct section *s)
+{
+	*queue_tail = s;
+	queue_tail = &s->next;
+	if (s->encoded)
+		queue_pending++;
+}
+
+/*
+ * Print the completed sections at the head of the queue, waiting for the
+ * workers until no more than max_pending buffers are still being decoded.
+ */
+static void queue_flush(struct print_state *st, unsigned int max_pending)
+{
+	struct section *s;
+
+	while ((s = queue_head)) {
+		bool done;
+
+		pthread_mutex_lock(&pool.mutex);
+		while (!s->done && queue_pending > max_pending)
+			pthread_cond_wait(&pool.done, &pool.mutex);
+		done = s->done;
+		pthread_mutex_unlock(&pool.mutex);
+		if (!done)
 			break;
 
-		out = realloc(out, 2*zstream.total_out);
-		if (out == NULL) {
-			inflateEnd(&zstream);
-			return 0;
-		}
+		queue_head = s->next;
+		if (!queue_head)
+			queue_tail = &queue_head;
+		if (s->encoded)
+			queue_pending--;
+
+		print_section(st, s);
 
-		zstream.next_out = (unsigned char *)out + zstream.total_out;
-		zstream.avail_out = zstream.total_out;
-	} while (1);
-end:
-	inflateEnd(&zstream);
-	free(*ptr);
-	*ptr = out;
-	return zstream.total_out / 4;
+		free(s->line);
+		free(s->data);
+		free(s->ring_name);
+		free(s);
+	}
 }
 
-static int ascii85_decode(const char *in, uint32_t **out, bool inflate)
+static struct section *
+section_new(const char *buffer_name, const char *ring_name,
+	    uint64_t gtt_offset, int ring, int do_decode)
 {
-	int len = 0, size = 1024;
+	struct section *s;
 
-	*out = realloc(*out, sizeof(uint32_t)*size);
-	if (*out == NULL)
-		return 0;
+	s = calloc(1, sizeof(*s));
+	if (s == NULL) {
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
 
-	while (*in >= '!' && *in <= 'z') {
-		uint32_t v = 0;
+	s->buffer_name = buffer_name;
+	s->ring_name = ring_name ? strdup(ring_name) : NULL;
+	s->gtt_offset = gtt_offset;
+	s->ring = ring;
+	s->acthd = -1;
+	s->do_decode = do_decode;
 
-		if (len == size) {
-			size *= 2;
-			*out = realloc(*out, sizeof(uint32_t)*size);
-			if (*out == NULL)
-				return 0;
-		}
+	return s;
+}
 
-		if (*in == 'z') {
-			in++;
-		} else {
-			v += in[0] - 33; v *= 85;
-			v += in[1] - 33; v *= 85;
-			v += in[2] - 33; v *= 85;
-			v += in[3] - 33; v *= 85;
-			v += in[4] - 33;
-			in += 5;
+/* Queue the buffer accumulated from "offset : value" lines, if any. */
+static struct section *
+queue_data(const char *buffer_name, const char *ring_name,
+	   uint64_t gtt_offset, int ring, int do_decode,
+	   uint32_t **data, int *data_size, int *count)
+{
+	struct section *s;
+
+	if (!*count)
+		return NULL;
+
+	s = section_new(buffer_name, ring_name, gtt_offset, ring, do_decode);
+	s->data = *data;
+	s->count = *count;
+	s->done = true;
+	queue_add(s);
+
+	*data = NULL;
+	*data_size = 0;
+	*count = 0;
+
+	return s;
+}
+
+static void
+append_data(uint32_t **data, int *data_size, int *count, uint32_t value)
+{
+	(*count)++;
+
+	if (*count > *data_size) {
+		*data_size = *data_size ? *data_size * 2 : 1024;
+		*data = realloc(*data, *data_size * sizeof (uint32_t));
+		if (*data == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
 		}
-		(*out)[len++] = v;
 	}
 
-	if (!inflate)
-		return len;
-
-	return zlib_inflate(out, len);
+	(*data)[*count - 1] = value;
 }
 
 static void
 read_data_file(FILE *file)
 {
-	struct drm_intel_decode *decode_ctx = NULL;
-	uint32_t devid = PCI_CHIP_I855_GM;
+	struct print_state st = {
+		.devid = PCI_CHIP_I855_GM,
+	};
+	struct section *s;
 	uint32_t *data = NULL;
-	uint32_t head[MAX_RINGS];
 	int head_idx = 0;
-	int num_rings = 0;
-	long long unsigned fence;
 	int data_size = 0, count = 0, matched;
 	char *line = NULL;
-	size_t line_size;
-	uint32_t offset, value, ring_length = 0;
+	size_t line_size = 0;
+	uint32_t offset, value;
 	uint64_t gtt_offset = 0;
-	uint32_t head_offset = -1;
+	int ring = -1;
 	const char *buffer_name = "batch buffer";
 	char *ring_name = NULL;
 	int do_decode = 1;
+	unsigned int max_pending;
+
+	pool_init();
+	max_pending = 2 * pool.num_threads;
 
 	while (getline(&line, &line_size, file) > 0) {
 		char *dashes;
 
 		if (line[0] == ':' || line[0] == '~') {
-			count = ascii85_decode(line+1, &data, line[0] == ':');
-			if (count == 0)
-				fprintf(stderr, "ASCII85 decode failed (%s - %s).\n",
-					ring_name, buffer_name);
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count, do_decode);
+			queue_data(buffer_name, ring_name,
+				   gtt_offset, ring, do_decode,
+				   &data, &data_size, &count);
+
+			s = section_new(buffer_name, ring_name,
+					gtt_offset, ring, do_decode);
+			s->encoded = true;
+			s->inflate = line[0] == ':';
+
+			/* Hand the line over rather than copy it */
+			s->ascii85 = line;
+			line = NULL;
+			line_size = 0;
+
+			queue_add(s);
+			pool_submit(s);
+			queue_flush(&st, max_pending);
 			continue;
 		}
 
 		dashes = strstr(line, "---");
 		if (dashes) {
-			const struct {
-				const char *match;
-				const char *name;
-				int do_decode;
-			} buffers[] = {
-				{ "ringbuffer", "ring", 1 },
-				{ "gtt_offset", "batch", 1 },
-				{ "hw context", "HW context", 1 },
-				{ "hw status", "HW status", 0 },
-				{ "wa context", "WA context", 1 },
-				{ "wa batchbuffer", "WA batch", 1 },
-				{ "user", "user", 0 },
-				{ "semaphores", "semaphores", 0 },
-				{ "guc log buffer", "GuC log", 0 },
-				{ },
-			}, *b;
+			const struct buffer_kind *b;
 			char *new_ring_name;
 
 			new_ring_name = malloc(dashes - line);
 			strncpy(new_ring_name, line, dashes - line);
 			new_ring_name[dashes - line - 1] = '\0';
 
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count, do_decode);
+			queue_data(buffer_name, ring_name,
+				   gtt_offset, ring, do_decode,
+				   &data, &data_size, &count);
 			gtt_offset = 0;
-			head_offset = -1;
+			ring = -1;
 
 			free(ring_name);
 			ring_name = new_ring_name;
 
-			dashes += 4;
-			for (b = buffers; b->match; b++) {
-				uint32_t lo, hi;
-
-				if (strncasecmp(dashes, b->match,
-						strlen(b->match)))
-					continue;
-
-				dashes = strchr(dashes, '=');
-				if (!dashes)
-					break;
-
-				matched = sscanf(dashes, "= 0x%08x %08x\n",
-						 &hi, &lo);
-				if (matched > 0) {
-					gtt_offset = hi;
-					if (matched == 2) {
-						gtt_offset <<= 32;
-						gtt_offset |= lo;
-					}
-				}
-
+			b = match_buffer(dashes, &gtt_offset);
+			if (b) {
 				do_decode = b->do_decode;
 				buffer_name = b->name;
-				if (b == buffers)
-					head_offset = head[head_idx++];
-				break;
+				if (b == buffer_kinds)
+					ring = head_idx++;
 			}
 
 			continue;
@@ -654,100 +632,446 @@ read_data_file(FILE *file)
 
 		matched = sscanf(line, "%08x : %08x", &offset, &value);
 		if (matched != 2) {
-			unsigned int reg, reg2;
-
 			/* display reg section is after the ringbuffers, don't mix them */
-			decode(decode_ctx,
-			       buffer_name, ring_name,
-			       gtt_offset, head_offset,
-			       data, &count, do_decode);
-
-			printf("%s", line);
-
-			matched = sscanf(line, "PCI ID: 0x%04x\n", &reg);
-			if (matched == 0)
-				matched = sscanf(line, " PCI ID: 0x%04x\n", &reg);
-			if (matched == 0) {
-				const char *pci_id_start = strstr(line, "PCI ID");
-				if (pci_id_start)
-					matched = sscanf(pci_id_start, "PCI ID: 0x%04x\n", &reg);
-			}
-			if (matched == 1) {
-				devid = reg;
-				printf("Detected GEN%i chipset\n",
-						intel_gen(devid));
+			queue_data(buffer_name, ring_name,
+				   gtt_offset, ring, do_decode,
+				   &data, &data_size, &count);
+
+			s = section_new(NULL, NULL, 0, -1, 0);
+			s->line = strdup(line);
+			s->done = true;
+			queue_add(s);
+			queue_flush(&st, max_pending);
+			continue;
+		}
 
-				decode_ctx = drm_intel_decode_context_alloc(devid);
-			}
+		append_data(&data, &data_size, &count, value);
+	}
 
-			matched = sscanf(line, "  CTL: 0x%08x\n", &reg);
-			if (matched == 1)
-				ring_length = print_ctl(reg);
+	queue_data(buffer_name, ring_name,
+		   gtt_offset, ring, do_decode,
+		   &data, &data_size, &count);
+	queue_flush(&st, 0);
+	pool_fini();
 
-			matched = sscanf(line, "  HEAD: 0x%08x\n", &reg);
-			if (matched == 1) {
-				head[num_rings++] = print_head(reg);
-			}
+	free(data);
+	free(line);
+	free(ring_name);
+}
 
-			matched = sscanf(line, "  ACTHD: 0x%08x\n", &reg);
-			if (matched == 1) {
-				print_acthd(reg, ring_length);
-				drm_intel_decode_set_head_tail(decode_ctx, reg, 0xffffffff);
-			}
+/*
+ * Indexed mode. Instead of decoding the whole error state, the file is mapped
+ * and a first pass records where each buffer is, along with the HEAD and ACTHD
+ * of each engine. Only the buffers selected by --ring and --buffer are then
+ * decoded, and --around-head cuts them down to the dwords around the hang.
+ */
+static struct {
+	const char *ring;
+	const char *buffer;
+	unsigned int around_head;
+	bool list;
+} filter;
+
+struct index_engine {
+	char *name;
+	uint32_t head;
+	uint64_t acthd;
+};
+
+struct index_buffer {
+	char *ring_name;
+	const struct buffer_kind *kind;
+	uint64_t gtt_offset;
+	size_t start, end; /* file offsets of its data lines */
+	int ring; /* ringbuffers are numbered as in read_data_file() */
+	int engine;
+};
+
+struct error_index {
+	char *map;
+	size_t size;
+	bool mapped;
+
+	uint32_t devid;
+
+	struct index_engine engine[MAX_RINGS];
+	int num_engines;
+
+	struct index_buffer *buffers;
+	int num_buffers, max_buffers;
+};
+
+static bool
+index_load(struct error_index *idx, FILE *file)
+{
+	size_t max = 0;
+	struct stat st;
+	size_t len;
+
+	if (fstat(fileno(file), &st) == 0 &&
+	    S_ISREG(st.st_mode) && st.st_size > 0) {
+		idx->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+				fileno(file), 0);
+		if (idx->map != MAP_FAILED) {
+			idx->size = st.st_size;
+			idx->mapped = true;
+			return true;
+		}
+	}
 
-			matched = sscanf(line, "  PGTBL_ER: 0x%08x\n", &reg);
-			if (matched == 1 && reg)
-				print_pgtbl_err(reg, devid);
+	/* The sysfs error file and pipes cannot be mapped, read them instead */
+	idx->map = NULL;
+	idx->size = 0;
+	do {
+		if (idx->size == max) {
+			max = max ? 2 * max : 1 << 20;
+			idx->map = realloc(idx->map, max);
+			if (idx->map == NULL)
+				return false;
+		}
 
-			matched = sscanf(line, "  ERROR: 0x%08x\n", &reg);
-			if (matched == 1 && reg)
-				print_error(reg, devid);
+		len = fread(idx->map + idx->size, 1, max - idx->size, file);
+		idx->size += len;
+	} while (len);
 
-			matched = sscanf(line, "  INSTDONE: 0x%08x\n", &reg);
-			if (matched == 1)
-				print_instdone(devid, reg, -1);
+	return !ferror(file);
+}
 
-			matched = sscanf(line, "  INSTDONE1: 0x%08x\n", &reg);
-			if (matched == 1)
-				print_instdone(devid, -1, reg);
+/* Copy a line of the map, so that it is terminated for sscanf() */
+static char *
+index_line(const char *p, const char *eol, char *buf, size_t size)
+{
+	size_t len = eol - p;
 
-			matched = sscanf(line, "  fence[%i] = %Lx\n", &reg, &fence);
-			if (matched == 2)
-				print_fence(devid, fence);
+	if (len > size - 2)
+		len = size - 2;
 
-			matched = sscanf(line, "  FAULT_REG: 0x%08x\n", &reg);
-			if (matched == 1 && reg)
-				print_fault_reg(devid, reg);
+	memcpy(buf, p, len);
+	buf[len] = '\n';
+	buf[len + 1] = '\0';
 
-			matched = sscanf(line, "  FAULT_TLB_DATA: 0x%08x 0x%08x\n", &reg, &reg2);
-			if (matched == 2)
-				print_fault_data(devid, reg, reg2);
+	return buf;
+}
 
+static void
+index_registers(struct error_index *idx, const char *line, char **name)
+{
+	struct index_engine *e;
+	unsigned int reg, hi, lo;
+	const char *str;
+	int matched;
+
+	str = strstr(line, " command stream:");
+	if (str) {
+		line += strspn(line, " ");
+		free(*name);
+		*name = strndup(line, str - line);
+		return;
+	}
+
+	/* As in print_line(), each HEAD starts the registers of an engine */
+	if (sscanf(line, "  HEAD: 0x%08x\n", &reg) == 1) {
+		if (idx->num_engines == MAX_RINGS)
+			return;
+
+		e = &idx->engine[idx->num_engines++];
+		e->name = *name;
+		e->head = reg & (0x7ffff << 2);
+		e->acthd = -1;
+		*name = NULL;
+		return;
+	}
+
+	matched = sscanf(line, "  ACTHD: 0x%08x %08x\n", &hi, &lo);
+	if (matched > 0 && idx->num_engines) {
+		e = &idx->engine[idx->num_engines - 1];
+		e->acthd = hi;
+		if (matched == 2)
+			e->acthd = (uint64_t)hi << 32 | lo;
+		return;
+	}
+
+	parse_pci_id(line, &idx->devid);
+}
+
+static struct index_buffer *
+index_add(struct error_index *idx)
+{
+	if (idx->num_buffers == idx->max_buffers) {
+		idx->max_buffers = idx->max_buffers ? 2 * idx->max_buffers : 64;
+		idx->buffers = realloc(idx->buffers,
+				       idx->max_buffers * sizeof(*idx->buffers));
+		if (idx->buffers == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+	}
+
+	return memset(&idx->buffers[idx->num_buffers++], 0,
+		      sizeof(*idx->buffers));
+}
+
+/*
+ * Match each buffer to the registers of its engine, by name where the
+ * "command stream" headers use the same names as the buffers, and otherwise
+ * by the order of the ringbuffers like read_data_file() does.
+ */
+static void
+index_resolve(struct error_index *idx)
+{
+	int i, j;
+
+	for (i = 0; i < idx->num_buffers; i++) {
+		struct index_buffer *b = &idx->buffers[i];
+		int ring = b->ring;
+
+		b->engine = -1;
+		for (j = 0; j < idx->num_engines; j++) {
+			if (idx->engine[j].name &&
+			    !strcasecmp(idx->engine[j].name, b->ring_name)) {
+				b->engine = j;
+				break;
+			}
+		}
+		if (b->engine >= 0)
 			continue;
+
+		for (j = 0; ring < 0 && j < idx->num_buffers; j++) {
+			if (!strcmp(idx->buffers[j].ring_name, b->ring_name))
+				ring = idx->buffers[j].ring;
 		}
+		if (ring >= 0 && ring < idx->num_engines)
+			b->engine = ring;
+	}
+}
 
-		count++;
+static void
+index_build(struct error_index *idx)
+{
+	const char *p = idx->map, *end = idx->map + idx->size;
+	struct index_buffer *b = NULL;
+	char *name = NULL;
+	int head_idx = 0;
+	char buf[256];
 
-		if (count > data_size) {
-			data_size = data_size ? data_size * 2 : 1024;
-			data = realloc(data, data_size * sizeof (uint32_t));
-			if (data == NULL) {
+	idx->devid = PCI_CHIP_I855_GM;
+
+	while (p < end) {
+		const char *eol = memchr(p, '\n', end - p);
+		const char *next = eol ? eol + 1 : end;
+		uint32_t offset, value;
+		char *line, *dashes;
+
+		/* Skip over the bulk of the file without copying it */
+		if (*p == ':' || *p == '~') {
+			if (b)
+				b->end = next - idx->map;
+			p = next;
+			continue;
+		}
+
+		line = index_line(p, eol ? eol : end, buf, sizeof(buf));
+
+		dashes = strstr(line, "---");
+		if (dashes) {
+			const struct buffer_kind *kind;
+			uint64_t gtt_offset = 0;
+
+			b = NULL;
+			kind = match_buffer(dashes, &gtt_offset);
+			if (kind) {
+				b = index_add(idx);
+				b->ring_name = strndup(line, dashes > line ?
+						       dashes - line - 1 : 0);
+				b->kind = kind;
+				b->gtt_offset = gtt_offset;
+				b->start = b->end = next - idx->map;
+				b->ring = kind == buffer_kinds ? head_idx++ : -1;
+			}
+		} else if (sscanf(line, "%08x : %08x", &offset, &value) == 2) {
+			if (b)
+				b->end = next - idx->map;
+		} else {
+			b = NULL;
+			index_registers(idx, line, &name);
+		}
+
+		p = next;
+	}
+
+	free(name);
+	index_resolve(idx);
+}
+
+static bool
+index_selected(const struct error_index *idx, const struct index_buffer *b)
+{
+	if (filter.ring && strcasecmp(b->ring_name, filter.ring))
+		return false;
+
+	if (filter.buffer &&
+	    strcasecmp(b->kind->name, filter.buffer) &&
+	    strcasecmp(b->kind->match, filter.buffer))
+		return false;
+
+	/* Skip what cannot contain the hang before decoding it */
+	if (filter.around_head) {
+		if (b->engine < 0)
+			return false;
+
+		if (b->ring < 0 &&
+		    idx->engine[b->engine].acthd < b->gtt_offset)
+			return false;
+	}
+
+	return true;
+}
+
+static void
+index_queue(struct error_index *idx, struct print_state *st,
+	    const struct index_buffer *b, unsigned int max_pending)
+{
+	const char *p = idx->map + b->start, *end = idx->map + b->end;
+	uint64_t acthd = b->engine >= 0 ? idx->engine[b->engine].acthd : -1;
+	int ring = b->ring >= 0 ? b->engine : -1;
+	const char *name = b->kind->name;
+	int do_decode = b->kind->do_decode;
+	uint32_t *data = NULL;
+	int data_size = 0, count = 0;
+	struct section *s;
+
+	while (p < end) {
+		const char *eol = memchr(p, '\n', end - p);
+		const char *next = eol ? eol + 1 : end;
+		uint32_t offset, value;
+		char buf[64];
+
+		if (*p == ':' || *p == '~') {
+			s = queue_data(name, b->ring_name, b->gtt_offset,
+				       ring, do_decode,
+				       &data, &data_size, &count);
+			if (s)
+				s->acthd = acthd;
+
+			s = section_new(name, b->ring_name, b->gtt_offset,
+					ring, do_decode);
+			s->acthd = acthd;
+			s->encoded = true;
+			s->inflate = *p == ':';
+			s->ascii85 = strndup(p, (eol ? eol : end) - p);
+			if (s->ascii85 == NULL) {
 				fprintf(stderr, "Out of memory.\n");
 				exit(1);
 			}
+
+			queue_add(s);
+			pool_submit(s);
+			queue_flush(st, max_pending);
+		} else if (sscanf(index_line(p, eol ? eol : end,
+					     buf, sizeof(buf)),
+				  "%08x : %08x", &offset, &value) == 2) {
+			append_data(&data, &data_size, &count, value);
 		}
 
-		data[count-1] = value;
+		p = next;
 	}
 
-	decode(decode_ctx,
-	       buffer_name, ring_name,
-	       gtt_offset, head_offset,
-	       data, &count, do_decode);
+	s = queue_data(name, b->ring_name, b->gtt_offset, ring, do_decode,
+		       &data, &data_size, &count);
+	if (s)
+		s->acthd = acthd;
+}
 
-	free(data);
-	free(line);
-	free(ring_name);
+static void
+index_list(const struct error_index *idx)
+{
+	int i;
+
+	for (i = 0; i < idx->num_engines; i++) {
+		const struct index_engine *e = &idx->engine[i];
+
+		printf("engine %d (%s): HEAD 0x%08x, ACTHD 0x%08x_%08x\n",
+		       i, e->name ? e->name : "unnamed", e->head,
+		       (unsigned)(e->acthd >> 32),
+		       (unsigned)(e->acthd & 0xffffffff));
+	}
+
+	for (i = 0; i < idx->num_buffers; i++) {
+		const struct index_buffer *b = &idx->buffers[i];
+
+		if (!index_selected(idx, b))
+			continue;
+
+		printf("%s (%s) at 0x%08x_%08x: %zu bytes at offset %zu, engine %d\n",
+		       b->kind->name, b->ring_name,
+		       (unsigned)(b->gtt_offset >> 32),
+		       (unsigned)(b->gtt_offset & 0xffffffff),
+		       b->end - b->start, b->start, b->engine);
+	}
+}
+
+static void
+read_indexed_file(FILE *file)
+{
+	struct error_index idx = {};
+	struct print_state st = {
+		.around_head = filter.around_head,
+	};
+	unsigned int max_pending;
+	int i;
+
+	if (!index_load(&idx, file)) {
+		fprintf(stderr, "Failed to read error state: %s\n",
+			strerror(errno));
+		exit(1);
+	}
+
+	index_build(&idx);
+
+	if (filter.list) {
+		index_list(&idx);
+		goto out;
+	}
+
+	st.devid = idx.devid;
+	st.decode_ctx = drm_intel_decode_context_alloc(st.devid);
+	printf("Detected GEN%i chipset\n", intel_gen(st.devid));
+
+	for (i = 0; i < idx.num_engines; i++)
+		st.head[i] = idx.engine[i].head;
+	st.num_rings = idx.num_engines;
+
+	pool_init();
+	max_pending = 2 * pool.num_threads;
+
+	for (i = 0; i < idx.num_buffers; i++) {
+		if (index_selected(&idx, &idx.buffers[i]))
+			index_queue(&idx, &st, &idx.buffers[i], max_pending);
+	}
+
+	queue_flush(&st, 0);
+	pool_fini();
+
+out:
+	for (i = 0; i < idx.num_engines; i++)
+		free(idx.engine[i].name);
+	for (i = 0; i < idx.num_buffers; i++)
+		free(idx.buffers[i].ring_name);
+	free(idx.buffers);
+
+	if (idx.mapped)
+		munmap(idx.map, idx.size);
+	else
+		free(idx.map);
+}
+
+static void
+read_file(FILE *file)
+{
+	if (filter.ring || filter.buffer || filter.around_head || filter.list)
+		read_indexed_file(file);
+	else
+		read_data_file(file);
 }
 
 static void setup_pager(void)
@@ -774,35 +1098,82 @@ static void setup_pager(void)
 	}
 }
 
+static void
+usage(FILE *out, const char *name)
+{
+	fprintf(out,
+			"intel_gpu_decode: Parse an Intel GPU i915_error_state\n"
+			"Usage:\n"
+			"\t%s [options] [<file>]\n"
+			"\n"
+			"With no arguments, debugfs-dri-directory is probed for in "
+			"/debug and \n"
+			"/sys/kernel/debug.  Otherwise, it may be "
+			"specified.  If a file is given,\n"
+			"it is parsed as an GPU dump in the format of "
+			"/debug/dri/0/i915_error_state.\n"
+			"\n"
+			"Options:\n"
+			"\t--ring=<name>           only decode the buffers of this ring, e.g. rcs0\n"
+			"\t--buffer=<kind>         only decode buffers of this kind, e.g. batch, ring\n"
+			"\t--around-head[=dwords]  only decode the dwords around HEAD and ACTHD\n"
+			"\t                        (default 32 either side)\n"
+			"\t--list                  list the engines and buffers of the error state\n",
+			name);
+}
+
 int
 main(int argc, char *argv[])
 {
+	static const struct option long_options[] = {
+		{ "ring", required_argument, 0, 'r' },
+		{ "buffer", required_argument, 0, 'b' },
+		{ "around-head", optional_argument, 0, 'a' },
+		{ "list", no_argument, 0, 'l' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0 },
+	};
 	FILE *file;
 	const char *path;
 	char *filename = NULL;
 	struct stat st;
-	int error;
-
-	if (argc > 2) {
-		fprintf(stderr,
-				"intel_gpu_decode: Parse an Intel GPU i915_error_state\n"
-				"Usage:\n"
-				"\t%s [<file>]\n"
-				"\n"
-				"With no arguments, debugfs-dri-directory is probed for in "
-				"/debug and \n"
-				"/sys/kernel/debug.  Otherwise, it may be "
-				"specified.  If a file is given,\n"
-				"it is parsed as an GPU dump in the format of "
-				"/debug/dri/0/i915_error_state.\n",
-				argv[0]);
+	int error, c;
+
+	while ((c = getopt_long(argc, argv, "r:b:a::lh",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'r':
+			filter.ring = optarg;
+			break;
+		case 'b':
+			filter.buffer = optarg;
+			break;
+		case 'a':
+			filter.around_head = optarg ? atoi(optarg) : 32;
+			if (!filter.around_head)
+				filter.around_head = 1;
+			break;
+		case 'l':
+			filter.list = true;
+			break;
+		case 'h':
+			usage(stdout, argv[0]);
+			return 0;
+		default:
+			usage(stderr, argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind > 1) {
+		usage(stderr, argv[0]);
 		return 1;
 	}
 
 	if (isatty(1))
 		setup_pager();
 
-	if (argc == 1) {
+	if (optind == argc) {
 		if (isatty(0)) {
 			path = "/sys/class/drm/card0/error";
 			error = stat(path, &st);
@@ -821,11 +1192,11 @@ main(int argc, char *argv[])
 				     "\tsudo mount -t debugfs debugfs /sys/kernel/debug\n");
 			}
 		} else {
-			read_data_file(stdin);
+			read_file(stdin);
 			exit(0);
 		}
 	} else {
-		path = argv[1];
+		path = argv[optind];
 		error = stat(path, &st);
 		if (error != 0) {
 			fprintf(stderr, "Error opening %s: %s\n",
@@ -866,7 +1237,7 @@ main(int argc, char *argv[])
 		}
 	}
 
-	read_data_file(file);
+	read_file(file);
 	fclose(file);
 
 	if (filename != path)
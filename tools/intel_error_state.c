@@ -0,0 +1,478 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "intel_chipset.h"
+#include "instdone.h"
+#include "intel_reg.h"
+#include "drmtest.h"
+#include "igt_ascii85.h"
+
+#include "intel_error_state.h"
+
+void
+print_instdone(FILE *out, uint32_t devid, unsigned int instdone, unsigned int instdone1)
+{
+	static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	static uint32_t instdone_devid;
+	static bool valid;
+	int i;
+
+	/* The definitions are global, and only valid for one device at a time */
+	pthread_mutex_lock(&mutex);
+	if (devid != instdone_devid || !num_instdone_bits) {
+		num_instdone_bits = 0;
+		valid = init_instdone_definitions(devid);
+		instdone_devid = devid;
+	}
+
+	for (i = 0; valid && i < num_instdone_bits; i++) {
+		int busy = 0;
+
+		if (instdone_bits[i].reg == INSTDONE_1) {
+			if (!(instdone1 & instdone_bits[i].bit))
+				busy = 1;
+		} else {
+			if (!(instdone & instdone_bits[i].bit))
+				busy = 1;
+		}
+
+		if (busy)
+			fprintf(out, "    busy: %s\n", instdone_bits[i].name);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+static void
+print_i830_pgtbl_err(FILE *out, unsigned int reg)
+{
+	const char *str;
+
+	switch((reg >> 3) & 0xf) {
+	case 0x1: str = "Overlay TLB"; break;
+	case 0x2: str = "Display A TLB"; break;
+	case 0x3: str = "Host TLB"; break;
+	case 0x4: str = "Render TLB"; break;
+	case 0x5: str = "Display C TLB"; break;
+	case 0x6: str = "Mapping TLB"; break;
+	case 0x7: str = "Command Stream TLB"; break;
+	case 0x8: str = "Vertex Buffer TLB"; break;
+	case 0x9: str = "Display B TLB"; break;
+	case 0xa: str = "Reserved System Memory"; break;
+	case 0xb: str = "Compressor TLB"; break;
+	case 0xc: str = "Binner TLB"; break;
+	default: str = "unknown"; break;
+	}
+
+	if (str)
+		fprintf(out, "    source = %s\n", str);
+
+	switch(reg & 0x7) {
+	case 0x0: str  = "Invalid GTT"; break;
+	case 0x1: str = "Invalid GTT PTE"; break;
+	case 0x2: str = "Invalid Memory"; break;
+	case 0x3: str = "Invalid TLB miss"; break;
+	case 0x4: str = "Invalid PTE data"; break;
+	case 0x5: str = "Invalid LocalMemory not present"; break;
+	case 0x6: str = "Invalid Tiling"; break;
+	case 0x7: str = "Host to CAM"; break;
+	}
+	fprintf(out, "    error = %s\n", str);
+}
+
+static void
+print_i915_pgtbl_err(FILE *out, unsigned int reg)
+{
+	if (reg & (1 << 29))
+		fprintf(out, "    Cursor A: Invalid GTT PTE\n");
+	if (reg & (1 << 28))
+		fprintf(out, "    Cursor B: Invalid GTT PTE\n");
+	if (reg & (1 << 27))
+		fprintf(out, "    MT: Invalid tiling\n");
+	if (reg & (1 << 26))
+		fprintf(out, "    MT: Invalid GTT PTE\n");
+	if (reg & (1 << 25))
+		fprintf(out, "    LC: Invalid tiling\n");
+	if (reg & (1 << 24))
+		fprintf(out, "    LC: Invalid GTT PTE\n");
+	if (reg & (1 << 23))
+		fprintf(out, "    BIN VertexData: Invalid GTT PTE\n");
+	if (reg & (1 << 22))
+		fprintf(out, "    BIN Instruction: Invalid GTT PTE\n");
+	if (reg & (1 << 21))
+		fprintf(out, "    CS VertexData: Invalid GTT PTE\n");
+	if (reg & (1 << 20))
+		fprintf(out, "    CS Instruction: Invalid GTT PTE\n");
+	if (reg & (1 << 19))
+		fprintf(out, "    CS: Invalid GTT\n");
+	if (reg & (1 << 18))
+		fprintf(out, "    Overlay: Invalid tiling\n");
+	if (reg & (1 << 16))
+		fprintf(out, "    Overlay: Invalid GTT PTE\n");
+	if (reg & (1 << 14))
+		fprintf(out, "    Display C: Invalid tiling\n");
+	if (reg & (1 << 12))
+		fprintf(out, "    Display C: Invalid GTT PTE\n");
+	if (reg & (1 << 10))
+		fprintf(out, "    Display B: Invalid tiling\n");
+	if (reg & (1 << 8))
+		fprintf(out, "    Display B: Invalid GTT PTE\n");
+	if (reg & (1 << 6))
+		fprintf(out, "    Display A: Invalid tiling\n");
+	if (reg & (1 << 4))
+		fprintf(out, "    Display A: Invalid GTT PTE\n");
+	if (reg & (1 << 1))
+		fprintf(out, "    Host Invalid PTE data\n");
+	if (reg & (1 << 0))
+		fprintf(out, "    Host Invalid GTT PTE\n");
+}
+
+static void
+print_i965_pgtbl_err(FILE *out, unsigned int reg)
+{
+	if (reg & (1 << 26))
+		fprintf(out, "    Invalid Sampler Cache GTT entry\n");
+	if (reg & (1 << 24))
+		fprintf(out, "    Invalid Render Cache GTT entry\n");
+	if (reg & (1 << 23))
+		fprintf(out, "    Invalid Instruction/State Cache GTT entry\n");
+	if (reg & (1 << 22))
+		fprintf(out, "    There is no ROC, this cannot occur!\n");
+	if (reg & (1 << 21))
+		fprintf(out, "    Invalid GTT entry during Vertex Fetch\n");
+	if (reg & (1 << 20))
+		fprintf(out, "    Invalid GTT entry during Command Fetch\n");
+	if (reg & (1 << 19))
+		fprintf(out, "    Invalid GTT entry during CS\n");
+	if (reg & (1 << 18))
+		fprintf(out, "    Invalid GTT entry during Cursor Fetch\n");
+	if (reg & (1 << 17))
+		fprintf(out, "    Invalid GTT entry during Overlay Fetch\n");
+	if (reg & (1 << 8))
+		fprintf(out, "    Invalid GTT entry during Display B Fetch\n");
+	if (reg & (1 << 4))
+		fprintf(out, "    Invalid GTT entry during Display A Fetch\n");
+	if (reg & (1 << 1))
+		fprintf(out, "    Valid PTE references illegal memory\n");
+	if (reg & (1 << 0))
+		fprintf(out, "    Invalid GTT entry during fetch for host\n");
+}
+
+void
+print_pgtbl_err(FILE *out, unsigned int reg, unsigned int devid)
+{
+	if (IS_965(devid)) {
+		return print_i965_pgtbl_err(out, reg);
+	} else if (IS_GEN3(devid)) {
+		return print_i915_pgtbl_err(out, reg);
+	} else {
+		return print_i830_pgtbl_err(out, reg);
+	}
+}
+
+static void print_ivb_error(FILE *out, unsigned int reg, unsigned int devid)
+{
+	if (reg & (1 << 0))
+		fprintf(out, "    TLB page fault error (GTT entry not valid)\n");
+	if (reg & (1 << 1))
+		fprintf(out, "    Invalid physical address in RSTRM interface (PAVP)\n");
+	if (reg & (1 << 2))
+		fprintf(out, "    Invalid page directory entry error\n");
+	if (reg & (1 << 3))
+		fprintf(out, "    Invalid physical address in ROSTRM interface (PAVP)\n");
+	if (reg & (1 << 4))
+		fprintf(out, "    TLB page VTD translation generated an error\n");
+	if (reg & (1 << 5))
+		fprintf(out, "    Invalid physical address in WRITE interface (PAVP)\n");
+	if (reg & (1 << 6))
+		fprintf(out, "    Page directory VTD translation generated error\n");
+	if (reg & (1 << 8))
+		fprintf(out, "    Cacheline containing a PD was marked as invalid\n");
+	if (IS_HASWELL(devid) && (reg >> 10) & 0x1f)
+		fprintf(out, "    %d pending page faults\n", (reg >> 10) & 0x1f);
+}
+
+static void print_snb_error(FILE *out, unsigned int reg)
+{
+	if (reg & (1 << 0))
+		fprintf(out, "    TLB page fault error (GTT entry not valid)\n");
+	if (reg & (1 << 1))
+		fprintf(out, "    Context page GTT translation generated a fault (GTT entry not valid)\n");
+	if (reg & (1 << 2))
+		fprintf(out, "    Invalid page directory entry error\n");
+	if (reg & (1 << 3))
+		fprintf(out, "    HWS page GTT translation generated a page fault (GTT entry not valid)\n");
+	if (reg & (1 << 4))
+		fprintf(out, "    TLB page VTD translation generated an error\n");
+	if (reg & (1 << 5))
+		fprintf(out, "    Context page VTD translation generated an error\n");
+	if (reg & (1 << 6))
+		fprintf(out, "    Page directory VTD translation generated error\n");
+	if (reg & (1 << 7))
+		fprintf(out, "    HWS page VTD translation generated an error\n");
+	if (reg & (1 << 8))
+		fprintf(out, "    Cacheline containing a PD was marked as invalid\n");
+}
+
+static void print_bdw_error(FILE *out, unsigned int reg, unsigned int devid)
+{
+	print_ivb_error(out, reg, devid);
+
+	if (reg & (1 << 10))
+		fprintf(out, "    Non WB memory type for Advanced Context\n");
+	if (reg & (1 << 11))
+		fprintf(out, "    PASID not enabled\n");
+	if (reg & (1 << 12))
+		fprintf(out, "    PASID boundary violation\n");
+	if (reg & (1 << 13))
+		fprintf(out, "    PASID not valid\n");
+	if (reg & (1 << 14))
+		fprintf(out, "    PASID was zero for untranslated request\n");
+	if (reg & (1 << 15))
+		fprintf(out, "    Context was not marked as present when doing DMA\n");
+}
+
+void
+print_error(FILE *out, unsigned int reg, unsigned int devid)
+{
+	switch (intel_gen(devid)) {
+	case 8: return print_bdw_error(out, reg, devid);
+	case 7: return print_ivb_error(out, reg, devid);
+	case 6: return print_snb_error(out, reg);
+	}
+}
+
+void
+print_fault_reg(FILE *out, unsigned devid, uint32_t reg)
+{
+	const char *gen7_types[] = { "Page",
+				     "Invalid PD",
+				     "Unloaded PD",
+				     "Invalid and Unloaded PD" };
+
+	const char *gen8_types[] = { "PTE",
+				     "PDE",
+				     "PDPE",
+				     "PML4E" };
+
+	const char *engine[] = { "GFX", "MFX0", "MFX1", "VEBX",
+				 "BLT", "Unknown", "Unknown", "Unknown" };
+
+	if (intel_gen(devid) < 7)
+		return;
+
+	if (reg & (1 << 0))
+		fprintf(out, "    Valid\n");
+	else
+		return;
+
+	if (intel_gen(devid) < 8)
+		fprintf(out, "    %s Fault (%s)\n", gen7_types[reg >> 1 & 0x3],
+		       reg & (1 << 11) ? "GGTT" : "PPGTT");
+	else
+		fprintf(out, "    Invalid %s Fault\n", gen8_types[reg >> 1 & 0x3]);
+
+	if (intel_gen(devid) < 8)
+		fprintf(out, "    Address 0x%08x\n", reg & ~((1 << 12)-1));
+	else
+		fprintf(out, "    Engine %s\n", engine[reg >> 12 & 0x7]);
+
+	fprintf(out, "    Source ID %d\n", reg >> 3 & 0xff);
+}
+
+void
+print_fault_data(FILE *out, unsigned devid, uint32_t data1, uint32_t data0)
+{
+	uint64_t address;
+
+	if (intel_gen(devid) < 8)
+		return;
+
+	address = ((uint64_t)(data0) << 12) | ((uint64_t)data1 & 0xf) << 44;
+	fprintf(out, "    Address 0x%016" PRIx64 " %s\n", address,
+	       data1 & (1 << 4) ? "GGTT" : "PPGTT");
+}
+
+static int zlib_inflate(uint32_t **ptr, int len)
+{
+	struct z_stream_s zstream;
+	size_t size;
+	void *out;
+
+	memset(&zstream, 0, sizeof(zstream));
+
+	zstream.next_in = (unsigned char *)*ptr;
+	zstream.avail_in = 4*len;
+
+	if (inflateInit(&zstream) != Z_OK)
+		return 0;
+
+	/*
+	 * The uncompressed size is not recorded in the error state. Objects
+	 * are mostly zeroes and compress well, so start with a generous
+	 * estimate, and give back what it overshot once done.
+	 */
+	size = ALIGN(32 * (size_t)zstream.avail_in, 4096);
+	out = malloc(size);
+	if (out == NULL) {
+		inflateEnd(&zstream);
+		return 0;
+	}
+	zstream.next_out = out;
+	zstream.avail_out = size;
+
+	do {
+		switch (inflate(&zstream, Z_SYNC_FLUSH)) {
+		case Z_STREAM_END:
+			goto end;
+		case Z_OK:
+			break;
+		default:
+			inflateEnd(&zstream);
+			free(out);
+			return 0;
+		}
+
+		if (zstream.avail_out)
+			break;
+
+		size *= 2;
+		out = realloc(out, size);
+		if (out == NULL) {
+			inflateEnd(&zstream);
+			return 0;
+		}
+
+		zstream.next_out = (unsigned char *)out + zstream.total_out;
+		zstream.avail_out = size - zstream.total_out;
+	} while (1);
+end:
+	inflateEnd(&zstream);
+	if (zstream.total_out && zstream.total_out < size) {
+		void *tight = realloc(out, zstream.total_out);
+		if (tight)
+			out = tight;
+	}
+	free(*ptr);
+	*ptr = out;
+	return zstream.total_out / 4;
+}
+
+int ascii85_decode(const char *in, uint32_t **out, bool inflate)
+{
+	size_t len, size;
+	int count;
+
+	len = igt_ascii85_scan(in, &size);
+	if (!size)
+		return 0;
+
+	free(*out);
+	*out = malloc(sizeof(uint32_t)*size);
+	if (*out == NULL)
+		return 0;
+
+	count = igt_ascii85_decode(in, len, *out);
+	if (!inflate)
+		return count;
+
+	return zlib_inflate(out, count);
+}
+
+bool
+parse_pci_id(const char *line, uint32_t *devid)
+{
+	unsigned int reg;
+	int matched;
+
+	matched = sscanf(line, "PCI ID: 0x%04x\n", &reg);
+	if (matched == 0)
+		matched = sscanf(line, " PCI ID: 0x%04x\n", &reg);
+	if (matched == 0) {
+		const char *pci_id_start = strstr(line, "PCI ID");
+		if (pci_id_start)
+			matched = sscanf(pci_id_start, "PCI ID: 0x%04x\n", &reg);
+	}
+	if (matched != 1)
+		return false;
+
+	*devid = reg;
+	return true;
+}
+
+const struct buffer_kind buffer_kinds[] = {
+	{ "ringbuffer", "ring", 1 },
+	{ "gtt_offset", "batch", 1 },
+	{ "hw context", "HW context", 1 },
+	{ "hw status", "HW status", 0 },
+	{ "wa context", "WA context", 1 },
+	{ "wa batchbuffer", "WA batch", 1 },
+	{ "user", "user", 0 },
+	{ "semaphores", "semaphores", 0 },
+	{ "guc log buffer", "GuC log", 0 },
+	{ },
+};
+
+/*
+ * Identify the buffer of a "<ring> --- <kind> = 0x<hi> <lo>" line, and its
+ * address. @dashes points to the "---".
+ */
+const struct buffer_kind *
+match_buffer(const char *dashes, uint64_t *gtt_offset)
+{
+	const struct buffer_kind *b;
+
+	dashes += 4;
+	for (b = buffer_kinds; b->match; b++) {
+		uint32_t lo, hi;
+		int matched;
+
+		if (strncasecmp(dashes, b->match, strlen(b->match)))
+			continue;
+
+		dashes = strchr(dashes, '=');
+		if (!dashes)
+			return NULL;
+
+		matched = sscanf(dashes, "= 0x%08x %08x\n", &hi, &lo);
+		if (matched > 0) {
+			*gtt_offset = hi;
+			if (matched == 2) {
+				*gtt_offset <<= 32;
+				*gtt_offset |= lo;
+			}
+		}
+
+		return b;
+	}
+
+	return NULL;
+}
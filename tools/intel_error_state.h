@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2017 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef INTEL_ERROR_STATE_H
+#define INTEL_ERROR_STATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Parsing of i915 error states shared by intel_error_decode and
+ * intel_error_bucket.
+ */
+
+struct buffer_kind {
+	const char *match;
+	const char *name;
+	int do_decode;
+};
+
+/* The first entry is the ringbuffer */
+extern const struct buffer_kind buffer_kinds[];
+
+const struct buffer_kind *
+match_buffer(const char *dashes, uint64_t *gtt_offset);
+
+bool parse_pci_id(const char *line, uint32_t *devid);
+
+int ascii85_decode(const char *in, uint32_t **out, bool inflate);
+
+void print_instdone(FILE *out, uint32_t devid,
+		    unsigned int instdone, unsigned int instdone1);
+void print_pgtbl_err(FILE *out, unsigned int reg, unsigned int devid);
+void print_error(FILE *out, unsigned int reg, unsigned int devid);
+void print_fault_reg(FILE *out, unsigned devid, uint32_t reg);
+void print_fault_data(FILE *out, unsigned devid, uint32_t data1, uint32_t data0);
+
+#endif /* INTEL_ERROR_STATE_H */
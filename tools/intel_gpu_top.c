@@ -34,9 +34,16 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 #include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/wait.h>
 #include <string.h>
 #ifdef HAVE_TERMIOS_H
@@ -121,9 +128,9 @@ uint64_t last_stats[STATS_COUNT];
 static unsigned long
 gettime(void)
 {
-    struct timeval t;
-    gettimeofday(&t, NULL);
-    return (t.tv_usec + (t.tv_sec * 1000000));
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_nsec / 1000 + (t.tv_sec * 1000000));
 }
 
 static int
@@ -319,6 +326,79 @@ struct ring {
 	int idle;
 };
 
+enum {
+	RING_RENDER,
+	RING_BSD,
+	RING_BSD6,
+	RING_BLT,
+	NUM_RINGS
+};
+
+static struct ring rings[NUM_RINGS] = {
+	[RING_RENDER] = {
+		.name = "render",
+		.mmio = 0x2030,
+	},
+	[RING_BSD] = {
+		.name = "bitstream",
+		.mmio = 0x4030,
+	},
+	[RING_BSD6] = {
+		.name = "bitstream",
+		.mmio = 0x12030,
+	},
+	[RING_BLT] = {
+		.name = "blitter",
+		.mmio = 0x22030,
+	},
+};
+
+/* Raw registers read at each sample */
+struct sample {
+	uint32_t instdone, instdone1;
+	uint32_t head[NUM_RINGS], tail[NUM_RINGS];
+};
+
+/*
+ * Samples are taken on a thread woken by a timerfd and published in a single
+ * producer, single consumer ring which the display drains once a second.
+ * Samples are dropped, and counted, when the ring is full.
+ */
+#define SAMPLE_RING_SIZE	(1 << 16)
+
+static struct sampler {
+	pthread_t thread;
+	bool is_965;
+	int samples_per_sec;
+	bool stop;
+	unsigned int head, tail;
+	uint32_t dropped;
+	struct sample samples[SAMPLE_RING_SIZE];
+} sampler;
+
+/*
+ * --record file: a record_header, followed for each display period by a
+ * record_period and its samples, in host byte order.
+ */
+#define RECORD_MAGIC	0x50544749	/* "IGTP" */
+#define RECORD_VERSION	1
+
+struct record_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t devid;
+	uint32_t samples_per_sec;
+	uint32_t ring_size[NUM_RINGS];
+	uint64_t stats[STATS_COUNT];
+};
+
+struct record_period {
+	uint32_t nsamples;
+	uint32_t dropped;
+	uint64_t duration_us;
+	uint64_t stats[STATS_COUNT];
+};
+
 static uint32_t ring_read(struct ring *ring, uint32_t reg)
 {
 	return INREG(ring->mmio + reg);
@@ -334,15 +414,15 @@ static void ring_reset(struct ring *ring)
 	ring->idle = ring->full = 0;
 }
 
-static void ring_sample(struct ring *ring)
+static void ring_sample(struct ring *ring, uint32_t head, uint32_t tail)
 {
 	int full;
 
 	if (!ring->size)
 		return;
 
-	ring->head = ring_read(ring, RING_HEAD) & HEAD_ADDR;
-	ring->tail = ring_read(ring, RING_TAIL) & TAIL_ADDR;
+	ring->head = head;
+	ring->tail = tail;
 
 	if (ring->tail == ring->head)
 		ring->idle++;
@@ -353,6 +433,121 @@ static void ring_sample(struct ring *ring)
 	ring->full += full;
 }
 
+static void read_sample(struct sample *sample)
+{
+	int i;
+
+	if (sampler.is_965) {
+		sample->instdone = INREG(INSTDONE_I965);
+		sample->instdone1 = INREG(INSTDONE_1);
+	} else {
+		sample->instdone = INREG(INSTDONE);
+		sample->instdone1 = 0;
+	}
+
+	for (i = 0; i < NUM_RINGS; i++) {
+		if (!rings[i].size)
+			continue;
+
+		sample->head[i] = ring_read(&rings[i], RING_HEAD) & HEAD_ADDR;
+		sample->tail[i] = ring_read(&rings[i], RING_TAIL) & TAIL_ADDR;
+	}
+}
+
+static void *sampler_thread(void *arg)
+{
+	struct itimerspec its = {};
+	uint64_t expirations;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, 0);
+	if (fd < 0)
+		err(1, "timerfd_create");
+
+	its.it_interval.tv_nsec = 1000000000 / sampler.samples_per_sec;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(fd, 0, &its, NULL))
+		err(1, "timerfd_settime");
+
+	while (!__atomic_load_n(&sampler.stop, __ATOMIC_RELAXED)) {
+		unsigned int head = sampler.head;
+
+		if (read(fd, &expirations, sizeof(expirations)) !=
+		    sizeof(expirations))
+			continue;
+
+		/* Timer ticks we were too late for are lost samples too */
+		if (expirations > 1)
+			__atomic_add_fetch(&sampler.dropped, expirations - 1,
+					   __ATOMIC_RELAXED);
+
+		if (head - __atomic_load_n(&sampler.tail, __ATOMIC_ACQUIRE) ==
+		    SAMPLE_RING_SIZE) {
+			__atomic_add_fetch(&sampler.dropped, 1,
+					   __ATOMIC_RELAXED);
+			continue;
+		}
+
+		read_sample(&sampler.samples[head % SAMPLE_RING_SIZE]);
+		__atomic_store_n(&sampler.head, head + 1, __ATOMIC_RELEASE);
+	}
+
+	close(fd);
+	return NULL;
+}
+
+/* Copy out the samples taken since the last call */
+static unsigned int sampler_drain(struct sample *samples, uint32_t *dropped)
+{
+	unsigned int head = __atomic_load_n(&sampler.head, __ATOMIC_ACQUIRE);
+	unsigned int tail = sampler.tail;
+	unsigned int n = 0;
+
+	for (; tail != head; tail++)
+		samples[n++] = sampler.samples[tail % SAMPLE_RING_SIZE];
+
+	__atomic_store_n(&sampler.tail, tail, __ATOMIC_RELEASE);
+	*dropped = __atomic_exchange_n(&sampler.dropped, 0, __ATOMIC_RELAXED);
+
+	return n;
+}
+
+static void account_samples(const struct sample *samples, unsigned int n)
+{
+	unsigned int i;
+	int j;
+
+	for (i = 0; i < n; i++) {
+		instdone = samples[i].instdone;
+		instdone1 = samples[i].instdone1;
+
+		for (j = 0; j < num_instdone_bits; j++)
+			update_idle_bit(&top_bits[j]);
+
+		for (j = 0; j < NUM_RINGS; j++)
+			ring_sample(&rings[j], samples[i].head[j],
+				    samples[i].tail[j]);
+	}
+}
+
+static void read_stats(uint64_t *values)
+{
+	int i;
+
+	for (i = 0; i < STATS_COUNT; i++) {
+		uint32_t stats_high, stats_low, stats_high_2;
+
+		do {
+			stats_high = INREG(stats_regs[i] + 4);
+			stats_low = INREG(stats_regs[i]);
+			stats_high_2 = INREG(stats_regs[i] + 4);
+		} while (stats_high != stats_high_2);
+
+		values[i] = (uint64_t)stats_high << 32 |
+			stats_low;
+	}
+}
+
 static void ring_print_header(FILE *out, struct ring *ring)
 {
     fprintf(out, "%.6s%%\tops\t",
@@ -400,6 +595,8 @@ usage(const char *appname)
 			"[-e <command>]       command to profile\n"
 			"[-o <file>]          output statistics to file. If file is '-',"
 			"                     run in batch mode and output statistics to stdio only \n"
+			"[--record <file>]    also save the raw samples to file\n"
+			"[--replay <file>]    output statistics from raw samples saved with --record\n"
 			"[-h]                 show this help screen\n"
 			"\n",
 			appname,
@@ -408,26 +605,79 @@ usage(const char *appname)
 	return;
 }
 
+static FILE *
+replay_open(const char *filename, struct record_header *header)
+{
+	FILE *file;
+
+	file = fopen(filename, "r");
+	if (!file) {
+		perror("fopen");
+		exit(1);
+	}
+
+	if (fread(header, sizeof(*header), 1, file) != 1 ||
+	    header->magic != RECORD_MAGIC ||
+	    header->version != RECORD_VERSION) {
+		fprintf(stderr, "Error: %s is not an intel_gpu_top recording\n",
+			filename);
+		exit(1);
+	}
+
+	return file;
+}
+
+/* Returns false at the end of the recording */
+static bool
+replay_period(FILE *file, struct record_period *period,
+	      struct sample *samples)
+{
+	if (fread(period, sizeof(*period), 1, file) != 1)
+		return false;
+
+	if (period->nsamples > SAMPLE_RING_SIZE ||
+	    fread(samples, sizeof(*samples), period->nsamples, file) !=
+	    period->nsamples) {
+		fprintf(stderr, "Error: truncated recording\n");
+		return false;
+	}
+
+	return true;
+}
+
+static void
+record_write(FILE *file, const void *data, size_t size)
+{
+	if (fwrite(data, size, 1, file) != 1) {
+		perror("fwrite");
+		exit(1);
+	}
+}
+
+enum {
+	OPT_RECORD = 256,
+	OPT_REPLAY,
+};
+
 int main(int argc, char **argv)
 {
+	static const struct option long_options[] = {
+		{ "record", required_argument, NULL, OPT_RECORD },
+		{ "replay", required_argument, NULL, OPT_REPLAY },
+		{ "help", no_argument, NULL, 'h' },
+		{ 0 }
+	};
+	static struct sample samples[SAMPLE_RING_SIZE];
 	uint32_t devid;
-	int drm_fd;
-	struct pci_device *pci_dev;
-	struct ring render_ring = {
-		.name = "render",
-		.mmio = 0x2030,
-	}, bsd_ring = {
-		.name = "bitstream",
-		.mmio = 0x4030,
-	}, bsd6_ring = {
-		.name = "bitstream",
-		.mmio = 0x12030,
-	}, blt_ring = {
-		.name = "blitter",
-		.mmio = 0x22030,
+	int drm_fd = -1;
+	struct pci_device *pci_dev = NULL;
+	struct record_header header = {
+		.magic = RECORD_MAGIC,
+		.version = RECORD_VERSION,
 	};
+	FILE *record = NULL, *replay = NULL;
 	int i, ch;
-	int samples_per_sec = SAMPLES_PER_SEC;
+	long samples_per_sec = SAMPLES_PER_SEC;
 	FILE *output = NULL;
 	double elapsed_time=0;
 	int print_headers=1;
@@ -435,15 +685,19 @@ int main(int argc, char **argv)
 	int child_stat;
 	char *cmd=NULL;
 	int interactive=1;
+	unsigned long long next_period;
 
 	/* Parse options? */
-	while ((ch = getopt(argc, argv, "s:o:e:h")) != -1) {
+	while ((ch = getopt_long(argc, argv, "s:o:e:h", long_options,
+				 NULL)) != -1) {
 		switch (ch) {
 		case 'e': cmd = strdup(optarg);
 			break;
-		case 's': samples_per_sec = atoi(optarg);
-			if (samples_per_sec < 100) {
-				fprintf(stderr, "Error: samples per second must be >= 100\n");
+		case 's': samples_per_sec = atol(optarg);
+			/* the sampling interval is a whole number of ns */
+			if (samples_per_sec < 100 ||
+			    samples_per_sec > 1000000000) {
+				fprintf(stderr, "Error: samples per second must be between 100 and 1000000000\n");
 				exit(1);
 			}
 			break;
@@ -461,6 +715,16 @@ int main(int argc, char **argv)
 				exit(1);
 			}
 			break;
+		case OPT_RECORD:
+			record = fopen(optarg, "w");
+			if (!record) {
+				perror("fopen");
+				exit(1);
+			}
+			break;
+		case OPT_REPLAY:
+			replay = replay_open(optarg, &header);
+			break;
 		case 'h':
 			usage(argv[0]);
 			exit(0);
@@ -473,9 +737,26 @@ int main(int argc, char **argv)
 		}
 	}
 
-	pci_dev = intel_get_pci_device();
-	devid = pci_dev->device_id;
-	intel_mmio_use_pci_bar(pci_dev);
+	if (replay) {
+		if (cmd || record) {
+			fprintf(stderr, "Error: --replay can't be combined with -e or --record\n");
+			exit(1);
+		}
+
+		/* Nothing to watch live, just output the statistics */
+		interactive = 0;
+		if (!output)
+			output = stdout;
+
+		devid = header.devid;
+		for (i = 0; i < NUM_RINGS; i++)
+			rings[i].size = header.ring_size[i];
+		memcpy(last_stats, header.stats, sizeof(last_stats));
+	} else {
+		pci_dev = intel_get_pci_device();
+		devid = pci_dev->device_id;
+		intel_mmio_use_pci_bar(pci_dev);
+	}
 	init_instdone_definitions(devid);
 
 	/* Do we have a command to run? */
@@ -512,41 +793,48 @@ int main(int argc, char **argv)
 		top_bits_sorted[i] = &top_bits[i];
 	}
 
-	/* Just to make sure we open the right debugfs files */
-	drm_fd = drm_open_driver_master(DRIVER_INTEL);
-
-	/* Grab access to the registers */
-	intel_register_access_init(pci_dev, 0, drm_fd);
-
-	ring_init(&render_ring);
-	if (IS_GEN4(devid) || IS_GEN5(devid))
-		ring_init(&bsd_ring);
-	if (IS_GEN6(devid) || IS_GEN7(devid)) {
-		ring_init(&bsd6_ring);
-		ring_init(&blt_ring);
-	}
+	if (!replay) {
+		/* Just to make sure we open the right debugfs files */
+		drm_fd = drm_open_driver_master(DRIVER_INTEL);
 
-	/* Initialize GPU stats */
-	if (HAS_STATS_REGS(devid)) {
-		for (i = 0; i < STATS_COUNT; i++) {
-			uint32_t stats_high, stats_low, stats_high_2;
+		/* Grab access to the registers */
+		intel_register_access_init(pci_dev, 0, drm_fd);
 
-			do {
-				stats_high = INREG(stats_regs[i] + 4);
-				stats_low = INREG(stats_regs[i]);
-				stats_high_2 = INREG(stats_regs[i] + 4);
-			} while (stats_high != stats_high_2);
+		ring_init(&rings[RING_RENDER]);
+		if (IS_GEN4(devid) || IS_GEN5(devid))
+			ring_init(&rings[RING_BSD]);
+		if (IS_GEN6(devid) || IS_GEN7(devid)) {
+			ring_init(&rings[RING_BSD6]);
+			ring_init(&rings[RING_BLT]);
+		}
 
-			last_stats[i] = (uint64_t)stats_high << 32 |
-				stats_low;
+		/* Initialize GPU stats */
+		if (HAS_STATS_REGS(devid))
+			read_stats(last_stats);
+
+		if (record) {
+			header.devid = devid;
+			header.samples_per_sec = samples_per_sec;
+			for (i = 0; i < NUM_RINGS; i++)
+				header.ring_size[i] = rings[i].size;
+			memcpy(header.stats, last_stats, sizeof(header.stats));
+			record_write(record, &header, sizeof(header));
 		}
+
+		sampler.is_965 = IS_965(devid);
+		sampler.samples_per_sec = samples_per_sec;
+		errno = pthread_create(&sampler.thread, NULL,
+				       sampler_thread, NULL);
+		if (errno)
+			err(1, "pthread_create");
 	}
 
+	next_period = gettime();
+
 	for (;;) {
-		int j;
-		unsigned long long t1, ti, tf, t2;
-		unsigned long long def_sleep = 1000000 / samples_per_sec;
-		unsigned long long last_samples_per_sec = samples_per_sec;
+		struct record_period period = {};
+		unsigned long long t;
+		unsigned long long last_samples_per_sec;
 		unsigned short int max_lines;
 		struct winsize ws;
 		char clear_screen[] = {0x1b, '[', 'H',
@@ -555,55 +843,44 @@ int main(int argc, char **argv)
 		int percent;
 		int len;
 
-		t1 = gettime();
-
-		ring_reset(&render_ring);
-		ring_reset(&bsd_ring);
-		ring_reset(&bsd6_ring);
-		ring_reset(&blt_ring);
-
-		for (i = 0; i < samples_per_sec; i++) {
-			long long interval;
-			ti = gettime();
-			if (IS_965(devid)) {
-				instdone = INREG(INSTDONE_I965);
-				instdone1 = INREG(INSTDONE_1);
-			} else
-				instdone = INREG(INSTDONE);
-
-			for (j = 0; j < num_instdone_bits; j++)
-				update_idle_bit(&top_bits[j]);
-
-			ring_sample(&render_ring);
-			ring_sample(&bsd_ring);
-			ring_sample(&bsd6_ring);
-			ring_sample(&blt_ring);
-
-			tf = gettime();
-			if (tf - t1 >= 1000000) {
-				/* We are out of sync, bail out */
-				last_samples_per_sec = i+1;
+		if (replay) {
+			if (!replay_period(replay, &period, samples))
 				break;
+			memcpy(stats, period.stats, sizeof(stats));
+		} else {
+			/* Let the sampler thread collect a second's worth */
+			next_period += 1000000;
+			t = gettime();
+			if (next_period > t)
+				usleep(next_period - t);
+
+			t = gettime();
+			period.duration_us = t - (next_period - 1000000);
+			if (t > next_period)
+				next_period = t;
+
+			period.nsamples = sampler_drain(samples,
+							&period.dropped);
+
+			if (HAS_STATS_REGS(devid))
+				read_stats(stats);
+
+			if (record) {
+				memcpy(period.stats, stats, sizeof(period.stats));
+				record_write(record, &period, sizeof(period));
+				if (period.nsamples)
+					record_write(record, samples,
+						     period.nsamples *
+						     sizeof(*samples));
+				fflush(record);
 			}
-			interval = def_sleep - (tf - ti);
-			if (interval > 0)
-				usleep(interval);
 		}
 
-		if (HAS_STATS_REGS(devid)) {
-			for (i = 0; i < STATS_COUNT; i++) {
-				uint32_t stats_high, stats_low, stats_high_2;
-
-				do {
-					stats_high = INREG(stats_regs[i] + 4);
-					stats_low = INREG(stats_regs[i]);
-					stats_high_2 = INREG(stats_regs[i] + 4);
-				} while (stats_high != stats_high_2);
+		for (i = 0; i < NUM_RINGS; i++)
+			ring_reset(&rings[i]);
 
-				stats[i] = (uint64_t)stats_high << 32 |
-					stats_low;
-			}
-		}
+		account_samples(samples, period.nsamples);
+		last_samples_per_sec = period.nsamples ?: 1;
 
 		qsort(top_bits_sorted, num_instdone_bits,
 		      sizeof(struct top_bit *), top_bits_sort);
@@ -616,17 +893,16 @@ int main(int argc, char **argv)
 		if (max_lines >= num_instdone_bits)
 			max_lines = num_instdone_bits;
 
-		t2 = gettime();
-		elapsed_time += (t2 - t1) / 1000000.0;
+		elapsed_time += period.duration_us / 1000000.0;
 
 		if (interactive) {
 			printf("%s", clear_screen);
 			print_clock_info(pci_dev);
 
-			ring_print(&render_ring, last_samples_per_sec);
-			ring_print(&bsd_ring, last_samples_per_sec);
-			ring_print(&bsd6_ring, last_samples_per_sec);
-			ring_print(&blt_ring, last_samples_per_sec);
+			for (i = 0; i < NUM_RINGS; i++)
+				ring_print(&rings[i], last_samples_per_sec);
+			printf("%25s dropped: %u/%u samples\n", "sampler",
+			       period.dropped, period.nsamples + period.dropped);
 
 			printf("\n%30s  %s\n", "task", "percent busy");
 			for (i = 0; i < max_lines; i++) {
@@ -658,10 +934,8 @@ int main(int argc, char **argv)
 			/* Print headers for columns at first run */
 			if (print_headers) {
 				fprintf(output, "# time\t");
-				ring_print_header(output, &render_ring);
-				ring_print_header(output, &bsd_ring);
-				ring_print_header(output, &bsd6_ring);
-				ring_print_header(output, &blt_ring);
+				for (i = 0; i < NUM_RINGS; i++)
+					ring_print_header(output, &rings[i]);
 				for (i = 0; i < MAX_NUM_TOP_BITS; i++) {
 					if (i < STATS_COUNT && HAS_STATS_REGS(devid)) {
 						fprintf(output, "%.6s\t",
@@ -671,16 +945,14 @@ int main(int argc, char **argv)
 					if (!top_bits[i].count)
 						continue;
 				}
-				fprintf(output, "\n");
+				fprintf(output, "dropped\n");
 				print_headers = 0;
 			}
 
 			/* Print statistics */
 			fprintf(output, "%.2f\t", elapsed_time);
-			ring_log(&render_ring, last_samples_per_sec, output);
-			ring_log(&bsd_ring, last_samples_per_sec, output);
-			ring_log(&bsd6_ring, last_samples_per_sec, output);
-			ring_log(&blt_ring, last_samples_per_sec, output);
+			for (i = 0; i < NUM_RINGS; i++)
+				ring_log(&rings[i], last_samples_per_sec, output);
 
 			for (i = 0; i < MAX_NUM_TOP_BITS; i++) {
 				if (i < STATS_COUNT && HAS_STATS_REGS(devid)) {
@@ -691,7 +963,7 @@ int main(int argc, char **argv)
 					if (!top_bits[i].count)
 						continue;
 			}
-			fprintf(output, "\n");
+			fprintf(output, "%u\n", period.dropped);
 			fflush(output);
 		}
 
@@ -716,9 +988,20 @@ int main(int argc, char **argv)
 		}
 	}
 
-	fclose(output);
+	if (replay) {
+		fclose(replay);
+	} else {
+		__atomic_store_n(&sampler.stop, true, __ATOMIC_RELAXED);
+		pthread_join(sampler.thread, NULL);
+
+		intel_register_access_fini();
+		close(drm_fd);
+	}
+
+	if (record)
+		fclose(record);
+	if (output)
+		fclose(output);
 
-	intel_register_access_fini();
-	close(drm_fd);
 	return 0;
 }
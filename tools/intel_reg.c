@@ -23,13 +23,17 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "igt.h"
@@ -72,10 +76,18 @@ struct config {
 	/* spread out bits for convenience */
 	bool binary;
 
+	/* decode: snapshot to decode registers from */
+	char *snapshot;
+
+	/* watch: sampling period, number of samples or 0 for no limit */
+	uint64_t period_ns;
+	uint64_t samples;
+
 	/* register spec */
 	char *specfile;
 	struct reg *regs;
 	ssize_t regcount;
+	struct reg_index index;
 
 	int verbosity;
 };
@@ -84,28 +96,22 @@ struct config {
 static int set_reg_by_addr(struct config *config, struct reg *reg,
 			   uint32_t addr)
 {
-	int i;
+	const struct reg *r;
 
 	reg->addr = addr;
 	if (reg->name)
 		free(reg->name);
 	reg->name = NULL;
 
-	for (i = 0; i < config->regcount; i++) {
-		struct reg *r = &config->regs[i];
-
-		if (reg->port_desc.port != r->port_desc.port)
-			continue;
-
-		/* ->mmio_offset should be 0 for non-MMIO ports. */
-		if (addr + reg->mmio_offset == r->addr + r->mmio_offset) {
-			/* Always output the "normalized" offset+addr. */
-			reg->mmio_offset = r->mmio_offset;
-			reg->addr = r->addr;
+	/* ->mmio_offset should be 0 for non-MMIO ports. */
+	r = intel_reg_spec_find_addr(&config->index, reg->port_desc.port,
+				     addr + reg->mmio_offset);
+	if (r) {
+		/* Always output the "normalized" offset+addr. */
+		reg->mmio_offset = r->mmio_offset;
+		reg->addr = r->addr;
 
-			reg->name = r->name ? strdup(r->name) : NULL;
-			break;
-		}
+		reg->name = r->name ? strdup(r->name) : NULL;
 	}
 
 	return 0;
@@ -115,32 +121,22 @@ static int set_reg_by_addr(struct config *config, struct reg *reg,
 static int set_reg_by_name(struct config *config, struct reg *reg,
 			   const char *name)
 {
-	int i;
+	const struct reg *r;
 
 	reg->name = strdup(name);
 	reg->addr = 0;
 
-	for (i = 0; i < config->regcount; i++) {
-		struct reg *r = &config->regs[i];
-
-		if (reg->port_desc.port != r->port_desc.port)
-			continue;
-
-		if (!r->name)
-			continue;
-
-		if (strcasecmp(name, r->name) == 0) {
-			reg->addr = r->addr;
+	r = intel_reg_spec_find_name(&config->index, reg->port_desc.port, name);
+	if (!r)
+		return -1;
 
-			/* Also get MMIO offset if not already specified. */
-			if (!reg->mmio_offset && r->mmio_offset)
-				reg->mmio_offset = r->mmio_offset;
+	reg->addr = r->addr;
 
-			return 0;
-		}
-	}
+	/* Also get MMIO offset if not already specified. */
+	if (!reg->mmio_offset && r->mmio_offset)
+		reg->mmio_offset = r->mmio_offset;
 
-	return -1;
+	return 0;
 }
 
 static void to_binary(char *buf, size_t buflen, uint32_t val)
@@ -518,11 +514,47 @@ static int intel_reg_snapshot(struct config *config, int argc, char *argv[])
 	return EXIT_SUCCESS;
 }
 
-/* XXX: add support for reading and re-decoding a previously done dump */
+/* Decode the given registers, or all known registers, from a snapshot. */
+static int decode_snapshot(struct config *config, int argc, char *argv[])
+{
+	int i;
+
+	intel_mmio_use_dump_file(config->snapshot);
+
+	if (argc == 1) {
+		for (i = 0; i < config->regcount; i++) {
+			if (config->regs[i].port_desc.port == PORT_MMIO)
+				dump_register(config, &config->regs[i]);
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	for (i = 1; i < argc; i++) {
+		struct reg reg;
+
+		if (parse_reg(config, &reg, argv[i]))
+			continue;
+
+		if (reg.port_desc.port != PORT_MMIO) {
+			fprintf(stderr, "decode: can't read port %s "
+				"from snapshot\n", reg.port_desc.name);
+			continue;
+		}
+
+		dump_register(config, &reg);
+	}
+
+	return EXIT_SUCCESS;
+}
+
 static int intel_reg_decode(struct config *config, int argc, char *argv[])
 {
 	int i;
 
+	if (config->snapshot)
+		return decode_snapshot(config, argc, argv);
+
 	if (argc == 1) {
 		fprintf(stderr, "decode: no registers specified\n");
 		return EXIT_FAILURE;
@@ -554,6 +586,445 @@ static int intel_reg_decode(struct config *config, int argc, char *argv[])
 	return EXIT_SUCCESS;
 }
 
+#define DIFF_BLOCK	64
+
+/*
+ * Return the offset of the first dword at or after offset that differs
+ * between a and b, or size if none does. Identical blocks are skipped with an
+ * XOR/OR reduction, which the compiler vectorises.
+ */
+static size_t next_diff(const char *a, const char *b, size_t offset,
+			size_t size)
+{
+	while (offset < size && offset % DIFF_BLOCK) {
+		if (*(const uint32_t *)(a + offset) !=
+		    *(const uint32_t *)(b + offset))
+			return offset;
+		offset += 4;
+	}
+
+	while (offset + DIFF_BLOCK <= size) {
+		const uint64_t *qa = (const uint64_t *)(a + offset);
+		const uint64_t *qb = (const uint64_t *)(b + offset);
+		uint64_t diff = 0;
+		int i;
+
+		for (i = 0; i < DIFF_BLOCK / sizeof(uint64_t); i++)
+			diff |= qa[i] ^ qb[i];
+
+		if (diff)
+			break;
+
+		offset += DIFF_BLOCK;
+	}
+
+	for (; offset < size; offset += 4) {
+		if (*(const uint32_t *)(a + offset) !=
+		    *(const uint32_t *)(b + offset))
+			break;
+	}
+
+	return offset;
+}
+
+static const char *map_snapshot(const char *file, size_t *size)
+{
+	struct stat st;
+
+	if (stat(file, &st)) {
+		fprintf(stderr, "stat '%s': %s\n", file, strerror(errno));
+		return NULL;
+	}
+
+	intel_mmio_use_dump_file((char *)file);
+	*size = st.st_size;
+
+	return igt_global_mmio;
+}
+
+static int intel_reg_diff(struct config *config, int argc, char *argv[])
+{
+	const char *a, *b;
+	size_t size_a, size_b, size, offset;
+
+	if (argc != 3) {
+		fprintf(stderr, "diff: two snapshots required\n");
+		return EXIT_FAILURE;
+	}
+
+	a = map_snapshot(argv[1], &size_a);
+	b = map_snapshot(argv[2], &size_b);
+	if (!a || !b)
+		return EXIT_FAILURE;
+
+	size = min(size_a, size_b) & ~3;
+	if (size_a != size_b)
+		fprintf(stderr, "Warning: snapshot sizes differ, comparing "
+			"the first 0x%zx bytes\n", size);
+
+	for (offset = next_diff(a, b, 0, size); offset < size;
+	     offset = next_diff(a, b, offset + 4, size)) {
+		const struct reg *r;
+		struct reg reg;
+
+		r = intel_reg_spec_find_addr(&config->index, PORT_MMIO,
+					     offset);
+		if (r) {
+			reg = *r;
+		} else if (config->verbosity > 0) {
+			/* Also show changes outside of the register spec */
+			parse_port_desc(&reg, NULL);
+			reg.addr = offset;
+			reg.name = NULL;
+		} else {
+			continue;
+		}
+
+		printf("-");
+		dump_decode(config, &reg,
+			    *(const uint32_t *)(a + offset));
+		printf("+");
+		dump_decode(config, &reg,
+			    *(const uint32_t *)(b + offset));
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * watch log: a header and the watched registers, followed by samples of a
+ * uint64_t timestamp in ns since the first sample and a uint32_t value per
+ * register, all in host byte order.
+ */
+#define WATCH_LOG_MAGIC		0x48435457	/* "WTCH" */
+#define WATCH_LOG_VERSION	1
+
+/* Samples buffered for writing, streamed out half a ring at a time. */
+#define WATCH_RING_SIZE		4096
+
+/* Longest --period in us, an hour, so that the schedule never overflows. */
+#define WATCH_MAX_PERIOD_US	3600e6
+
+struct watch_log_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t devid;
+	uint32_t nregs;
+	uint64_t period_ns;
+	int64_t start_sec;	/* CLOCK_REALTIME of the first sample */
+	int64_t start_nsec;
+};
+
+struct watch_log_reg {
+	uint32_t mmio_offset;
+	uint32_t addr;
+	char name[56];
+};
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_signal(int sig)
+{
+	watch_stop = 1;
+}
+
+static int write_all(int fd, const void *buf, size_t size)
+{
+	const char *p = buf;
+
+	while (size) {
+		ssize_t r = write(fd, p, size);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		p += r;
+		size -= r;
+	}
+
+	return 0;
+}
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int intel_reg_watch(struct config *config, int argc, char *argv[])
+{
+	struct watch_log_header header = {
+		.magic = WATCH_LOG_MAGIC,
+		.version = WATCH_LOG_VERSION,
+		.devid = config->devid,
+		.nregs = argc - 1,
+		.period_ns = config->period_ns,
+	};
+	const size_t half = WATCH_RING_SIZE / 2;
+	struct watch_log_reg *log_regs = NULL;
+	volatile uint32_t **ptrs = NULL;
+	uint64_t start, now, next, nsamples = 0, late = 0;
+	size_t sample_size, pos = 0;
+	struct timespec ts;
+	char *ring = NULL;
+	int ret = EXIT_FAILURE;
+	int i, r;
+
+	if (argc == 1) {
+		fprintf(stderr, "watch: no registers specified\n");
+		return EXIT_FAILURE;
+	}
+
+	if (isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "watch: not writing binary log to a terminal\n");
+		return EXIT_FAILURE;
+	}
+
+	sample_size = sizeof(uint64_t) + header.nregs * sizeof(uint32_t);
+	log_regs = calloc(header.nregs, sizeof(*log_regs));
+	ptrs = calloc(header.nregs, sizeof(*ptrs));
+	ring = malloc(WATCH_RING_SIZE * sample_size);
+	if (!log_regs || !ptrs || !ring) {
+		fprintf(stderr, "watch: %s\n", strerror(ENOMEM));
+		goto out;
+	}
+
+	if (config->mmiofile)
+		intel_mmio_use_dump_file(config->mmiofile);
+	else
+		intel_register_access_init(config->pci_dev, 0, config->drm_fd);
+
+	for (i = 0; i < header.nregs; i++) {
+		struct reg reg;
+
+		if (parse_reg(config, &reg, argv[i + 1]))
+			goto out_fini;
+
+		if (reg.port_desc.port != PORT_MMIO) {
+			fprintf(stderr, "watch: port %s not supported\n",
+				reg.port_desc.name);
+			free(reg.name);
+			goto out_fini;
+		}
+
+		log_regs[i].mmio_offset = reg.mmio_offset;
+		log_regs[i].addr = reg.addr;
+		if (reg.name)
+			strncpy(log_regs[i].name, reg.name,
+				sizeof(log_regs[i].name) - 1);
+		free(reg.name);
+
+		/* Sample the registers directly, without INREG() */
+		ptrs[i] = (volatile uint32_t *)((char *)igt_global_mmio +
+						reg.mmio_offset + reg.addr);
+	}
+
+	signal(SIGINT, watch_signal);
+	signal(SIGTERM, watch_signal);
+
+	/* Wake up as close to the period as possible */
+	prctl(PR_SET_TIMERSLACK, 1);
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	start = next = monotonic_ns();
+	header.start_sec = ts.tv_sec;
+	header.start_nsec = ts.tv_nsec;
+
+	r = write_all(STDOUT_FILENO, &header, sizeof(header));
+	if (!r)
+		r = write_all(STDOUT_FILENO, log_regs,
+			      header.nregs * sizeof(*log_regs));
+
+	/* No allocations nor formatting from here on. */
+	while (!r && !watch_stop &&
+	       (!config->samples || nsamples < config->samples)) {
+		char *sample = ring + pos * sample_size;
+		uint64_t t;
+
+		now = monotonic_ns();
+		t = now - start;
+		memcpy(sample, &t, sizeof(t));
+		for (i = 0; i < header.nregs; i++) {
+			uint32_t val = *ptrs[i];
+
+			memcpy(sample + sizeof(t) + i * sizeof(val),
+			       &val, sizeof(val));
+		}
+
+		nsamples++;
+		if (++pos % half == 0) {
+			r = write_all(STDOUT_FILENO,
+				      ring + (pos - half) * sample_size,
+				      half * sample_size);
+			pos %= WATCH_RING_SIZE;
+		}
+
+		if (!config->period_ns)
+			continue;
+
+		/* Keep to the period, skipping slots we were late for */
+		next += config->period_ns;
+		now = monotonic_ns();
+		if (next <= now) {
+			late += (now - next) / config->period_ns + 1;
+			next += ((now - next) / config->period_ns + 1) *
+				config->period_ns;
+		}
+
+		ts.tv_sec = next / 1000000000ull;
+		ts.tv_nsec = next % 1000000000ull;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+				       &ts, NULL) == EINTR && !watch_stop)
+			;
+	}
+
+	if (!r && pos % half)
+		r = write_all(STDOUT_FILENO,
+			      ring + (pos - pos % half) * sample_size,
+			      (pos % half) * sample_size);
+
+	if (r) {
+		fprintf(stderr, "watch: writing log: %s\n", strerror(-r));
+		goto out_fini;
+	}
+
+	if (config->verbosity > 0) {
+		double secs = (monotonic_ns() - start) / 1e9;
+
+		fprintf(stderr, "%"PRIu64" samples in %.3f s (%.0f Hz), "
+			"%"PRIu64" periods missed\n",
+			nsamples, secs, nsamples / secs, late);
+	}
+
+	ret = EXIT_SUCCESS;
+
+out_fini:
+	intel_register_access_fini();
+out:
+	free(ring);
+	free(ptrs);
+	free(log_regs);
+
+	return ret;
+}
+
+static void print_csv_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"')
+			putchar('"');
+		putchar(*s == '\n' ? ' ' : *s);
+	}
+	putchar('"');
+}
+
+static int intel_reg_watch_csv(struct config *config, int argc, char *argv[])
+{
+	struct watch_log_header header;
+	struct watch_log_reg *log_regs = NULL;
+	struct reg *regs = NULL;
+	char *sample = NULL;
+	size_t sample_size;
+	int ret = EXIT_FAILURE;
+	FILE *file;
+	int i;
+
+	if (argc != 2) {
+		fprintf(stderr, "watch-csv: one log required\n");
+		return EXIT_FAILURE;
+	}
+
+	file = fopen(argv[1], "r");
+	if (!file) {
+		fprintf(stderr, "Error: fopen '%s': %s\n",
+			argv[1], strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    header.magic != WATCH_LOG_MAGIC ||
+	    header.version != WATCH_LOG_VERSION ||
+	    !header.nregs || header.nregs > 0xffff) {
+		fprintf(stderr, "watch-csv: '%s' is not a watch log\n",
+			argv[1]);
+		goto out;
+	}
+
+	sample_size = sizeof(uint64_t) + header.nregs * sizeof(uint32_t);
+	log_regs = calloc(header.nregs, sizeof(*log_regs));
+	regs = calloc(header.nregs, sizeof(*regs));
+	sample = malloc(sample_size);
+	if (!log_regs || !regs || !sample) {
+		fprintf(stderr, "watch-csv: %s\n", strerror(ENOMEM));
+		goto out;
+	}
+
+	if (fread(log_regs, sizeof(*log_regs), header.nregs, file) !=
+	    header.nregs) {
+		fprintf(stderr, "watch-csv: '%s' is truncated\n", argv[1]);
+		goto out;
+	}
+
+	printf("time");
+	for (i = 0; i < header.nregs; i++) {
+		struct watch_log_reg *lr = &log_regs[i];
+
+		lr->name[sizeof(lr->name) - 1] = '\0';
+
+		parse_port_desc(&regs[i], NULL);
+		regs[i].mmio_offset = lr->mmio_offset;
+		regs[i].addr = lr->addr;
+		regs[i].name = *lr->name ? lr->name : NULL;
+
+		if (regs[i].name)
+			printf(",%s,%s decode", lr->name, lr->name);
+		else
+			printf(",0x%08x,0x%08x decode",
+			       lr->mmio_offset + lr->addr,
+			       lr->mmio_offset + lr->addr);
+	}
+	printf("\n");
+
+	while (fread(sample, sample_size, 1, file) == 1) {
+		uint64_t t;
+
+		memcpy(&t, sample, sizeof(t));
+		printf("%"PRIu64".%09"PRIu64, t / 1000000000, t % 1000000000);
+
+		for (i = 0; i < header.nregs; i++) {
+			char decode[1024];
+			uint32_t val;
+
+			memcpy(&val, sample + sizeof(t) + i * sizeof(val),
+			       sizeof(val));
+
+			intel_reg_spec_decode(decode, sizeof(decode), &regs[i],
+					      val, header.devid);
+
+			printf(",0x%08x,", val);
+			print_csv_string(decode);
+		}
+		printf("\n");
+	}
+
+	ret = EXIT_SUCCESS;
+
+out:
+	free(sample);
+	free(regs);
+	free(log_regs);
+	fclose(file);
+
+	return ret;
+}
+
 static int intel_reg_list(struct config *config, int argc, char *argv[])
 {
 	int i;
@@ -572,6 +1043,10 @@ struct command {
 	const char *description;
 	const char *synopsis;
 	int (*function)(struct config *config, int argc, char *argv[]);
+	/* doesn't need the device, with --devid */
+	bool offline;
+	/* needs neither the device nor the register spec */
+	bool standalone;
 };
 
 static const struct command commands[] = {
@@ -595,14 +1070,36 @@ static const struct command commands[] = {
 	{
 		.name = "decode",
 		.function = intel_reg_decode,
-		.synopsis = "REGISTER VALUE [REGISTER VALUE ...]",
+		.synopsis = "REGISTER VALUE [REGISTER VALUE ...] | "
+			    "--snapshot=FILE [REGISTER ...]",
 		.description = "decode value(s) for specified register(s)",
+		.offline = true,
+	},
+	{
+		.name = "diff",
+		.function = intel_reg_diff,
+		.synopsis = "SNAPSHOT SNAPSHOT",
+		.description = "decode registers that differ between snapshots",
+		.offline = true,
 	},
 	{
 		.name = "snapshot",
 		.function = intel_reg_snapshot,
 		.description = "create a snapshot of the MMIO bar to stdout",
 	},
+	{
+		.name = "watch",
+		.function = intel_reg_watch,
+		.synopsis = "[--period=US] [--samples=N] REGISTER [...] > LOG",
+		.description = "sample register(s) periodically to a binary log",
+	},
+	{
+		.name = "watch-csv",
+		.function = intel_reg_watch_csv,
+		.synopsis = "LOG",
+		.description = "decode a binary watch log to CSV",
+		.standalone = true,
+	},
 	{
 		.name = "list",
 		.function = intel_reg_list,
@@ -733,18 +1230,29 @@ static int read_reg_spec(struct config *config)
 		path = buf;
 	}
 
-	config->regcount = intel_reg_spec_file(&config->regs, path);
+	config->regcount = intel_reg_spec_file_cached(&config->regs, path);
 	if (config->regcount <= 0) {
 		fprintf(stderr, "Warning: reading '%s' failed. "
 			"Using builtin register spec.\n", path);
 		goto builtin;
 	}
 
-	return config->regcount;
+	goto index;
 
 builtin:
 	/* Fallback to builtin register spec. */
 	config->regcount = intel_reg_spec_builtin(&config->regs, config->devid);
+	if (config->regcount < 0)
+		return config->regcount;
+
+index:
+	r = intel_reg_spec_index(&config->index, config->regs,
+				 config->regcount);
+	if (r) {
+		fprintf(stderr, "Error: indexing register spec: %s\n",
+			strerror(-r));
+		return r;
+	}
 
 	return config->regcount;
 }
@@ -758,6 +1266,9 @@ enum opt {
 	OPT_POST,
 	OPT_ALL,
 	OPT_BINARY,
+	OPT_SNAPSHOT,
+	OPT_PERIOD,
+	OPT_SAMPLES,
 	OPT_SPEC,
 	OPT_VERBOSE,
 	OPT_QUIET,
@@ -772,6 +1283,7 @@ int main(int argc, char *argv[])
 	const struct command *command = NULL;
 	struct config config = {
 		.count = 1,
+		.period_ns = 1000000,
 	};
 	bool help = false;
 
@@ -791,6 +1303,11 @@ int main(int argc, char *argv[])
 		/* options specific to read, dump and decode */
 		{ "all",	no_argument,		NULL,	OPT_ALL },
 		{ "binary",	no_argument,		NULL,	OPT_BINARY },
+		/* options specific to decode */
+		{ "snapshot",	required_argument,	NULL,	OPT_SNAPSHOT },
+		/* options specific to watch */
+		{ "period",	required_argument,	NULL,	OPT_PERIOD },
+		{ "samples",	required_argument,	NULL,	OPT_SAMPLES },
 		{ 0 }
 	};
 
@@ -831,6 +1348,34 @@ int main(int argc, char *argv[])
 				return EXIT_FAILURE;
 			}
 			break;
+		case OPT_SNAPSHOT:
+			config.snapshot = strdup(optarg);
+			if (!config.snapshot) {
+				fprintf(stderr, "strdup: %s\n",
+					strerror(errno));
+				return EXIT_FAILURE;
+			}
+			break;
+		case OPT_PERIOD: {
+			double period = strtod(optarg, &endp);
+
+			/* Written so as to also reject nan */
+			if (*endp || endp == optarg ||
+			    !(period >= 0 && period <= WATCH_MAX_PERIOD_US)) {
+				fprintf(stderr, "invalid period '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			config.period_ns = period * 1000;
+			break;
+		}
+		case OPT_SAMPLES:
+			config.samples = strtoull(optarg, &endp, 10);
+			if (*endp || endp == optarg) {
+				fprintf(stderr, "invalid samples '%s'\n",
+					optarg);
+				return EXIT_FAILURE;
+			}
+			break;
 		case OPT_ALL:
 			config.all_platforms = true;
 			break;
@@ -864,13 +1409,27 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	for (i = 0; i < ARRAY_SIZE(commands); i++) {
+		if (strcmp(argv[0], commands[i].name) == 0) {
+			command = &commands[i];
+			break;
+		}
+	}
+
+	if (!command) {
+		fprintf(stderr, "'%s' is not an intel-reg command\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (command->standalone)
+		return command->function(&config, argc, argv);
+
 	if (config.mmiofile) {
 		if (!config.devid) {
 			fprintf(stderr, "--mmio requires --devid\n");
 			return EXIT_FAILURE;
 		}
-	} else {
-		/* XXX: devid without --mmio could be useful for decode. */
+	} else if (!command->offline || !config.devid) {
 		if (config.devid) {
 			fprintf(stderr, "--devid without --mmio\n");
 			return EXIT_FAILURE;
@@ -880,27 +1439,17 @@ int main(int argc, char *argv[])
 	}
 
 	/* Just to make sure we open the right debugfs files */
-	config.drm_fd = __drm_open_driver(DRIVER_INTEL);
+	if (config.pci_dev || config.mmiofile)
+		config.drm_fd = __drm_open_driver(DRIVER_INTEL);
 
 	if (read_reg_spec(&config) < 0) {
 		return EXIT_FAILURE;
 	}
 
-	for (i = 0; i < ARRAY_SIZE(commands); i++) {
-		if (strcmp(argv[0], commands[i].name) == 0) {
-			command = &commands[i];
-			break;
-		}
-	}
-
-	if (!command) {
-		fprintf(stderr, "'%s' is not an intel-reg command\n", argv[0]);
-		return EXIT_FAILURE;
-	}
-
 	ret = command->function(&config, argc, argv);
 
 	free(config.mmiofile);
+	free(config.snapshot);
 
 	return ret;
 }
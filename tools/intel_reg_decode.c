@@ -2673,6 +2673,89 @@ static struct {
 };
 #undef DECLARE_REGS
 
+/*
+ * The entries of known_registers that apply to one devid, sorted by address
+ * and then by their order in known_registers, so that a register is decoded
+ * with a binary search rather than a walk of every table.
+ */
+struct decode_entry {
+	uint32_t addr;
+	int order;
+	const struct reg_debug *reg;
+	const char *description;
+};
+
+static struct {
+	struct decode_entry *entries;
+	int count;
+	uint32_t devid;
+} decode_table;
+
+static int decode_entry_cmp(const void *A, const void *B)
+{
+	const struct decode_entry *a = A, *b = B;
+
+	if (a->addr != b->addr)
+		return a->addr < b->addr ? -1 : 1;
+
+	return a->order - b->order;
+}
+
+static int build_decode_table(uint32_t devid)
+{
+	struct decode_entry *entries;
+	int i, j, count = 0;
+
+	for (i = 0; i < ARRAY_SIZE(known_registers); i++)
+		count += known_registers[i].count;
+
+	entries = calloc(count, sizeof(*entries));
+	if (!entries)
+		return -ENOMEM;
+
+	count = 0;
+	for (i = 0; i < ARRAY_SIZE(known_registers); i++) {
+		if (devid && known_registers[i].match &&
+		    !known_registers[i].match(devid, 0))
+			continue;
+
+		for (j = 0; j < known_registers[i].count; j++) {
+			entries[count].addr = known_registers[i].regs[j].reg;
+			entries[count].order = count;
+			entries[count].reg = &known_registers[i].regs[j];
+			entries[count].description =
+				known_registers[i].description;
+			count++;
+		}
+	}
+
+	qsort(entries, count, sizeof(*entries), decode_entry_cmp);
+
+	free(decode_table.entries);
+	decode_table.entries = entries;
+	decode_table.count = count;
+	decode_table.devid = devid;
+
+	return 0;
+}
+
+static const struct decode_entry *find_decode_entry(uint32_t addr)
+{
+	int lo = 0, hi = decode_table.count;
+
+	/* the first entry for addr */
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (decode_table.entries[mid].addr < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return &decode_table.entries[lo];
+}
+
 /*
  * Decode register value into buffer for devid.
  *
@@ -2682,48 +2765,43 @@ static struct {
 int intel_reg_spec_decode(char *buf, size_t bufsize, const struct reg *reg,
 			  uint32_t val, uint32_t devid)
 {
+	const struct decode_entry *e, *end;
 	char tmp[1024];
-	int i, j;
 
 	if (!bufsize)
 		return -1;
 
 	*buf = 0;
 
-	for (i = 0; i < ARRAY_SIZE(known_registers); i++) {
-		const struct reg_debug *regs = known_registers[i].regs;
-
-		if (devid) {
-			if (known_registers[i].match &&
-			    !known_registers[i].match(devid, 0))
-				continue;
-		}
+	if (!decode_table.entries || decode_table.devid != devid) {
+		if (build_decode_table(devid))
+			return -1;
+	}
 
-		for (j = 0; j < known_registers[i].count; j++) {
-			const struct reg_debug *r = &regs[j];
-			if (reg->addr != r->reg)
-				continue;
+	end = decode_table.entries + decode_table.count;
+	for (e = find_decode_entry(reg->addr);
+	     e < end && e->addr == reg->addr; e++) {
+		const struct reg_debug *r = e->reg;
 
-			if (r->debug_output) {
-				if (r->debug_output(tmp, sizeof(tmp), r->reg,
-						    val, devid) == 0)
-					continue;
-			} else if (devid) {
-				return 0;
-			} else {
+		if (r->debug_output) {
+			if (r->debug_output(tmp, sizeof(tmp), r->reg,
+					    val, devid) == 0)
 				continue;
-			}
-
-			if (devid) {
-				strncpy(buf, tmp, bufsize);
-				return 0;
-			}
+		} else if (devid) {
+			return 0;
+		} else {
+			continue;
+		}
 
-			strncat(buf, known_registers[i].description, bufsize);
-			strncat(buf, "\t", bufsize);
-			strncat(buf, tmp, bufsize);
-			strncat(buf, "\n", bufsize);
+		if (devid) {
+			strncpy(buf, tmp, bufsize);
+			return 0;
 		}
+
+		strncat(buf, e->description, bufsize);
+		strncat(buf, "\t", bufsize);
+		strncat(buf, tmp, bufsize);
+		strncat(buf, "\n", bufsize);
 	}
 
 	return 0;
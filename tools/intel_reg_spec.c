@@ -23,12 +23,17 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <regex.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "intel_reg_spec.h"
 
@@ -235,9 +240,9 @@ static int parse_line(struct reg *reg, const char *line)
 			reg->name = p;
 		} else if (i == 2) {
 			reg->addr = strtoul(p, &e, 16);
-			free(p);
 			if (*e)
 				ret = -1;
+			free(p);
 		} else if (i == 3) {
 			ret = parse_port_desc(reg, p);
 			free(p);
@@ -250,8 +255,46 @@ static int parse_line(struct reg *reg, const char *line)
 	return ret;
 }
 
+/* Files read while parsing a spec, recorded for the spec cache */
+struct spec_sources {
+	char **files;
+	size_t count;
+};
+
+static int add_source(struct spec_sources *sources, const char *filename)
+{
+	char **files;
+
+	if (!sources)
+		return 0;
+
+	files = realloc(sources->files,
+			(sources->count + 1) * sizeof(*sources->files));
+	if (!files)
+		return -1;
+
+	sources->files = files;
+	sources->files[sources->count] = strdup(filename);
+	if (!sources->files[sources->count])
+		return -1;
+
+	sources->count++;
+
+	return 0;
+}
+
+static void free_sources(struct spec_sources *sources)
+{
+	size_t i;
+
+	for (i = 0; i < sources->count; i++)
+		free(sources->files[i]);
+	free(sources->files);
+}
+
 static ssize_t parse_file(struct reg **regs, size_t *nregs,
-			  ssize_t index, const char *filename)
+			  ssize_t index, const char *filename,
+			  struct spec_sources *sources)
 {
 	FILE *file;
 	char *line = NULL, *include;
@@ -266,6 +309,11 @@ static ssize_t parse_file(struct reg **regs, size_t *nregs,
 		return -1;
 	}
 
+	if (add_source(sources, filename)) {
+		fprintf(stderr, "Error: %s\n", strerror(ENOMEM));
+		goto out;
+	}
+
 	while (getline(&line, &linesize, file) != -1) {
 		struct reg reg;
 
@@ -276,7 +324,8 @@ static ssize_t parse_file(struct reg **regs, size_t *nregs,
 
 		include = include_file(line, filename);
 		if (include) {
-			index = parse_file(regs, nregs, index, include);
+			index = parse_file(regs, nregs, index, include,
+					   sources);
 			free(include);
 			if (index < 0) {
 				fprintf(stderr, "Error: %s:%d: %s",
@@ -328,7 +377,7 @@ ssize_t intel_reg_spec_file(struct reg **regs, const char *file)
 	size_t nregs = 0;
 	*regs = NULL;
 
-	return parse_file(regs, &nregs, 0, file);
+	return parse_file(regs, &nregs, 0, file, NULL);
 }
 
 /*
@@ -344,6 +393,494 @@ void intel_reg_spec_free(struct reg *regs, size_t n)
 	free(regs);
 }
 
+/*
+ * Compiled spec cache. Parsing the text spec dominates the startup time of
+ * intel_reg, so the parsed spec is also stored in a binary file under
+ * $XDG_CACHE_HOME/intel_reg, named after the spec file. The cache is mapped
+ * and used without any parsing for as long as none of the text files it was
+ * compiled from have changed; the text files remain the source of truth.
+ *
+ * The file is a header, followed by the source files, the registers in spec
+ * order and a pool of NUL terminated strings, all in host byte order.
+ *
+ * intel_reg usually runs as root, so the cache is only used from directories,
+ * and only read from files, owned by the effective user and writable by no one
+ * else. Under sudo -E that skips the cache in the invoking user's home, rather
+ * than trusting a cache they could have written, or leaving root owned
+ * directories behind in it.
+ */
+#define SPEC_CACHE_MAGIC	0x47455249	/* "IREG" */
+#define SPEC_CACHE_VERSION	1
+
+struct spec_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nsources;
+	uint32_t nregs;
+	uint32_t strings_size;
+	uint32_t reserved;
+};
+
+struct spec_cache_source {
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t size;
+	uint32_t path;		/* offset in the string pool */
+	uint32_t reserved;
+};
+
+struct spec_cache_reg {
+	uint32_t port;		/* port name, offset in the string pool */
+	uint32_t mmio_offset;
+	uint32_t addr;
+	uint32_t name;		/* offset in the string pool */
+};
+
+static bool source_matches(const struct spec_cache_source *source,
+			   const struct stat *st)
+{
+	return source->mtime_sec == st->st_mtim.tv_sec &&
+		source->mtime_nsec == st->st_mtim.tv_nsec &&
+		source->size == st->st_size;
+}
+
+static bool spec_cache_trusted(const struct stat *st)
+{
+	return st->st_uid == geteuid() && !(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+/* Missing directories are only created, by us, when storing the cache */
+static bool spec_cache_dir_trusted(const char *dir)
+{
+	struct stat st;
+
+	if (stat(dir, &st))
+		return errno == ENOENT;
+
+	return S_ISDIR(st.st_mode) && spec_cache_trusted(&st);
+}
+
+/*
+ * Get the cache file name for the spec file at the absolute path, optionally
+ * creating the cache directory.
+ */
+static int spec_cache_file(char *buf, size_t buflen, const char *path,
+			   bool create)
+{
+	const char *dir = getenv("XDG_CACHE_HOME");
+	const char *base = strrchr(path, '/');
+	char parent[PATH_MAX];
+	uint32_t hash = 2166136261u;
+	const char *p;
+	int len;
+
+	if (dir && *dir)
+		len = snprintf(parent, sizeof(parent), "%s", dir);
+	else if ((dir = getenv("HOME")) && *dir &&
+		 spec_cache_dir_trusted(dir))
+		len = snprintf(parent, sizeof(parent), "%s/.cache", dir);
+	else
+		return -ENOENT;
+
+	if (len >= sizeof(parent))
+		return -ENAMETOOLONG;
+
+	/* Spec files of the same name in different directories */
+	for (p = path; *p; p++) {
+		hash ^= (unsigned char)*p;
+		hash *= 16777619u;
+	}
+
+	if (create && mkdir(parent, 0755) && errno != EEXIST)
+		return -errno;
+	if (!spec_cache_dir_trusted(parent))
+		return -EPERM;
+
+	len = snprintf(buf, buflen, "%s/intel_reg", parent);
+	if (len >= buflen)
+		return -ENAMETOOLONG;
+	if (create && mkdir(buf, 0755) && errno != EEXIST)
+		return -errno;
+	if (!spec_cache_dir_trusted(buf))
+		return -EPERM;
+
+	len = snprintf(buf, buflen, "%s/intel_reg/%s-%08x",
+		       parent, base ? base + 1 : path, hash);
+	if (len >= buflen)
+		return -ENAMETOOLONG;
+
+	return 0;
+}
+
+static ssize_t spec_cache_load(struct reg **regs, const char *cachefile)
+{
+	const struct spec_cache_header *header;
+	const struct spec_cache_source *sources;
+	const struct spec_cache_reg *cregs;
+	const char *strings;
+	struct stat st;
+	size_t size, mapsize;
+	ssize_t ret = -1;
+	void *map;
+	uint32_t i;
+	size_t j = 0;
+	int fd;
+
+	fd = open(cachefile, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !spec_cache_trusted(&st) ||
+	    st.st_size < sizeof(*header)) {
+		close(fd);
+		return -1;
+	}
+
+	mapsize = st.st_size;
+	map = mmap(NULL, mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	header = map;
+	if (header->magic != SPEC_CACHE_MAGIC ||
+	    header->version != SPEC_CACHE_VERSION ||
+	    !header->nregs || !header->strings_size)
+		goto out;
+
+	size = sizeof(*header) +
+		(size_t)header->nsources * sizeof(*sources) +
+		(size_t)header->nregs * sizeof(*cregs) +
+		header->strings_size;
+	if (size != mapsize)
+		goto out;
+
+	sources = (const void *)(header + 1);
+	cregs = (const void *)(sources + header->nsources);
+	strings = (const char *)(cregs + header->nregs);
+	if (strings[header->strings_size - 1])
+		goto out;
+
+	/* Stale if any of the files the spec was compiled from changed */
+	for (i = 0; i < header->nsources; i++) {
+		if (sources[i].path >= header->strings_size ||
+		    stat(strings + sources[i].path, &st) ||
+		    !source_matches(&sources[i], &st))
+			goto out;
+	}
+
+	*regs = calloc(header->nregs, sizeof(**regs));
+	if (!*regs)
+		goto out;
+
+	for (i = 0; i < header->nregs; i++) {
+		const struct spec_cache_reg *cr = &cregs[i];
+		struct reg *reg = &(*regs)[i];
+
+		if (cr->port >= header->strings_size ||
+		    cr->name >= header->strings_size)
+			break;
+
+		/* Registers share the few port names, usually the previous one */
+		if (!i || cr->port != cregs[i - 1].port) {
+			for (j = 0; j < ARRAY_SIZE(port_descs); j++)
+				if (!strcmp(strings + cr->port,
+					    port_descs[j].name))
+					break;
+			if (j == ARRAY_SIZE(port_descs))
+				break;
+		}
+
+		reg->port_desc = port_descs[j];
+		reg->mmio_offset = cr->mmio_offset;
+		reg->addr = cr->addr;
+		reg->name = strdup(strings + cr->name);
+		if (!reg->name)
+			break;
+	}
+
+	if (i < header->nregs) {
+		intel_reg_spec_free(*regs, i);
+		*regs = NULL;
+		goto out;
+	}
+
+	ret = header->nregs;
+
+out:
+	munmap(map, mapsize);
+
+	return ret;
+}
+
+static void spec_cache_store(const char *cachefile, const struct reg *regs,
+			     size_t n, const struct spec_sources *spec_sources)
+{
+	struct spec_cache_header *header;
+	struct spec_cache_source *sources;
+	struct spec_cache_reg *cregs;
+	uint32_t ports[ARRAY_SIZE(port_descs)];
+	char tmpfile[PATH_MAX];
+	size_t size, strings_size = 0;
+	char *buf, *strings;
+	struct stat st;
+	size_t i, j;
+	int fd;
+
+	for (i = 0; i < ARRAY_SIZE(port_descs); i++)
+		strings_size += strlen(port_descs[i].name) + 1;
+	for (i = 0; i < spec_sources->count; i++)
+		strings_size += strlen(spec_sources->files[i]) + 1;
+	for (i = 0; i < n; i++)
+		strings_size += strlen(regs[i].name) + 1;
+
+	if (strings_size > UINT32_MAX || n > UINT32_MAX)
+		return;
+
+	size = sizeof(*header) +
+		spec_sources->count * sizeof(*sources) +
+		n * sizeof(*cregs) + strings_size;
+	buf = calloc(1, size);
+	if (!buf)
+		return;
+
+	header = (void *)buf;
+	sources = (void *)(header + 1);
+	cregs = (void *)(sources + spec_sources->count);
+	strings = (char *)(cregs + n);
+
+	header->magic = SPEC_CACHE_MAGIC;
+	header->version = SPEC_CACHE_VERSION;
+	header->nsources = spec_sources->count;
+	header->nregs = n;
+	header->strings_size = strings_size;
+
+	strings_size = 0;
+	for (i = 0; i < ARRAY_SIZE(port_descs); i++) {
+		ports[i] = strings_size;
+		strcpy(strings + strings_size, port_descs[i].name);
+		strings_size += strlen(port_descs[i].name) + 1;
+	}
+
+	for (i = 0; i < spec_sources->count; i++) {
+		const char *file = spec_sources->files[i];
+
+		if (stat(file, &st))
+			goto out;
+
+		sources[i].mtime_sec = st.st_mtim.tv_sec;
+		sources[i].mtime_nsec = st.st_mtim.tv_nsec;
+		sources[i].size = st.st_size;
+		sources[i].path = strings_size;
+		strcpy(strings + strings_size, file);
+		strings_size += strlen(file) + 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		/* ->port_desc is always a copy of one of port_descs[] */
+		for (j = 0; j < ARRAY_SIZE(port_descs); j++)
+			if (regs[i].port_desc.name == port_descs[j].name)
+				break;
+		if (j == ARRAY_SIZE(port_descs))
+			goto out;
+
+		cregs[i].port = ports[j];
+		cregs[i].mmio_offset = regs[i].mmio_offset;
+		cregs[i].addr = regs[i].addr;
+		cregs[i].name = strings_size;
+		strcpy(strings + strings_size, regs[i].name);
+		strings_size += strlen(regs[i].name) + 1;
+	}
+
+	/* Readers never see a partially written cache */
+	if (snprintf(tmpfile, sizeof(tmpfile), "%s.XXXXXX", cachefile) >=
+	    sizeof(tmpfile))
+		goto out;
+
+	fd = mkstemp(tmpfile);
+	if (fd < 0)
+		goto out;
+
+	if (write(fd, buf, size) != size || fchmod(fd, 0644) ||
+	    rename(tmpfile, cachefile))
+		unlink(tmpfile);
+
+	close(fd);
+
+out:
+	free(buf);
+}
+
+/*
+ * Get register definitions from file, through the compiled spec cache. The
+ * cache is (re)generated from the text spec when missing or stale. Failing to
+ * write the cache is not an error.
+ */
+ssize_t intel_reg_spec_file_cached(struct reg **regs, const char *file)
+{
+	char path[PATH_MAX], cachefile[PATH_MAX];
+	struct spec_sources sources = {};
+	size_t nregs = 0;
+	ssize_t ret;
+
+	if (!realpath(file, path) ||
+	    spec_cache_file(cachefile, sizeof(cachefile), path, false))
+		return intel_reg_spec_file(regs, file);
+
+	ret = spec_cache_load(regs, cachefile);
+	if (ret > 0)
+		return ret;
+
+	*regs = NULL;
+	ret = parse_file(regs, &nregs, 0, path, &sources);
+	if (ret > 0 &&
+	    !spec_cache_file(cachefile, sizeof(cachefile), path, true))
+		spec_cache_store(cachefile, *regs, ret, &sources);
+
+	free_sources(&sources);
+
+	return ret;
+}
+
+static uint32_t hash_name(enum port_addr port, const char *name)
+{
+	uint32_t hash = 2166136261u ^ port;
+
+	while (*name) {
+		hash ^= tolower((unsigned char)*name++);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/* ->mmio_offset is 0 for non-MMIO ports, so the sum identifies a register */
+static uint32_t hash_addr(enum port_addr port, uint32_t addr)
+{
+	return (addr ^ (uint32_t)port << 24) * 2654435761u;
+}
+
+static bool name_matches(const struct reg *r, enum port_addr port,
+			 const char *name)
+{
+	return r->port_desc.port == port && r->name &&
+		strcasecmp(r->name, name) == 0;
+}
+
+static bool addr_matches(const struct reg *r, enum port_addr port,
+			 uint32_t addr)
+{
+	return r->port_desc.port == port && r->addr + r->mmio_offset == addr;
+}
+
+/*
+ * Build hash indexes of regs by name and by address. The index refers to
+ * regs, which must outlive it.
+ */
+int intel_reg_spec_index(struct reg_index *index, const struct reg *regs,
+			 size_t n)
+{
+	size_t size = 16;
+	size_t i;
+
+	while (size < 2 * n)
+		size *= 2;
+
+	index->regs = regs;
+	index->mask = size - 1;
+	index->by_name = malloc(size * sizeof(*index->by_name));
+	index->by_addr = malloc(size * sizeof(*index->by_addr));
+	if (!index->by_name || !index->by_addr) {
+		intel_reg_spec_index_fini(index);
+		return -ENOMEM;
+	}
+
+	memset(index->by_name, 0xff, size * sizeof(*index->by_name));
+	memset(index->by_addr, 0xff, size * sizeof(*index->by_addr));
+
+	for (i = 0; i < n; i++) {
+		const struct reg *r = &regs[i];
+		enum port_addr port = r->port_desc.port;
+		uint32_t addr = r->addr + r->mmio_offset;
+		uint32_t h;
+
+		/* Keep the first of duplicates, like a linear search */
+		if (r->name) {
+			h = hash_name(port, r->name) & index->mask;
+			while (index->by_name[h] >= 0 &&
+			       !name_matches(&regs[index->by_name[h]],
+					     port, r->name))
+				h = (h + 1) & index->mask;
+			if (index->by_name[h] < 0)
+				index->by_name[h] = i;
+		}
+
+		h = hash_addr(port, addr) & index->mask;
+		while (index->by_addr[h] >= 0 &&
+		       !addr_matches(&regs[index->by_addr[h]], port, addr))
+			h = (h + 1) & index->mask;
+		if (index->by_addr[h] < 0)
+			index->by_addr[h] = i;
+	}
+
+	return 0;
+}
+
+void intel_reg_spec_index_fini(struct reg_index *index)
+{
+	free(index->by_name);
+	free(index->by_addr);
+	memset(index, 0, sizeof(*index));
+}
+
+/*
+ * Find the register named name, ignoring case, on port.
+ */
+const struct reg *intel_reg_spec_find_name(const struct reg_index *index,
+					   enum port_addr port,
+					   const char *name)
+{
+	uint32_t h;
+
+	if (!index->by_name)
+		return NULL;
+
+	for (h = hash_name(port, name) & index->mask;
+	     index->by_name[h] >= 0;
+	     h = (h + 1) & index->mask) {
+		const struct reg *r = &index->regs[index->by_name[h]];
+
+		if (name_matches(r, port, name))
+			return r;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find the register at addr, including any MMIO offset, on port.
+ */
+const struct reg *intel_reg_spec_find_addr(const struct reg_index *index,
+					   enum port_addr port,
+					   uint32_t addr)
+{
+	uint32_t h;
+
+	if (!index->by_addr)
+		return NULL;
+
+	for (h = hash_addr(port, addr) & index->mask;
+	     index->by_addr[h] >= 0;
+	     h = (h + 1) & index->mask) {
+		const struct reg *r = &index->regs[index->by_addr[h]];
+
+		if (addr_matches(r, port, addr))
+			return r;
+	}
+
+	return NULL;
+}
+
 void intel_reg_spec_print_ports(void)
 {
 	int i;
@@ -58,6 +58,18 @@ struct reg {
 	char *name;
 };
 
+/*
+ * Hash indexes of a register spec by name and by address, built once after
+ * reading the spec. Where several registers match, the first one in the spec
+ * is found, as a linear search would.
+ */
+struct reg_index {
+	const struct reg *regs;
+	int *by_name;
+	int *by_addr;
+	uint32_t mask;
+};
+
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
 #endif
@@ -70,7 +82,17 @@ static inline void *recalloc(void *ptr, size_t nmemb, size_t size)
 int parse_port_desc(struct reg *reg, const char *s);
 ssize_t intel_reg_spec_builtin(struct reg **regs, uint32_t devid);
 ssize_t intel_reg_spec_file(struct reg **regs, const char *filename);
+ssize_t intel_reg_spec_file_cached(struct reg **regs, const char *filename);
 void intel_reg_spec_free(struct reg *regs, size_t n);
+int intel_reg_spec_index(struct reg_index *index, const struct reg *regs,
+			 size_t n);
+void intel_reg_spec_index_fini(struct reg_index *index);
+const struct reg *intel_reg_spec_find_name(const struct reg_index *index,
+					   enum port_addr port,
+					   const char *name);
+const struct reg *intel_reg_spec_find_addr(const struct reg_index *index,
+					   enum port_addr port,
+					   uint32_t addr);
 int intel_reg_spec_decode(char *buf, size_t bufsize, const struct reg *reg,
 			  uint32_t val, uint32_t devid);
 void intel_reg_spec_print_ports(void);